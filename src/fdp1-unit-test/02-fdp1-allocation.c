@@ -73,8 +73,8 @@ static int fdp1_pool_allocation_test(struct fdp1_context * fdp1)
 	}
 
 	/* Clean Up */
-	fdp1_v4l2_free_buffers(src_bufs);
-	fdp1_v4l2_free_buffers(dst_bufs);
+	fail += fdp1_v4l2_free_buffers(src_bufs);
+	fail += fdp1_v4l2_free_buffers(dst_bufs);
 	fdp1_v4l2_close(dev);
 
 	return fail;
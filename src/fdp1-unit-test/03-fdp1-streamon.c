@@ -32,7 +32,7 @@ static int fdp1_test_m2m_object(struct fdp1_context * fdp1)
 		return TEST_FAIL;
 	}
 
-	fdp1_free_m2m(m2m);
+	fail += fdp1_free_m2m(m2m);
 
 	return fail;
 }
@@ -83,7 +83,7 @@ static int fdp1_stream_on(struct fdp1_context * fdp1)
 
 	/* That's all folks */
 
-	fdp1_free_m2m(m2m);
+	fail += fdp1_free_m2m(m2m);
 
 	return fail;
 }
@@ -10,15 +10,18 @@
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <inttypes.h>
 #include <sys/ioctl.h>
 
 #include "fdp1-unit-test.h"
 #include "fdp1-v4l2-helpers.h"
 #include "fdp1-buffer.h"
+#include "fdp1-verify.h"
+#include "fdp1-perf.h"
 
 
 static int read_progressive_frame(struct fdp1_context * fdp1,
-		struct fdp1_m2m * m2m, int last)
+		struct fdp1_m2m * m2m, struct fdp1_verify * verify, int last)
 {
 	int ret;
 	int j;
@@ -35,16 +38,15 @@ static int read_progressive_frame(struct fdp1_context * fdp1,
 	/* Enqueue back the buffer (note that the index is preserved) */
 	if (!last) {
 		fdp1_fill_buffer(buffer);
+		if (fdp1->verbose >= 4)
+			fdp1_dump_buffer(fdp1, buffer, "SrcBuf");
+
 		if (fdp1_v4l2_queue_buffer(m2m->dev, buffer))
 			return TEST_FAIL;
 
 		kprint(fdp1, 3, "Enqueued src buffer, index: %d\n", buffer->index);
-
-
-#if 0
-		if (very verbose)
-			draw_frame(buffer, "SrcBuf:");
-#endif
+	} else {
+		fdp1_v4l2_buffer_release(buffer);
 	}
 
 	buffer = fdp1_m2m_dequeue_capture(m2m);
@@ -58,15 +60,13 @@ static int read_progressive_frame(struct fdp1_context * fdp1,
 
 	kprint(fdp1, 3, "Dequeued dst buffer, index: %d\n", buffer->index);
 
-#if 0
-	if (very verbose)
-		draw_frame(buffer, "DstBuf:");
+	n = fdp1_verify_buffer(verify, buffer);
+	if (n)
+		kprint(fdp1, 0, "Capture %d: %d bytes differ from the source\n",
+				verify->frames, n);
 
-	debug("DstBuf[%d] CRC: 0x%x\n", n,
-			crc8(0x00, p_dst_buf[n],
-				   dst_buf_size[n]) );
-
-#endif
+	if (fdp1->verbose >= 4)
+		fdp1_dump_buffer(fdp1, buffer, "DstBuf");
 
 	/* Enqueue back the buffer */
 	if (!last) {
@@ -79,6 +79,8 @@ static int read_progressive_frame(struct fdp1_context * fdp1,
 		}
 
 		kprint(fdp1, 3, "Enqueued dst buffer, index: %d\n", buffer->index);
+	} else {
+		fdp1_v4l2_buffer_release(buffer);
 	}
 
 	return 0;
@@ -87,6 +89,8 @@ static int read_progressive_frame(struct fdp1_context * fdp1,
 static int fdp1_run_progressive_frames(struct fdp1_context * fdp1)
 {
 	struct fdp1_m2m * m2m;
+	struct fdp1_verify verify;
+	uint64_t start;
 	int fail = 0;
 	int ret;
 	int i;
@@ -95,6 +99,11 @@ static int fdp1_run_progressive_frames(struct fdp1_context * fdp1)
 
 	start_test(fdp1, "Progressive Stream Test");
 
+	if (fdp1_verify_init(&verify, fdp1->verify)) {
+		kprint(fdp1, 0, "Invalid verification spec %s\n", fdp1->verify);
+		return TEST_FAIL;
+	}
+
 	m2m = fdp1_create_m2m(fdp1, V4L2_PIX_FMT_YUYV, V4L2_FIELD_NONE,
 			V4L2_PIX_FMT_YUYV);
 
@@ -138,6 +147,7 @@ static int fdp1_run_progressive_frames(struct fdp1_context * fdp1)
 	}
 
 	num_frames = fdp1->num_frames;
+	start = fdp1_time_ns();
 
 	/* Start reading / processing */
 	while (num_frames) {
@@ -161,18 +171,110 @@ static int fdp1_run_progressive_frames(struct fdp1_context * fdp1)
 		if (num_frames == 1)
 			last = 1;
 
-		if (read_progressive_frame(fdp1, m2m, last)) {
+		if (read_progressive_frame(fdp1, m2m, &verify, last)) {
 			kprint(fdp1, 1, "read_progressive_frame frame failed\n");
 			fail++;
 			break;
 		}
 
 		--num_frames;
+		fdp1_perf_frame(fdp1);
 
 		kprint(fdp1, 4, "FRAMES LEFT: %d\n", num_frames);
 	}
 
-	fdp1_free_m2m(m2m);
+	fdp1_verify_report(fdp1, &verify, fdp1_time_ns() - start);
+	fdp1_perf_report(fdp1);
+	if (verify.bad_frames)
+		fail++;
+
+	fdp1_v4l2_pool_report(fdp1, m2m->src_queue.pool);
+	fdp1_v4l2_pool_report(fdp1, m2m->dst_queue.pool);
+
+	fail += fdp1_free_m2m(m2m);
+
+	return fail;
+}
+
+/*
+ * A two plane frame in memory, with padding after every line: the fill
+ * content must land on the active pixels only, and verify from there.
+ */
+static int fdp1_stride_layout_test(struct fdp1_context * fdp1)
+{
+	struct fdp1_v4l2_buffer_pool pool;
+	struct fdp1_v4l2_buffer * buffer = &pool.buffer[0];
+	struct fdp1_v4l2_plane_layout layout[3];
+	struct fdp1_verify verify;
+	unsigned int bytesperline = fdp1->width + 64;
+	unsigned int size = bytesperline * fdp1->height * 2;
+	unsigned int n, i;
+	int fail = 0;
+
+	start_test(fdp1, "Stride Layout Test");
+
+	memzero(pool);
+	pool.verbose = fdp1->verbose;
+	pool.fmt.width = fdp1->width;
+	pool.fmt.height = fdp1->height;
+	pool.fmt.pixelformat = V4L2_PIX_FMT_NV16;
+	pool.fmt.num_planes = 1;
+	pool.fmt.plane_fmt[0].bytesperline = bytesperline;
+	pool.fmt.plane_fmt[0].sizeimage = size;
+
+	buffer->pool = &pool;
+	buffer->n_planes = 1;
+	buffer->sizes[0] = size;
+	buffer->mem[0] = malloc(size);
+	if (!buffer->mem[0])
+		return TEST_FAIL;
+
+	n = fdp1_v4l2_buffer_layout(buffer, layout);
+	if (n != 2 || layout[1].offset != bytesperline * fdp1->height ||
+	    layout[1].stride != bytesperline || layout[1].bytes != fdp1->width) {
+		kprint(fdp1, 0, "NV16 laid out as %u planes, chroma %u bytes of %u from %u\n",
+				n, layout[1].bytes, layout[1].stride,
+				layout[1].offset);
+		fail++;
+		goto out;
+	}
+
+	memset(buffer->mem[0], 0, size);
+	fdp1_fill_buffer(buffer);
+
+	for (i = 0; i < size; i++) {
+		bool padding = i % bytesperline >= fdp1->width;
+
+		if (padding && buffer->mem[0][i]) {
+			kprint(fdp1, 0, "Padding written at byte %u\n", i);
+			fail++;
+			break;
+		}
+	}
+
+	/* As the driver would hand it back */
+	fdp1_v4l2_buffer_set_state(buffer, FDP1_BUF_QUEUED);
+	fdp1_v4l2_buffer_set_state(buffer, FDP1_BUF_DEQUEUED);
+
+	fdp1_verify_init(&verify, "full");
+	buffer->mem[0][size - 1] ^= 0x40;
+	n = fdp1_verify_buffer(&verify, buffer);
+	if (n || verify.checked != fdp1->width * fdp1->height * 2) {
+		kprint(fdp1, 0, "%u bytes differ, %" PRIu64 " checked\n", n,
+				verify.checked);
+		fail++;
+	}
+
+	fdp1_v4l2_buffer_set_state(buffer, FDP1_BUF_DEQUEUED);
+	buffer->mem[0][layout[1].offset + layout[1].stride] ^= 0x40;
+	n = fdp1_verify_buffer(&verify, buffer);
+	if (n != 1) {
+		kprint(fdp1, 0, "%u bytes differ, not 1\n", n);
+		fail++;
+	}
+
+out:
+	free(buffer->mem[0]);
 
 	return fail;
 }
@@ -181,6 +283,7 @@ int fdp1_progressive(struct fdp1_context * fdp1)
 {
 	unsigned int fail = 0;
 
+	fail += fdp1_stride_layout_test(fdp1);
 	fail += fdp1_run_progressive_frames(fdp1);
 
 	return fail;
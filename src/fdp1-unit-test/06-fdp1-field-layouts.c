@@ -0,0 +1,61 @@
+/*
+ * FDP1 Unit Test Utility
+ *      Author: Kieran Bingham
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by the
+ * Free Software Foundation; either version 2 of the License, or (at your
+ * option) any later version
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "fdp1-unit-test.h"
+#include "fdp1-v4l2-helpers.h"
+#include "fdp1-stats.h"
+#include "fdp1-cadence.h"
+
+/*
+ * Every interlaced layout the output queue accepts. V4L2_FIELD_ALTERNATE
+ * carries one field per buffer, tagged TOP or BOTTOM as it is queued.
+ */
+static enum v4l2_field fdp1_interlaced_layouts[] = {
+	V4L2_FIELD_INTERLACED,
+	V4L2_FIELD_INTERLACED_TB,
+	V4L2_FIELD_INTERLACED_BT,
+	V4L2_FIELD_SEQ_TB,
+	V4L2_FIELD_SEQ_BT,
+	V4L2_FIELD_ALTERNATE,
+};
+
+static int fdp1_run_field_layout(struct fdp1_context * fdp1,
+				 enum v4l2_field field,
+				 enum fdp1_deint_mode deint_mode)
+{
+	struct fdp1_cadence_stats stats;
+
+	start_test(fdp1, "Field Layout Test");
+
+	kprint(fdp1, 1, "Starting %s test in Mode %s\n", v4l2_field(field),
+			fdp1_deint_mode_str(deint_mode));
+
+	return fdp1_cadence_stream(fdp1, V4L2_PIX_FMT_YUYV, field,
+				   deint_mode, V4L2_PIX_FMT_YUYV, &stats);
+}
+
+int fdp1_field_layouts(struct fdp1_context * fdp1)
+{
+	unsigned int fail = 0;
+	unsigned int i;
+
+	for (i = 0; i < ARRAY_SIZE(fdp1_interlaced_layouts); i++) {
+		/* One mode with, and one without, reference fields */
+		fail += fdp1_run_field_layout(fdp1, fdp1_interlaced_layouts[i],
+					      FDP1_FIXED2D);
+		fail += fdp1_run_field_layout(fdp1, fdp1_interlaced_layouts[i],
+					      FDP1_ADAPT2D3D);
+	}
+
+	return fail;
+}
@@ -0,0 +1,160 @@
+/*
+ * FDP1 Unit Test Utility
+ *      Author: Kieran Bingham
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by the
+ * Free Software Foundation; either version 2 of the License, or (at your
+ * option) any later version
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <inttypes.h>
+#include <poll.h>
+
+#include "fdp1-unit-test.h"
+#include "fdp1-v4l2-helpers.h"
+#include "fdp1-buffer.h"
+
+/* Frames to process at each resolution */
+#define FDP1_RECONFIGURE_FRAMES	8
+
+/* A reconfigure must not stall a 30 frame a second stream by a frame */
+#define FDP1_RECONFIGURE_PERIOD	((uint64_t)1000000000 / 30)
+
+/*
+ * Stream a few progressive frames through a stopped context, checking each
+ * capture fits the current format, and stop it again.
+ */
+static int fdp1_reconfigure_stream(struct fdp1_context * fdp1,
+				   struct fdp1_m2m * m2m)
+{
+	struct fdp1_v4l2_buffer_pool * src = m2m->src_queue.pool;
+	struct fdp1_v4l2_buffer_pool * dst = m2m->dst_queue.pool;
+	struct fdp1_v4l2_buffer * buffer;
+	unsigned int i;
+	int fail = 0;
+
+	for (i = 0; i < src->qty; i++) {
+		fdp1_fill_buffer(&src->buffer[i]);
+		if (fdp1_v4l2_queue_buffer(m2m->dev, &src->buffer[i]))
+			fail++;
+	}
+
+	for (i = 0; i < dst->qty; i++)
+		if (fdp1_v4l2_queue_buffer(m2m->dev, &dst->buffer[i]))
+			fail++;
+
+	fail += fdp1_m2m_stream_on(m2m, V4L2_BUF_TYPE_VIDEO_OUTPUT_MPLANE);
+	fail += fdp1_m2m_stream_on(m2m, V4L2_BUF_TYPE_VIDEO_CAPTURE_MPLANE);
+
+	for (i = 0; i < FDP1_RECONFIGURE_FRAMES && !fail; i++) {
+		struct pollfd pfd = {
+			.fd = m2m->dev->fd,
+			.events = POLLIN,
+		};
+
+		if (poll(&pfd, 1, 1000) <= 0) {
+			kprint(fdp1, 0, "Stalled at %dx%d after %d frames\n",
+					m2m->width, m2m->height, i);
+			fail++;
+			break;
+		}
+
+		buffer = fdp1_m2m_dequeue_output(m2m);
+		if (!buffer) {
+			fail++;
+			break;
+		}
+
+		fdp1_fill_buffer(buffer);
+		if (fdp1_v4l2_queue_buffer(m2m->dev, buffer))
+			fail++;
+
+		buffer = fdp1_m2m_dequeue_capture(m2m);
+		if (!buffer) {
+			fail++;
+			break;
+		}
+
+		/* A whole YUYV frame of the new size, within the buffer */
+		if (buffer->bytesused < m2m->width * m2m->height * 2 ||
+		    buffer->bytesused > buffer->sizes[0]) {
+			kprint(fdp1, 0, "Capture at %dx%d has %d bytes\n",
+					m2m->width, m2m->height,
+					buffer->bytesused);
+			fail++;
+		}
+
+		fdp1_clear_buffer(buffer);
+		if (fdp1_v4l2_queue_buffer(m2m->dev, buffer))
+			fail++;
+	}
+
+	fail += fdp1_m2m_stream_off(m2m, V4L2_BUF_TYPE_VIDEO_OUTPUT_MPLANE);
+	fail += fdp1_m2m_stream_off(m2m, V4L2_BUF_TYPE_VIDEO_CAPTURE_MPLANE);
+
+	return fail;
+}
+
+/*
+ * Switch a context down to half its resolution and back, streaming at each
+ * size. Each switch replaces the buffers of both queues, and must take less
+ * than a frame period.
+ */
+static int fdp1_reconfigure_test(struct fdp1_context * fdp1)
+{
+	unsigned int widths[] = { fdp1->width / 2 & ~1, fdp1->width };
+	unsigned int heights[] = { fdp1->height / 2 & ~1, fdp1->height };
+	struct fdp1_m2m * m2m;
+	unsigned int i;
+	uint64_t start, elapsed;
+	int fail = 0;
+
+	start_test(fdp1, "Reconfigure Test");
+
+	m2m = fdp1_create_m2m(fdp1, V4L2_PIX_FMT_YUYV, V4L2_FIELD_NONE,
+			V4L2_PIX_FMT_YUYV);
+	if (!m2m) {
+		kprint(fdp1, 0, "Failed to create an M2M object\n");
+		return TEST_FAIL;
+	}
+
+	fail += fdp1_reconfigure_stream(fdp1, m2m);
+
+	for (i = 0; i < ARRAY_SIZE(widths) && !fail; i++) {
+		start = fdp1_time_ns();
+		fail += fdp1_m2m_reconfigure(fdp1, m2m, widths[i], heights[i]);
+		elapsed = fdp1_time_ns() - start;
+
+		kprint(fdp1, 1, "Reconfigured to %dx%d in %" PRIu64 " us\n",
+				widths[i], heights[i], elapsed / 1000);
+
+		if (fail)
+			break;
+
+		if (elapsed > FDP1_RECONFIGURE_PERIOD) {
+			kprint(fdp1, 0, "Reconfigure to %dx%d took %" PRIu64
+					" us, over a frame period of %" PRIu64 " us\n",
+					widths[i], heights[i], elapsed / 1000,
+					FDP1_RECONFIGURE_PERIOD / 1000);
+			fail++;
+		}
+
+		fail += fdp1_reconfigure_stream(fdp1, m2m);
+	}
+
+	fail += fdp1_free_m2m(m2m);
+
+	return fail;
+}
+
+int fdp1_reconfigure(struct fdp1_context * fdp1)
+{
+	unsigned int fail = 0;
+
+	fail += fdp1_reconfigure_test(fdp1);
+
+	return fail;
+}
@@ -0,0 +1,333 @@
+/*
+ * FDP1 Unit Test Utility
+ *      Author: Kieran Bingham
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by the
+ * Free Software Foundation; either version 2 of the License, or (at your
+ * option) any later version
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <inttypes.h>
+#include <signal.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+
+#include <linux/videodev2.h>
+
+#include "fdp1-unit-test.h"
+#include "fdp1-v4l2-helpers.h"
+#include "fdp1-broker.h"
+
+/* Jobs the test broker admits at once */
+#define FDP1_BROKER_TEST_INFLIGHT	4
+
+static volatile int broker_stop;
+
+static void broker_handle_stop(int sig)
+{
+	broker_stop = 1;
+}
+
+/*
+ * Start a broker on the stub backend in a child process, and connect to it.
+ * Returns the connected socket, or -1.
+ */
+static int fdp1_broker_start(struct fdp1_context * fdp1, const char * path,
+			     pid_t * pid)
+{
+	unsigned int i;
+	int sock;
+
+	fflush(stdout);
+	fflush(stderr);
+
+	*pid = fork();
+	if (*pid < 0) {
+		perror("fork");
+		return -1;
+	}
+
+	if (*pid == 0) {
+		struct fdp1_broker broker;
+		struct sigaction sa;
+		int ret;
+
+		memzero(sa);
+		sa.sa_handler = broker_handle_stop;
+		sigaction(SIGTERM, &sa, NULL);
+		signal(SIGPIPE, SIG_IGN);
+
+		ret = fdp1_broker_init(&broker, fdp1, &fdp1_broker_stub, path,
+				       FDP1_BROKER_TEST_INFLIGHT);
+		if (!ret)
+			ret = fdp1_broker_run(&broker, &broker_stop);
+		fdp1_broker_cleanup(&broker);
+
+		_exit(ret ? 1 : 0);
+	}
+
+	/* Give it a second to start listening */
+	for (i = 0; i < 100; i++) {
+		sock = fdp1_broker_connect(path);
+		if (sock >= 0)
+			return sock;
+
+		usleep(10000);
+	}
+
+	kprint(fdp1, 0, "Broker did not start listening on %s\n", path);
+	kill(*pid, SIGKILL);
+	waitpid(*pid, NULL, 0);
+
+	return -1;
+}
+
+static int fdp1_broker_stop(struct fdp1_context * fdp1, pid_t pid)
+{
+	int status;
+
+	kill(pid, SIGTERM);
+	if (waitpid(pid, &status, 0) != pid ||
+	    !WIFEXITED(status) || WEXITSTATUS(status)) {
+		kprint(fdp1, 0, "Broker did not stop cleanly\n");
+		return 1;
+	}
+
+	return 0;
+}
+
+struct fdp1_broker_test_job {
+	struct fdp1_broker_msg msg;
+	int src_fd;
+	int dst_fd;
+	size_t size;	/* Of the source, and of each capture */
+};
+
+/* Create the buffers for a job, with a source unique to it */
+static int fdp1_broker_job_create(struct fdp1_context * fdp1,
+				  struct fdp1_broker_test_job * job,
+				  uint32_t id, uint32_t field, uint32_t mode)
+{
+	uint8_t * src;
+	size_t i;
+
+	memzero(*job);
+	job->msg.job = id;
+	job->msg.out_fourcc = V4L2_PIX_FMT_YUYV;
+	job->msg.cap_fourcc = V4L2_PIX_FMT_YUYV;
+	job->msg.field = field;
+	job->msg.mode = mode;
+	job->msg.width = fdp1->width;
+	job->msg.height = fdp1->height;
+	job->size = fdp1->width * fdp1->height * 2;
+
+	job->src_fd = fdp1_broker_memfd("fdp1-src", job->size);
+	job->dst_fd = fdp1_broker_memfd("fdp1-dst", 2 * job->size);
+	if (job->src_fd < 0 || job->dst_fd < 0)
+		return 1;
+
+	src = mmap(NULL, job->size, PROT_WRITE, MAP_SHARED, job->src_fd, 0);
+	if (src == MAP_FAILED)
+		return 1;
+
+	for (i = 0; i < job->size; i++)
+		src[i] = id + i;
+
+	munmap(src, job->size);
+
+	return 0;
+}
+
+static void fdp1_broker_job_destroy(struct fdp1_broker_test_job * job)
+{
+	if (job->src_fd >= 0)
+		close(job->src_fd);
+	if (job->dst_fd >= 0)
+		close(job->dst_fd);
+}
+
+/* Check each capture the stub wrote is a copy of the job's source */
+static int fdp1_broker_job_check(struct fdp1_context * fdp1,
+				 struct fdp1_broker_test_job * job,
+				 const struct fdp1_broker_msg * reply,
+				 unsigned int captures)
+{
+	uint8_t * dst;
+	unsigned int c;
+	size_t i;
+	int fail = 0;
+
+	if (reply->captures != captures || reply->bytesused != job->size) {
+		kprint(fdp1, 0, "Job %u: %u captures of %u bytes, expected %u of %zu\n",
+				job->msg.job, reply->captures, reply->bytesused,
+				captures, job->size);
+		return 1;
+	}
+
+	dst = mmap(NULL, 2 * job->size, PROT_READ, MAP_SHARED, job->dst_fd, 0);
+	if (dst == MAP_FAILED)
+		return 1;
+
+	for (c = 0; c < captures && !fail; c++) {
+		for (i = 0; i < job->size; i++) {
+			if (dst[c * job->size + i] != (uint8_t)(job->msg.job + i)) {
+				kprint(fdp1, 0, "Job %u: capture %u differs at %zu\n",
+						job->msg.job, c, i);
+				fail++;
+				break;
+			}
+		}
+	}
+
+	munmap(dst, 2 * job->size);
+
+	return fail;
+}
+
+/*
+ * Submit a progressive job, an interlaced one, and one the broker cannot
+ * serve, one at a time, checking each reply.
+ */
+static int fdp1_broker_roundtrip_test(struct fdp1_context * fdp1, int sock)
+{
+	static const struct {
+		uint32_t field;
+		uint32_t mode;
+		uint32_t type;
+		unsigned int captures;
+	} cases[] = {
+		{ V4L2_FIELD_NONE, FDP1_PROGRESSIVE, FDP1_BROKER_COMPLETE, 1 },
+		{ V4L2_FIELD_INTERLACED, FDP1_FIXED2D, FDP1_BROKER_COMPLETE, 2 },
+		{ V4L2_FIELD_INTERLACED, FDP1_ADAPT2D3D, FDP1_BROKER_ERROR, 0 },
+		{ V4L2_FIELD_NONE, FDP1_PROGRESSIVE, FDP1_BROKER_COMPLETE, 1 },
+	};
+	struct fdp1_broker_test_job job;
+	struct fdp1_broker_msg reply;
+	unsigned int i;
+	int fail = 0;
+
+	start_test(fdp1, "Broker Round Trip Test");
+
+	for (i = 0; i < ARRAY_SIZE(cases); i++) {
+		if (fdp1_broker_job_create(fdp1, &job, i, cases[i].field,
+					   cases[i].mode) ||
+		    fdp1_broker_submit(sock, &job.msg, job.src_fd, job.dst_fd) ||
+		    fdp1_broker_reply(sock, &reply)) {
+			kprint(fdp1, 0, "Job %u: not submitted\n", i);
+			fdp1_broker_job_destroy(&job);
+			fail++;
+			break;
+		}
+
+		if (reply.job != i || reply.type != cases[i].type) {
+			kprint(fdp1, 0, "Job %u: reply %u for job %u, expected %u\n",
+					i, reply.type, reply.job, cases[i].type);
+			fail++;
+		} else if (reply.type == FDP1_BROKER_COMPLETE) {
+			fail += fdp1_broker_job_check(fdp1, &job, &reply,
+						      cases[i].captures);
+			kprint(fdp1, 1, "Job %u: %u captures in %" PRIu64 " us\n",
+					i, reply.captures,
+					reply.latency_ns / 1000);
+		}
+
+		fdp1_broker_job_destroy(&job);
+	}
+
+	return fail;
+}
+
+/*
+ * Hold the broker still while a burst of jobs twice its limit arrives: it
+ * must admit exactly as many as it allows, and turn the rest away busy.
+ */
+static int fdp1_broker_admission_test(struct fdp1_context * fdp1, int sock,
+				      pid_t pid)
+{
+	struct fdp1_broker_test_job jobs[2 * FDP1_BROKER_TEST_INFLIGHT];
+	unsigned int completed = 0, busy = 0;
+	unsigned int i;
+	int status;
+	int fail = 0;
+
+	start_test(fdp1, "Broker Admission Test");
+
+	kill(pid, SIGSTOP);
+	if (waitpid(pid, &status, WUNTRACED) != pid || !WIFSTOPPED(status)) {
+		kprint(fdp1, 0, "Could not stop the broker\n");
+		return 1;
+	}
+
+	for (i = 0; i < ARRAY_SIZE(jobs); i++) {
+		fail += fdp1_broker_job_create(fdp1, &jobs[i], 100 + i,
+					       V4L2_FIELD_NONE, FDP1_PROGRESSIVE);
+		fail += !!fdp1_broker_submit(sock, &jobs[i].msg,
+					     jobs[i].src_fd, jobs[i].dst_fd);
+	}
+
+	kill(pid, SIGCONT);
+
+	for (i = 0; i < ARRAY_SIZE(jobs) && !fail; i++) {
+		struct fdp1_broker_msg reply;
+		unsigned int j = 0;
+
+		if (fdp1_broker_reply(sock, &reply)) {
+			fail++;
+			break;
+		}
+
+		if (reply.job >= 100)
+			j = reply.job - 100;
+
+		if (reply.type == FDP1_BROKER_COMPLETE && j < ARRAY_SIZE(jobs)) {
+			fail += fdp1_broker_job_check(fdp1, &jobs[j], &reply, 1);
+			completed++;
+		} else if (reply.type == FDP1_BROKER_BUSY) {
+			busy++;
+		} else {
+			kprint(fdp1, 0, "Unexpected reply %u to job %u\n",
+					reply.type, reply.job);
+			fail++;
+		}
+	}
+
+	kprint(fdp1, 1, "%u jobs completed, %u busy\n", completed, busy);
+
+	if (completed != FDP1_BROKER_TEST_INFLIGHT ||
+	    busy != ARRAY_SIZE(jobs) - FDP1_BROKER_TEST_INFLIGHT) {
+		kprint(fdp1, 0, "Admitted %u of %zu jobs, limited to %u\n",
+				completed, ARRAY_SIZE(jobs),
+				FDP1_BROKER_TEST_INFLIGHT);
+		fail++;
+	}
+
+	for (i = 0; i < ARRAY_SIZE(jobs); i++)
+		fdp1_broker_job_destroy(&jobs[i]);
+
+	return fail;
+}
+
+int fdp1_broker_tests(struct fdp1_context * fdp1)
+{
+	char path[64];
+	unsigned int fail = 0;
+	pid_t pid;
+	int sock;
+
+	snprintf(path, sizeof(path), "/tmp/fdp1-broker-test-%d.sock", getpid());
+
+	sock = fdp1_broker_start(fdp1, path, &pid);
+	if (sock < 0)
+		return TEST_FAIL;
+
+	fail += fdp1_broker_roundtrip_test(fdp1, sock);
+	fail += fdp1_broker_admission_test(fdp1, sock, pid);
+
+	close(sock);
+	fail += fdp1_broker_stop(fdp1, pid);
+
+	return fail;
+}
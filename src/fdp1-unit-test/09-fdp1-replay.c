@@ -0,0 +1,290 @@
+/*
+ * FDP1 Unit Test Utility
+ *      Author: Kieran Bingham
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by the
+ * Free Software Foundation; either version 2 of the License, or (at your
+ * option) any later version
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <inttypes.h>
+#include <sys/ioctl.h>
+
+#include <linux/videodev2.h>
+
+#include "fdp1-unit-test.h"
+#include "fdp1-v4l2-helpers.h"
+#include "fdp1-stats.h"
+#include "fdp1-record.h"
+#include "fdp1-replay.h"
+
+/* Time between the calls of the session, as recorded */
+#define FDP1_REPLAY_TEST_GAP_NS	2000000
+
+/* The dmabuf the session exports, as numbered when it was recorded */
+#define FDP1_REPLAY_TEST_FD	1000
+
+/* More controls than a payload holds */
+#define FDP1_REPLAY_TEST_CONTROLS \
+	(FDP1_RECORD_PAYLOAD_MAX / sizeof(struct v4l2_ext_control) + 1)
+
+/*
+ * Record a short session without a device: a format, a buffer queued and
+ * dequeued with its plane, a control the driver refuses, extended controls,
+ * a dmabuf exported and queued, and stopping. Calls which cannot be
+ * replayed are counted in 'skipped': a dmabuf the session never exported,
+ * controls for a request, and controls too many to record.
+ */
+static unsigned int fdp1_replay_test_record(struct fdp1_context * fdp1,
+					    const char * path,
+					    unsigned int * skipped)
+{
+	struct v4l2_ext_control controls[FDP1_REPLAY_TEST_CONTROLS];
+	struct v4l2_format fmt;
+	struct v4l2_requestbuffers reqbufs;
+	struct v4l2_exportbuffer expbuf;
+	struct v4l2_plane planes[1];
+	struct v4l2_buffer buf;
+	struct v4l2_control ctrl;
+	struct v4l2_ext_controls ctrls;
+	struct fdp1_record * log;
+	int type = V4L2_BUF_TYPE_VIDEO_OUTPUT_MPLANE;
+	unsigned int session;
+	unsigned int calls = 0;
+	uint64_t t;
+
+	*skipped = 0;
+
+	log = fdp1_record_start(path);
+	if (!log)
+		return 0;
+
+	t = fdp1_time_ns();
+	session = fdp1_record_open(log, 0, 0, t, t + 1000);
+
+	memzero(fmt);
+	fmt.type = type;
+	fmt.fmt.pix_mp.width = fdp1->width;
+	fmt.fmt.pix_mp.height = fdp1->height;
+	fmt.fmt.pix_mp.pixelformat = V4L2_PIX_FMT_YUYV;
+	t += FDP1_REPLAY_TEST_GAP_NS;
+	fdp1_record_ioctl(log, session, VIDIOC_S_FMT, &fmt, 0, t, t + 20000);
+	calls++;
+
+	memzero(reqbufs);
+	reqbufs.type = type;
+	reqbufs.memory = V4L2_MEMORY_MMAP;
+	reqbufs.count = 1;
+	t += FDP1_REPLAY_TEST_GAP_NS;
+	fdp1_record_ioctl(log, session, VIDIOC_REQBUFS,
+			  &reqbufs, 0, t, t + 300000);
+	calls++;
+
+	memzero(buf);
+	memzero(planes);
+	buf.type = type;
+	buf.memory = V4L2_MEMORY_MMAP;
+	buf.length = ARRAY_SIZE(planes);
+	buf.m.planes = planes;
+	planes[0].bytesused = fdp1->width * fdp1->height * 2;
+	t += FDP1_REPLAY_TEST_GAP_NS;
+	fdp1_record_ioctl(log, session, VIDIOC_QBUF, &buf, 0, t, t + 5000);
+	t += FDP1_REPLAY_TEST_GAP_NS;
+	fdp1_record_ioctl(log, session, VIDIOC_DQBUF, &buf, 0, t, t + 3000);
+	calls += 2;
+
+	memzero(ctrl);
+	ctrl.id = V4L2_CID_DEINTERLACING_MODE;
+	ctrl.value = 99;
+	t += FDP1_REPLAY_TEST_GAP_NS;
+	fdp1_record_ioctl(log, session, VIDIOC_S_CTRL,
+			  &ctrl, -EINVAL, t, t + 1000);
+	calls++;
+
+	memzero(ctrls);
+	memzero(controls);
+	ctrls.count = 2;
+	ctrls.controls = controls;
+	controls[0].id = V4L2_CID_DEINTERLACING_MODE;
+	controls[0].value = 1;
+	controls[1].id = V4L2_CID_DEINTERLACING_MODE;
+	controls[1].value = 2;
+	t += FDP1_REPLAY_TEST_GAP_NS;
+	fdp1_record_ioctl(log, session, VIDIOC_S_EXT_CTRLS,
+			  &ctrls, 0, t, t + 2000);
+	calls++;
+
+	ctrls.which = V4L2_CTRL_WHICH_REQUEST_VAL;
+	ctrls.request_fd = FDP1_REPLAY_TEST_FD + 1;
+	t += FDP1_REPLAY_TEST_GAP_NS;
+	fdp1_record_ioctl(log, session, VIDIOC_S_EXT_CTRLS,
+			  &ctrls, 0, t, t + 2000);
+	(*skipped)++;
+
+	ctrls.which = 0;
+	ctrls.count = ARRAY_SIZE(controls);
+	t += FDP1_REPLAY_TEST_GAP_NS;
+	fdp1_record_ioctl(log, session, VIDIOC_S_EXT_CTRLS,
+			  &ctrls, 0, t, t + 2000);
+	(*skipped)++;
+
+	memzero(expbuf);
+	expbuf.type = type;
+	expbuf.fd = FDP1_REPLAY_TEST_FD;
+	t += FDP1_REPLAY_TEST_GAP_NS;
+	fdp1_record_ioctl(log, session, VIDIOC_EXPBUF,
+			  &expbuf, 0, t, t + 10000);
+	calls++;
+
+	buf.memory = V4L2_MEMORY_DMABUF;
+	planes[0].m.fd = FDP1_REPLAY_TEST_FD;
+	t += FDP1_REPLAY_TEST_GAP_NS;
+	fdp1_record_ioctl(log, session, VIDIOC_QBUF, &buf, 0, t, t + 5000);
+	calls++;
+
+	planes[0].m.fd = FDP1_REPLAY_TEST_FD + 1;
+	t += FDP1_REPLAY_TEST_GAP_NS;
+	fdp1_record_ioctl(log, session, VIDIOC_QBUF, &buf, 0, t, t + 5000);
+	(*skipped)++;
+
+	t += FDP1_REPLAY_TEST_GAP_NS;
+	fdp1_record_ioctl(log, session, VIDIOC_STREAMOFF,
+			  &type, 0, t, t + 40000);
+	calls++;
+
+	fdp1_record_close(log, session);
+	fdp1_record_stop(log);
+
+	return calls;
+}
+
+/* Read the log back, checking each entry came through whole */
+static int fdp1_replay_test_read(struct fdp1_context * fdp1, const char * path,
+				 unsigned int calls, unsigned int skipped)
+{
+	uint64_t payload[FDP1_RECORD_PAYLOAD_MAX / sizeof(uint64_t)];
+	struct fdp1_record_entry entry;
+	unsigned int ioctls = 0;
+	FILE * log;
+	int fail = 0;
+	int ret;
+
+	log = fdp1_record_load(path);
+	if (!log)
+		return 1;
+
+	while ((ret = fdp1_record_next(log, &entry, payload)) > 0) {
+		struct v4l2_buffer * buf = (struct v4l2_buffer *)payload;
+		struct v4l2_ext_controls * ctrls =
+			(struct v4l2_ext_controls *)payload;
+
+		if (entry.event != FDP1_RECORD_IOCTL &&
+		    entry.event != FDP1_RECORD_DROPPED)
+			continue;
+
+		ioctls++;
+
+		if (entry.request == VIDIOC_DQBUF &&
+		    (buf->length != 1 || buf->m.planes[0].bytesused !=
+		     (uint32_t)(fdp1->width * fdp1->height * 2))) {
+			kprint(fdp1, 0, "Dequeued buffer lost its plane\n");
+			fail++;
+		}
+
+		if (entry.request == VIDIOC_S_CTRL && entry.ret != -EINVAL) {
+			kprint(fdp1, 0, "S_CTRL recorded as %d\n", entry.ret);
+			fail++;
+		}
+
+		if (entry.request == VIDIOC_S_EXT_CTRLS &&
+		    entry.event == FDP1_RECORD_IOCTL &&
+		    (ctrls->count != 2 || ctrls->controls[1].value != 2)) {
+			kprint(fdp1, 0, "Controls lost their values\n");
+			fail++;
+		}
+	}
+
+	fclose(log);
+
+	if (ret < 0 || ioctls != calls + skipped) {
+		kprint(fdp1, 0, "Read %u of %u calls: %d\n", ioctls,
+				calls + skipped, ret);
+		fail++;
+	}
+
+	return fail;
+}
+
+static int fdp1_replay_test_run(struct fdp1_context * fdp1, const char * path,
+				unsigned int calls, unsigned int skipped,
+				bool timed)
+{
+	struct fdp1_replay_result * result;
+	uint64_t span = (calls + skipped - 1) * FDP1_REPLAY_TEST_GAP_NS;
+	int fail = 0;
+
+	result = calloc(1, sizeof(*result));
+	if (!result)
+		return 1;
+
+	fail += !!fdp1_replay(fdp1, path, &fdp1_replay_stub, timed, result);
+
+	if (fdp1->verbose >= 2)
+		fdp1_replay_report(result);
+
+	if (result->sessions != 1 || result->calls != calls ||
+	    result->skipped != skipped || result->mismatches) {
+		kprint(fdp1, 0, "Replayed %u sessions, %u calls (%u skipped), %u mismatches\n",
+				result->sessions, result->calls,
+				result->skipped, result->mismatches);
+		fail++;
+	}
+
+	/* Timed, the calls keep their spacing; otherwise they come at once */
+	if (timed ? result->replayed_ns < span : result->replayed_ns >= span) {
+		kprint(fdp1, 0, "%s replay took %" PRIu64 " us, recorded over %" PRIu64 " us\n",
+				timed ? "Timed" : "Fast",
+				result->replayed_ns / 1000, span / 1000);
+		fail++;
+	}
+
+	free(result);
+
+	return fail;
+}
+
+static int fdp1_replay_test(struct fdp1_context * fdp1)
+{
+	char path[64];
+	unsigned int calls, skipped;
+	int fail = 0;
+
+	start_test(fdp1, "Session Record and Replay Test");
+
+	/* A log of its own, beside any the user is recording */
+	snprintf(path, sizeof(path), "/tmp/fdp1-replay-test-%d.log", getpid());
+
+	calls = fdp1_replay_test_record(fdp1, path, &skipped);
+	if (!calls)
+		return TEST_FAIL;
+
+	fail += fdp1_replay_test_read(fdp1, path, calls, skipped);
+	fail += fdp1_replay_test_run(fdp1, path, calls, skipped, false);
+	fail += fdp1_replay_test_run(fdp1, path, calls, skipped, true);
+
+	unlink(path);
+
+	return fail;
+}
+
+int fdp1_replay_tests(struct fdp1_context * fdp1)
+{
+	unsigned int fail = 0;
+
+	fail += fdp1_replay_test(fdp1);
+
+	return fail;
+}
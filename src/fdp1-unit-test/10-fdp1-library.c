@@ -0,0 +1,240 @@
+/*
+ * FDP1 Unit Test Utility
+ *      Author: Kieran Bingham
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by the
+ * Free Software Foundation; either version 2 of the License, or (at your
+ * option) any later version
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include <linux/videodev2.h>
+
+#include "fdp1-unit-test.h"
+#include "fdp1-v4l2-helpers.h"
+#include "fdp1.h"
+
+static void fdp1_library_config(struct fdp1_context * fdp1,
+				struct fdp1_config * config)
+{
+	memzero(*config);
+	config->width = fdp1->width;
+	config->height = fdp1->height;
+	config->out_fourcc = V4L2_PIX_FMT_YUYV;
+	config->out_field = V4L2_FIELD_NONE;
+	config->cap_fourcc = V4L2_PIX_FMT_YUYV;
+}
+
+/* Configurations the library refuses, without touching a device */
+static int fdp1_library_config_test(struct fdp1_context * fdp1)
+{
+	struct fdp1_device * device;
+	struct fdp1_config config;
+	int fail = 0;
+
+	start_test(fdp1, "Library Configuration Test");
+
+	if (fdp1_api_version() != FDP1_API_VERSION) {
+		kprint(fdp1, 0, "Library API %u, header %u\n",
+				fdp1_api_version(), FDP1_API_VERSION);
+		fail++;
+	}
+
+	fail += fdp1_job_captures(V4L2_FIELD_NONE, FDP1_MODE_ADAPT2D3D) != 1;
+	fail += fdp1_job_captures(V4L2_FIELD_SEQ_TB, FDP1_MODE_FIXED2D) != 2;
+	fail += fdp1_job_captures(V4L2_FIELD_SEQ_TB, FDP1_MODE_ADAPT2D3D) != -EINVAL;
+
+	fdp1_library_config(fdp1, &config);
+	config.width = 0;
+	if (fdp1_device_open(fdp1->dev, &config, &device) != -EINVAL || device) {
+		kprint(fdp1, 0, "Opened a device %u pixels wide\n", config.width);
+		fail++;
+	}
+
+	return fail;
+}
+
+/*
+ * A device which is not there: the error must come back as a code, and
+ * nothing may be printed on the way.
+ */
+static int fdp1_library_silent_test(struct fdp1_context * fdp1)
+{
+	char devname[] = "/dev/videoNNNNNNN";
+	struct fdp1_device * device;
+	struct fdp1_config config;
+	struct stat st;
+	unsigned int index;
+	FILE * capture;
+	int saved;
+	int ret;
+	int fail = 0;
+
+	start_test(fdp1, "Library Error Reporting Test");
+
+	for (index = 0; index < 1024; index++) {
+		snprintf(devname, sizeof(devname), "/dev/video%u", index);
+		if (stat(devname, &st))
+			break;
+	}
+
+	capture = tmpfile();
+	if (!capture)
+		return TEST_FAIL;
+
+	fflush(stderr);
+	saved = dup(STDERR_FILENO);
+	dup2(fileno(capture), STDERR_FILENO);
+
+	fdp1_library_config(fdp1, &config);
+	ret = fdp1_device_open(index, &config, &device);
+
+	fflush(stderr);
+	dup2(saved, STDERR_FILENO);
+	close(saved);
+
+	if (ret != -ENOENT || device) {
+		kprint(fdp1, 0, "Opening %s returned %d\n", devname, ret);
+		fail++;
+	}
+
+	if (lseek(fileno(capture), 0, SEEK_END) > 0) {
+		kprint(fdp1, 0, "Opening %s printed an error\n", devname);
+		fail++;
+	}
+
+	fclose(capture);
+
+	return fail;
+}
+
+/* One progressive frame through the library, as a service would */
+static int fdp1_library_process_test(struct fdp1_context * fdp1)
+{
+	struct fdp1_device * device;
+	struct fdp1_config config;
+	size_t src_size, dst_size;
+	uint32_t bytesused = 0;
+	uint8_t * src, * dst;
+	int fail = 0;
+	int ret;
+
+	start_test(fdp1, "Library Process Test");
+
+	fdp1_library_config(fdp1, &config);
+	ret = fdp1_device_open(fdp1->dev, &config, &device);
+	if (ret) {
+		kprint(fdp1, 0, "Failed to open /dev/video%d: %s\n", fdp1->dev,
+				strerror(-ret));
+		return TEST_FAIL;
+	}
+
+	fdp1_device_sizes(device, &src_size, &dst_size);
+
+	src = calloc(1, src_size);
+	dst = calloc(1, dst_size);
+	if (!src || !dst) {
+		fail++;
+		goto out;
+	}
+
+	memset(src, 0x80, src_size);
+
+	ret = fdp1_device_process(device, src, src_size, dst, dst_size,
+				  &bytesused);
+	if (ret != 1 || !bytesused) {
+		kprint(fdp1, 0, "Processed into %d frames of %u bytes\n", ret,
+				bytesused);
+		fail++;
+	}
+
+out:
+	free(src);
+	free(dst);
+	fdp1_device_close(device);
+
+	return fail;
+}
+
+/*
+ * A tuning written and read back is the same, keys from a later version
+ * are skipped, and a line which is not a key and its value is refused.
+ */
+static int fdp1_library_tuning_test(struct fdp1_context * fdp1)
+{
+	struct fdp1_tuning tuning, loaded;
+	char path[64];
+	FILE * file;
+	int fail = 0;
+	int ret;
+
+	start_test(fdp1, "Library Tuning Test");
+
+	snprintf(path, sizeof(path), "/tmp/fdp1-tuning-test-%d.conf", getpid());
+
+	memzero(tuning);
+	tuning.width = 1920;
+	tuning.height = 1080;
+	tuning.out_field = V4L2_FIELD_INTERLACED;
+	tuning.mode = FDP1_MODE_FIXED2D;
+	tuning.buffers = 6;
+	tuning.contexts = 2;
+	tuning.depth = 2;
+	tuning.fps = 120;
+	tuning.p99_us = 16000;
+	tuning.memory = 6ULL << 30;
+
+	ret = fdp1_tuning_save(path, &tuning);
+	if (ret) {
+		kprint(fdp1, 0, "Failed to save %s: %s\n", path, strerror(-ret));
+		return TEST_FAIL;
+	}
+
+	ret = fdp1_tuning_load(path, &loaded);
+	fail += ret != 0;
+	fail += memcmp(&tuning, &loaded, sizeof(tuning)) != 0;
+
+	file = fopen(path, "a");
+	if (!file) {
+		unlink(path);
+		return TEST_FAIL;
+	}
+	fprintf(file, "\n  # From a later version\nthreads 3\n");
+	fclose(file);
+
+	ret = fdp1_tuning_load(path, &loaded);
+	fail += ret != 0;
+	fail += loaded.depth != tuning.depth;
+
+	file = fopen(path, "a");
+	if (file) {
+		fprintf(file, "depth two\n");
+		fclose(file);
+	}
+
+	fail += fdp1_tuning_load(path, &loaded) != -EINVAL;
+
+	unlink(path);
+
+	if (fail)
+		kprint(fdp1, 0, "The tuning did not survive a round trip\n");
+
+	return fail;
+}
+
+int fdp1_library_tests(struct fdp1_context * fdp1)
+{
+	unsigned int fail = 0;
+
+	fail += fdp1_library_config_test(fdp1);
+	fail += fdp1_library_tuning_test(fdp1);
+	fail += fdp1_library_silent_test(fdp1);
+	fail += fdp1_library_process_test(fdp1);
+
+	return fail;
+}
@@ -0,0 +1,165 @@
+/*
+ * FDP1 Unit Test Utility
+ *      Author: Kieran Bingham
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by the
+ * Free Software Foundation; either version 2 of the License, or (at your
+ * option) any later version
+ */
+
+#include <cstdio>
+#include <cstdlib>
+#include <cinttypes>
+
+#include <linux/videodev2.h>
+
+extern "C" {
+#include "fdp1-unit-test.h"
+#include "fdp1-v4l2-helpers.h"
+}
+
+#include "fdp1-v4l2-helpers.hpp"
+
+using namespace fdp1;
+
+static_assert(Yuyv::planes == 1 && Yuyv::stride(0, 64) == 128, "YUYV layout");
+static_assert(Nv12m::mem_planes == 2 && Nv12m::lines(1, 48) == 24, "NV12M layout");
+static_assert(Nv16::size(64, 48) == 64 * 48 * 2, "NV16 size");
+static_assert(Yvu420::size(64, 48) == 64 * 48 * 3 / 2, "YVU420 size");
+
+/* Limited range, with chroma varying along both axes */
+static Yuv fdp1_formats_gradient(unsigned int x, unsigned int y)
+{
+	return { (uint8_t)(16 + (x + y) % 220),
+		 (uint8_t)(16 + x % 224),
+		 (uint8_t)(16 + (y * 3) % 224) };
+}
+
+static void fdp1_formats_start(struct fdp1_context * fdp1, const char * test)
+{
+	start_test(fdp1, const_cast<char *>(test));
+}
+
+/*
+ * Every format in memory: what is filled verifies, a single byte changed
+ * is found, and a packed frame converted to it keeps the same pixels.
+ */
+template <class F>
+static int fdp1_formats_host_test(struct fdp1_context * fdp1)
+{
+	const unsigned int width = fdp1->width & ~(F::width_align - 1);
+	const unsigned int height = fdp1->height & ~(F::height_align - 1);
+	size_t size = F::size(width, height);
+	uint8_t * mem = (uint8_t *)calloc(1, size);
+	uint8_t * src = (uint8_t *)calloc(1, Yuyv::size(width, height));
+	int fail = 0;
+	uint64_t n;
+
+	if (!mem || !src) {
+		free(mem);
+		free(src);
+		return TEST_FAIL;
+	}
+
+	Frame<F> frame(mem, width, height);
+	Frame<Yuyv> packed(src, width, height);
+
+	fill(frame, fdp1_formats_gradient);
+	n = verify(frame, fdp1_formats_gradient);
+	if (n) {
+		kprint(fdp1, 0, "%4.4s: %" PRIu64 " bytes differ as filled\n",
+				(char *)&F::fourcc, n);
+		fail++;
+	}
+
+	mem[size - 1] ^= 0x40;
+	n = verify(frame, fdp1_formats_gradient);
+	if (n != 1) {
+		kprint(fdp1, 0, "%4.4s: %" PRIu64 " bytes differ, not 1\n",
+				(char *)&F::fourcc, n);
+		fail++;
+	}
+
+	fill(packed, fdp1_formats_gradient);
+	convert(packed, frame);
+	n = verify(frame, fdp1_formats_gradient);
+	if (n) {
+		kprint(fdp1, 0, "%4.4s: %" PRIu64 " bytes differ converted from YUYV\n",
+				(char *)&F::fourcc, n);
+		fail++;
+	}
+
+	free(mem);
+	free(src);
+
+	return fail;
+}
+
+static int fdp1_formats_kernel_test(struct fdp1_context * fdp1)
+{
+	int fail = 0;
+
+	fdp1_formats_start(fdp1, "Format Kernel Test");
+
+	AllFormats::for_each([&](auto format) {
+		fail += fdp1_formats_host_test<decltype(format)>(fdp1);
+	});
+
+	return fail;
+}
+
+/* One frame through the device, filled and checked by the kernels */
+static int fdp1_formats_device_test(struct fdp1_context * fdp1)
+{
+	M2M m2m = M2M::create<Yuyv, Yuyv>(fdp1, V4L2_FIELD_NONE);
+	uint64_t n;
+	int fail = 0;
+
+	fdp1_formats_start(fdp1, "Format Device Test");
+
+	if (!m2m.valid())
+		return TEST_FAIL;
+
+	MappedBuffer out(&m2m->src_queue.pool->buffer[0]);
+	MappedBuffer cap(&m2m->dst_queue.pool->buffer[0]);
+	Frame<Yuyv> src(out, m2m->width, m2m->height);
+
+	if (!src.valid() || out.write())
+		return TEST_FAIL;
+
+	fill(src, fdp1_formats_gradient);
+
+	fail += !!cap.queue(m2m->dev);
+	fail += !!out.queue(m2m->dev);
+	fail += m2m.stream_on();
+	if (fail)
+		return fail;
+
+	MappedBuffer returned(fdp1_m2m_dequeue_output(m2m.get()));
+	MappedBuffer captured(fdp1_m2m_dequeue_capture(m2m.get()));
+	if (!returned.valid() || !captured.valid())
+		return TEST_FAIL;
+
+	Frame<Yuyv> dst(captured, m2m->width, m2m->height);
+	if (!dst.valid())
+		return TEST_FAIL;
+
+	n = verify(dst, fdp1_formats_gradient);
+	if (n) {
+		kprint(fdp1, 0, "%" PRIu64 " bytes differ from the source\n", n);
+		fail++;
+	}
+
+	return fail;
+}
+
+extern "C" int fdp1_pixel_format_tests(struct fdp1_context * fdp1)
+{
+	unsigned int fail = 0;
+
+	fail += fdp1_formats_kernel_test(fdp1);
+	fail += fdp1_formats_device_test(fdp1);
+
+	return fail;
+}
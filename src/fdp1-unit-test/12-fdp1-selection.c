@@ -0,0 +1,199 @@
+/*
+ * FDP1 Unit Test Utility
+ *      Author: Kieran Bingham
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by the
+ * Free Software Foundation; either version 2 of the License, or (at your
+ * option) any later version
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <linux/videodev2.h>
+
+#include "fdp1-unit-test.h"
+#include "fdp1-v4l2-helpers.h"
+#include "fdp1-buffer.h"
+
+/* YUYV: a pixel is two bytes, and a window starts on a pair of them */
+#define FDP1_SELECTION_BPP	2
+
+static bool fdp1_rect_equal(const struct v4l2_rect * a,
+			    const struct v4l2_rect * b)
+{
+	return a->left == b->left && a->top == b->top &&
+	       a->width == b->width && a->height == b->height;
+}
+
+/* The centre quarter of the frame, by area */
+static struct v4l2_rect fdp1_selection_window(struct fdp1_m2m * m2m)
+{
+	struct v4l2_rect r;
+
+	r.width = (m2m->width / 2) & ~1;
+	r.height = (m2m->height / 2) & ~1;
+	r.left = ((m2m->width - r.width) / 2) & ~1;
+	r.top = ((m2m->height - r.height) / 2) & ~1;
+
+	return r;
+}
+
+/* The default selections of both queues cover the whole frame */
+static int fdp1_selection_bounds_test(struct fdp1_context * fdp1)
+{
+	static const struct {
+		uint32_t type;
+		uint32_t target;
+	} targets[] = {
+		{ V4L2_BUF_TYPE_VIDEO_OUTPUT_MPLANE,  V4L2_SEL_TGT_CROP },
+		{ V4L2_BUF_TYPE_VIDEO_OUTPUT_MPLANE,  V4L2_SEL_TGT_CROP_BOUNDS },
+		{ V4L2_BUF_TYPE_VIDEO_CAPTURE_MPLANE, V4L2_SEL_TGT_COMPOSE },
+		{ V4L2_BUF_TYPE_VIDEO_CAPTURE_MPLANE, V4L2_SEL_TGT_COMPOSE_BOUNDS },
+	};
+	struct v4l2_rect frame = { 0, 0, fdp1->width, fdp1->height };
+	struct fdp1_m2m * m2m;
+	struct v4l2_rect r;
+	unsigned int i;
+	int fail = 0;
+
+	start_test(fdp1, "Selection Bounds Test");
+
+	m2m = fdp1_create_m2m(fdp1, V4L2_PIX_FMT_YUYV, V4L2_FIELD_NONE,
+			      V4L2_PIX_FMT_YUYV);
+	if (!m2m) {
+		kprint(fdp1, 0, "Failed to create an M2M object\n");
+		return TEST_FAIL;
+	}
+
+	for (i = 0; i < ARRAY_SIZE(targets); i++) {
+		if (fdp1_m2m_get_selection(m2m, targets[i].type,
+					   targets[i].target, &r)) {
+			fail++;
+			continue;
+		}
+
+		if (!fdp1_rect_equal(&r, &frame)) {
+			kprint(fdp1, 0, "%s selection %u is %ux%u@%u,%u\n",
+					q_type(targets[i].type), targets[i].target,
+					r.width, r.height, r.left, r.top);
+			fail++;
+		}
+	}
+
+	fail += fdp1_free_m2m(m2m);
+
+	return fail;
+}
+
+/*
+ * Picture in picture: the centre of the source, into the top left of the
+ * capture. Each line of the window must hold the source line it came from.
+ */
+static int fdp1_selection_roi_test(struct fdp1_context * fdp1)
+{
+	struct fdp1_v4l2_plane_layout src_layout[3], dst_layout[3];
+	struct fdp1_v4l2_buffer * src, * dst;
+	struct v4l2_rect crop, compose;
+	struct fdp1_m2m * m2m;
+	unsigned int y, n = 0;
+	int fail = 0;
+
+	start_test(fdp1, "Region of Interest Test");
+
+	m2m = fdp1_create_m2m(fdp1, V4L2_PIX_FMT_YUYV, V4L2_FIELD_NONE,
+			      V4L2_PIX_FMT_YUYV);
+	if (!m2m) {
+		kprint(fdp1, 0, "Failed to create an M2M object\n");
+		return TEST_FAIL;
+	}
+
+	crop = fdp1_selection_window(m2m);
+	compose = crop;
+	compose.left = 0;
+	compose.top = 0;
+
+	fail += !!fdp1_m2m_set_selection(m2m, V4L2_BUF_TYPE_VIDEO_OUTPUT_MPLANE,
+					 V4L2_SEL_TGT_CROP, &crop);
+	fail += !!fdp1_m2m_set_selection(m2m, V4L2_BUF_TYPE_VIDEO_CAPTURE_MPLANE,
+					 V4L2_SEL_TGT_COMPOSE, &compose);
+	if (fail)
+		goto out;
+
+	if (crop.width != compose.width || crop.height != compose.height) {
+		kprint(fdp1, 0, "Cropped %ux%u, composed %ux%u: no scaler\n",
+				crop.width, crop.height,
+				compose.width, compose.height);
+		fail++;
+		goto out;
+	}
+
+	fdp1_fill_buffer(&m2m->src_queue.pool->buffer[0]);
+	fdp1_clear_buffer(&m2m->dst_queue.pool->buffer[0]);
+
+	fail += !!fdp1_v4l2_buffer_pool_queue(m2m->dev, m2m->dst_queue.pool, 0);
+	fail += !!fdp1_v4l2_buffer_pool_queue(m2m->dev, m2m->src_queue.pool, 0);
+	fail += !!fdp1_m2m_stream_on(m2m, V4L2_BUF_TYPE_VIDEO_OUTPUT_MPLANE);
+	fail += !!fdp1_m2m_stream_on(m2m, V4L2_BUF_TYPE_VIDEO_CAPTURE_MPLANE);
+	if (fail)
+		goto out;
+
+	src = fdp1_m2m_dequeue_output(m2m);
+	dst = fdp1_m2m_dequeue_capture(m2m);
+	if (!src || !dst) {
+		fail++;
+		goto out;
+	}
+
+	fdp1_v4l2_buffer_layout(src, src_layout);
+	fdp1_v4l2_buffer_layout(dst, dst_layout);
+
+	for (y = 0; y < compose.height; y++) {
+		const char * line = dst->mem[0] + dst_layout[0].offset +
+			(compose.top + y) * dst_layout[0].stride +
+			compose.left * FDP1_SELECTION_BPP;
+
+		n += fdp1_fill_compare(line,
+			(crop.top + y) * src_layout[0].bytes +
+			crop.left * FDP1_SELECTION_BPP,
+			compose.width * FDP1_SELECTION_BPP);
+	}
+
+	if (n) {
+		kprint(fdp1, 0, "%u bytes of the window differ from the source\n", n);
+		fail++;
+	}
+
+	fdp1_v4l2_buffer_release(src);
+	fdp1_v4l2_buffer_release(dst);
+
+out:
+	fail += fdp1_free_m2m(m2m);
+
+	return fail;
+}
+
+int fdp1_selection_tests(struct fdp1_context * fdp1)
+{
+	unsigned int fail = 0;
+	int supported;
+
+	supported = fdp1_selection_supported(fdp1);
+	if (supported < 0) {
+		kprint(fdp1, 0, "Failed to probe for selection: %s\n",
+				strerror(-supported));
+		return TEST_FAIL;
+	}
+
+	/* rcar_fdp1 has no selection API: these only run on other drivers */
+	if (!supported) {
+		kprint(fdp1, 1, "No selection support, skipping its tests\n");
+		return 0;
+	}
+
+	fail += fdp1_selection_bounds_test(fdp1);
+	fail += fdp1_selection_roi_test(fdp1);
+
+	return fail;
+}
@@ -0,0 +1,237 @@
+/*
+ * FDP1 Unit Test Utility
+ *      Author: Kieran Bingham
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by the
+ * Free Software Foundation; either version 2 of the License, or (at your
+ * option) any later version
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <linux/videodev2.h>
+
+#include "fdp1-unit-test.h"
+#include "fdp1-v4l2-helpers.h"
+#include "fdp1-tile.h"
+
+/* Each stripe owns its columns once, and reads no more than it may */
+static int fdp1_tile_plan_check(struct fdp1_context * fdp1,
+				unsigned int width, unsigned int stripe_width,
+				unsigned int overlap)
+{
+	struct fdp1_tiler tiler;
+	unsigned int next = 0;
+	unsigned int i;
+	int fail = 0;
+
+	if (fdp1_tile_plan(&tiler, width, 16, stripe_width, overlap)) {
+		kprint(fdp1, 0, "%u columns in stripes of %u not planned\n",
+				width, stripe_width);
+		return TEST_FAIL;
+	}
+
+	for (i = 0; i < tiler.n_stripes; i++) {
+		const struct fdp1_stripe * s = &tiler.stripe[i];
+		unsigned int start = s->left + s->owned;
+		unsigned int end = start + s->kept;
+
+		fail += start != next;
+		fail += s->owned + s->kept > s->width;
+		fail += s->left + s->width > width;
+		fail += s->left % FDP1_TILE_ALIGN || start % FDP1_TILE_ALIGN;
+
+		/* The full overlap, wherever the frame has it */
+		fail += s->owned < (start < overlap ? start : overlap);
+		fail += s->width - s->owned - s->kept <
+			(width - end < overlap ? width - end : overlap);
+
+		next = end;
+	}
+
+	fail += next != width;
+
+	if (fail)
+		kprint(fdp1, 0, "%u columns in stripes of %u, %u overlapping: %d errors\n",
+				width, stripe_width, overlap, fail);
+
+	return fail;
+}
+
+static int fdp1_tile_plan_test(struct fdp1_context * fdp1)
+{
+	struct fdp1_tiler tiler;
+	int fail = 0;
+
+	start_test(fdp1, "Stripe Plan Test");
+
+	fail += fdp1_tile_plan_check(fdp1, 3840, 1024, 16);
+	fail += fdp1_tile_plan_check(fdp1, 3840, 960, 16);
+	fail += fdp1_tile_plan_check(fdp1, 1920, 1920, 16);
+	fail += fdp1_tile_plan_check(fdp1, 1926, 640, 2);
+	fail += fdp1_tile_plan_check(fdp1, 100, 16, 40);
+
+	fail += fdp1_tile_plan(&tiler, 3840, 16, 0, 16) != -EINVAL;
+	fail += fdp1_tile_plan(&tiler, 3840, 16, 64, 16) != -E2BIG;
+
+	return fail;
+}
+
+/* Limited range, and different for every byte of a line */
+static uint8_t fdp1_tile_pattern(unsigned int x, unsigned int y)
+{
+	return 16 + (x * 7 + y * 13) % 220;
+}
+
+/*
+ * A progressive frame in four stripes: every byte must come back where it
+ * was, with nothing lost or doubled where the stripes meet.
+ */
+static int fdp1_tile_stitch_test(struct fdp1_context * fdp1)
+{
+	unsigned int stride = fdp1->width * 2;
+	size_t size = (size_t)stride * fdp1->height;
+	struct fdp1_tiler tiler;
+	uint8_t * src, * dst;
+	unsigned int x, y, n = 0;
+	int fail = 0;
+	int ret;
+
+	start_test(fdp1, "Stripe Stitch Test");
+
+	if (fdp1_tile_plan(&tiler, fdp1->width, fdp1->height, fdp1->width / 4,
+			   fdp1_tile_overlap(FDP1_PROGRESSIVE)))
+		return TEST_FAIL;
+
+	src = malloc(size);
+	dst = calloc(1, size);
+	if (!src || !dst) {
+		fail++;
+		goto out;
+	}
+
+	for (y = 0; y < fdp1->height; y++)
+		for (x = 0; x < stride; x++)
+			src[y * stride + x] = fdp1_tile_pattern(x, y);
+
+	if (fdp1_tile_open(fdp1, &tiler, V4L2_FIELD_NONE, FDP1_PROGRESSIVE)) {
+		fail++;
+		goto out;
+	}
+
+	ret = fdp1_tile_process(&tiler, src, stride, dst, stride);
+	if (ret != 1) {
+		kprint(fdp1, 0, "Tiled frame returned %d\n", ret);
+		fail++;
+	} else {
+		for (x = 0; x < size; x++)
+			n += src[x] != dst[x];
+	}
+
+	if (n) {
+		kprint(fdp1, 0, "%u bytes of the stitched frame differ\n", n);
+		fail++;
+	}
+
+	fdp1_tile_close(&tiler);
+
+out:
+	free(src);
+	free(dst);
+
+	return fail;
+}
+
+/* Plan, open and process one interlaced frame of 'src' into 'dst' */
+static int fdp1_tile_seam_frame(struct fdp1_context * fdp1,
+				unsigned int stripe_width, unsigned int overlap,
+				const uint8_t * src, uint8_t * dst)
+{
+	unsigned int stride = fdp1->width * 2;
+	struct fdp1_tiler tiler;
+	int ret;
+
+	if (fdp1_tile_plan(&tiler, fdp1->width, fdp1->height, stripe_width,
+			   overlap))
+		return -EINVAL;
+
+	if (fdp1_tile_open(fdp1, &tiler, V4L2_FIELD_INTERLACED, FDP1_FIXED2D))
+		return -ENODEV;
+
+	ret = fdp1_tile_process(&tiler, src, stride, dst, stride);
+
+	fdp1_tile_close(&tiler);
+
+	return ret;
+}
+
+/*
+ * An interlaced frame deinterlaced in four stripes, with the overlap of
+ * fdp1_tile_overlap(), must match the same frame deinterlaced whole: the
+ * overlap covers all the interpolation reaches for, or a seam shows.
+ */
+static int fdp1_tile_seam_test(struct fdp1_context * fdp1)
+{
+	unsigned int stride = fdp1->width * 2;
+	/* Both fields of the frame come out as captures of their own */
+	size_t size = (size_t)stride * fdp1->height * 2;
+	uint8_t * src, * whole, * tiled;
+	unsigned int x, y, n = 0;
+	int fail = 0;
+	int ret;
+
+	start_test(fdp1, "Stripe Seam Test");
+
+	src = malloc(size / 2);
+	whole = calloc(1, size);
+	tiled = calloc(1, size);
+	if (!src || !whole || !tiled) {
+		fail++;
+		goto out;
+	}
+
+	for (y = 0; y < fdp1->height; y++)
+		for (x = 0; x < stride; x++)
+			src[y * stride + x] = fdp1_tile_pattern(x, y);
+
+	ret = fdp1_tile_seam_frame(fdp1, fdp1->width, 0, src, whole);
+	if (ret == 2)
+		ret = fdp1_tile_seam_frame(fdp1, fdp1->width / 4,
+					   fdp1_tile_overlap(FDP1_FIXED2D),
+					   src, tiled);
+
+	if (ret != 2) {
+		kprint(fdp1, 0, "Deinterlaced frame returned %d\n", ret);
+		fail++;
+		goto out;
+	}
+
+	for (x = 0; x < size; x++)
+		n += whole[x] != tiled[x];
+
+	if (n) {
+		kprint(fdp1, 0, "%u bytes differ with %u columns of overlap\n",
+				n, fdp1_tile_overlap(FDP1_FIXED2D));
+		fail++;
+	}
+
+out:
+	free(src);
+	free(whole);
+	free(tiled);
+
+	return fail;
+}
+
+int fdp1_tiling_tests(struct fdp1_context * fdp1)
+{
+	unsigned int fail = 0;
+
+	fail += fdp1_tile_plan_test(fdp1);
+	fail += fdp1_tile_stitch_test(fdp1);
+	fail += fdp1_tile_seam_test(fdp1);
+
+	return fail;
+}
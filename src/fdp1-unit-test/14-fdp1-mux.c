@@ -0,0 +1,204 @@
+/*
+ * FDP1 Unit Test Utility
+ *      Author: Kieran Bingham
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by the
+ * Free Software Foundation; either version 2 of the License, or (at your
+ * option) any later version
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <linux/videodev2.h>
+
+#include "fdp1-unit-test.h"
+#include "fdp1-v4l2-helpers.h"
+#include "fdp1-stats.h"
+#include "fdp1-mux.h"
+
+#define MS	1000000ULL
+
+/* What fdp1_mux_run() does for a frame, without a device */
+static void fdp1_mux_test_queue(struct fdp1_mux * mux,
+				struct fdp1_mux_stream * s)
+{
+	s->waiting--;
+	s->queued++;
+	mux->queued++;
+}
+
+static void fdp1_mux_test_retire(struct fdp1_mux * mux,
+				 struct fdp1_mux_stream * s)
+{
+	s->head = (s->head + 1) % FDP1_MUX_BACKLOG;
+	s->queued--;
+	mux->queued--;
+}
+
+/*
+ * Fill the multiplexer, and one more: every stream it has room for is
+ * added, and the one it has not is refused, leaving the others as they
+ * were.
+ */
+static int fdp1_mux_full_test(struct fdp1_context * fdp1)
+{
+	struct fdp1_mux_stream * s;
+	struct fdp1_mux mux;
+	unsigned int i;
+	int fail = 0;
+
+	start_test(fdp1, "Full Multiplexer Test");
+
+	memzero(mux);
+
+	for (i = 0; i < FDP1_MUX_MAX_STREAMS + 1; i++) {
+		s = fdp1_mux_add(&mux, "stream", 720, 480, V4L2_FIELD_NONE,
+				 FDP1_PROGRESSIVE, 0, 1000 * MS);
+
+		if (i < FDP1_MUX_MAX_STREAMS && s != &mux.stream[i]) {
+			kprint(fdp1, 0, "Stream %u of %u not added\n",
+					i + 1, FDP1_MUX_MAX_STREAMS);
+			fail++;
+		}
+	}
+
+	if (s) {
+		kprint(fdp1, 0, "Stream %u added to a full multiplexer\n", i);
+		fail++;
+	}
+
+	fail += mux.n_streams != FDP1_MUX_MAX_STREAMS;
+
+	return fail;
+}
+
+/*
+ * A live channel due a frame after it arrives, against an archive which
+ * always has frames waiting, due whenever: the live frame goes first, and
+ * the archive never has more queued than its depth.
+ */
+static int fdp1_mux_order_test(struct fdp1_context * fdp1)
+{
+	struct fdp1_mux_stream * live, * archive;
+	struct fdp1_mux mux;
+	int fail = 0;
+
+	start_test(fdp1, "Deadline Order Test");
+
+	memzero(mux);
+	mux.policy = FDP1_MUX_EDF;
+	mux.inflight = 2;
+
+	archive = fdp1_mux_add(&mux, "archive", 1920, 1080, V4L2_FIELD_NONE,
+			       FDP1_PROGRESSIVE, 0, 1000 * MS);
+	live = fdp1_mux_add(&mux, "live", 720, 480, V4L2_FIELD_INTERLACED,
+			    FDP1_FIXED2D, 33 * MS, 33 * MS);
+	if (!archive || !live)
+		return TEST_FAIL;
+
+	fdp1_mux_arrive(&mux, 0);
+	fail += archive->waiting != FDP1_MUX_BACKLOG;
+	fail += live->waiting != 1;
+
+	/* Listed last, due first */
+	fail += fdp1_mux_pick(&mux) != live;
+	fdp1_mux_test_queue(&mux, live);
+
+	fail += fdp1_mux_pick(&mux) != archive;
+	fdp1_mux_test_queue(&mux, archive);
+
+	/* The device is full, and then the archive is at its depth */
+	fail += fdp1_mux_pick(&mux) != NULL;
+	fdp1_mux_test_retire(&mux, live);
+	fail += fdp1_mux_pick(&mux) != NULL;
+
+	/* The next live frame overtakes every archive frame waiting */
+	fdp1_mux_arrive(&mux, 40 * MS);
+	fail += live->waiting != 1;
+	fail += fdp1_mux_pick(&mux) != live;
+
+	/* Left to the kernel, the archive queues all it is allowed */
+	mux.policy = FDP1_MUX_KERNEL;
+	archive->depth = 4;
+	fdp1_mux_test_queue(&mux, live);
+	fail += fdp1_mux_pick(&mux) != archive;
+
+	/* A live channel which falls behind drops what it has no room for */
+	fdp1_mux_arrive(&mux, 40 * MS + 33 * MS * FDP1_MUX_BACKLOG);
+	fail += live->queued + live->waiting != FDP1_MUX_BACKLOG;
+	fail += live->stats.arrived != FDP1_MUX_BACKLOG + 2;
+	fail += live->stats.dropped != 1;
+
+	if (fail)
+		kprint(fdp1, 0, "%d scheduling decisions differ\n", fail);
+
+	return fail;
+}
+
+/*
+ * A 60i channel and a flooding progressive archive on the device at once:
+ * every frame dispatched completes, and the channel misses nothing.
+ */
+static int fdp1_mux_stream_test(struct fdp1_context * fdp1)
+{
+	struct fdp1_mux_stream * live, * archive;
+	struct fdp1_mux mux;
+	unsigned int i;
+	int fail = 0;
+	int ret;
+
+	start_test(fdp1, "Deadline Multiplex Test");
+
+	memzero(mux);
+	mux.policy = FDP1_MUX_EDF;
+	mux.inflight = 2;
+
+	/* 30 interlaced frames, 60 fields, a second */
+	live = fdp1_mux_add(&mux, "60i", fdp1->width, fdp1->height,
+			    V4L2_FIELD_INTERLACED, FDP1_FIXED2D,
+			    1000 * MS / 30, 1000 * MS / 30);
+	archive = fdp1_mux_add(&mux, "25p", fdp1->width, fdp1->height,
+			       V4L2_FIELD_NONE, FDP1_PROGRESSIVE,
+			       0, 1000 * MS);
+	if (!live || !archive)
+		return TEST_FAIL;
+
+	if (fdp1_mux_open(fdp1, &mux))
+		return TEST_FAIL;
+
+	ret = fdp1_mux_run(&mux, fdp1->num_frames * live->period);
+	if (ret) {
+		kprint(fdp1, 0, "Multiplexing failed: %s\n", strerror(-ret));
+		fail++;
+	}
+
+	fdp1_mux_close(&mux);
+
+	for (i = 0; i < mux.n_streams; i++) {
+		struct fdp1_mux_stream * s = &mux.stream[i];
+
+		kprint(fdp1, 1, "%s: %u arrived, %u dispatched, %u completed, %u missed\n",
+				s->name, s->stats.arrived, s->stats.dispatched,
+				s->stats.completed, s->stats.missed);
+
+		fail += s->stats.completed != s->stats.dispatched;
+	}
+
+	fail += !archive->stats.completed;
+	fail += live->stats.dropped + live->stats.missed != 0;
+
+	return fail;
+}
+
+int fdp1_mux_tests(struct fdp1_context * fdp1)
+{
+	unsigned int fail = 0;
+
+	fail += fdp1_mux_full_test(fdp1);
+	fail += fdp1_mux_order_test(fdp1);
+	fail += fdp1_mux_stream_test(fdp1);
+
+	return fail;
+}
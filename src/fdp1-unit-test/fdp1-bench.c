@@ -0,0 +1,1070 @@
+/*
+ * FDP1 Unit Test Utility
+ *      Author: Kieran Bingham
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by the
+ * Free Software Foundation; either version 2 of the License, or (at your
+ * option) any later version
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <inttypes.h>
+#include <poll.h>
+
+#include "fdp1-unit-test.h"
+#include "fdp1-v4l2-helpers.h"
+#include "fdp1-buffer.h"
+#include "fdp1-stats.h"
+#include "fdp1-cadence.h"
+#include "fdp1-tile.h"
+#include "fdp1-mux.h"
+
+/*
+ * Benchmarks
+ *
+ * Unlike the tests, these report measurements rather than pass/fail. A
+ * failure only means the measurement could not be taken.
+ */
+
+struct fdp1_bench {
+	char * name;
+	int (*run)(struct fdp1_context * fdp1);
+};
+
+/* Frames per second, from a count over a duration in nanoseconds */
+static double fdp1_bench_rate(unsigned int count, uint64_t ns)
+{
+	if (!count || !ns)
+		return 0.0;
+
+	return count * 1000000000.0 / ns;
+}
+
+static void fdp1_bench_stream_header(char * what)
+{
+	printf("%-26s %-18s %9s %9s %9s %9s %9s %9s\n", what, "Mode",
+	       "buf/s", "cap/s", "ttfc us", "avg us", "p99 us", "max us");
+}
+
+static void fdp1_bench_stream_result(char * what, enum fdp1_deint_mode mode,
+				     struct fdp1_cadence_stats * stats)
+{
+	printf("%-26s %-18s %9.1f %9.1f %9" PRIu64 " %9" PRIu64 " %9" PRIu64 " %9" PRIu64 "\n",
+	       what, fdp1_deint_mode_str(mode),
+	       fdp1_bench_rate(stats->submitted, stats->elapsed),
+	       fdp1_bench_rate(stats->captured, stats->elapsed),
+	       stats->first_capture ? (stats->first_capture - stats->start) / 1000 : 0,
+	       fdp1_latency_avg(&stats->latency) / 1000,
+	       fdp1_latency_percentile(&stats->latency, 99) / 1000,
+	       stats->latency.max / 1000);
+}
+
+/*
+ * Field layouts
+ *
+ * Compare the latency and throughput of each output field layout. With
+ * V4L2_FIELD_ALTERNATE each buffer is half the size, and its capture can
+ * be produced as soon as the single field has arrived.
+ */
+static int fdp1_bench_field_layouts(struct fdp1_context * fdp1)
+{
+	static const enum v4l2_field layouts[] = {
+		V4L2_FIELD_NONE,
+		V4L2_FIELD_INTERLACED,
+		V4L2_FIELD_SEQ_TB,
+		V4L2_FIELD_SEQ_BT,
+		V4L2_FIELD_ALTERNATE,
+	};
+	static const enum fdp1_deint_mode modes[] = {
+		FDP1_FIXED2D,
+		FDP1_ADAPT2D3D,
+	};
+	struct fdp1_cadence_stats stats;
+	unsigned int i, m;
+	int fail = 0;
+
+	fdp1_bench_stream_header("Layout");
+
+	for (i = 0; i < ARRAY_SIZE(layouts); i++) {
+		for (m = 0; m < ARRAY_SIZE(modes); m++) {
+			enum fdp1_deint_mode mode = modes[m];
+
+			if (layouts[i] == V4L2_FIELD_NONE) {
+				/* Progressive content has only one mode */
+				if (m)
+					continue;
+				mode = FDP1_PROGRESSIVE;
+			}
+
+			if (fdp1_cadence_stream(fdp1, V4L2_PIX_FMT_YUYV,
+						layouts[i], mode,
+						V4L2_PIX_FMT_YUYV, &stats)) {
+				fail++;
+				continue;
+			}
+
+			fdp1_bench_stream_result(v4l2_field(layouts[i]),
+						 mode, &stats);
+		}
+	}
+
+	return fail;
+}
+
+/* The time of each phase, and of the whole, from open or reconfigure */
+struct fdp1_bench_startup {
+	struct fdp1_latency phase[FDP1_PHASE_MAX];
+	struct fdp1_latency total;
+};
+
+static void fdp1_bench_startup_reset(struct fdp1_bench_startup * startup)
+{
+	unsigned int p;
+
+	for (p = 0; p < FDP1_PHASE_MAX; p++)
+		fdp1_latency_reset(&startup->phase[p]);
+
+	fdp1_latency_reset(&startup->total);
+}
+
+static void fdp1_bench_startup_add(struct fdp1_bench_startup * startup,
+				   struct fdp1_v4l2_dev * dev, uint64_t start)
+{
+	unsigned int p;
+
+	fdp1_latency_add(&startup->total, fdp1_time_ns() - start);
+
+	for (p = 0; p < FDP1_PHASE_MAX; p++)
+		if (dev->phase_calls[p])
+			fdp1_latency_add(&startup->phase[p], dev->phase_ns[p]);
+}
+
+static void fdp1_bench_startup_print(char * what,
+				     const struct fdp1_latency * a,
+				     const struct fdp1_latency * b)
+{
+	const struct fdp1_latency * lat[] = { a, b };
+	unsigned int i;
+
+	printf("%-18s", what);
+
+	for (i = 0; i < ARRAY_SIZE(lat); i++) {
+		if (!lat[i]->count) {
+			printf(" %9s %9s %9s", "-", "-", "-");
+			continue;
+		}
+
+		printf(" %9" PRIu64 " %9" PRIu64 " %9" PRIu64,
+		       fdp1_latency_avg(lat[i]) / 1000,
+		       fdp1_latency_percentile(lat[i], 99) / 1000,
+		       lat[i]->max / 1000);
+	}
+
+	printf("\n");
+}
+
+/*
+ * Queue every buffer of both pools, start streaming and wait for the first
+ * capture. The content is irrelevant, so the buffers are not filled.
+ */
+static int fdp1_bench_first_capture(struct fdp1_context * fdp1,
+				    struct fdp1_m2m * m2m)
+{
+	struct fdp1_v4l2_buffer_pool * src = m2m->src_queue.pool;
+	struct fdp1_v4l2_buffer_pool * dst = m2m->dst_queue.pool;
+	struct fdp1_v4l2_buffer * buffer;
+	struct pollfd pfd = {
+		.fd = m2m->dev->fd,
+		.events = POLLIN,
+	};
+	unsigned int i;
+	int fail = 0;
+
+	for (i = 0; i < src->qty; i++)
+		if (fdp1_v4l2_queue_buffer(m2m->dev, &src->buffer[i]))
+			fail++;
+
+	for (i = 0; i < dst->qty; i++)
+		if (fdp1_v4l2_queue_buffer(m2m->dev, &dst->buffer[i]))
+			fail++;
+
+	fail += fdp1_m2m_stream_on(m2m, V4L2_BUF_TYPE_VIDEO_OUTPUT_MPLANE);
+	fail += fdp1_m2m_stream_on(m2m, V4L2_BUF_TYPE_VIDEO_CAPTURE_MPLANE);
+	if (fail)
+		return fail;
+
+	if (poll(&pfd, 1, 1000) <= 0) {
+		kprint(fdp1, 0, "No capture at %dx%d\n", m2m->width, m2m->height);
+		return TEST_FAIL;
+	}
+
+	buffer = fdp1_m2m_dequeue_capture(m2m);
+	if (!buffer)
+		return TEST_FAIL;
+
+	fdp1_v4l2_buffer_release(buffer);
+
+	return TEST_PASS;
+}
+
+/*
+ * Startup
+ *
+ * Break the time from opening the device to the first capture down into
+ * its phases, for a fresh context each frame. Each context then switches
+ * to half the resolution and back, timing the STREAMOFF, S_FMT, REQBUFS,
+ * STREAMON cycle a resolution change costs, again to the first capture.
+ */
+static int fdp1_bench_startup(struct fdp1_context * fdp1)
+{
+	struct fdp1_bench_startup open, reconfigure;
+	unsigned int width = (fdp1->width / 2) & ~1;
+	unsigned int height = (fdp1->height / 2) & ~1;
+	struct fdp1_m2m * m2m;
+	uint64_t start;
+	unsigned int p;
+	int i;
+	int fail = 0;
+
+	fdp1_bench_startup_reset(&open);
+	fdp1_bench_startup_reset(&reconfigure);
+
+	for (i = 0; i < fdp1->num_frames && !fail; i++) {
+		start = fdp1_time_ns();
+
+		m2m = fdp1_create_m2m(fdp1, V4L2_PIX_FMT_YUYV, V4L2_FIELD_NONE,
+				      V4L2_PIX_FMT_YUYV);
+		if (!m2m)
+			return ++fail;
+
+		fail += fdp1_bench_first_capture(fdp1, m2m);
+		if (!fail)
+			fdp1_bench_startup_add(&open, m2m->dev, start);
+
+		/* There and back again */
+		if (!fail) {
+			fdp1_v4l2_phase_reset(m2m->dev);
+			start = fdp1_time_ns();
+
+			fail += fdp1_m2m_reconfigure(fdp1, m2m, width, height);
+			if (!fail)
+				fail += fdp1_bench_first_capture(fdp1, m2m);
+			if (!fail)
+				fdp1_bench_startup_add(&reconfigure, m2m->dev, start);
+		}
+
+		if (!fail) {
+			fdp1_v4l2_phase_reset(m2m->dev);
+			start = fdp1_time_ns();
+
+			fail += fdp1_m2m_reconfigure(fdp1, m2m, fdp1->width,
+						     fdp1->height);
+			if (!fail)
+				fail += fdp1_bench_first_capture(fdp1, m2m);
+			if (!fail)
+				fdp1_bench_startup_add(&reconfigure, m2m->dev, start);
+		}
+
+		fail += fdp1_free_m2m(m2m);
+	}
+
+	printf("%-18s %29s %29s\n", "", "Open (us)",
+	       "Reconfigure (us)");
+	printf("%-18s %9s %9s %9s %9s %9s %9s\n", "Phase",
+	       "avg", "p99", "max", "avg", "p99", "max");
+
+	for (p = 0; p < FDP1_PHASE_MAX; p++)
+		fdp1_bench_startup_print(fdp1_v4l2_phase_str(p),
+					 &open.phase[p], &reconfigure.phase[p]);
+
+	fdp1_bench_startup_print("first capture", &open.total,
+				 &reconfigure.total);
+
+	return fail;
+}
+
+/* Page faults taken in each phase of a stream */
+enum fdp1_bench_fault_phase {
+	FDP1_FAULTS_MAP,	/* open to mmap */
+	FDP1_FAULTS_PRIME,	/* First fill and queue of every buffer */
+	FDP1_FAULTS_RUN,	/* Streaming */
+	FDP1_FAULTS_MAX,
+};
+
+static char * fdp1_bench_fault_phases[] = {
+	"map", "prime", "run",
+};
+
+/* The runs of each stream, to show how repeatable the first frame is */
+#define FDP1_BENCH_FAULT_RUNS	5
+
+static int fdp1_bench_fault_stream(struct fdp1_context * fdp1,
+				   struct fdp1_faults faults[FDP1_FAULTS_MAX],
+				   struct fdp1_latency * ttfc)
+{
+	struct fdp1_cadence cadence;
+	struct fdp1_cadence_stats stats;
+	struct fdp1_faults start, delta;
+	struct fdp1_m2m * m2m;
+	int fail = 0;
+
+	fdp1_cadence_init(&cadence, V4L2_FIELD_NONE, FDP1_PROGRESSIVE);
+
+	fdp1_faults(&start);
+	m2m = fdp1_create_m2m(fdp1, V4L2_PIX_FMT_YUYV, V4L2_FIELD_NONE,
+			      V4L2_PIX_FMT_YUYV);
+	if (!m2m)
+		return TEST_FAIL;
+
+	fdp1_faults_since(&delta, &start);
+	faults[FDP1_FAULTS_MAP].minor += delta.minor;
+	faults[FDP1_FAULTS_MAP].major += delta.major;
+
+	fdp1_faults(&start);
+	fail += fdp1_cadence_prime(fdp1, m2m, &cadence, fdp1->num_frames, &stats);
+	fdp1_faults_since(&delta, &start);
+	faults[FDP1_FAULTS_PRIME].minor += delta.minor;
+	faults[FDP1_FAULTS_PRIME].major += delta.major;
+
+	fail += fdp1_m2m_stream_on(m2m, V4L2_BUF_TYPE_VIDEO_OUTPUT_MPLANE);
+	fail += fdp1_m2m_stream_on(m2m, V4L2_BUF_TYPE_VIDEO_CAPTURE_MPLANE);
+
+	if (!fail) {
+		fdp1_faults(&start);
+		fail += fdp1_cadence_run(fdp1, m2m, &cadence, fdp1->num_frames,
+					 &stats);
+		fdp1_faults_since(&delta, &start);
+		faults[FDP1_FAULTS_RUN].minor += delta.minor;
+		faults[FDP1_FAULTS_RUN].major += delta.major;
+
+		if (stats.first_capture)
+			fdp1_latency_add(ttfc, stats.first_capture - stats.start);
+	}
+
+	fail += fdp1_free_m2m(m2m);
+
+	return fail;
+}
+
+/*
+ * Faults
+ *
+ * Count the page faults taken in each phase of a progressive stream, with
+ * plain mappings and with pre-faulted, locked ones (as --lock), and how
+ * much the time to the first capture varies with each.
+ */
+static int fdp1_bench_faults(struct fdp1_context * fdp1)
+{
+	int lock_buffers = fdp1->lock_buffers;
+	unsigned int p, r;
+	int fail = 0;
+	int lock;
+
+	printf("%-10s %-8s %12s %12s %9s %9s %9s\n", "Mapping", "Phase",
+	       "minor/run", "major/run", "ttfc us", "min us", "max us");
+
+	for (lock = 0; lock < 2; lock++) {
+		struct fdp1_faults faults[FDP1_FAULTS_MAX];
+		struct fdp1_latency ttfc;
+
+		memzero(faults);
+		fdp1_latency_reset(&ttfc);
+
+		fdp1->lock_buffers = lock;
+
+		for (r = 0; r < FDP1_BENCH_FAULT_RUNS && !fail; r++)
+			fail += fdp1_bench_fault_stream(fdp1, faults, &ttfc);
+
+		if (fail)
+			break;
+
+		for (p = 0; p < FDP1_FAULTS_MAX; p++) {
+			printf("%-10s %-8s %12" PRIu64 " %12" PRIu64,
+			       lock ? "locked" : "mmap",
+			       fdp1_bench_fault_phases[p],
+			       faults[p].minor / FDP1_BENCH_FAULT_RUNS,
+			       faults[p].major / FDP1_BENCH_FAULT_RUNS);
+
+			if (p == FDP1_FAULTS_RUN)
+				printf(" %9" PRIu64 " %9" PRIu64 " %9" PRIu64,
+				       fdp1_latency_avg(&ttfc) / 1000,
+				       ttfc.min / 1000, ttfc.max / 1000);
+
+			printf("\n");
+		}
+	}
+
+	fdp1->lock_buffers = lock_buffers;
+
+	return fail;
+}
+
+/*
+ * Cache maintenance
+ *
+ * Compare throughput when the CPU touches every buffer, none after
+ * priming, or one in eight, with the cache maintenance the CPU does not
+ * need skipped. The first run keeps full maintenance, as a reference.
+ */
+static int fdp1_bench_cache(struct fdp1_context * fdp1)
+{
+	static const struct {
+		char * name;
+		int cache_hints;
+		int touch;
+	} modes[] = {
+		{ "coherent, touch",	0, 1 },
+		{ "touch",		1, 1 },
+		{ "no touch",		1, 0 },
+		{ "touch 1 in 8",	1, 8 },
+	};
+	int cache_hints = fdp1->cache_hints;
+	int touch = fdp1->touch;
+	struct fdp1_cadence_stats stats;
+	unsigned int i;
+	int fail = 0;
+
+	fdp1_bench_stream_header("Buffers");
+
+	for (i = 0; i < ARRAY_SIZE(modes); i++) {
+		fdp1->cache_hints = modes[i].cache_hints;
+		fdp1->touch = modes[i].touch;
+
+		if (fdp1_cadence_stream(fdp1, V4L2_PIX_FMT_YUYV,
+					V4L2_FIELD_NONE, FDP1_PROGRESSIVE,
+					V4L2_PIX_FMT_YUYV, &stats)) {
+			fail++;
+			continue;
+		}
+
+		fdp1_bench_stream_result(modes[i].name, FDP1_PROGRESSIVE, &stats);
+	}
+
+	fdp1->cache_hints = cache_hints;
+	fdp1->touch = touch;
+
+	return fail;
+}
+
+/*
+ * Buffer preparation
+ *
+ * Measure VIDIOC_QBUF on the output queue for each memory type, with and
+ * without the buffers validated by VIDIOC_PREPARE_BUF beforehand. Nothing
+ * is streamed: each round queues every buffer, and STREAMOFF returns them.
+ * DMABUF buffers are exported from the output queue of a second context.
+ */
+#define FDP1_BENCH_QBUF_ROUNDS	16
+
+static int fdp1_bench_qbuf_rounds(struct fdp1_m2m * m2m, bool prepare,
+				  struct fdp1_latency * qbuf,
+				  struct fdp1_latency * prep)
+{
+	struct fdp1_v4l2_buffer_pool * pool = m2m->src_queue.pool;
+	struct fdp1_v4l2_dev * dev = m2m->dev;
+	unsigned int r, i;
+	uint64_t ns;
+	int fail = 0;
+
+	for (i = 0; i < pool->qty; i++)
+		fdp1_fill_buffer(&pool->buffer[i]);
+
+	for (r = 0; r < FDP1_BENCH_QBUF_ROUNDS && !fail; r++) {
+		for (i = 0; i < pool->qty; i++) {
+			struct fdp1_v4l2_buffer * buffer = &pool->buffer[i];
+
+			if (prepare) {
+				ns = dev->phase_ns[FDP1_PHASE_PREPARE_BUF];
+				fail += !!fdp1_v4l2_prepare_buffer(dev, buffer);
+				fdp1_latency_add(prep,
+					dev->phase_ns[FDP1_PHASE_PREPARE_BUF] - ns);
+			}
+
+			ns = dev->phase_ns[FDP1_PHASE_QBUF];
+			fail += !!fdp1_v4l2_queue_buffer(dev, buffer);
+			fdp1_latency_add(qbuf, dev->phase_ns[FDP1_PHASE_QBUF] - ns);
+		}
+
+		fail += fdp1_m2m_stream_off(m2m, V4L2_BUF_TYPE_VIDEO_OUTPUT_MPLANE);
+	}
+
+	return fail;
+}
+
+static int fdp1_bench_qbuf(struct fdp1_context * fdp1)
+{
+	static const uint32_t memories[] = {
+		V4L2_MEMORY_MMAP,
+		V4L2_MEMORY_DMABUF,
+		V4L2_MEMORY_USERPTR,
+	};
+	int prepare_buffers = fdp1->prepare_buffers;
+	int cache_hints = fdp1->cache_hints;
+	struct fdp1_m2m * donor, * m2m;
+	struct fdp1_latency qbuf, prep;
+	unsigned int i;
+	int prepare;
+	int fail = 0;
+
+	/* Prepare only where measured, with the same maintenance throughout */
+	fdp1->prepare_buffers = 0;
+	fdp1->cache_hints = 0;
+
+	donor = fdp1_create_m2m(fdp1, V4L2_PIX_FMT_YUYV, V4L2_FIELD_NONE,
+				V4L2_PIX_FMT_YUYV);
+	if (!donor) {
+		kprint(fdp1, 0, "Failed to create an M2M object\n");
+		fdp1->prepare_buffers = prepare_buffers;
+		fdp1->cache_hints = cache_hints;
+		return TEST_FAIL;
+	}
+
+	printf("%-10s %-10s %9s %9s %9s %11s\n", "Memory", "Buffers",
+	       "avg us", "p99 us", "max us", "prepare us");
+
+	for (i = 0; i < ARRAY_SIZE(memories); i++) {
+		m2m = fdp1_create_m2m(fdp1, V4L2_PIX_FMT_YUYV, V4L2_FIELD_NONE,
+				      V4L2_PIX_FMT_YUYV);
+		if (!m2m) {
+			fail++;
+			continue;
+		}
+
+		if (memories[i] != V4L2_MEMORY_MMAP) {
+			fail += fdp1_v4l2_free_buffers(m2m->src_queue.pool);
+			m2m->src_queue.pool = fdp1_v4l2_import_buffers(fdp1,
+					m2m->dev, V4L2_BUF_TYPE_VIDEO_OUTPUT_MPLANE,
+					memories[i], V4L2_FIELD_NONE,
+					donor->dev, donor->src_queue.pool);
+		}
+
+		if (!m2m->src_queue.pool) {
+			/* Not every driver takes every memory type */
+			printf("%-10s %-10s %9s\n",
+			       fdp1_v4l2_memory_str(memories[i]), "-",
+			       "unsupported");
+			fail += fdp1_free_m2m(m2m);
+			continue;
+		}
+
+		for (prepare = 0; prepare < 2; prepare++) {
+			fdp1_latency_reset(&qbuf);
+			fdp1_latency_reset(&prep);
+
+			if (fdp1_bench_qbuf_rounds(m2m, prepare, &qbuf, &prep)) {
+				fail++;
+				break;
+			}
+
+			printf("%-10s %-10s %9.1f %9.1f %9.1f",
+			       fdp1_v4l2_memory_str(memories[i]),
+			       prepare ? "prepared" : "unprepared",
+			       fdp1_latency_avg(&qbuf) / 1000.0,
+			       fdp1_latency_percentile(&qbuf, 99) / 1000.0,
+			       qbuf.max / 1000.0);
+
+			if (prepare)
+				printf(" %11.1f", fdp1_latency_avg(&prep) / 1000.0);
+
+			printf("\n");
+		}
+
+		fail += fdp1_free_m2m(m2m);
+	}
+
+	fail += fdp1_free_m2m(donor);
+
+	fdp1->prepare_buffers = prepare_buffers;
+	fdp1->cache_hints = cache_hints;
+
+	return fail;
+}
+
+/*
+ * Deinterlace mode switches
+ *
+ * Alternate between video (adaptive) and film (fixed 3D) deinterlacing
+ * every FDP1_BENCH_SWITCH_PERIOD buffers: in a media request with the
+ * buffer, with VIDIOC_S_CTRL as the stream runs, or by stopping the stream,
+ * setting the mode and starting again. The cost of a switch is the time
+ * taken over a stream which never switches, shared between its switches.
+ */
+#define FDP1_BENCH_SWITCH_PERIOD	8
+
+enum fdp1_bench_switch {
+	FDP1_SWITCH_NONE,
+	FDP1_SWITCH_REQUEST,
+	FDP1_SWITCH_S_CTRL,
+	FDP1_SWITCH_RESTART,
+	FDP1_SWITCH_MAX,
+};
+
+static char * fdp1_bench_switches[] = {
+	"none", "request", "s_ctrl", "restart",
+};
+
+/* Stream the cadence a period at a time, restarting between each */
+static int fdp1_bench_switch_restart(struct fdp1_context * fdp1,
+				     const struct fdp1_cadence * cadence,
+				     struct fdp1_cadence_stats * total)
+{
+	struct fdp1_cadence segment = *cadence;
+	struct fdp1_cadence_stats stats;
+	struct fdp1_m2m * m2m;
+	unsigned int n, count;
+	int fail = 0;
+
+	memzero(*total);
+
+	/* Each segment runs in a single mode */
+	segment.switch_period = 0;
+
+	m2m = fdp1_create_m2m(fdp1, cadence->out_fourcc, cadence->field,
+			      cadence->cap_fourcc);
+	if (!m2m)
+		return TEST_FAIL;
+
+	total->start = fdp1_time_ns();
+
+	for (n = 0; n < (unsigned int)fdp1->num_frames && !fail; n += count) {
+		enum fdp1_deint_mode mode = fdp1_cadence_mode(cadence, n);
+
+		count = fdp1->num_frames - n;
+		if (count > cadence->switch_period)
+			count = cadence->switch_period;
+
+		fail += fdp1_cadence_prime(fdp1, m2m, &segment, count, &stats);
+		fail += !!fdp1_m2m_set_ctrl(m2m, V4L2_CID_DEINTERLACING_MODE, mode);
+		fail += fdp1_m2m_stream_on(m2m, V4L2_BUF_TYPE_VIDEO_OUTPUT_MPLANE);
+		fail += fdp1_m2m_stream_on(m2m, V4L2_BUF_TYPE_VIDEO_CAPTURE_MPLANE);
+
+		if (!fail)
+			fail += fdp1_cadence_run(fdp1, m2m, &segment, count, &stats);
+
+		fail += fdp1_m2m_stream_off(m2m, V4L2_BUF_TYPE_VIDEO_OUTPUT_MPLANE);
+		fail += fdp1_m2m_stream_off(m2m, V4L2_BUF_TYPE_VIDEO_CAPTURE_MPLANE);
+
+		if (!total->first_capture)
+			total->first_capture = stats.first_capture;
+
+		total->submitted += stats.submitted;
+		total->captured += stats.captured;
+		total->mode_switches += n && mode != fdp1_cadence_mode(cadence, n - 1);
+		fdp1_latency_merge(&total->latency, &stats.latency);
+	}
+
+	total->elapsed = fdp1_time_ns() - total->start;
+
+	fail += fdp1_free_m2m(m2m);
+
+	return fail;
+}
+
+static int fdp1_bench_mode_switch(struct fdp1_context * fdp1)
+{
+	struct fdp1_cadence_stats stats;
+	struct fdp1_cadence cadence;
+	double base = 0.0;
+	unsigned int i;
+	int requests;
+	int fail = 0;
+
+	if (fdp1_cadence_setup(fdp1, &cadence, V4L2_PIX_FMT_YUYV,
+			       V4L2_FIELD_INTERLACED, FDP1_ADAPT2D3D,
+			       V4L2_PIX_FMT_YUYV))
+		return TEST_FAIL;
+
+	requests = fdp1_requests_supported(fdp1);
+	if (requests < 0)
+		return TEST_FAIL;
+
+	printf("%-10s %9s %9s %9s %9s %9s %9s %10s\n", "Switch",
+	       "buf/s", "cap/s", "avg us", "p99 us", "max us",
+	       "switches", "us/switch");
+
+	for (i = 0; i < FDP1_SWITCH_MAX; i++) {
+		cadence.requests = i == FDP1_SWITCH_REQUEST;
+		cadence.switch_period = 0;
+
+		if (i != FDP1_SWITCH_NONE)
+			fdp1_cadence_set_switch(&cadence, FDP1_FIXED3D,
+						FDP1_BENCH_SWITCH_PERIOD);
+
+		if (cadence.requests && !requests) {
+			printf("%-10s %9s\n", fdp1_bench_switches[i], "unsupported");
+			continue;
+		}
+
+		if (i == FDP1_SWITCH_RESTART)
+			fail += fdp1_bench_switch_restart(fdp1, &cadence, &stats);
+		else
+			fail += fdp1_cadence_execute(fdp1, &cadence, &stats);
+
+		if (fail)
+			break;
+
+		/* Nanoseconds per buffer when the mode never changes */
+		if (i == FDP1_SWITCH_NONE && stats.submitted)
+			base = (double)stats.elapsed / stats.submitted;
+
+		printf("%-10s %9.1f %9.1f %9" PRIu64 " %9" PRIu64 " %9" PRIu64 " %9u",
+		       fdp1_bench_switches[i],
+		       fdp1_bench_rate(stats.submitted, stats.elapsed),
+		       fdp1_bench_rate(stats.captured, stats.elapsed),
+		       fdp1_latency_avg(&stats.latency) / 1000,
+		       fdp1_latency_percentile(&stats.latency, 99) / 1000,
+		       stats.latency.max / 1000,
+		       stats.mode_switches);
+
+		if (stats.mode_switches)
+			printf(" %10.1f", (stats.elapsed - base * stats.submitted) /
+			       stats.mode_switches / 1000.0);
+
+		printf("\n");
+	}
+
+	return fail;
+}
+
+/*
+ * Regions of interest
+ *
+ * Stream progressive frames cropped to a centred window of the source,
+ * composed into the same window of the capture, shrinking the window from
+ * the whole frame. The memory traffic of the device is the window read
+ * and written, so the rate should scale with its area, down to whatever
+ * each frame costs regardless of its size.
+ */
+static int fdp1_bench_roi(struct fdp1_context * fdp1)
+{
+	/* Of each side of the frame */
+	static const unsigned int percents[] = { 100, 75, 50, 35, 25 };
+	struct fdp1_cadence_stats stats;
+	struct fdp1_cadence cadence;
+	unsigned int i;
+	int fail = 0;
+	int ret;
+
+	if (fdp1_cadence_setup(fdp1, &cadence, V4L2_PIX_FMT_YUYV,
+			       V4L2_FIELD_NONE, FDP1_PROGRESSIVE,
+			       V4L2_PIX_FMT_YUYV))
+		return TEST_FAIL;
+
+	printf("%-12s %6s %9s %9s %9s %9s %9s\n", "Window", "Area",
+	       "buf/s", "cap/s", "MB/s", "avg us", "p99 us");
+
+	ret = fdp1_selection_supported(fdp1);
+	if (ret < 0)
+		return TEST_FAIL;
+
+	if (!ret) {
+		printf("%-12s %6s %9s\n", "window", "", "unsupported");
+		return fail;
+	}
+
+	for (i = 0; i < ARRAY_SIZE(percents); i++) {
+		struct v4l2_rect * r = &cadence.crop;
+		char what[32];
+		double area;
+
+		/* YUYV windows start and end on a pair of pixels */
+		r->width = (fdp1->width * percents[i] / 100) & ~1;
+		r->height = (fdp1->height * percents[i] / 100) & ~1;
+		r->left = ((fdp1->width - r->width) / 2) & ~1;
+		r->top = ((fdp1->height - r->height) / 2) & ~1;
+		cadence.compose = *r;
+
+		if (fdp1_cadence_execute(fdp1, &cadence, &stats)) {
+			fail++;
+			continue;
+		}
+
+		area = (double)r->width * r->height;
+		snprintf(what, sizeof(what), "%ux%u", r->width, r->height);
+
+		/* Two bytes a pixel, read from the source and written back */
+		printf("%-12s %5.1f%% %9.1f %9.1f %9.1f %9" PRIu64 " %9" PRIu64 "\n",
+		       what, 100.0 * area / (fdp1->width * fdp1->height),
+		       fdp1_bench_rate(stats.submitted, stats.elapsed),
+		       fdp1_bench_rate(stats.captured, stats.elapsed),
+		       fdp1_bench_rate(stats.captured, stats.elapsed) *
+		       area * 2 * 2 / 1000000.0,
+		       fdp1_latency_avg(&stats.latency) / 1000,
+		       fdp1_latency_percentile(&stats.latency, 99) / 1000);
+	}
+
+	return fail;
+}
+
+/*
+ * Stripe tiling
+ *
+ * Process progressive frames split into ever narrower stripes, all queued
+ * at once. The overhead of a stripe width is the extra columns it reads
+ * for its overlaps, and the time per frame against the widest stripes the
+ * device would take: one stripe, unless the frame is too wide for that.
+ */
+static int fdp1_bench_tiles(struct fdp1_context * fdp1)
+{
+	static const unsigned int divisors[] = { 1, 2, 3, 4, 6, 8, 12, 16 };
+	unsigned int stride = fdp1->width * 2;
+	size_t size = (size_t)stride * fdp1->height;
+	uint64_t base = 0;
+	uint8_t * src, * dst;
+	unsigned int i, n;
+	int fail = 0;
+
+	src = calloc(1, size);
+	dst = calloc(1, size);
+	if (!src || !dst) {
+		free(src);
+		free(dst);
+		return TEST_FAIL;
+	}
+
+	memset(src, 0x80, size);
+
+	printf("%-8s %7s %9s %9s %9s %9s\n", "Stripe", "Stripes", "Overlap",
+	       "frames/s", "us/frame", "Overhead");
+
+	for (i = 0; i < ARRAY_SIZE(divisors); i++) {
+		struct fdp1_tiler tiler;
+		uint64_t start, elapsed;
+		unsigned int columns;
+		int ret = 0;
+
+		if (fdp1_tile_plan(&tiler, fdp1->width, fdp1->height,
+				   fdp1->width / divisors[i],
+				   fdp1_tile_overlap(FDP1_PROGRESSIVE)))
+			continue;
+
+		columns = fdp1_tile_columns(&tiler);
+
+		if (fdp1_tile_open(fdp1, &tiler, V4L2_FIELD_NONE,
+				   FDP1_PROGRESSIVE)) {
+			printf("%-8u %7u %9s\n", tiler.stripe[0].kept,
+			       tiler.n_stripes, "unsupported");
+			continue;
+		}
+
+		start = fdp1_time_ns();
+		for (n = 0; n < fdp1->num_frames && ret >= 0; n++)
+			ret = fdp1_tile_process(&tiler, src, stride, dst, stride);
+		elapsed = fdp1_time_ns() - start;
+
+		fdp1_tile_close(&tiler);
+
+		if (ret < 0) {
+			kprint(fdp1, 0, "%u stripes failed: %s\n", tiler.n_stripes,
+					strerror(-ret));
+			fail++;
+			continue;
+		}
+
+		/* Nothing was timed to report against */
+		if (!n)
+			continue;
+
+		if (!base)
+			base = elapsed;
+
+		printf("%-8u %7u %8.1f%% %9.1f %9" PRIu64 " %8.1f%%\n",
+		       tiler.stripe[0].kept, tiler.n_stripes,
+		       100.0 * (columns - tiler.width) / tiler.width,
+		       fdp1_bench_rate(n, elapsed), elapsed / n / 1000,
+		       100.0 * ((double)elapsed - base) / base);
+	}
+
+	free(src);
+	free(dst);
+
+	return fail;
+}
+
+/*
+ * Deadline multiplexing
+ *
+ * A 60i channel, due a frame period after each frame arrives, shares the
+ * device with a progressive archive transcode which always has frames to
+ * queue. Left to the kernel, the archive keeps every buffer it has queued
+ * and the channel waits its turn behind them. Dispatched earliest deadline
+ * first, two frames at a time, the channel should miss nothing, and the
+ * archive gets whatever time is left.
+ */
+static int fdp1_bench_mux(struct fdp1_context * fdp1)
+{
+	static const struct {
+		const char * name;
+		enum fdp1_mux_policy policy;
+	} policies[] = {
+		{ "kernel",	FDP1_MUX_KERNEL },
+		{ "edf",	FDP1_MUX_EDF },
+	};
+	/* 30 interlaced frames, 60 fields, a second */
+	uint64_t period = 1000000000ULL / 30;
+	unsigned int i, j;
+	int fail = 0;
+
+	printf("%-8s %-8s %9s %9s %9s %9s %9s %9s\n", "Policy", "Stream",
+	       "frames/s", "Dropped", "Missed", "avg us", "p99 us", "late us");
+
+	for (i = 0; i < ARRAY_SIZE(policies); i++) {
+		struct fdp1_mux mux;
+		int ret;
+
+		memzero(mux);
+		mux.policy = policies[i].policy;
+		mux.inflight = 2;
+
+		if (!fdp1_mux_add(&mux, "60i", fdp1->width, fdp1->height,
+				  V4L2_FIELD_INTERLACED, FDP1_FIXED2D,
+				  period, period) ||
+		    !fdp1_mux_add(&mux, "25p", fdp1->width, fdp1->height,
+				  V4L2_FIELD_NONE, FDP1_PROGRESSIVE,
+				  0, 1000000000ULL)) {
+			kprint(fdp1, 0, "Failed to add the %s streams\n",
+					policies[i].name);
+			return TEST_FAIL;
+		}
+
+		if (fdp1_mux_open(fdp1, &mux)) {
+			printf("%-8s %-8s %9s\n", policies[i].name, "",
+			       "unsupported");
+			continue;
+		}
+
+		ret = fdp1_mux_run(&mux, fdp1->num_frames * period);
+
+		fdp1_mux_close(&mux);
+
+		if (ret) {
+			kprint(fdp1, 0, "%s multiplexing failed: %s\n",
+					policies[i].name, strerror(-ret));
+			fail++;
+			continue;
+		}
+
+		for (j = 0; j < mux.n_streams; j++) {
+			struct fdp1_mux_stream_stats * stats = &mux.stream[j].stats;
+
+			printf("%-8s %-8s %9.1f %9u %9u %9" PRIu64 " %9" PRIu64
+			       " %9" PRIu64 "\n",
+			       policies[i].name, mux.stream[j].name,
+			       fdp1_bench_rate(stats->completed,
+					       fdp1->num_frames * period),
+			       stats->dropped, stats->missed,
+			       fdp1_latency_avg(&stats->latency) / 1000,
+			       fdp1_latency_percentile(&stats->latency, 99) / 1000,
+			       stats->late_max / 1000);
+		}
+	}
+
+	return fail;
+}
+
+/*
+ * Live pacing
+ *
+ * Deinterlace a 50i and a 60i feed paced as they would arrive live, then
+ * at two, four and eight times their rate, with the jitter and drop policy
+ * of the options. The fastest pace which neither drops a frame nor runs
+ * late is the headroom of the device over the feed, which throughput does
+ * not show: a live source never gets ahead of itself to keep the queues
+ * full.
+ */
+static int fdp1_bench_live(struct fdp1_context * fdp1)
+{
+	static const struct {
+		const char * name;
+		unsigned int rate;	/* Interlaced frames a second */
+	} feeds[] = {
+		{ "50i",	25 },
+		{ "60i",	30 },
+	};
+	static const unsigned int speeds[] = { 1, 2, 4, 8 };
+	struct fdp1_cadence_stats stats;
+	struct fdp1_cadence cadence;
+	unsigned int i, j;
+	int fail = 0;
+
+	printf("%-6s %6s %9s %9s %9s %9s %9s %9s\n", "Feed", "Speed",
+	       "buf/s", "Dropped", "Late", "avg us", "p99 us", "max us");
+
+	for (i = 0; i < ARRAY_SIZE(feeds); i++) {
+		for (j = 0; j < ARRAY_SIZE(speeds); j++) {
+			if (fdp1_cadence_setup(fdp1, &cadence, V4L2_PIX_FMT_YUYV,
+					       V4L2_FIELD_INTERLACED,
+					       FDP1_ADAPT2D3D,
+					       V4L2_PIX_FMT_YUYV))
+				return TEST_FAIL;
+
+			cadence.rate = feeds[i].rate * speeds[j];
+
+			if (fdp1_cadence_execute(fdp1, &cadence, &stats)) {
+				fail++;
+				continue;
+			}
+
+			printf("%-6s %5ux %9.1f %9u %9u %9" PRIu64 " %9" PRIu64
+			       " %9" PRIu64 "\n",
+			       feeds[i].name, speeds[j],
+			       fdp1_bench_rate(stats.submitted, stats.elapsed),
+			       stats.dropped, stats.late,
+			       fdp1_latency_avg(&stats.live_latency) / 1000,
+			       fdp1_latency_percentile(&stats.live_latency, 99) / 1000,
+			       stats.live_latency.max / 1000);
+		}
+	}
+
+	return fail;
+}
+
+static struct fdp1_bench fdp1_benches[] = {
+	{ "layouts",	fdp1_bench_field_layouts },
+	{ "startup",	fdp1_bench_startup },
+	{ "faults",	fdp1_bench_faults },
+	{ "cache",	fdp1_bench_cache },
+	{ "qbuf",	fdp1_bench_qbuf },
+	{ "modeswitch",	fdp1_bench_mode_switch },
+	{ "roi",	fdp1_bench_roi },
+	{ "tiles",	fdp1_bench_tiles },
+	{ "mux",	fdp1_bench_mux },
+	{ "live",	fdp1_bench_live },
+};
+
+int fdp1_bench(struct fdp1_context * fdp1)
+{
+	unsigned int fail = 0;
+	unsigned int i;
+	int found = 0;
+
+	if (fdp1->num_frames <= 0) {
+		fprintf(stderr, "Benchmarks need at least one frame\n");
+		return TEST_FAIL;
+	}
+
+	for (i = 0; i < ARRAY_SIZE(fdp1_benches); i++) {
+		if (strcmp(fdp1->bench, "all") &&
+		    strcmp(fdp1->bench, fdp1_benches[i].name))
+			continue;
+
+		found++;
+
+		printf("%s: %s benchmark, %dx%d, %d frames\n", fdp1->appname,
+		       fdp1_benches[i].name, fdp1->width, fdp1->height,
+		       fdp1->num_frames);
+
+		fail += fdp1_benches[i].run(fdp1);
+
+		printf("\n");
+	}
+
+	if (!found) {
+		fprintf(stderr, "Unknown benchmark '%s'\n", fdp1->bench);
+		fail++;
+	}
+
+	return fail;
+}
@@ -0,0 +1,798 @@
+/*
+ * FDP1 Unit Test Utility
+ *      Author: Kieran Bingham
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by the
+ * Free Software Foundation; either version 2 of the License, or (at your
+ * option) any later version
+ */
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#include <linux/dma-buf.h>
+#include <linux/videodev2.h>
+
+#include "fdp1-unit-test.h"
+#include "fdp1-v4l2-helpers.h"
+#include "fdp1-broker.h"
+#include "fdp1.h"
+
+struct fdp1_broker_job {
+	struct fdp1_broker_job * next;
+	struct fdp1_broker_msg msg;
+
+	int sock;	/* The client, to reply to */
+	int src_fd;
+	int dst_fd;
+	uint64_t received;
+};
+
+struct fdp1_broker_context {
+	struct fdp1_broker_msg key;
+	unsigned int fields;	/* Captures per job */
+
+	struct fdp1_device * device;	/* The device backend only */
+};
+
+static bool fdp1_broker_key_match(const struct fdp1_broker_msg * a,
+				  const struct fdp1_broker_msg * b)
+{
+	return a->out_fourcc == b->out_fourcc &&
+	       a->cap_fourcc == b->cap_fourcc &&
+	       a->field == b->field &&
+	       (a->field == V4L2_FIELD_NONE || a->mode == b->mode) &&
+	       a->width == b->width &&
+	       a->height == b->height;
+}
+
+static struct fdp1_broker_context *
+fdp1_broker_context_alloc(const struct fdp1_broker_msg * key)
+{
+	struct fdp1_broker_context * ctx;
+	int fields;
+
+	fields = fdp1_job_captures(key->field, key->mode);
+	if (fields < 0)
+		return NULL;
+
+	ctx = calloc(1, sizeof(*ctx));
+	if (!ctx)
+		return NULL;
+
+	ctx->key = *key;
+	ctx->fields = fields;
+
+	return ctx;
+}
+
+/*
+ * Device backend
+ *
+ * Each context is a libfdp1 device of its own, streaming on both queues
+ * for as long as it stays warm.
+ */
+static struct fdp1_broker_context *
+fdp1_broker_device_open(struct fdp1_context * fdp1,
+			const struct fdp1_broker_msg * key)
+{
+	struct fdp1_broker_context * ctx;
+	struct fdp1_config config = {
+		.width = key->width,
+		.height = key->height,
+		.out_fourcc = key->out_fourcc,
+		.out_field = key->field,
+		.cap_fourcc = key->cap_fourcc,
+		.mode = key->mode,
+	};
+	int ret;
+
+	ctx = fdp1_broker_context_alloc(key);
+	if (!ctx)
+		return NULL;
+
+	if (fdp1->cache_hints)
+		config.flags |= FDP1_CONFIG_CACHE_HINTS;
+	if (fdp1->prepare_buffers)
+		config.flags |= FDP1_CONFIG_PREPARE;
+	if (fdp1->lock_buffers)
+		config.flags |= FDP1_CONFIG_LOCK;
+
+	ret = fdp1_device_open(fdp1->dev, &config, &ctx->device);
+	if (ret) {
+		kprint(fdp1, 1, "Failed to open a %ux%u context: %s\n",
+				key->width, key->height, strerror(-ret));
+		free(ctx);
+		return NULL;
+	}
+
+	return ctx;
+}
+
+static void fdp1_broker_device_close(struct fdp1_broker_context * ctx)
+{
+	fdp1_device_close(ctx->device);
+	free(ctx);
+}
+
+static int fdp1_broker_device_run(struct fdp1_broker_context * ctx,
+				  const uint8_t * src, size_t src_size,
+				  uint8_t * dst, size_t dst_size,
+				  uint32_t * bytesused)
+{
+	return fdp1_device_process(ctx->device, src, src_size, dst, dst_size,
+				   bytesused);
+}
+
+const struct fdp1_broker_backend fdp1_broker_device = {
+	.name = "device",
+	.open = fdp1_broker_device_open,
+	.close = fdp1_broker_device_close,
+	.run = fdp1_broker_device_run,
+};
+
+/*
+ * Stub backend
+ *
+ * Each capture is a copy of the source, as much of it as fits in an equal
+ * share of the destination.
+ */
+static struct fdp1_broker_context *
+fdp1_broker_stub_open(struct fdp1_context * fdp1,
+		      const struct fdp1_broker_msg * key)
+{
+	return fdp1_broker_context_alloc(key);
+}
+
+static void fdp1_broker_stub_close(struct fdp1_broker_context * ctx)
+{
+	free(ctx);
+}
+
+static int fdp1_broker_stub_run(struct fdp1_broker_context * ctx,
+				const uint8_t * src, size_t src_size,
+				uint8_t * dst, size_t dst_size,
+				uint32_t * bytesused)
+{
+	size_t size = dst_size / ctx->fields;
+	unsigned int i;
+
+	if (src_size < size)
+		size = src_size;
+
+	for (i = 0; i < ctx->fields; i++)
+		memcpy(dst + i * size, src, size);
+
+	*bytesused = size;
+
+	return ctx->fields;
+}
+
+const struct fdp1_broker_backend fdp1_broker_stub = {
+	.name = "stub",
+	.open = fdp1_broker_stub_open,
+	.close = fdp1_broker_stub_close,
+	.run = fdp1_broker_stub_run,
+};
+
+/*
+ * Contexts
+ *
+ * Kept most recently used first. A miss opens a new context at the front,
+ * closing the least recently used one if there is no room. That is only
+ * closed once its replacement has opened, so a failed open loses nothing.
+ */
+static struct fdp1_broker_context *
+fdp1_broker_context_get(struct fdp1_broker * broker,
+			const struct fdp1_broker_msg * key)
+{
+	struct fdp1_broker_context * ctx = NULL;
+	unsigned int last = FDP1_BROKER_CONTEXTS - 1;
+	unsigned int i;
+
+	for (i = 0; i < FDP1_BROKER_CONTEXTS && broker->contexts[i]; i++) {
+		if (fdp1_broker_key_match(&broker->contexts[i]->key, key)) {
+			ctx = broker->contexts[i];
+			last = i;
+			break;
+		}
+	}
+
+	if (!ctx) {
+		ctx = broker->backend->open(broker->fdp1, key);
+		if (!ctx)
+			return NULL;
+
+		if (broker->contexts[last]) {
+			broker->backend->close(broker->contexts[last]);
+			broker->contexts[last] = NULL;
+		}
+
+		broker->contexts_opened++;
+		kprint(broker->fdp1, 1, "Opened context %ux%u %s %s\n",
+				key->width, key->height,
+				v4l2_field(key->field),
+				fdp1_deint_mode_str(key->mode));
+	}
+
+	memmove(&broker->contexts[1], &broker->contexts[0],
+		last * sizeof(broker->contexts[0]));
+	broker->contexts[0] = ctx;
+
+	return ctx;
+}
+
+/* Close a context which failed a job, as its queues are in an unknown state */
+static void fdp1_broker_context_drop(struct fdp1_broker * broker,
+				     struct fdp1_broker_context * ctx)
+{
+	unsigned int i;
+
+	for (i = 0; i < FDP1_BROKER_CONTEXTS; i++)
+		if (broker->contexts[i] == ctx)
+			break;
+
+	if (i == FDP1_BROKER_CONTEXTS)
+		return;
+
+	memmove(&broker->contexts[i], &broker->contexts[i + 1],
+		(FDP1_BROKER_CONTEXTS - i - 1) * sizeof(broker->contexts[0]));
+	broker->contexts[FDP1_BROKER_CONTEXTS - 1] = NULL;
+
+	broker->backend->close(ctx);
+}
+
+/*
+ * Messages
+ */
+static int fdp1_broker_send(int sock, const struct fdp1_broker_msg * msg,
+			    const int * fds, unsigned int n_fds)
+{
+	char control[CMSG_SPACE(2 * sizeof(int))];
+	struct iovec iov = {
+		.iov_base = (void *)msg,
+		.iov_len = sizeof(*msg),
+	};
+	struct msghdr hdr = {
+		.msg_iov = &iov,
+		.msg_iovlen = 1,
+	};
+
+	if (n_fds) {
+		struct cmsghdr * cmsg;
+
+		memzero(control);
+		hdr.msg_control = control;
+		hdr.msg_controllen = CMSG_SPACE(n_fds * sizeof(int));
+
+		cmsg = CMSG_FIRSTHDR(&hdr);
+		cmsg->cmsg_level = SOL_SOCKET;
+		cmsg->cmsg_type = SCM_RIGHTS;
+		cmsg->cmsg_len = CMSG_LEN(n_fds * sizeof(int));
+		memcpy(CMSG_DATA(cmsg), fds, n_fds * sizeof(int));
+	}
+
+	if (sendmsg(sock, &hdr, MSG_NOSIGNAL) != sizeof(*msg))
+		return -errno;
+
+	return 0;
+}
+
+/*
+ * Receive one message, and the descriptors it carries, without waiting.
+ * Returns its size, 0 once the client has gone, or a negative errno.
+ */
+static ssize_t fdp1_broker_recv(int sock, struct fdp1_broker_msg * msg,
+				int fds[2])
+{
+	char control[CMSG_SPACE(2 * sizeof(int))];
+	struct iovec iov = {
+		.iov_base = msg,
+		.iov_len = sizeof(*msg),
+	};
+	struct msghdr hdr = {
+		.msg_iov = &iov,
+		.msg_iovlen = 1,
+		.msg_control = control,
+		.msg_controllen = sizeof(control),
+	};
+	struct cmsghdr * cmsg;
+	ssize_t ret;
+
+	fds[0] = fds[1] = -1;
+
+	ret = recvmsg(sock, &hdr, MSG_DONTWAIT | MSG_CMSG_CLOEXEC);
+	if (ret < 0)
+		return -errno;
+
+	for (cmsg = CMSG_FIRSTHDR(&hdr); cmsg; cmsg = CMSG_NXTHDR(&hdr, cmsg)) {
+		unsigned int n;
+
+		if (cmsg->cmsg_level != SOL_SOCKET ||
+		    cmsg->cmsg_type != SCM_RIGHTS)
+			continue;
+
+		n = (cmsg->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+		memcpy(fds, CMSG_DATA(cmsg), (n < 2 ? n : 2) * sizeof(int));
+	}
+
+	if (hdr.msg_flags & (MSG_TRUNC | MSG_CTRUNC))
+		return -EMSGSIZE;
+
+	return ret;
+}
+
+static void fdp1_broker_respond(struct fdp1_broker * broker, int sock,
+				const struct fdp1_broker_msg * job,
+				uint32_t type, int status)
+{
+	struct fdp1_broker_msg reply = *job;
+
+	reply.type = type;
+	reply.status = status;
+
+	if (fdp1_broker_send(sock, &reply, NULL, 0))
+		kprint(broker->fdp1, 1, "Job %u: client gone\n", job->job);
+}
+
+static void fdp1_broker_close_fds(int fds[2])
+{
+	if (fds[0] >= 0)
+		close(fds[0]);
+	if (fds[1] >= 0)
+		close(fds[1]);
+}
+
+/* Admit, or refuse, each job the client has sent since we last looked */
+static int fdp1_broker_receive(struct fdp1_broker * broker, int sock)
+{
+	struct fdp1_broker_msg msg;
+	int fds[2];
+	ssize_t ret;
+
+	while ((ret = fdp1_broker_recv(sock, &msg, fds)) != -EAGAIN) {
+		struct fdp1_broker_job * job;
+
+		if (ret <= 0 && ret != -EMSGSIZE) {
+			fdp1_broker_close_fds(fds);
+			return ret;
+		}
+
+		if (ret != sizeof(msg) || msg.type != FDP1_BROKER_SUBMIT ||
+		    fds[0] < 0 || fds[1] < 0 ||
+		    fdp1_job_captures(msg.field, msg.mode) < 0) {
+			fdp1_broker_close_fds(fds);
+			fdp1_broker_respond(broker, sock, &msg,
+					    FDP1_BROKER_ERROR, -EINVAL);
+			broker->failed++;
+			continue;
+		}
+
+		if (broker->inflight >= broker->max_inflight) {
+			fdp1_broker_close_fds(fds);
+			fdp1_broker_respond(broker, sock, &msg,
+					    FDP1_BROKER_BUSY, -EBUSY);
+			broker->rejected++;
+			continue;
+		}
+
+		job = calloc(1, sizeof(*job));
+		if (!job) {
+			fdp1_broker_close_fds(fds);
+			fdp1_broker_respond(broker, sock, &msg,
+					    FDP1_BROKER_ERROR, -ENOMEM);
+			broker->failed++;
+			continue;
+		}
+
+		job->msg = msg;
+		job->sock = sock;
+		job->src_fd = fds[0];
+		job->dst_fd = fds[1];
+		job->received = fdp1_time_ns();
+
+		if (broker->tail)
+			broker->tail->next = job;
+		else
+			broker->queue = job;
+		broker->tail = job;
+		broker->inflight++;
+	}
+
+	return 0;
+}
+
+static void fdp1_broker_job_free(struct fdp1_broker * broker,
+				 struct fdp1_broker_job * job)
+{
+	close(job->src_fd);
+	close(job->dst_fd);
+	free(job);
+	broker->inflight--;
+}
+
+/* Map a job's buffer whole, returning its size through 'size' */
+static void * fdp1_broker_map(int fd, int prot, size_t * size)
+{
+	off_t end = lseek(fd, 0, SEEK_END);
+	void * mem;
+
+	if (end <= 0)
+		return NULL;
+
+	mem = mmap(NULL, end, prot, MAP_SHARED, fd, 0);
+	if (mem == MAP_FAILED)
+		return NULL;
+
+	*size = end;
+
+	return mem;
+}
+
+/*
+ * Bracket CPU access to a client's dmabuf, for its exporter's cache
+ * maintenance. Other shared memory (a memfd) has none to do.
+ */
+static int fdp1_broker_sync(int fd, uint64_t flags)
+{
+	struct dma_buf_sync sync = {
+		.flags = flags,
+	};
+
+	if (ioctl(fd, DMA_BUF_IOCTL_SYNC, &sync) && errno != ENOTTY)
+		return -errno;
+
+	return 0;
+}
+
+/*
+ * Run a job on its mapped buffers, in the context for it, with the CPU
+ * access to them synchronised. The context is returned through 'ctx', left
+ * NULL if the job failed before one was needed.
+ */
+static int fdp1_broker_run_job(struct fdp1_broker * broker,
+			       struct fdp1_broker_job * job,
+			       uint8_t * src, size_t src_size,
+			       uint8_t * dst, size_t dst_size,
+			       uint32_t * bytesused,
+			       struct fdp1_broker_context ** ctx)
+{
+	int ret;
+
+	ret = fdp1_broker_sync(job->src_fd,
+			       DMA_BUF_SYNC_START | DMA_BUF_SYNC_READ);
+	if (ret < 0)
+		return ret;
+
+	ret = fdp1_broker_sync(job->dst_fd,
+			       DMA_BUF_SYNC_START | DMA_BUF_SYNC_WRITE);
+	if (!ret) {
+		*ctx = fdp1_broker_context_get(broker, &job->msg);
+		if (!*ctx)
+			ret = -ENODEV;
+		else
+			ret = broker->backend->run(*ctx, src, src_size,
+						   dst, dst_size, bytesused);
+
+		fdp1_broker_sync(job->dst_fd,
+				 DMA_BUF_SYNC_END | DMA_BUF_SYNC_WRITE);
+	}
+
+	fdp1_broker_sync(job->src_fd, DMA_BUF_SYNC_END | DMA_BUF_SYNC_READ);
+
+	return ret;
+}
+
+/* Run the oldest job, and reply to it */
+static void fdp1_broker_process(struct fdp1_broker * broker)
+{
+	struct fdp1_broker_job * job = broker->queue;
+	struct fdp1_broker_context * ctx = NULL;
+	struct fdp1_broker_msg reply;
+	size_t src_size = 0, dst_size = 0;
+	uint8_t * src, * dst;
+	uint32_t bytesused = 0;
+	int ret;
+
+	broker->queue = job->next;
+	if (!broker->queue)
+		broker->tail = NULL;
+
+	src = fdp1_broker_map(job->src_fd, PROT_READ, &src_size);
+	dst = fdp1_broker_map(job->dst_fd, PROT_READ | PROT_WRITE, &dst_size);
+
+	/* A job which cannot be mapped is no reason to open a context */
+	if (!src || !dst)
+		ret = -EBADF;
+	else
+		ret = fdp1_broker_run_job(broker, job, src, src_size,
+					  dst, dst_size, &bytesused, &ctx);
+
+	if (src)
+		munmap(src, src_size);
+	if (dst)
+		munmap(dst, dst_size);
+
+	if (ret < 0) {
+		kprint(broker->fdp1, 0, "Job %u failed: %s\n",
+				job->msg.job, strerror(-ret));
+		/*
+		 * A dst too small is refused before anything is queued, but
+		 * any other failure may have left the context unusable.
+		 */
+		if (ctx && ret != -ENOSPC)
+			fdp1_broker_context_drop(broker, ctx);
+
+		fdp1_broker_respond(broker, job->sock, &job->msg,
+				    FDP1_BROKER_ERROR, ret);
+		broker->failed++;
+	} else {
+		reply = job->msg;
+		reply.type = FDP1_BROKER_COMPLETE;
+		reply.captures = ret;
+		reply.bytesused = bytesused;
+		reply.latency_ns = fdp1_time_ns() - job->received;
+
+		if (fdp1_broker_send(job->sock, &reply, NULL, 0))
+			kprint(broker->fdp1, 1, "Job %u: client gone\n",
+					job->msg.job);
+		broker->completed++;
+	}
+
+	fdp1_broker_job_free(broker, job);
+}
+
+/* Forget a client, along with the jobs it was still waiting for */
+static void fdp1_broker_disconnect(struct fdp1_broker * broker, unsigned int i)
+{
+	struct fdp1_broker_job ** link = &broker->queue;
+	int sock = broker->clients[i];
+
+	broker->tail = NULL;
+
+	while (*link) {
+		struct fdp1_broker_job * job = *link;
+
+		if (job->sock == sock) {
+			*link = job->next;
+			fdp1_broker_job_free(broker, job);
+			continue;
+		}
+
+		broker->tail = job;
+		link = &job->next;
+	}
+
+	close(sock);
+	broker->clients[i] = -1;
+}
+
+/*
+ * Server
+ */
+int fdp1_broker_init(struct fdp1_broker * broker,
+		     struct fdp1_context * fdp1,
+		     const struct fdp1_broker_backend * backend,
+		     const char * path,
+		     unsigned int max_inflight)
+{
+	struct sockaddr_un addr = { .sun_family = AF_UNIX };
+	unsigned int i;
+
+	memzero(*broker);
+
+	broker->fdp1 = fdp1;
+	broker->backend = backend;
+	broker->path = path;
+	broker->max_inflight = max_inflight;
+	broker->listen_fd = -1;
+
+	for (i = 0; i < FDP1_BROKER_CLIENTS; i++)
+		broker->clients[i] = -1;
+
+	if (strlen(path) >= sizeof(addr.sun_path))
+		return -ENAMETOOLONG;
+	strcpy(addr.sun_path, path);
+
+	broker->listen_fd = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0);
+	if (broker->listen_fd < 0) {
+		perror("socket");
+		return -errno;
+	}
+
+	/* A socket left behind by a broker which did not stop cleanly */
+	unlink(path);
+
+	if (bind(broker->listen_fd, (struct sockaddr *)&addr, sizeof(addr)) ||
+	    listen(broker->listen_fd, FDP1_BROKER_CLIENTS)) {
+		int ret = -errno;
+
+		perror(path);
+		close(broker->listen_fd);
+		broker->listen_fd = -1;
+		return ret;
+	}
+
+	kprint(fdp1, 1, "Listening on %s, %s backend, %u jobs in flight\n",
+			path, backend->name, max_inflight);
+
+	return 0;
+}
+
+static void fdp1_broker_accept(struct fdp1_broker * broker)
+{
+	unsigned int i;
+	int sock;
+
+	sock = accept4(broker->listen_fd, NULL, NULL, SOCK_CLOEXEC);
+	if (sock < 0)
+		return;
+
+	for (i = 0; i < FDP1_BROKER_CLIENTS; i++) {
+		if (broker->clients[i] < 0) {
+			broker->clients[i] = sock;
+			return;
+		}
+	}
+
+	kprint(broker->fdp1, 0, "Too many clients\n");
+	close(sock);
+}
+
+/*
+ * fdp1_broker_run
+ *
+ * Serve until '*stop' is set, by a signal handler for instance. Incoming
+ * jobs are taken in between each one processed, so that the clients hear
+ * they are busy as soon as they are.
+ */
+int fdp1_broker_run(struct fdp1_broker * broker, volatile int * stop)
+{
+	struct pollfd pfds[1 + FDP1_BROKER_CLIENTS];
+	unsigned int i;
+
+	while (!*stop) {
+		int ret;
+
+		pfds[0].fd = broker->listen_fd;
+		pfds[0].events = POLLIN;
+
+		for (i = 0; i < FDP1_BROKER_CLIENTS; i++) {
+			pfds[1 + i].fd = broker->clients[i];
+			pfds[1 + i].events = POLLIN;
+			pfds[1 + i].revents = 0;
+		}
+
+		ret = poll(pfds, ARRAY_SIZE(pfds), broker->queue ? 0 : -1);
+		if (ret < 0) {
+			if (errno == EINTR)
+				continue;
+
+			perror("poll");
+			return -errno;
+		}
+
+		for (i = 0; i < FDP1_BROKER_CLIENTS; i++) {
+			if (broker->clients[i] < 0 || !pfds[1 + i].revents)
+				continue;
+
+			if (fdp1_broker_receive(broker, broker->clients[i]) ||
+			    pfds[1 + i].revents & (POLLHUP | POLLERR))
+				fdp1_broker_disconnect(broker, i);
+		}
+
+		if (pfds[0].revents & POLLIN)
+			fdp1_broker_accept(broker);
+
+		if (broker->queue)
+			fdp1_broker_process(broker);
+	}
+
+	return 0;
+}
+
+void fdp1_broker_cleanup(struct fdp1_broker * broker)
+{
+	unsigned int i;
+
+	for (i = 0; i < FDP1_BROKER_CLIENTS; i++)
+		if (broker->clients[i] >= 0)
+			fdp1_broker_disconnect(broker, i);
+
+	for (i = 0; i < FDP1_BROKER_CONTEXTS; i++) {
+		if (broker->contexts[i])
+			broker->backend->close(broker->contexts[i]);
+		broker->contexts[i] = NULL;
+	}
+
+	if (broker->listen_fd >= 0) {
+		close(broker->listen_fd);
+		unlink(broker->path);
+		broker->listen_fd = -1;
+	}
+
+	kprint(broker->fdp1, 1, "%u completed, %u busy, %u failed, %u contexts opened\n",
+			broker->completed, broker->rejected, broker->failed,
+			broker->contexts_opened);
+}
+
+/*
+ * Clients
+ */
+int fdp1_broker_connect(const char * path)
+{
+	struct sockaddr_un addr = { .sun_family = AF_UNIX };
+	int sock;
+
+	if (strlen(path) >= sizeof(addr.sun_path))
+		return -ENAMETOOLONG;
+	strcpy(addr.sun_path, path);
+
+	sock = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0);
+	if (sock < 0)
+		return -errno;
+
+	if (connect(sock, (struct sockaddr *)&addr, sizeof(addr))) {
+		int ret = -errno;
+
+		close(sock);
+		return ret;
+	}
+
+	return sock;
+}
+
+/* An anonymous shared buffer of 'size' bytes, to pass to the broker */
+int fdp1_broker_memfd(const char * name, size_t size)
+{
+	int fd = memfd_create(name, MFD_CLOEXEC);
+
+	if (fd < 0)
+		return -errno;
+
+	if (ftruncate(fd, size)) {
+		int ret = -errno;
+
+		close(fd);
+		return ret;
+	}
+
+	return fd;
+}
+
+int fdp1_broker_submit(int sock, const struct fdp1_broker_msg * job,
+		       int src_fd, int dst_fd)
+{
+	struct fdp1_broker_msg msg = *job;
+	int fds[2] = { src_fd, dst_fd };
+
+	msg.type = FDP1_BROKER_SUBMIT;
+
+	return fdp1_broker_send(sock, &msg, fds, 2);
+}
+
+/* Wait for the reply to one of the jobs submitted */
+int fdp1_broker_reply(int sock, struct fdp1_broker_msg * reply)
+{
+	ssize_t ret = recv(sock, reply, sizeof(*reply), 0);
+
+	if (ret < 0)
+		return -errno;
+
+	if (ret != sizeof(*reply))
+		return -EPROTO;
+
+	return 0;
+}
@@ -0,0 +1,133 @@
+/*
+ * FDP1 Unit Test Utility
+ *      Author: Kieran Bingham
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by the
+ * Free Software Foundation; either version 2 of the License, or (at your
+ * option) any later version
+ */
+
+#ifndef _FDP1_BROKER_H_
+#define _FDP1_BROKER_H_
+
+/*
+ * FDP1 broker
+ *
+ * A long running process which owns the device on behalf of its clients.
+ * It keeps a few contexts open, each streaming with its pools allocated,
+ * for the formats most recently asked for, so a client pays neither for
+ * the setup of a context nor for fresh CMA allocations with each job.
+ *
+ * Clients connect to a SOCK_SEQPACKET Unix socket and send one SUBMIT
+ * message per job, carrying two file descriptors: the source frame and the
+ * destination for its captures, each a memfd or a dmabuf. The broker
+ * copies the source into a buffer of the context, processes it, copies each
+ * capture into the destination one after the other, and replies COMPLETE.
+ * A job beyond the admission limit is refused with BUSY straight away.
+ *
+ * Only modes without reference fields (progressive, and fixed 2D) are
+ * served, so that every job completes on its own.
+ */
+#define FDP1_BROKER_SOCKET	"/run/fdp1-broker.sock"
+#define FDP1_BROKER_CLIENTS	16
+#define FDP1_BROKER_CONTEXTS	4
+#define FDP1_BROKER_INFLIGHT	8
+
+enum fdp1_broker_msg_type {
+	FDP1_BROKER_SUBMIT = 1,
+	FDP1_BROKER_COMPLETE,
+	FDP1_BROKER_BUSY,
+	FDP1_BROKER_ERROR,
+};
+
+struct fdp1_broker_msg {
+	uint32_t type;
+	uint32_t job;		/* Chosen by the client, returned in the reply */
+
+	/* SUBMIT: what the source is, and what to make of it */
+	uint32_t out_fourcc;
+	uint32_t cap_fourcc;
+	uint32_t field;
+	uint32_t mode;
+	uint32_t width;
+	uint32_t height;
+
+	/* COMPLETE: captures written, each of 'bytesused' bytes */
+	uint32_t captures;
+	uint32_t bytesused;
+
+	/* ERROR: a negative errno */
+	int32_t status;
+	uint32_t reserved;
+
+	/* COMPLETE: from receipt of the job to its reply */
+	uint64_t latency_ns;
+};
+
+/*
+ * Backends
+ *
+ * The device backend processes jobs on the FDP1 through the helpers. The
+ * stub stands in for the device, so the broker and its clients can be
+ * tested anywhere: each capture is a copy of the source.
+ */
+struct fdp1_broker_context;
+
+struct fdp1_broker_backend {
+	char * name;
+
+	struct fdp1_broker_context * (*open)(struct fdp1_context * fdp1,
+					     const struct fdp1_broker_msg * key);
+	void (*close)(struct fdp1_broker_context * ctx);
+
+	/* Process 'src', writing the captures to 'dst', returning them */
+	int (*run)(struct fdp1_broker_context * ctx,
+		   const uint8_t * src, size_t src_size,
+		   uint8_t * dst, size_t dst_size,
+		   uint32_t * bytesused);
+};
+
+extern const struct fdp1_broker_backend fdp1_broker_device;
+extern const struct fdp1_broker_backend fdp1_broker_stub;
+
+struct fdp1_broker {
+	struct fdp1_context * fdp1;
+	const struct fdp1_broker_backend * backend;
+	const char * path;
+	unsigned int max_inflight;
+
+	int listen_fd;
+	int clients[FDP1_BROKER_CLIENTS];
+
+	/* Warm contexts, most recently used first */
+	struct fdp1_broker_context * contexts[FDP1_BROKER_CONTEXTS];
+
+	/* Jobs admitted and waiting, oldest first */
+	struct fdp1_broker_job * queue;
+	struct fdp1_broker_job * tail;
+	unsigned int inflight;
+
+	/* Totals, reported as the broker stops */
+	unsigned int completed;
+	unsigned int rejected;
+	unsigned int failed;
+	unsigned int contexts_opened;
+};
+
+int fdp1_broker_init(struct fdp1_broker * broker,
+		     struct fdp1_context * fdp1,
+		     const struct fdp1_broker_backend * backend,
+		     const char * path,
+		     unsigned int max_inflight);
+int fdp1_broker_run(struct fdp1_broker * broker, volatile int * stop);
+void fdp1_broker_cleanup(struct fdp1_broker * broker);
+
+/* Clients */
+int fdp1_broker_connect(const char * path);
+int fdp1_broker_memfd(const char * name, size_t size);
+int fdp1_broker_submit(int sock, const struct fdp1_broker_msg * job,
+		       int src_fd, int dst_fd);
+int fdp1_broker_reply(int sock, struct fdp1_broker_msg * reply);
+
+#endif /* _FDP1_BROKER_H_ */
@@ -0,0 +1,137 @@
+/*
+ * FDP1 Unit Test Utility
+ *      Author: Kieran Bingham
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by the
+ * Free Software Foundation; either version 2 of the License, or (at your
+ * option) any later version
+ */
+
+#include <signal.h>
+#include <limits.h>
+
+#include "fdp1-unit-test.h"
+#include "fdp1-broker.h"
+
+/* Options filled with defaults */
+static struct fdp1_context fdp1_ctx = {
+	.dev = 0,
+	.width = 128,
+	.height = 80,
+	.verbose = false,
+	.touch = 1,
+};
+
+static char * socket_path = FDP1_BROKER_SOCKET;
+static unsigned int max_inflight = FDP1_BROKER_INFLIGHT;
+static const struct fdp1_broker_backend * backend = &fdp1_broker_device;
+
+static volatile int stop;
+
+static void handle_stop(int sig)
+{
+	stop = 1;
+}
+
+void help(char ** argv, struct fdp1_context * fdp1)
+{
+	printf("%s: \n", fdp1->appname);
+	printf("--device/-d       :  Use device /dev/videoX (%d)\n", fdp1->dev);
+	printf("--socket/-s PATH  :  Listen on PATH [%s]\n", socket_path);
+	printf("--max-inflight/-m :  Jobs admitted before refusing more [%u]\n", max_inflight);
+	printf("--cache-hints/-c  :  Skip cache maintenance the CPU does not need\n");
+	printf("--stub/-S         :  Copy frames instead of using the device\n");
+	printf("--verbose/v       :  Verbose output [%d]\n", fdp1->verbose);
+	printf("--help/-?         :  Display this help\n");
+
+	printf("\n");
+}
+
+int process_arguments(int argc, char ** argv, struct fdp1_context * fdp1)
+{
+	char * end;
+	long n;
+	int option;
+
+	static struct option long_options[] = {
+		/*  { .name, .has_arg, .flag, .val } */
+		{"device",	required_argument,	0, 'd'},
+		{"socket",	required_argument,	0, 's'},
+		{"max-inflight", required_argument,	0, 'm'},
+		{"cache-hints",	no_argument,		0, 'c'},
+		{"stub",	no_argument,		0, 'S'},
+		{"verbose",	no_argument,		0, 'v'},
+		{"help",  	no_argument, 		0, '?'},
+		{0, 0, 0, 0}
+	};
+
+	while ((option = getopt_long(argc, argv, "d:s:m:cSv?",
+			long_options, NULL)) != -1) {
+
+		switch (option) {
+		case 'd':
+			fdp1->dev = atoi(optarg);
+			break;
+		case 's':
+			socket_path = optarg;
+			break;
+		case 'm':
+			n = strtol(optarg, &end, 10);
+			if (!*optarg || *end || n < 1 || n > INT_MAX) {
+				fprintf(stderr, "Invalid max-inflight '%s', must be at least 1\n",
+					optarg);
+				exit(1);
+			}
+			max_inflight = n;
+			break;
+		case 'c':
+			fdp1->cache_hints = 1;
+			break;
+		case 'S':
+			backend = &fdp1_broker_stub;
+			break;
+		case 'v':
+			fdp1->verbose++;
+			break;
+		default:
+		case '?':
+			help(argv, fdp1);
+			exit(0);
+			break;
+		}
+	}
+
+	return 0;
+}
+
+int main(int argc, char ** argv)
+{
+	struct fdp1_broker broker;
+	struct sigaction sa;
+	int ret;
+
+	char * searched = strrchr(argv[0], '/');
+	fdp1_ctx.appname = searched ? searched + 1 : argv[0];
+
+	process_arguments(argc, argv, &fdp1_ctx);
+
+	/* No SA_RESTART: the signal must interrupt the broker's poll() */
+	memzero(sa);
+	sa.sa_handler = handle_stop;
+	sigaction(SIGINT, &sa, NULL);
+	sigaction(SIGTERM, &sa, NULL);
+	signal(SIGPIPE, SIG_IGN);
+
+	ret = fdp1_broker_init(&broker, &fdp1_ctx, backend, socket_path,
+			       max_inflight);
+	if (!ret)
+		ret = fdp1_broker_run(&broker, &stop);
+
+	fdp1_broker_cleanup(&broker);
+
+	printf("%s: %u jobs completed, %u busy, %u failed\n", fdp1_ctx.appname,
+	       broker.completed, broker.rejected, broker.failed);
+
+	return ret ? 1 : 0;
+}
@@ -15,61 +15,145 @@
 #include "fdp1-unit-test.h"
 #include "fdp1-v4l2-helpers.h"
 #include "fdp1-buffer.h"
+#include "fdp1-perf.h"
 
-static char * content_string = "ABCDEFGHIJKLMNOPQRSTUVWXYZ1234567890";
+/*
+ * The fill content repeats every FDP1_FILL_PERIOD bytes. The pattern holds
+ * enough periods that a run of FDP1_FILL_RUN bytes, at any phase, can be
+ * copied or compared in one go.
+ */
+#define FDP1_FILL_PERIOD	32
+#define FDP1_FILL_RUN		256
+
+#define FDP1_FILL_CONTENT	"ABCDEFGHIJKLMNOPQRSTUVWXYZ123456"
 
-static char get_content_char(unsigned int n)
+static const char fdp1_fill_pattern[FDP1_FILL_PERIOD + FDP1_FILL_RUN] =
+	FDP1_FILL_CONTENT FDP1_FILL_CONTENT FDP1_FILL_CONTENT
+	FDP1_FILL_CONTENT FDP1_FILL_CONTENT FDP1_FILL_CONTENT
+	FDP1_FILL_CONTENT FDP1_FILL_CONTENT FDP1_FILL_CONTENT;
+
+static void fdp1_fill_line(char * p, unsigned int offset, unsigned int len)
 {
-	int pos = n % 32;
-	return content_string[pos];
+	while (len) {
+		unsigned int n = len < FDP1_FILL_RUN ? len : FDP1_FILL_RUN;
+
+		memcpy(p, fdp1_fill_pattern + offset % FDP1_FILL_PERIOD, n);
+
+		p += n;
+		offset += n;
+		len -= n;
+	}
 }
 
+/*
+ * fdp1_fill_buffer
+ *
+ * Write the fill content over the active pixels of each line, leaving the
+ * padding at the end of the lines untouched.
+ */
 void fdp1_fill_buffer(struct fdp1_v4l2_buffer * buffer)
 {
-	char * p;
-	int i, k;
+	struct fdp1_v4l2_plane_layout layout[3];
+	struct fdp1_perf_sample perf;
+	unsigned int n, i, y;
 
-	for (i=0; i < buffer->n_planes; i++) {
-		p = buffer->mem[i];
+	if (fdp1_v4l2_buffer_set_state(buffer, FDP1_BUF_FILLED))
+		return;
 
-		for (k = 0; k < buffer->sizes[i]; k++) {
-			*p++ = get_content_char(k);
-		}
+	fdp1_perf_begin(buffer->pool->perf, &perf);
+
+	n = fdp1_v4l2_buffer_layout(buffer, layout);
+	for (i = 0; i < n; i++) {
+		char * line = buffer->mem[layout[i].mem] + layout[i].offset;
+
+		for (y = 0; y < layout[i].lines; y++, line += layout[i].stride)
+			fdp1_fill_line(line, y * layout[i].bytes, layout[i].bytes);
 	}
+
+	fdp1_perf_end(buffer->pool->perf, FDP1_PERF_FILL, &perf);
 }
 
-void fdp1_clear_buffer(struct fdp1_v4l2_buffer * buffer)
+/*
+ * fdp1_fill_compare
+ *
+ * Compare 'len' bytes of a line against the content fdp1_fill_buffer()
+ * wrote there, starting 'offset' bytes into the active area of the plane as
+ * if its lines had no padding. The expected bytes depend only on that
+ * offset, so any part of a buffer can be checked without keeping a
+ * reference frame. Returns the number of bytes differing.
+ */
+unsigned int fdp1_fill_compare(const char * mem, unsigned int offset,
+			       unsigned int len)
 {
+	unsigned int mismatched = 0;
 	unsigned int i;
+
+	while (len) {
+		const char * expected = fdp1_fill_pattern + offset % FDP1_FILL_PERIOD;
+		unsigned int n = len < FDP1_FILL_RUN ? len : FDP1_FILL_RUN;
+
+		if (memcmp(mem, expected, n))
+			for (i = 0; i < n; i++)
+				mismatched += mem[i] != expected[i];
+
+		mem += n;
+		offset += n;
+		len -= n;
+	}
+
+	return mismatched;
+}
+
+void fdp1_clear_buffer(struct fdp1_v4l2_buffer * buffer)
+{
+	struct fdp1_v4l2_plane_layout layout[3];
+	struct fdp1_perf_sample perf;
+	unsigned int n, i, y;
+
+	if (fdp1_v4l2_buffer_set_state(buffer, FDP1_BUF_FILLED))
+		return;
+
+	fdp1_perf_begin(buffer->pool->perf, &perf);
+
 	/* White */
-	for (i = 0; i < buffer->n_planes; i++)
-		memset(buffer->mem[i], 255, buffer->sizes[i]);
+	n = fdp1_v4l2_buffer_layout(buffer, layout);
+	for (i = 0; i < n; i++) {
+		char * line = buffer->mem[layout[i].mem] + layout[i].offset;
+
+		for (y = 0; y < layout[i].lines; y++, line += layout[i].stride)
+			memset(line, 255, layout[i].bytes);
+	}
+
+	fdp1_perf_end(buffer->pool->perf, FDP1_PERF_CLEAR, &perf);
 }
 
-#if 0
-void fdp1_draw_frame(void *mem, unsigned int lines, char * pfx)
+/*
+ * fdp1_dump_buffer
+ *
+ * Print the active pixels of each line, as characters (which the fill
+ * content is), or in hex with --hexdump.
+ */
+void fdp1_dump_buffer(struct fdp1_context * fdp1,
+		      struct fdp1_v4l2_buffer * buffer, const char * pfx)
 {
-	unsigned int i, j;
-	unsigned int len = lines * width;
-	char * pos = (char*)mem;
-
-	printf("%s pos =%x\n", pfx, pos);
-
-	for(i = 0; i < lines; i++)
-	{
-		for(j = 0; j < width; j++)
-		{
-			if(isprint(*pos)) /* printable char */
-			{
-				putchar(*pos);
-			}
-			else /* other char */
-			{
-				putchar('.');
+	struct fdp1_v4l2_plane_layout layout[3];
+	unsigned int n, i, x, y;
+
+	n = fdp1_v4l2_buffer_layout(buffer, layout);
+	for (i = 0; i < n; i++) {
+		const char * line = buffer->mem[layout[i].mem] + layout[i].offset;
+
+		for (y = 0; y < layout[i].lines; y++, line += layout[i].stride) {
+			printf("%s[%u] %4u: ", pfx, i, y);
+
+			for (x = 0; x < layout[i].bytes; x++) {
+				if (fdp1->hex_not_draw)
+					printf("%02x", (unsigned char)line[x]);
+				else
+					putchar(isprint(line[x]) ? line[x] : '.');
 			}
-			pos++;
+
+			putchar('\n');
 		}
-		putchar('\n');
 	}
 }
-#endif
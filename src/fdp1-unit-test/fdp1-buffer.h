@@ -14,4 +14,10 @@
 void fdp1_fill_buffer(struct fdp1_v4l2_buffer * buffer);
 void fdp1_clear_buffer(struct fdp1_v4l2_buffer * buffer);
 
+unsigned int fdp1_fill_compare(const char * mem, unsigned int offset,
+			       unsigned int len);
+
+void fdp1_dump_buffer(struct fdp1_context * fdp1,
+		      struct fdp1_v4l2_buffer * buffer, const char * pfx);
+
 #endif /* _FDP1_BUFFER_H_ */
@@ -0,0 +1,928 @@
+/*
+ * FDP1 Unit Test Utility
+ *      Author: Kieran Bingham
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by the
+ * Free Software Foundation; either version 2 of the License, or (at your
+ * option) any later version
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <inttypes.h>
+#include <poll.h>
+#include <sys/timerfd.h>
+
+#include "fdp1-unit-test.h"
+#include "fdp1-v4l2-helpers.h"
+#include "fdp1-buffer.h"
+#include "fdp1-stats.h"
+#include "fdp1-synth.h"
+#include "fdp1-cadence.h"
+#include "fdp1-perf.h"
+
+/* How long to wait for the device before declaring it stalled */
+#define FDP1_CADENCE_TIMEOUT_MS 1000
+
+/* Modes which need the next field before processing the current one */
+#define FDP1_DEINT_MODE_USES_NEXT(mode)		\
+	((mode) == FDP1_ADAPT2D3D ||		\
+	 (mode) == FDP1_FIXED3D ||		\
+	 (mode) == FDP1_NEXTFIELD)
+
+/* Modes which keep the previous field as a reference */
+#define FDP1_DEINT_MODE_USES_PREV(mode)		\
+	((mode) == FDP1_ADAPT2D3D ||		\
+	 (mode) == FDP1_FIXED3D ||		\
+	 (mode) == FDP1_PREVFIELD)
+
+int fdp1_cadence_init(struct fdp1_cadence * cadence,
+		      enum v4l2_field field,
+		      enum fdp1_deint_mode mode)
+{
+	memzero(*cadence);
+
+	cadence->field = field;
+	cadence->mode = mode;
+	cadence->touch = 1;
+
+	switch (field) {
+	case V4L2_FIELD_NONE:
+		/* A progressive frame is processed as a single 'field' */
+		cadence->fields_per_buffer = 1;
+		return 0;
+	case V4L2_FIELD_TOP:
+	case V4L2_FIELD_BOTTOM:
+	case V4L2_FIELD_ALTERNATE:
+		cadence->fields_per_buffer = 1;
+		break;
+	case V4L2_FIELD_INTERLACED:
+	case V4L2_FIELD_INTERLACED_TB:
+	case V4L2_FIELD_INTERLACED_BT:
+	case V4L2_FIELD_SEQ_TB:
+	case V4L2_FIELD_SEQ_BT:
+		cadence->fields_per_buffer = 2;
+		break;
+	default:
+		return -EINVAL;
+	}
+
+	if (FDP1_DEINT_MODE_USES_NEXT(mode))
+		cadence->lookahead = 1;
+
+	if (FDP1_DEINT_MODE_USES_PREV(mode))
+		cadence->lookbehind = 1;
+
+	return 0;
+}
+
+/* The number of capture buffers produced once 'buffers' have been queued */
+unsigned int fdp1_cadence_captures(const struct fdp1_cadence * cadence,
+				   unsigned int buffers)
+{
+	unsigned int fields = buffers * cadence->fields_per_buffer;
+
+	if (fields <= cadence->lookahead)
+		return 0;
+
+	return fields - cadence->lookahead;
+}
+
+/*
+ * The number of output buffers returned once 'buffers' have been queued.
+ *
+ * A buffer is only returned when every one of its fields has been processed,
+ * and is no longer needed as a reference for a later field.
+ */
+unsigned int fdp1_cadence_released(const struct fdp1_cadence * cadence,
+				   unsigned int buffers)
+{
+	unsigned int processed = fdp1_cadence_captures(cadence, buffers);
+
+	if (processed <= cadence->lookbehind)
+		return 0;
+
+	return (processed - cadence->lookbehind) / cadence->fields_per_buffer;
+}
+
+/* The number of output buffers to queue before the first capture is ready */
+unsigned int fdp1_cadence_warmup(const struct fdp1_cadence * cadence)
+{
+	unsigned int fields = 1 + cadence->lookahead;
+
+	return (fields + cadence->fields_per_buffer - 1) /
+		cadence->fields_per_buffer;
+}
+
+void fdp1_cadence_describe(struct fdp1_context * fdp1,
+			   const struct fdp1_cadence * cadence)
+{
+	unsigned int n = MAX_BUFFER_POOL_SIZE;
+
+	kprint(fdp1, 1, "Cadence %s %s: %d capture(s) per buffer, "
+			"warm-up %d buffer(s), %d buffer(s) held, %d field(s) undrained\n",
+			v4l2_field(cadence->field),
+			fdp1_deint_mode_str(cadence->mode),
+			cadence->fields_per_buffer,
+			fdp1_cadence_warmup(cadence),
+			n - fdp1_cadence_released(cadence, n),
+			cadence->lookahead);
+
+	if (cadence->switch_period)
+		kprint(fdp1, 1, "Switching with %s every %d buffer(s), by %s\n",
+				fdp1_deint_mode_str(cadence->switch_mode),
+				cadence->switch_period,
+				cadence->requests ? "request" : "VIDIOC_S_CTRL");
+}
+
+/*
+ * Alternate with 'mode' every 'period' output buffers. The accounting of
+ * the cadence holds for both modes only if they keep the same fields.
+ */
+int fdp1_cadence_set_switch(struct fdp1_cadence * cadence,
+			    enum fdp1_deint_mode mode,
+			    unsigned int period)
+{
+	if (FDP1_DEINT_MODE_USES_NEXT(mode) != !!cadence->lookahead ||
+	    FDP1_DEINT_MODE_USES_PREV(mode) != !!cadence->lookbehind)
+		return -EINVAL;
+
+	cadence->switch_mode = mode;
+	cadence->switch_period = period;
+
+	return 0;
+}
+
+/* The deinterlacing mode of the n'th output buffer */
+enum fdp1_deint_mode fdp1_cadence_mode(const struct fdp1_cadence * cadence,
+				       unsigned int n)
+{
+	if (!cadence->switch_period || (n / cadence->switch_period) % 2 == 0)
+		return cadence->mode;
+
+	return cadence->switch_mode;
+}
+
+/* Does the CPU touch the n'th buffer */
+static bool fdp1_cadence_touches(const struct fdp1_cadence * cadence,
+				 unsigned int n)
+{
+	return cadence->touch && n % cadence->touch == 0;
+}
+
+/* Fill an output buffer with the n'th source */
+static int fdp1_cadence_fill(const struct fdp1_cadence * cadence,
+			     struct fdp1_v4l2_buffer * buffer, unsigned int n)
+{
+	if (cadence->synth)
+		return fdp1_synth_fill(cadence->synth, buffer, n) ? TEST_FAIL
+								   : TEST_PASS;
+
+	fdp1_fill_buffer(buffer);
+
+	return TEST_PASS;
+}
+
+static int fdp1_cadence_queue_output(struct fdp1_m2m * m2m,
+				     const struct fdp1_cadence * cadence,
+				     struct fdp1_v4l2_buffer * buffer,
+				     struct fdp1_cadence_stats * stats)
+{
+	enum fdp1_deint_mode mode = fdp1_cadence_mode(cadence, stats->submitted);
+	bool change = stats->submitted &&
+		mode != fdp1_cadence_mode(cadence, stats->submitted - 1);
+	unsigned int held;
+	int ret;
+
+	/* Every buffer has content from priming, untouched ones keep it */
+	if ((stats->submitted < m2m->src_queue.pool->qty ||
+	     fdp1_cadence_touches(cadence, stats->submitted)) &&
+	    fdp1_cadence_fill(cadence, buffer, stats->submitted))
+		return TEST_FAIL;
+
+	if (cadence->prepare && !buffer->prepared &&
+	    fdp1_v4l2_prepare_buffer(m2m->dev, buffer))
+		return TEST_FAIL;
+
+	if (cadence->requests) {
+		ret = fdp1_v4l2_queue_request(m2m->dev, buffer,
+				change ? V4L2_CID_DEINTERLACING_MODE : 0, mode);
+	} else {
+		if (change &&
+		    fdp1_m2m_set_ctrl(m2m, V4L2_CID_DEINTERLACING_MODE, mode))
+			return TEST_FAIL;
+
+		ret = fdp1_v4l2_queue_buffer(m2m->dev, buffer);
+	}
+
+	if (ret)
+		return TEST_FAIL;
+
+	stats->mode_switches += change;
+
+	/* As the driver will return it, to the microsecond */
+	stats->submit_ns[stats->submitted % FDP1_CADENCE_HISTORY] =
+		buffer->queued_at - buffer->queued_at % 1000;
+
+	stats->submitted++;
+
+	held = stats->submitted - stats->released;
+	if (held > stats->max_held)
+		stats->max_held = held;
+
+	return TEST_PASS;
+}
+
+static int fdp1_cadence_queue_capture(struct fdp1_m2m * m2m,
+				      const struct fdp1_cadence * cadence,
+				      struct fdp1_v4l2_buffer * buffer,
+				      struct fdp1_cadence_stats * stats)
+{
+	buffer->cpu_reads = fdp1_cadence_touches(cadence, stats->caps_queued);
+	if (buffer->cpu_reads)
+		fdp1_clear_buffer(buffer);
+
+	if (cadence->prepare && !buffer->prepared &&
+	    fdp1_v4l2_prepare_buffer(m2m->dev, buffer))
+		return TEST_FAIL;
+
+	if (fdp1_v4l2_queue_buffer(m2m->dev, buffer))
+		return TEST_FAIL;
+
+	stats->caps_queued++;
+
+	return TEST_PASS;
+}
+
+/*
+ * Identify a capture from its watermark, and check it is the field that
+ * should follow the previous capture. Returns the number of errors found.
+ */
+static int fdp1_cadence_check_capture(struct fdp1_context * fdp1,
+				      const struct fdp1_cadence * cadence,
+				      struct fdp1_v4l2_buffer * buffer,
+				      struct fdp1_cadence_stats * stats)
+{
+	struct fdp1_watermark_stats * wm = &stats->watermark;
+	unsigned int sequence = buffer->v4l2_buf.sequence;
+	/* A progressive frame spans the time of two fields */
+	unsigned int step = cadence->field == V4L2_FIELD_NONE ? 2 : 1;
+	unsigned int t, source;
+	int fail = 0;
+
+	if (stats->captured > 1 && sequence != wm->sequence + 1) {
+		kprint(fdp1, 0, "Capture sequence %u follows %u\n",
+				sequence, wm->sequence);
+		wm->sequence_errors++;
+		fail++;
+	}
+	wm->sequence = sequence;
+
+	/* A window of the source need not hold the watermark */
+	if (!cadence->decoder || cadence->crop.width || !buffer->cpu_reads)
+		return fail;
+
+	if (fdp1_synth_decode(cadence->decoder, buffer, wm->next, &t)) {
+		kprint(fdp1, 1, "Capture %u has no watermark\n", sequence);
+		wm->undecodable++;
+		return fail;
+	}
+
+	wm->decoded++;
+
+	if (t == wm->next) {
+		wm->next += step;
+	} else if ((int)(t - wm->next) > 0) {
+		kprint(fdp1, 0, "Capture %u is field %u, expected %u: %u dropped\n",
+				sequence, t, wm->next, (t - wm->next) / step);
+		wm->drops += (t - wm->next) / step;
+		wm->next = t + step;
+		fail++;
+	} else if (t + step == wm->next) {
+		kprint(fdp1, 0, "Capture %u repeats field %u\n", sequence, t);
+		wm->repeats++;
+		fail++;
+	} else {
+		kprint(fdp1, 0, "Capture %u is field %u, expected %u: reordered\n",
+				sequence, t, wm->next);
+		wm->reorders++;
+		fail++;
+	}
+
+	/* The driver copies the timestamp of the source buffer to its captures */
+	source = cadence->field == V4L2_FIELD_ALTERNATE ? t : t / 2;
+	if (source < stats->submitted &&
+	    stats->submitted - source <= FDP1_CADENCE_HISTORY &&
+	    fdp1_v4l2_buffer_timestamp(buffer) !=
+	    stats->submit_ns[source % FDP1_CADENCE_HISTORY]) {
+		kprint(fdp1, 0, "Capture %u of buffer %u has a foreign timestamp\n",
+				sequence, source);
+		wm->timestamp_errors++;
+		fail++;
+	}
+
+	return fail;
+}
+
+/*
+ * A paced source
+ *
+ * Each frame is due a period after the one before it, and arrives up to
+ * the jitter of the cadence later, though never ahead of the frame before
+ * it. The timer is armed for one arrival at a time. Frames wait in the
+ * backlog for an output buffer the driver has returned, and the drop
+ * policy of the cadence decides which is lost when the backlog is full.
+ */
+struct fdp1_pace {
+	int fd;			/* timerfd, or -1 when unpaced */
+	uint64_t period;
+	uint64_t start;
+	uint64_t due;		/* The arrival the timer is armed for */
+	unsigned int ticks;	/* Arrivals so far */
+	uint32_t seed;
+
+	uint64_t backlog[FDP1_PACE_BACKLOG];
+	unsigned int waiting;
+};
+
+/* xorshift32: cheap, and repeatable from run to run */
+static uint32_t fdp1_pace_random(struct fdp1_pace * pace)
+{
+	uint32_t x = pace->seed;
+
+	x ^= x << 13;
+	x ^= x >> 17;
+	x ^= x << 5;
+
+	return pace->seed = x;
+}
+
+static int fdp1_pace_arm(struct fdp1_pace * pace,
+			 const struct fdp1_cadence * cadence)
+{
+	struct itimerspec its;
+	uint64_t t = pace->start + pace->ticks * pace->period;
+
+	if (cadence->jitter)
+		t += fdp1_pace_random(pace) % (cadence->jitter + 1);
+
+	if (t < pace->due)
+		t = pace->due;
+
+	pace->due = t;
+
+	memzero(its);
+	its.it_value.tv_sec = t / 1000000000ULL;
+	its.it_value.tv_nsec = t % 1000000000ULL;
+
+	return timerfd_settime(pace->fd, TFD_TIMER_ABSTIME, &its, NULL);
+}
+
+static int fdp1_pace_start(struct fdp1_pace * pace,
+			   const struct fdp1_cadence * cadence)
+{
+	memzero(*pace);
+	pace->fd = -1;
+
+	if (!cadence->rate)
+		return 0;
+
+	pace->fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+	if (pace->fd < 0)
+		return -errno;
+
+	pace->period = 1000000000ULL / cadence->rate;
+	pace->start = fdp1_time_ns();
+	pace->seed = 0x2545f491;
+
+	return fdp1_pace_arm(pace, cadence) ? -errno : 0;
+}
+
+static void fdp1_pace_stop(struct fdp1_pace * pace)
+{
+	if (pace->fd >= 0)
+		close(pace->fd);
+
+	pace->fd = -1;
+}
+
+/* Take the frame which has waited longest from the backlog */
+static uint64_t fdp1_pace_pop(struct fdp1_pace * pace)
+{
+	uint64_t arrival = pace->backlog[0];
+
+	pace->waiting--;
+	memmove(&pace->backlog[0], &pace->backlog[1],
+		pace->waiting * sizeof(pace->backlog[0]));
+
+	return arrival;
+}
+
+static int fdp1_pace_queue(struct fdp1_m2m * m2m,
+			   const struct fdp1_cadence * cadence,
+			   struct fdp1_pace * pace,
+			   struct fdp1_v4l2_buffer * buffer,
+			   struct fdp1_cadence_stats * stats)
+{
+	stats->arrival_ns[stats->submitted % FDP1_CADENCE_HISTORY] =
+		fdp1_pace_pop(pace);
+
+	return fdp1_cadence_queue_output(m2m, cadence, buffer, stats);
+}
+
+/*
+ * The timer has fired: the frame it was armed for joins the backlog, and
+ * goes straight to the device if an output buffer is free. The timer is
+ * armed again until the backlog holds every buffer still to be queued.
+ */
+static int fdp1_pace_arrive(struct fdp1_m2m * m2m,
+			    const struct fdp1_cadence * cadence,
+			    struct fdp1_pace * pace,
+			    unsigned int num_buffers,
+			    struct fdp1_cadence_stats * stats)
+{
+	struct fdp1_v4l2_buffer_pool * pool = m2m->src_queue.pool;
+	uint64_t expirations;
+	unsigned int i;
+	int fail = 0;
+
+	if (read(pace->fd, &expirations, sizeof(expirations)) < 0)
+		return errno == EAGAIN ? TEST_PASS : TEST_FAIL;
+
+	stats->arrived++;
+	pace->ticks++;
+
+	if (pace->waiting == FDP1_PACE_BACKLOG) {
+		stats->dropped++;
+
+		if (cadence->drop == FDP1_DROP_OLDEST)
+			fdp1_pace_pop(pace);
+	}
+
+	if (pace->waiting < FDP1_PACE_BACKLOG)
+		pace->backlog[pace->waiting++] = pace->due;
+
+	/* Primed buffers are FILLED, those the driver has returned FREE */
+	for (i = 0; i < pool->qty && pace->waiting &&
+		    stats->submitted < num_buffers; i++)
+		if (pool->buffer[i].state == FDP1_BUF_FREE ||
+		    pool->buffer[i].state == FDP1_BUF_FILLED)
+			fail += fdp1_pace_queue(m2m, cadence, pace,
+						&pool->buffer[i], stats);
+
+	if (stats->submitted + pace->waiting < num_buffers &&
+	    fdp1_pace_arm(pace, cadence))
+		fail++;
+
+	return fail;
+}
+
+/* The latency of a paced capture, and whether it came back in time */
+static void fdp1_pace_capture(const struct fdp1_cadence * cadence,
+			      const struct fdp1_pace * pace,
+			      struct fdp1_v4l2_buffer * buffer,
+			      struct fdp1_cadence_stats * stats)
+{
+	unsigned int own = stats->captured / cadence->fields_per_buffer;
+	unsigned int last = (stats->captured + cadence->lookahead) /
+			    cadence->fields_per_buffer;
+
+	fdp1_latency_add(&stats->live_latency, buffer->dequeued_at -
+			 stats->arrival_ns[own % FDP1_CADENCE_HISTORY]);
+
+	if (buffer->dequeued_at >
+	    stats->arrival_ns[last % FDP1_CADENCE_HISTORY] + pace->period)
+		stats->late++;
+}
+
+/*
+ * fdp1_cadence_prime
+ *
+ * Queue as much work as the pools allow before streaming starts, limited
+ * to what the stream of 'num_buffers' output buffers will need.
+ */
+int fdp1_cadence_prime(struct fdp1_context * fdp1,
+		       struct fdp1_m2m * m2m,
+		       const struct fdp1_cadence * cadence,
+		       unsigned int num_buffers,
+		       struct fdp1_cadence_stats * stats)
+{
+	struct fdp1_v4l2_buffer_pool * src = m2m->src_queue.pool;
+	struct fdp1_v4l2_buffer_pool * dst = m2m->dst_queue.pool;
+	unsigned int captures = fdp1_cadence_captures(cadence, num_buffers);
+	unsigned int i;
+	int fail = 0;
+
+	memzero(*stats);
+
+	/*
+	 * A paced source queues its buffers as frames arrive, in whatever
+	 * order the driver returns them, so each starts with content.
+	 */
+	for (i = 0; i < src->qty && cadence->rate; i++)
+		fail += fdp1_cadence_fill(cadence, &src->buffer[i], i);
+
+	for (i = 0; i < src->qty && stats->submitted < num_buffers &&
+		    !cadence->rate; i++)
+		fail += fdp1_cadence_queue_output(m2m, cadence, &src->buffer[i], stats);
+
+	kprint(fdp1, 2, "Queued %d source (output) buffers\n", stats->submitted);
+
+	for (i = 0; i < dst->qty && stats->caps_queued < captures; i++)
+		fail += fdp1_cadence_queue_capture(m2m, cadence, &dst->buffer[i], stats);
+
+	kprint(fdp1, 2, "Queued %d dest (capture) buffers\n", stats->caps_queued);
+
+	return fail;
+}
+
+/*
+ * fdp1_cadence_run
+ *
+ * Keep both queues saturated until 'num_buffers' output buffers have been
+ * processed. Buffers are recycled as soon as the driver returns them rather
+ * than in lockstep, and each return is checked against the cadence: the
+ * driver must never produce more than the cadence allows for the buffers
+ * it has been given, and must produce everything it allows before stalling.
+ *
+ * A paced cadence queues each output buffer as its frame arrives instead,
+ * and accounts for the frames dropped, and the captures which came late.
+ */
+int fdp1_cadence_run(struct fdp1_context * fdp1,
+		     struct fdp1_m2m * m2m,
+		     const struct fdp1_cadence * cadence,
+		     unsigned int num_buffers,
+		     struct fdp1_cadence_stats * stats)
+{
+	unsigned int captures = fdp1_cadence_captures(cadence, num_buffers);
+	unsigned int released = fdp1_cadence_released(cadence, num_buffers);
+	struct fdp1_v4l2_buffer * buffer;
+	struct fdp1_pace pace;
+	unsigned int held;
+	unsigned int i;
+	int timeout;
+	int fail = 0;
+
+	stats->start = fdp1_time_ns();
+
+	if (fdp1_pace_start(&pace, cadence)) {
+		kprint(fdp1, 0, "Failed to start the pacing timer\n");
+		fdp1_pace_stop(&pace);
+		return TEST_FAIL;
+	}
+
+	/* A paced device may sit idle until the next frame arrives */
+	timeout = FDP1_CADENCE_TIMEOUT_MS +
+		  (pace.period + cadence->jitter) / 1000000;
+
+	while (stats->captured < captures || stats->released < released) {
+		struct pollfd pfd[2] = {
+			{ .fd = m2m->dev->fd, .events = POLLIN | POLLOUT },
+			{ .fd = pace.fd, .events = POLLIN },
+		};
+		struct fdp1_perf_sample perf;
+		int r;
+
+		fdp1_perf_begin(m2m->dev->perf, &perf);
+		r = poll(pfd, 2, timeout);
+		fdp1_perf_end(m2m->dev->perf, FDP1_PERF_WAIT, &perf);
+		if (r < 0) {
+			perror("poll");
+			fail++;
+			break;
+		}
+
+		if (r == 0 || !((pfd[0].revents & (POLLIN | POLLOUT)) ||
+				(pfd[1].revents & POLLIN))) {
+			kprint(fdp1, 0, "Stalled after %d buffers: "
+					"captured %d of %d, released %d of %d\n",
+					stats->submitted,
+					stats->captured,
+					fdp1_cadence_captures(cadence, stats->submitted),
+					stats->released,
+					fdp1_cadence_released(cadence, stats->submitted));
+			fail++;
+			break;
+		}
+
+		if (pfd[1].revents & POLLIN)
+			fail += fdp1_pace_arrive(m2m, cadence, &pace, num_buffers,
+						 stats);
+
+		if (pfd[0].revents & POLLOUT) {
+			buffer = fdp1_v4l2_dequeue_buffer(m2m->dev, &m2m->src_queue);
+			if (!buffer) {
+				fail++;
+				break;
+			}
+
+			stats->released++;
+
+			if (stats->released > fdp1_cadence_released(cadence, stats->submitted)) {
+				kprint(fdp1, 0, "Output buffer %d returned early (%d of %d)\n",
+						buffer->index, stats->released,
+						stats->submitted);
+				fail++;
+			}
+
+			if (stats->submitted >= num_buffers ||
+			    (cadence->rate && !pace.waiting))
+				fdp1_v4l2_buffer_release(buffer);
+			else if (cadence->rate)
+				fail += fdp1_pace_queue(m2m, cadence, &pace, buffer,
+							stats);
+			else
+				fail += fdp1_cadence_queue_output(m2m, cadence, buffer, stats);
+		}
+
+		if (pfd[0].revents & POLLIN) {
+			buffer = fdp1_v4l2_dequeue_buffer(m2m->dev, &m2m->dst_queue);
+			if (!buffer) {
+				fail++;
+				break;
+			}
+
+			if (!stats->captured)
+				stats->first_capture = fdp1_time_ns();
+
+			if (cadence->rate)
+				fdp1_pace_capture(cadence, &pace, buffer, stats);
+
+			stats->captured++;
+
+			fdp1_latency_add(&stats->latency, buffer->dequeued_at -
+					 fdp1_v4l2_buffer_timestamp(buffer));
+
+			if (buffer->bytesused == 0)
+				kprint(fdp1, 1, "Capture finished 0 bytes used\n");
+
+			fail += fdp1_cadence_check_capture(fdp1, cadence, buffer, stats);
+
+			if (stats->captured > fdp1_cadence_captures(cadence, stats->submitted)) {
+				kprint(fdp1, 0, "Unexpected capture %d from %d buffers\n",
+						stats->captured, stats->submitted);
+				fail++;
+			}
+
+			if (stats->caps_queued < captures)
+				fail += fdp1_cadence_queue_capture(m2m, cadence, buffer, stats);
+			else
+				fdp1_v4l2_buffer_release(buffer);
+
+			fdp1_perf_frame(fdp1);
+		}
+
+		if (fail)
+			break;
+	}
+
+	stats->elapsed = fdp1_time_ns() - stats->start;
+
+	fdp1_pace_stop(&pace);
+
+	/* A short paced stream leaves primed buffers it never queued */
+	for (i = 0; i < m2m->src_queue.pool->qty && cadence->rate; i++)
+		if (m2m->src_queue.pool->buffer[i].state == FDP1_BUF_FILLED)
+			fdp1_v4l2_buffer_release(&m2m->src_queue.pool->buffer[i]);
+
+	/* Whatever the cadence holds back must still be owned by the driver */
+	held = stats->submitted - stats->released;
+	if (fdp1_v4l2_pool_count(m2m->src_queue.pool, FDP1_BUF_QUEUED) != held) {
+		kprint(fdp1, 0, "Driver holds %d output buffers, expected %d\n",
+				fdp1_v4l2_pool_count(m2m->src_queue.pool, FDP1_BUF_QUEUED),
+				held);
+		fail++;
+	}
+
+	kprint(fdp1, 1, "%d buffers in, %d captures out in %" PRIu64 " us, "
+			"peak %d buffers held\n",
+			stats->submitted, stats->captured,
+			stats->elapsed / 1000, stats->max_held);
+
+	if (cadence->decoder)
+		kprint(fdp1, 1, "Watermarks: %u decoded, %u unreadable, %u dropped, "
+				"%u repeated, %u reordered, %u sequence and "
+				"%u timestamp errors\n",
+				stats->watermark.decoded, stats->watermark.undecodable,
+				stats->watermark.drops, stats->watermark.repeats,
+				stats->watermark.reorders,
+				stats->watermark.sequence_errors,
+				stats->watermark.timestamp_errors);
+
+	if (cadence->rate)
+		kprint(fdp1, 1, "Paced at %u/s: %u arrived, %u dropped, %u late, "
+				"latency %" PRIu64 " us avg, %" PRIu64 " us p99\n",
+				cadence->rate, stats->arrived, stats->dropped,
+				stats->late,
+				fdp1_latency_avg(&stats->live_latency) / 1000,
+				fdp1_latency_percentile(&stats->live_latency, 99) / 1000);
+
+	return fail;
+}
+
+/*
+ * fdp1_cadence_setup
+ *
+ * Initialise a cadence for the given formats, field layout and deinterlace
+ * mode, with the content and buffer handling chosen by the options.
+ */
+int fdp1_cadence_setup(struct fdp1_context * fdp1,
+		       struct fdp1_cadence * cadence,
+		       uint32_t out_fourcc,
+		       enum v4l2_field field,
+		       enum fdp1_deint_mode mode,
+		       uint32_t cap_fourcc)
+{
+	if (fdp1_cadence_init(cadence, field, mode)) {
+		kprint(fdp1, 1, "Unsupported field layout %s\n", v4l2_field(field));
+		return TEST_FAIL;
+	}
+
+	cadence->out_fourcc = out_fourcc;
+	cadence->cap_fourcc = cap_fourcc;
+
+	/*
+	 * Content with real motion rather than static text, and watermarked
+	 * so every capture can be traced back to the field it came from.
+	 */
+	cadence->touch = fdp1->touch;
+	cadence->prepare = fdp1->prepare_buffers;
+	cadence->rate = fdp1->rate;
+	cadence->jitter = fdp1->jitter * 1000ULL;
+	cadence->drop = fdp1->drop_oldest ? FDP1_DROP_OLDEST : FDP1_DROP_NEWEST;
+	cadence->synth = fdp1_synth_get(fdp1, out_fourcc, field);
+
+	/* Sources which are not refilled would repeat their watermarks */
+	if (cadence->synth && cadence->touch == 1)
+		cadence->decoder = fdp1_synth_get(fdp1, cap_fourcc, V4L2_FIELD_NONE);
+
+	return TEST_PASS;
+}
+
+/* Narrow a context to the windows of a cadence, if it has any */
+static int fdp1_cadence_select(struct fdp1_context * fdp1,
+			       struct fdp1_m2m * m2m,
+			       const struct fdp1_cadence * cadence)
+{
+	struct v4l2_rect crop = cadence->crop;
+	struct v4l2_rect compose = cadence->compose;
+
+	if (crop.width &&
+	    fdp1_m2m_set_selection(m2m, V4L2_BUF_TYPE_VIDEO_OUTPUT_MPLANE,
+				   V4L2_SEL_TGT_CROP, &crop)) {
+		kprint(fdp1, 0, "Failed to crop the source to %ux%u\n",
+				cadence->crop.width, cadence->crop.height);
+		return TEST_FAIL;
+	}
+
+	if (compose.width &&
+	    fdp1_m2m_set_selection(m2m, V4L2_BUF_TYPE_VIDEO_CAPTURE_MPLANE,
+				   V4L2_SEL_TGT_COMPOSE, &compose)) {
+		kprint(fdp1, 0, "Failed to compose the capture to %ux%u\n",
+				cadence->compose.width, cadence->compose.height);
+		return TEST_FAIL;
+	}
+
+	kprint(fdp1, 1, "Cropped %ux%u@%u,%u, composed %ux%u@%u,%u\n",
+			m2m->crop.width, m2m->crop.height,
+			m2m->crop.left, m2m->crop.top,
+			m2m->compose.width, m2m->compose.height,
+			m2m->compose.left, m2m->compose.top);
+
+	return TEST_PASS;
+}
+
+/*
+ * fdp1_cadence_execute
+ *
+ * Create a context for a cadence, and run fdp1->num_frames output buffers
+ * through it.
+ */
+int fdp1_cadence_execute(struct fdp1_context * fdp1,
+			 const struct fdp1_cadence * cadence,
+			 struct fdp1_cadence_stats * stats)
+{
+	struct fdp1_m2m * m2m;
+	enum fdp1_deint_mode current_mode;
+	enum v4l2_field field = cadence->field;
+	enum fdp1_deint_mode mode = cadence->mode;
+	unsigned int min_cap_bufs = 0;
+	unsigned int min_output_bufs = 0;
+	int fail = 0;
+
+	fdp1_cadence_describe(fdp1, cadence);
+
+	m2m = fdp1_create_m2m(fdp1, cadence->out_fourcc, field,
+			      cadence->cap_fourcc);
+	if (!m2m) {
+		kprint(fdp1, 0, "Failed to create an M2M object\n");
+		return TEST_FAIL;
+	}
+
+	if (cadence->requests &&
+	    !fdp1_v4l2_pool_requests(m2m->dev, m2m->src_queue.pool)) {
+		kprint(fdp1, 0, "Output queue does not support requests\n");
+		fdp1_free_m2m(m2m);
+		return TEST_FAIL;
+	}
+
+	if (fdp1_cadence_select(fdp1, m2m, cadence)) {
+		fdp1_free_m2m(m2m);
+		return TEST_FAIL;
+	}
+
+	fdp1_m2m_get_ctrl(m2m, V4L2_CID_MIN_BUFFERS_FOR_OUTPUT, (int*)&min_output_bufs);
+	kprint(fdp1, 1, "+++++++ V4L2_CID_MIN_BUFFERS_FOR_OUTPUT %d\n", min_output_bufs);
+
+	fdp1_m2m_get_ctrl(m2m, V4L2_CID_MIN_BUFFERS_FOR_CAPTURE, (int*)&min_cap_bufs);
+	kprint(fdp1, 1, "+++++++ MIN_BUFFERS_FOR_CAPTURE %d\n", min_cap_bufs);
+
+	/* Reset after (known) invalid MIN_BUFFERS_FOR_OUTPUT ctrl */
+	errno = 0;
+
+	fail += fdp1_cadence_prime(fdp1, m2m, cadence, fdp1->num_frames, stats);
+
+	if (field != V4L2_FIELD_NONE &&
+	    fdp1_m2m_set_ctrl(m2m, V4L2_CID_DEINTERLACING_MODE, mode)) {
+		kprint(fdp1, 1, "Failed to set DEINT MODE\n");
+		fail++;
+		fdp1_free_m2m(m2m);
+		return fail;
+	}
+
+	if (fdp1_m2m_stream_on(m2m, V4L2_BUF_TYPE_VIDEO_OUTPUT_MPLANE)) {
+		kprint(fdp1, 1, "Failed to stream on OUTPUT\n");
+		fail++;
+	}
+
+	if (fdp1_m2m_stream_on(m2m, V4L2_BUF_TYPE_VIDEO_CAPTURE_MPLANE)) {
+		kprint(fdp1, 1, "Failed to stream on CAPTURE\n");
+		fail++;
+	}
+
+	if (fail) {
+		kprint(fdp1, 1, "Failed to establish streaming starting criteria\n");
+		fdp1_free_m2m(m2m);
+		return fail;
+	}
+
+	/* Deint mode is only set when stream on is called.
+	 * We can only 'verify' after we start streaming...
+	 * unless a request may already have moved it on.
+	 */
+	if (field != V4L2_FIELD_NONE && !cadence->switch_period) {
+		if (fdp1_m2m_get_ctrl(m2m, V4L2_CID_DEINTERLACING_MODE,
+				      (int*)&current_mode)) {
+			kprint(fdp1, 1, "Failed to get DEINT MODE\n");
+			fail++;
+			fdp1_free_m2m(m2m);
+			return fail;
+		}
+
+		if (current_mode != mode) {
+			kprint(fdp1, 1, "********* Fail++ Deint mode is not as expected. %d != %d\n",
+					current_mode, mode);
+			fail++;
+			fdp1_free_m2m(m2m);
+			return fail;
+		}
+	}
+
+	if (fdp1_cadence_run(fdp1, m2m, cadence, fdp1->num_frames, stats)) {
+		kprint(fdp1, 1, "process frame operation failed\n");
+		fail++;
+	}
+
+	/* How many buffers did this mode really keep in the driver */
+	fdp1_v4l2_pool_report(fdp1, m2m->src_queue.pool);
+	fdp1_v4l2_pool_report(fdp1, m2m->dst_queue.pool);
+
+	fdp1_perf_report(fdp1);
+
+	fail += fdp1_free_m2m(m2m);
+
+	return fail;
+}
+
+/*
+ * fdp1_cadence_stream
+ *
+ * Create a context for the given formats, field layout and deinterlace
+ * mode, and run fdp1->num_frames output buffers through it.
+ */
+int fdp1_cadence_stream(struct fdp1_context * fdp1,
+			uint32_t out_fourcc,
+			enum v4l2_field field,
+			enum fdp1_deint_mode mode,
+			uint32_t cap_fourcc,
+			struct fdp1_cadence_stats * stats)
+{
+	struct fdp1_cadence cadence;
+
+	if (fdp1_cadence_setup(fdp1, &cadence, out_fourcc, field, mode,
+			       cap_fourcc))
+		return TEST_FAIL;
+
+	return fdp1_cadence_execute(fdp1, &cadence, stats);
+}
@@ -0,0 +1,189 @@
+/*
+ * FDP1 Unit Test Utility
+ *      Author: Kieran Bingham
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by the
+ * Free Software Foundation; either version 2 of the License, or (at your
+ * option) any later version
+ */
+
+#ifndef _FDP1_CADENCE_H_
+#define _FDP1_CADENCE_H_
+
+/*
+ * What a paced source does with a frame which arrives to a full backlog,
+ * when the device has every output buffer and more are waiting for one.
+ */
+enum fdp1_drop_policy {
+	FDP1_DROP_NEWEST = 0,	/* The frame arriving is lost */
+	FDP1_DROP_OLDEST,	/* The frame waiting longest is lost instead */
+};
+
+/* Frames a paced source holds while every output buffer is in use */
+#define FDP1_PACE_BACKLOG	2
+
+/*
+ * A cadence describes how the driver consumes output (source) buffers and
+ * produces capture buffers for a given field layout and deinterlace mode.
+ *
+ * Every field of an output buffer produces one capture buffer, but only
+ * once the fields it depends on are available. The fields following the
+ * current one must have been queued (lookahead), and the fields before it
+ * are retained by the driver as references (lookbehind).
+ */
+struct fdp1_cadence {
+	uint32_t out_fourcc;
+	uint32_t cap_fourcc;
+	enum v4l2_field field;
+	enum fdp1_deint_mode mode;
+
+	unsigned int fields_per_buffer;
+	unsigned int lookahead;
+	unsigned int lookbehind;
+
+	/* Content for the output buffers, or NULL for fdp1_fill_buffer() */
+	struct fdp1_synth * synth;
+
+	/* Reads the watermark of the synth content back from the captures */
+	struct fdp1_synth * decoder;
+
+	/*
+	 * The CPU writes every Nth output buffer, and reads every Nth capture
+	 * (always once for 1, never after priming for 0). Untouched buffers
+	 * are requeued as they are, and need no cache maintenance.
+	 */
+	unsigned int touch;
+
+	/* Validate buffers with VIDIOC_PREPARE_BUF before queueing them */
+	bool prepare;
+
+	/*
+	 * Alternate between 'mode' and 'switch_mode' every 'switch_period'
+	 * output buffers, without stopping. With 'requests', each change
+	 * travels in a media request with the first buffer it applies to.
+	 * Otherwise it is set as that buffer is queued, and the driver picks
+	 * it up whenever it next reads the control.
+	 */
+	enum fdp1_deint_mode switch_mode;
+	unsigned int switch_period;
+	bool requests;
+	/*
+	 * Process only the 'crop' window of each source, into the 'compose'
+	 * window of each capture. Either is the whole frame while empty.
+	 */
+	struct v4l2_rect crop;
+	struct v4l2_rect compose;
+
+	/*
+	 * Pace the source as a live feed of 'rate' output buffers a second,
+	 * each arriving on a timer up to 'jitter' ns after it is due, rather
+	 * than as fast as the device returns them. 0 is unpaced.
+	 */
+	unsigned int rate;
+	uint64_t jitter;
+	enum fdp1_drop_policy drop;
+};
+
+/* Submit times kept to check the timestamps copied to the captures */
+#define FDP1_CADENCE_HISTORY	64
+
+/*
+ * The identity of each capture, as read from its watermark, against the
+ * field that should have come next, the capture sequence number, and the
+ * timestamp of the output buffer it came from.
+ */
+struct fdp1_watermark_stats {
+	unsigned int decoded;
+	unsigned int undecodable;
+	unsigned int drops;		/* Fields skipped over */
+	unsigned int repeats;		/* The previous field again */
+	unsigned int reorders;		/* A field from further back */
+	unsigned int sequence_errors;	/* Capture sequence not consecutive */
+	unsigned int timestamp_errors;	/* Not the timestamp of its source */
+
+	unsigned int next;		/* The field time expected next */
+	unsigned int sequence;		/* The last capture sequence number */
+};
+
+struct fdp1_cadence_stats {
+	unsigned int submitted;		/* Output buffers queued */
+	unsigned int released;		/* Output buffers returned to us */
+	unsigned int caps_queued;	/* Capture buffers queued */
+	unsigned int captured;		/* Capture buffers returned to us */
+	unsigned int max_held;		/* Peak output buffers in the driver */
+	unsigned int mode_switches;
+
+	uint64_t start;
+	uint64_t first_capture;
+	uint64_t elapsed;
+
+	/* From queueing an output buffer, to dequeueing each capture of it */
+	struct fdp1_latency latency;
+
+	uint64_t submit_ns[FDP1_CADENCE_HISTORY];
+	struct fdp1_watermark_stats watermark;
+
+	/*
+	 * Paced streams only. A capture is late if it comes back more than a
+	 * frame period after the last source it needs arrived. Its latency
+	 * runs from the arrival of its own source, through any wait for a
+	 * free output buffer.
+	 */
+	unsigned int arrived;
+	unsigned int dropped;
+	unsigned int late;
+	struct fdp1_latency live_latency;
+	uint64_t arrival_ns[FDP1_CADENCE_HISTORY];
+};
+
+int fdp1_cadence_init(struct fdp1_cadence * cadence,
+		      enum v4l2_field field,
+		      enum fdp1_deint_mode mode);
+
+unsigned int fdp1_cadence_captures(const struct fdp1_cadence * cadence,
+				   unsigned int buffers);
+unsigned int fdp1_cadence_released(const struct fdp1_cadence * cadence,
+				   unsigned int buffers);
+unsigned int fdp1_cadence_warmup(const struct fdp1_cadence * cadence);
+
+int fdp1_cadence_set_switch(struct fdp1_cadence * cadence,
+			    enum fdp1_deint_mode mode,
+			    unsigned int period);
+enum fdp1_deint_mode fdp1_cadence_mode(const struct fdp1_cadence * cadence,
+				       unsigned int n);
+
+void fdp1_cadence_describe(struct fdp1_context * fdp1,
+			   const struct fdp1_cadence * cadence);
+
+int fdp1_cadence_prime(struct fdp1_context * fdp1,
+		       struct fdp1_m2m * m2m,
+		       const struct fdp1_cadence * cadence,
+		       unsigned int num_buffers,
+		       struct fdp1_cadence_stats * stats);
+
+int fdp1_cadence_run(struct fdp1_context * fdp1,
+		     struct fdp1_m2m * m2m,
+		     const struct fdp1_cadence * cadence,
+		     unsigned int num_buffers,
+		     struct fdp1_cadence_stats * stats);
+
+int fdp1_cadence_setup(struct fdp1_context * fdp1,
+		       struct fdp1_cadence * cadence,
+		       uint32_t out_fourcc,
+		       enum v4l2_field field,
+		       enum fdp1_deint_mode mode,
+		       uint32_t cap_fourcc);
+
+int fdp1_cadence_execute(struct fdp1_context * fdp1,
+			 const struct fdp1_cadence * cadence,
+			 struct fdp1_cadence_stats * stats);
+
+int fdp1_cadence_stream(struct fdp1_context * fdp1,
+			uint32_t out_fourcc,
+			enum v4l2_field field,
+			enum fdp1_deint_mode mode,
+			uint32_t cap_fourcc,
+			struct fdp1_cadence_stats * stats);
+
+#endif /* _FDP1_CADENCE_H_ */
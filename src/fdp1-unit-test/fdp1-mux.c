@@ -0,0 +1,440 @@
+/*
+ * FDP1 Unit Test Utility
+ *      Author: Kieran Bingham
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by the
+ * Free Software Foundation; either version 2 of the License, or (at your
+ * option) any later version
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <poll.h>
+
+#include <linux/videodev2.h>
+
+#include "fdp1-unit-test.h"
+#include "fdp1-v4l2-helpers.h"
+#include "fdp1-buffer.h"
+#include "fdp1-stats.h"
+#include "fdp1-mux.h"
+#include "fdp1.h"
+
+/* How long the device may keep every stream waiting before we give up */
+#define FDP1_MUX_TIMEOUT_MS	1000
+
+/*
+ * fdp1_mux_add
+ *
+ * Add a stream of 'width' x 'height' frames of 'field' layout, processed in
+ * 'mode', arriving every 'period' ns, and due 'latency' ns after each one
+ * arrives. Returns the stream, to adjust before fdp1_mux_open(), or NULL
+ * once the multiplexer is full.
+ */
+struct fdp1_mux_stream *
+fdp1_mux_add(struct fdp1_mux * mux, const char * name,
+	     unsigned int width, unsigned int height,
+	     enum v4l2_field field, enum fdp1_deint_mode mode,
+	     uint64_t period, uint64_t latency)
+{
+	struct fdp1_mux_stream * s;
+
+	if (mux->n_streams == FDP1_MUX_MAX_STREAMS)
+		return NULL;
+
+	s = &mux->stream[mux->n_streams++];
+	memzero(*s);
+
+	s->name = name;
+	s->width = width;
+	s->height = height;
+	s->field = field;
+	s->mode = mode;
+	s->period = period;
+	s->latency = latency;
+	s->depth = 1;
+
+	fdp1_latency_reset(&s->stats.latency);
+	fdp1_latency_reset(&s->stats.service);
+
+	return s;
+}
+
+static struct fdp1_mux_frame * fdp1_mux_frame(struct fdp1_mux_stream * s,
+					      unsigned int n)
+{
+	return &s->frame[(s->head + n) % FDP1_MUX_BACKLOG];
+}
+
+/*
+ * fdp1_mux_arrive
+ *
+ * Add every frame which has arrived by 'now' to the backlog of its stream.
+ * A flooding stream always has a full backlog, each frame arriving as it
+ * is added; a periodic stream drops the frames it has no room for.
+ */
+void fdp1_mux_arrive(struct fdp1_mux * mux, uint64_t now)
+{
+	unsigned int i;
+
+	for (i = 0; i < mux->n_streams; i++) {
+		struct fdp1_mux_stream * s = &mux->stream[i];
+
+		while (s->next_arrival <= now) {
+			unsigned int held = s->queued + s->waiting;
+			struct fdp1_mux_frame * f;
+
+			if (held == FDP1_MUX_BACKLOG && !s->period)
+				break;
+
+			s->stats.arrived++;
+
+			if (held == FDP1_MUX_BACKLOG) {
+				s->stats.dropped++;
+			} else {
+				f = fdp1_mux_frame(s, held);
+				f->arrival = s->period ? s->next_arrival : now;
+				f->deadline = f->arrival + s->latency;
+				f->returned = false;
+				f->captured = 0;
+				s->waiting++;
+			}
+
+			s->next_arrival += s->period;
+		}
+	}
+}
+
+/*
+ * fdp1_mux_pick
+ *
+ * The stream whose first waiting frame should be queued next, or NULL if
+ * none may be. With FDP1_MUX_EDF, that is the earliest deadline of those
+ * streams with room under their depth, while the device has room under
+ * 'inflight'. With FDP1_MUX_KERNEL, any stream with room goes, and the
+ * kernel decides.
+ */
+struct fdp1_mux_stream * fdp1_mux_pick(struct fdp1_mux * mux)
+{
+	struct fdp1_mux_stream * best = NULL;
+	uint64_t deadline = 0;
+	unsigned int i;
+
+	if (mux->policy == FDP1_MUX_EDF && mux->queued >= mux->inflight)
+		return NULL;
+
+	for (i = 0; i < mux->n_streams; i++) {
+		struct fdp1_mux_stream * s = &mux->stream[i];
+		struct fdp1_mux_frame * f;
+
+		if (!s->waiting || s->queued >= s->depth)
+			continue;
+
+		f = fdp1_mux_frame(s, s->queued);
+		if (!best || f->deadline < deadline) {
+			best = s;
+			deadline = f->deadline;
+		}
+	}
+
+	return best;
+}
+
+/*
+ * fdp1_mux_open
+ *
+ * Create and start a context for each stream, its output buffers filled
+ * once and queued as they are from then on. The depth of each stream is
+ * limited to the frames its buffers can hold, and is all of them for
+ * FDP1_MUX_KERNEL.
+ */
+int fdp1_mux_open(struct fdp1_context * fdp1, struct fdp1_mux * mux)
+{
+	unsigned int i, b;
+	int fail = 0;
+
+	for (i = 0; i < mux->n_streams && !fail; i++) {
+		struct fdp1_mux_stream * s = &mux->stream[i];
+		struct fdp1_context ctx = *fdp1;
+		struct fdp1_v4l2_buffer_pool * pool;
+		int captures = fdp1_job_captures(s->field, s->mode);
+		unsigned int fits;
+
+		if (captures < 0) {
+			kprint(fdp1, 0, "%s: %s in %s needs fields of other frames\n",
+					s->name, v4l2_field(s->field),
+					fdp1_deint_mode_str(s->mode));
+			fail++;
+			break;
+		}
+
+		s->captures = captures;
+
+		ctx.width = s->width;
+		ctx.height = s->height;
+
+		s->m2m = fdp1_create_m2m(&ctx, V4L2_PIX_FMT_YUYV, s->field,
+					 V4L2_PIX_FMT_YUYV);
+		if (!s->m2m) {
+			kprint(fdp1, 0, "Failed to create a context for %s\n",
+					s->name);
+			fail++;
+			break;
+		}
+
+		pool = s->m2m->src_queue.pool;
+		for (b = 0; b < pool->qty; b++)
+			fdp1_fill_buffer(&pool->buffer[b]);
+
+		fits = s->m2m->dst_queue.pool->qty / s->captures;
+		if (fits > pool->qty)
+			fits = pool->qty;
+
+		if (mux->policy == FDP1_MUX_KERNEL || s->depth > fits)
+			s->depth = fits;
+
+		if (!s->depth)
+			fail++;
+
+		if (s->field != V4L2_FIELD_NONE &&
+		    fdp1_m2m_set_ctrl(s->m2m, V4L2_CID_DEINTERLACING_MODE, s->mode))
+			fail++;
+
+		fail += !!fdp1_m2m_stream_on(s->m2m, V4L2_BUF_TYPE_VIDEO_OUTPUT_MPLANE);
+		fail += !!fdp1_m2m_stream_on(s->m2m, V4L2_BUF_TYPE_VIDEO_CAPTURE_MPLANE);
+	}
+
+	if (fail)
+		fdp1_mux_close(mux);
+
+	return fail;
+}
+
+void fdp1_mux_close(struct fdp1_mux * mux)
+{
+	unsigned int i;
+
+	for (i = 0; i < mux->n_streams; i++) {
+		fdp1_free_m2m(mux->stream[i].m2m);
+		mux->stream[i].m2m = NULL;
+	}
+}
+
+static struct fdp1_v4l2_buffer *
+fdp1_mux_free_buffer(struct fdp1_v4l2_buffer_pool * pool)
+{
+	unsigned int i;
+
+	for (i = 0; i < pool->qty; i++)
+		if (pool->buffer[i].state == FDP1_BUF_FREE)
+			return &pool->buffer[i];
+
+	return NULL;
+}
+
+/* Queue the first waiting frame of a stream, and the captures it needs */
+static int fdp1_mux_dispatch(struct fdp1_mux * mux, struct fdp1_mux_stream * s)
+{
+	struct fdp1_m2m * m2m = s->m2m;
+	struct fdp1_v4l2_buffer * buffer;
+	unsigned int c;
+
+	for (c = 0; c < s->captures; c++) {
+		buffer = fdp1_mux_free_buffer(m2m->dst_queue.pool);
+		if (!buffer)
+			return -ENOBUFS;
+
+		if (fdp1_v4l2_queue_buffer(m2m->dev, buffer))
+			return -errno;
+	}
+
+	buffer = fdp1_mux_free_buffer(m2m->src_queue.pool);
+	if (!buffer)
+		return -ENOBUFS;
+
+	if (fdp1_v4l2_buffer_set_state(buffer, FDP1_BUF_FILLED))
+		return -EBUSY;
+
+	if (fdp1_v4l2_queue_buffer(m2m->dev, buffer))
+		return -errno;
+
+	fdp1_mux_frame(s, s->queued)->dispatched = fdp1_time_ns();
+
+	s->waiting--;
+	s->queued++;
+	mux->queued++;
+	s->stats.dispatched++;
+
+	return 0;
+}
+
+/*
+ * A frame is presented with its last capture, and leaves the ring once its
+ * output buffer is back too, so that its buffers are free for the next.
+ */
+static void fdp1_mux_complete(struct fdp1_mux_stream * s,
+			      struct fdp1_mux_frame * f, uint64_t now)
+{
+	struct fdp1_mux_stream_stats * stats = &s->stats;
+
+	stats->completed++;
+	fdp1_latency_add(&stats->latency, now - f->arrival);
+	fdp1_latency_add(&stats->service, now - f->dispatched);
+
+	if (now > f->deadline) {
+		stats->missed++;
+		if (now - f->deadline > stats->late_max)
+			stats->late_max = now - f->deadline;
+	}
+}
+
+static void fdp1_mux_retire(struct fdp1_mux * mux, struct fdp1_mux_stream * s)
+{
+	while (s->queued) {
+		struct fdp1_mux_frame * f = fdp1_mux_frame(s, 0);
+
+		if (!f->returned || f->captured < s->captures)
+			break;
+
+		s->head = (s->head + 1) % FDP1_MUX_BACKLOG;
+		s->queued--;
+		mux->queued--;
+	}
+}
+
+/* Dequeue whatever a stream's context has ready */
+static int fdp1_mux_reap(struct fdp1_mux * mux, struct fdp1_mux_stream * s,
+			 short revents, uint64_t now)
+{
+	struct fdp1_m2m * m2m = s->m2m;
+	struct fdp1_v4l2_buffer * buffer;
+	struct fdp1_mux_frame * f;
+	unsigned int n;
+
+	if (revents & POLLERR)
+		return -EIO;
+
+	/* Buffers come back in the order their frames were queued */
+	for (n = 0; n < s->queued; n++)
+		if (!fdp1_mux_frame(s, n)->returned)
+			break;
+
+	if (revents & POLLOUT && n < s->queued) {
+		buffer = fdp1_v4l2_dequeue_buffer(m2m->dev, &m2m->src_queue);
+		if (!buffer)
+			return -errno;
+
+		fdp1_v4l2_buffer_release(buffer);
+		fdp1_mux_frame(s, n)->returned = true;
+	}
+
+	for (n = 0; n < s->queued; n++)
+		if (fdp1_mux_frame(s, n)->captured < s->captures)
+			break;
+
+	if (revents & POLLIN && n < s->queued) {
+		buffer = fdp1_v4l2_dequeue_buffer(m2m->dev, &m2m->dst_queue);
+		if (!buffer)
+			return -errno;
+
+		fdp1_v4l2_buffer_release(buffer);
+
+		f = fdp1_mux_frame(s, n);
+		if (++f->captured == s->captures)
+			fdp1_mux_complete(s, f, now);
+	}
+
+	fdp1_mux_retire(mux, s);
+
+	return 0;
+}
+
+/*
+ * fdp1_mux_run
+ *
+ * Stream every context of an open multiplexer for 'duration' ns, and then
+ * until the frames in flight are done. Frames still waiting by then are
+ * never dispatched. Returns 0, or -errno.
+ */
+int fdp1_mux_run(struct fdp1_mux * mux, uint64_t duration)
+{
+	struct pollfd pfd[FDP1_MUX_MAX_STREAMS];
+	uint64_t start = fdp1_time_ns();
+	uint64_t progress = start;
+	struct fdp1_mux_stream * s;
+	uint64_t now;
+	unsigned int i;
+	int ret;
+
+	for (i = 0; i < mux->n_streams; i++)
+		mux->stream[i].next_arrival = start;
+
+	for (;;) {
+		int timeout = FDP1_MUX_TIMEOUT_MS;
+		bool arriving;
+
+		now = fdp1_time_ns();
+		arriving = now - start < duration;
+
+		if (arriving)
+			fdp1_mux_arrive(mux, now);
+		else if (!mux->queued)
+			break;
+
+		while ((s = fdp1_mux_pick(mux))) {
+			ret = fdp1_mux_dispatch(mux, s);
+			if (ret)
+				return ret;
+		}
+
+		for (i = 0; i < mux->n_streams; i++) {
+			s = &mux->stream[i];
+
+			/* poll() skips negative fds */
+			pfd[i].fd = s->queued ? s->m2m->dev->fd : -1;
+			pfd[i].events = POLLIN | POLLOUT;
+			pfd[i].revents = 0;
+
+			/* Wake for the next arrival, rounded up to the ms */
+			if (arriving && s->period) {
+				uint64_t wait = s->next_arrival > now ?
+						s->next_arrival - now : 0;
+				int ms = (wait + 999999) / 1000000;
+
+				if (ms < timeout)
+					timeout = ms;
+			}
+		}
+
+		ret = poll(pfd, mux->n_streams, timeout);
+
+		if (ret < 0 && errno == EINTR)
+			continue;
+		if (ret < 0)
+			return -errno;
+
+		now = fdp1_time_ns();
+
+		if (!ret) {
+			if (mux->queued &&
+			    now - progress > FDP1_MUX_TIMEOUT_MS * 1000000ULL)
+				return -ETIMEDOUT;
+			continue;
+		}
+
+		progress = now;
+
+		for (i = 0; i < mux->n_streams; i++) {
+			if (!pfd[i].revents)
+				continue;
+
+			ret = fdp1_mux_reap(mux, &mux->stream[i],
+					    pfd[i].revents, now);
+			if (ret)
+				return ret;
+		}
+	}
+
+	return 0;
+}
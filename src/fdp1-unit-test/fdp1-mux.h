@@ -0,0 +1,109 @@
+/*
+ * FDP1 Unit Test Utility
+ *      Author: Kieran Bingham
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by the
+ * Free Software Foundation; either version 2 of the License, or (at your
+ * option) any later version
+ */
+
+#ifndef _FDP1_MUX_H_
+#define _FDP1_MUX_H_
+
+/*
+ * Deadline multiplexing
+ *
+ * Several streams share the device, each through a context of its own. The
+ * kernel runs whichever context has a job ready, in turn, so a stream which
+ * keeps its queues full (an archive transcode) takes as many turns as one
+ * with a frame due now (a live channel). Here frames wait in userspace
+ * until they are dispatched instead: each has a deadline, its arrival plus
+ * the latency its stream allows, and the earliest deadline goes first.
+ * Only 'inflight' frames are queued to the device at once, no more than
+ * 'depth' of them to any one context, so the kernel is left little to
+ * choose between.
+ *
+ * As for the tiler, only layouts and modes which produce each capture from
+ * the frame it came with (as fdp1_job_captures() has it) can be streamed.
+ */
+#define FDP1_MUX_MAX_STREAMS	8
+
+/* Frames waiting or in flight, per stream */
+#define FDP1_MUX_BACKLOG	16
+
+enum fdp1_mux_policy {
+	FDP1_MUX_EDF = 0,	/* Earliest deadline first, queues limited */
+	FDP1_MUX_KERNEL,	/* Every frame queued as it arrives */
+};
+
+struct fdp1_mux_frame {
+	uint64_t arrival;
+	uint64_t deadline;
+	uint64_t dispatched;
+	bool returned;		/* The output buffer is back */
+	unsigned int captured;
+};
+
+struct fdp1_mux_stream_stats {
+	unsigned int arrived;
+	unsigned int dropped;		/* Arrived to a full backlog */
+	unsigned int dispatched;
+	unsigned int completed;
+	unsigned int missed;		/* Completed after their deadline */
+	uint64_t late_max;		/* The worst of them, in ns */
+	struct fdp1_latency latency;	/* Arrival to the last capture */
+	struct fdp1_latency service;	/* Dispatch to the last capture */
+};
+
+struct fdp1_mux_stream {
+	/* Set before fdp1_mux_open() */
+	const char * name;
+	unsigned int width;
+	unsigned int height;
+	enum v4l2_field field;
+	enum fdp1_deint_mode mode;
+	uint64_t period;	/* Between arrivals in ns, or 0 to flood */
+	uint64_t latency;	/* From arrival to deadline, in ns */
+	unsigned int depth;	/* Frames queued to the context at once */
+
+	struct fdp1_m2m * m2m;
+	unsigned int captures;	/* Per frame */
+
+	/*
+	 * A ring of frames from 'head': the first 'queued' are in flight, in
+	 * the order they were queued, and the 'waiting' after them are not.
+	 */
+	struct fdp1_mux_frame frame[FDP1_MUX_BACKLOG];
+	unsigned int head;
+	unsigned int queued;
+	unsigned int waiting;
+	uint64_t next_arrival;
+
+	struct fdp1_mux_stream_stats stats;
+};
+
+struct fdp1_mux {
+	enum fdp1_mux_policy policy;
+	unsigned int inflight;	/* Frames queued across all contexts */
+	unsigned int queued;
+
+	unsigned int n_streams;
+	struct fdp1_mux_stream stream[FDP1_MUX_MAX_STREAMS];
+};
+
+struct fdp1_mux_stream *
+fdp1_mux_add(struct fdp1_mux * mux, const char * name,
+	     unsigned int width, unsigned int height,
+	     enum v4l2_field field, enum fdp1_deint_mode mode,
+	     uint64_t period, uint64_t latency);
+
+void fdp1_mux_arrive(struct fdp1_mux * mux, uint64_t now);
+struct fdp1_mux_stream * fdp1_mux_pick(struct fdp1_mux * mux);
+
+int fdp1_mux_open(struct fdp1_context * fdp1, struct fdp1_mux * mux);
+void fdp1_mux_close(struct fdp1_mux * mux);
+
+int fdp1_mux_run(struct fdp1_mux * mux, uint64_t duration);
+
+#endif /* _FDP1_MUX_H_ */
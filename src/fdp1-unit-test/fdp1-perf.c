@@ -0,0 +1,310 @@
+/*
+ * FDP1 Unit Test Utility
+ *      Author: Kieran Bingham
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by the
+ * Free Software Foundation; either version 2 of the License, or (at your
+ * option) any later version
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+#include <unistd.h>
+#include <errno.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+
+#include "fdp1-unit-test.h"
+#include "fdp1-perf.h"
+
+static const struct {
+	char * name;
+	uint32_t type;
+	uint64_t config;
+} fdp1_perf_counters[FDP1_PERF_COUNTERS] = {
+	[FDP1_PERF_TASK_CLOCK] = { "task us",
+		PERF_TYPE_SOFTWARE, PERF_COUNT_SW_TASK_CLOCK },
+	[FDP1_PERF_CONTEXT_SWITCHES] = { "ctx-sw",
+		PERF_TYPE_SOFTWARE, PERF_COUNT_SW_CONTEXT_SWITCHES },
+	[FDP1_PERF_PAGE_FAULTS] = { "faults",
+		PERF_TYPE_SOFTWARE, PERF_COUNT_SW_PAGE_FAULTS },
+	[FDP1_PERF_CYCLES] = { "cycles",
+		PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES },
+	[FDP1_PERF_INSTRUCTIONS] = { "instrs",
+		PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS },
+	[FDP1_PERF_CACHE_MISSES] = { "cache-miss",
+		PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES },
+};
+
+static char * fdp1_perf_stages[FDP1_PERF_STAGES] = {
+	[FDP1_PERF_FILL]   = "fill",
+	[FDP1_PERF_CLEAR]  = "clear",
+	[FDP1_PERF_VERIFY] = "verify",
+	[FDP1_PERF_QBUF]   = "qbuf",
+	[FDP1_PERF_DQBUF]  = "dqbuf",
+	[FDP1_PERF_WAIT]   = "wait",
+};
+
+struct fdp1_perf_totals {
+	uint64_t calls[FDP1_PERF_STAGES];
+	uint64_t value[FDP1_PERF_STAGES][FDP1_PERF_COUNTERS];
+};
+
+struct fdp1_perf {
+	int fd[FDP1_PERF_COUNTERS];
+
+	/* Position of each counter in a group read, or -1 if not counted */
+	int slot[FDP1_PERF_COUNTERS];
+	unsigned int n_slots;
+
+	bool multiplexed;
+	unsigned int frames;
+
+	struct fdp1_perf_totals frame;
+	struct fdp1_perf_totals total;
+};
+
+static int fdp1_perf_event_open(struct perf_event_attr * attr, int group_fd)
+{
+	return syscall(__NR_perf_event_open, attr, 0, -1, group_fd, 0);
+}
+
+/* Open one counter of the group, user space only if we must */
+static int fdp1_perf_open_counter(enum fdp1_perf_counter counter, int group_fd)
+{
+	struct perf_event_attr attr;
+	int fd;
+
+	memzero(attr);
+	attr.size = sizeof(attr);
+	attr.type = fdp1_perf_counters[counter].type;
+	attr.config = fdp1_perf_counters[counter].config;
+	attr.read_format = PERF_FORMAT_GROUP |
+			   PERF_FORMAT_TOTAL_TIME_ENABLED |
+			   PERF_FORMAT_TOTAL_TIME_RUNNING;
+	attr.disabled = group_fd < 0;
+	attr.exclude_hv = 1;
+
+	fd = fdp1_perf_event_open(&attr, group_fd);
+	if (fd < 0 && (errno == EACCES || errno == EPERM)) {
+		/* perf_event_paranoid may still allow counting user space */
+		attr.exclude_kernel = 1;
+		fd = fdp1_perf_event_open(&attr, group_fd);
+	}
+
+	return fd;
+}
+
+/*
+ * fdp1_perf_open
+ *
+ * Open the counter group for this thread, as the counters of 'fdp1'. The
+ * software task clock leads it, so the group exists whenever
+ * perf_event_open() is usable at all.
+ */
+int fdp1_perf_open(struct fdp1_context * fdp1)
+{
+	struct fdp1_perf * perf;
+	unsigned int c;
+	int leader;
+
+	perf = calloc(1, sizeof(*perf));
+	if (!perf)
+		return -ENOMEM;
+
+	for (c = 0; c < FDP1_PERF_COUNTERS; c++) {
+		perf->fd[c] = -1;
+		perf->slot[c] = -1;
+	}
+
+	leader = fdp1_perf_open_counter(FDP1_PERF_TASK_CLOCK, -1);
+	if (leader < 0) {
+		perror("perf_event_open");
+		free(perf);
+		return -errno;
+	}
+
+	perf->fd[FDP1_PERF_TASK_CLOCK] = leader;
+	perf->slot[FDP1_PERF_TASK_CLOCK] = perf->n_slots++;
+
+	for (c = 0; c < FDP1_PERF_COUNTERS; c++) {
+		if (c == FDP1_PERF_TASK_CLOCK)
+			continue;
+
+		perf->fd[c] = fdp1_perf_open_counter(c, leader);
+		if (perf->fd[c] < 0) {
+			kprint(fdp1, 1, "No %s counter: %s\n",
+					fdp1_perf_counters[c].name, strerror(errno));
+			continue;
+		}
+
+		perf->slot[c] = perf->n_slots++;
+	}
+
+	if (perf->slot[FDP1_PERF_CYCLES] < 0)
+		kprint(fdp1, 0, "No PMU access, only software counters are available\n");
+
+	ioctl(leader, PERF_EVENT_IOC_RESET, PERF_IOC_FLAG_GROUP);
+	ioctl(leader, PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP);
+
+	fdp1->counters = perf;
+
+	return 0;
+}
+
+void fdp1_perf_close(struct fdp1_context * fdp1)
+{
+	struct fdp1_perf * perf = fdp1->counters;
+	unsigned int c;
+
+	if (!perf)
+		return;
+
+	for (c = 0; c < FDP1_PERF_COUNTERS; c++)
+		if (perf->fd[c] >= 0)
+			close(perf->fd[c]);
+
+	free(perf);
+	fdp1->counters = NULL;
+}
+
+static void fdp1_perf_read(struct fdp1_perf * perf,
+			   struct fdp1_perf_sample * sample)
+{
+	uint64_t data[3 + FDP1_PERF_COUNTERS];
+	unsigned int c;
+
+	memzero(*sample);
+
+	if (read(perf->fd[FDP1_PERF_TASK_CLOCK], data, sizeof(data)) <
+	    (ssize_t)((3 + perf->n_slots) * sizeof(uint64_t)))
+		return;
+
+	/* The PMU had too few counters to keep the whole group running */
+	if (data[2] < data[1])
+		perf->multiplexed = true;
+
+	for (c = 0; c < FDP1_PERF_COUNTERS; c++)
+		if (perf->slot[c] >= 0)
+			sample->value[c] = data[3 + perf->slot[c]];
+}
+
+void fdp1_perf_begin(struct fdp1_perf * perf,
+		     struct fdp1_perf_sample * sample)
+{
+	if (perf)
+		fdp1_perf_read(perf, sample);
+}
+
+void fdp1_perf_end(struct fdp1_perf * perf, enum fdp1_perf_stage stage,
+		   const struct fdp1_perf_sample * sample)
+{
+	struct fdp1_perf_sample now;
+	unsigned int c;
+
+	if (!perf)
+		return;
+
+	fdp1_perf_read(perf, &now);
+
+	perf->frame.calls[stage]++;
+	perf->total.calls[stage]++;
+
+	for (c = 0; c < FDP1_PERF_COUNTERS; c++) {
+		uint64_t delta = now.value[c] - sample->value[c];
+
+		perf->frame.value[stage][c] += delta;
+		perf->total.value[stage][c] += delta;
+	}
+}
+
+static void fdp1_perf_print_header(char * what)
+{
+	unsigned int c;
+
+	printf("%-8s %7s", what, "calls");
+
+	for (c = 0; c < FDP1_PERF_COUNTERS; c++)
+		printf(" %12s", fdp1_perf_counters[c].name);
+
+	printf("\n");
+}
+
+/* Print each stage of the totals, divided by 'frames' */
+static void fdp1_perf_print(const struct fdp1_perf * perf,
+			    const struct fdp1_perf_totals * totals,
+			    unsigned int frames)
+{
+	unsigned int s, c;
+
+	for (s = 0; s < FDP1_PERF_STAGES; s++) {
+		if (!totals->calls[s])
+			continue;
+
+		printf("%-8s %7.1f", fdp1_perf_stages[s],
+		       (double)totals->calls[s] / frames);
+
+		for (c = 0; c < FDP1_PERF_COUNTERS; c++) {
+			double value = (double)totals->value[s][c] / frames;
+
+			if (perf->slot[c] < 0)
+				printf(" %12s", "-");
+			else if (c == FDP1_PERF_TASK_CLOCK)
+				printf(" %12.1f", value / 1000);
+			else
+				printf(" %12.0f", value);
+		}
+
+		printf("\n");
+	}
+}
+
+/*
+ * The end of a frame: report what each stage took for it when verbose,
+ * and start the next.
+ */
+void fdp1_perf_frame(struct fdp1_context * fdp1)
+{
+	struct fdp1_perf * perf = fdp1->counters;
+
+	if (!perf)
+		return;
+
+	if (fdp1->verbose >= 2) {
+		char what[16];
+
+		snprintf(what, sizeof(what), "Frame %u", perf->frames);
+		fdp1_perf_print_header(what);
+		fdp1_perf_print(perf, &perf->frame, 1);
+	}
+
+	memzero(perf->frame);
+	perf->frames++;
+}
+
+/* Report the whole run, and per frame, and start again */
+void fdp1_perf_report(struct fdp1_context * fdp1)
+{
+	struct fdp1_perf * perf = fdp1->counters;
+
+	if (!perf || !perf->frames)
+		return;
+
+	printf("Stage counters over %u frames%s:\n", perf->frames,
+	       perf->multiplexed ? " (multiplexed, undercounted)" : "");
+
+	fdp1_perf_print_header("Total");
+	fdp1_perf_print(perf, &perf->total, 1);
+
+	fdp1_perf_print_header("Frame");
+	fdp1_perf_print(perf, &perf->total, perf->frames);
+
+	memzero(perf->frame);
+	memzero(perf->total);
+	perf->frames = 0;
+	perf->multiplexed = false;
+}
@@ -0,0 +1,63 @@
+/*
+ * FDP1 Unit Test Utility
+ *      Author: Kieran Bingham
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by the
+ * Free Software Foundation; either version 2 of the License, or (at your
+ * option) any later version
+ */
+
+#ifndef _FDP1_PERF_H_
+#define _FDP1_PERF_H_
+
+/*
+ * Pipeline stage counters
+ *
+ * A single perf_event_open() group counts this thread, and is read on
+ * entry to and exit from each stage of the pipeline. The counts between
+ * the two are accounted to the stage, both for the current frame and for
+ * the whole run. Hardware counters which the PMU cannot provide are left
+ * out of the group, leaving the software ones.
+ *
+ * The group belongs to the context which opened it, and is handed on to
+ * its devices and buffer pools, which pass it to each stage. Every call
+ * is a no-op without one, as for a context fdp1_perf_open() never opened.
+ */
+enum fdp1_perf_stage {
+	FDP1_PERF_FILL,		/* fdp1_fill_buffer(), fdp1_synth_fill() */
+	FDP1_PERF_CLEAR,	/* fdp1_clear_buffer() */
+	FDP1_PERF_VERIFY,	/* fdp1_verify_buffer() */
+	FDP1_PERF_QBUF,		/* fdp1_v4l2_queue_buffer() */
+	FDP1_PERF_DQBUF,	/* fdp1_v4l2_dequeue_buffer() */
+	FDP1_PERF_WAIT,		/* fdp1_m2m_wait(), and the cadence's poll() */
+	FDP1_PERF_STAGES,
+};
+
+enum fdp1_perf_counter {
+	FDP1_PERF_TASK_CLOCK,	/* ns on the CPU, the group leader */
+	FDP1_PERF_CONTEXT_SWITCHES,
+	FDP1_PERF_PAGE_FAULTS,
+	FDP1_PERF_CYCLES,
+	FDP1_PERF_INSTRUCTIONS,
+	FDP1_PERF_CACHE_MISSES,
+	FDP1_PERF_COUNTERS,
+};
+
+/* A reading of the group, taken on entry to a stage */
+struct fdp1_perf_sample {
+	uint64_t value[FDP1_PERF_COUNTERS];
+};
+
+int fdp1_perf_open(struct fdp1_context * fdp1);
+void fdp1_perf_close(struct fdp1_context * fdp1);
+
+void fdp1_perf_begin(struct fdp1_perf * perf,
+		     struct fdp1_perf_sample * sample);
+void fdp1_perf_end(struct fdp1_perf * perf, enum fdp1_perf_stage stage,
+		   const struct fdp1_perf_sample * sample);
+
+void fdp1_perf_frame(struct fdp1_context * fdp1);
+void fdp1_perf_report(struct fdp1_context * fdp1);
+
+#endif /* _FDP1_PERF_H_ */
@@ -0,0 +1,251 @@
+/*
+ * FDP1 Unit Test Utility
+ *      Author: Kieran Bingham
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by the
+ * Free Software Foundation; either version 2 of the License, or (at your
+ * option) any later version
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/ioctl.h>
+
+#include <linux/videodev2.h>
+
+#include "fdp1-unit-test.h"
+#include "fdp1-v4l2-helpers.h"
+#include "fdp1-record.h"
+
+struct fdp1_record {
+	FILE * file;
+	uint64_t start;
+	unsigned int sessions;
+	unsigned int dropped;
+};
+
+/* Open a log at 'path', returning it, or NULL */
+struct fdp1_record * fdp1_record_start(const char * path)
+{
+	struct fdp1_record_header header;
+	struct fdp1_record * log;
+
+	log = calloc(1, sizeof(*log));
+	if (!log)
+		return NULL;
+
+	log->file = fopen(path, "wb");
+	if (!log->file) {
+		perror(path);
+		free(log);
+		return NULL;
+	}
+
+	memzero(header);
+	memcpy(header.magic, FDP1_RECORD_MAGIC, sizeof(header.magic));
+	header.version = FDP1_RECORD_VERSION;
+	header.entry_size = sizeof(struct fdp1_record_entry);
+
+	if (fwrite(&header, sizeof(header), 1, log->file) != 1) {
+		perror(path);
+		fclose(log->file);
+		free(log);
+		return NULL;
+	}
+
+	log->start = fdp1_time_ns();
+
+	return log;
+}
+
+void fdp1_record_stop(struct fdp1_record * log)
+{
+	if (!log)
+		return;
+
+	if (log->dropped)
+		fprintf(stderr, "Session log: %u calls too large to record\n",
+			log->dropped);
+
+	fclose(log->file);
+	free(log);
+}
+
+/*
+ * The array an argument points to, which follows it in its payload: the
+ * planes of a multi-planar buffer, or the controls of v4l2_ext_controls.
+ * Returns its size, or 0 if there is none, with the array in 'array'. A
+ * 'copy' of it, when given, is pointed to in its place.
+ */
+static size_t fdp1_record_array(unsigned long request, void * arg,
+				const void ** array, void * copy)
+{
+	struct v4l2_buffer * buf = arg;
+	struct v4l2_ext_controls * ctrls = arg;
+
+	switch (request) {
+	case VIDIOC_QUERYBUF:
+	case VIDIOC_QBUF:
+	case VIDIOC_DQBUF:
+	case VIDIOC_PREPARE_BUF:
+		if (!V4L2_TYPE_IS_MULTIPLANAR(buf->type) || !buf->m.planes)
+			return 0;
+
+		*array = buf->m.planes;
+		if (copy)
+			buf->m.planes = copy;
+
+		return (buf->length < VIDEO_MAX_PLANES ?
+			buf->length : VIDEO_MAX_PLANES) *
+		       sizeof(struct v4l2_plane);
+
+	case VIDIOC_G_EXT_CTRLS:
+	case VIDIOC_S_EXT_CTRLS:
+	case VIDIOC_TRY_EXT_CTRLS:
+		if (!ctrls->controls)
+			return 0;
+
+		*array = ctrls->controls;
+		if (copy)
+			ctrls->controls = copy;
+
+		return ctrls->count * sizeof(struct v4l2_ext_control);
+
+	default:
+		return 0;
+	}
+}
+
+/* Append an entry and its payload in a single write */
+static void fdp1_record_write(struct fdp1_record * log,
+			      enum fdp1_record_event event,
+			      unsigned int session, unsigned long request,
+			      int ret, uint64_t start, uint64_t end,
+			      const void * payload, size_t size,
+			      const void * extra, size_t extra_size)
+{
+	char buf[sizeof(struct fdp1_record_entry) + FDP1_RECORD_PAYLOAD_MAX];
+	struct fdp1_record_entry * entry = (struct fdp1_record_entry *)buf;
+
+	/* Keep its place in the log, so a replay knows what it missed */
+	if (size + extra_size > FDP1_RECORD_PAYLOAD_MAX) {
+		event = FDP1_RECORD_DROPPED;
+		size = extra_size = 0;
+		log->dropped++;
+	}
+
+	memzero(*entry);
+	entry->time_ns = start - log->start;
+	entry->duration_ns = end - start;
+	entry->request = request;
+	entry->ret = ret;
+	entry->session = session;
+	entry->event = event;
+	entry->size = size + extra_size;
+
+	memcpy(buf + sizeof(*entry), payload, size);
+	memcpy(buf + sizeof(*entry) + size, extra, extra_size);
+
+	fwrite(buf, sizeof(*entry) + entry->size, 1, log->file);
+}
+
+/* Record a device being opened, returning the session it begins */
+unsigned int fdp1_record_open(struct fdp1_record * log, uint32_t dev, int ret,
+			      uint64_t start, uint64_t end)
+{
+	if (!log)
+		return 0;
+
+	fdp1_record_write(log, FDP1_RECORD_OPEN, log->sessions, 0, ret,
+			  start, end, &dev, sizeof(dev), NULL, 0);
+
+	return log->sessions++;
+}
+
+void fdp1_record_close(struct fdp1_record * log, unsigned int session)
+{
+	uint64_t now = fdp1_time_ns();
+
+	if (log)
+		fdp1_record_write(log, FDP1_RECORD_CLOSE, session, 0, 0,
+				  now, now, NULL, 0, NULL, 0);
+}
+
+void fdp1_record_ioctl(struct fdp1_record * log, unsigned int session,
+		       unsigned long request, void * arg, int ret,
+		       uint64_t start, uint64_t end)
+{
+	const void * array = NULL;
+	size_t size;
+
+	if (!log)
+		return;
+
+	size = fdp1_record_array(request, arg, &array, NULL);
+
+	fdp1_record_write(log, FDP1_RECORD_IOCTL, session, request, ret,
+			  start, end, arg, _IOC_SIZE(request), array, size);
+}
+
+/* Open a log for reading, positioned at its first entry */
+FILE * fdp1_record_load(const char * path)
+{
+	struct fdp1_record_header header;
+	FILE * log;
+
+	log = fopen(path, "rb");
+	if (!log) {
+		perror(path);
+		return NULL;
+	}
+
+	if (fread(&header, sizeof(header), 1, log) != 1 ||
+	    memcmp(header.magic, FDP1_RECORD_MAGIC, sizeof(header.magic)) ||
+	    header.version != FDP1_RECORD_VERSION ||
+	    header.entry_size != sizeof(struct fdp1_record_entry)) {
+		fprintf(stderr, "%s: not a session log this tool can read\n", path);
+		fclose(log);
+		return NULL;
+	}
+
+	return log;
+}
+
+/*
+ * Read the next entry, and its payload into 'payload', which must hold
+ * FDP1_RECORD_PAYLOAD_MAX bytes. The planes of a multi-planar buffer, and
+ * the controls of v4l2_ext_controls, are pointed back at their copy in the
+ * payload, so it can be issued as it is.
+ *
+ * Returns 1 for an entry, 0 at the end of the log, or a negative errno.
+ */
+int fdp1_record_next(FILE * log, struct fdp1_record_entry * entry,
+		     void * payload)
+{
+	const void * array;
+	size_t size;
+
+	if (fread(entry, sizeof(*entry), 1, log) != 1)
+		return feof(log) ? 0 : -EIO;
+
+	if (entry->size > FDP1_RECORD_PAYLOAD_MAX ||
+	    fread(payload, 1, entry->size, log) != entry->size)
+		return -EINVAL;
+
+	if (entry->event != FDP1_RECORD_IOCTL)
+		return 1;
+
+	size = _IOC_SIZE(entry->request);
+	if (entry->size < size)
+		return -EINVAL;
+
+	if (entry->size > size &&
+	    entry->size != size + fdp1_record_array(entry->request, payload,
+						    &array,
+						    (char *)payload + size))
+		return -EINVAL;
+
+	return 1;
+}
@@ -0,0 +1,77 @@
+/*
+ * FDP1 Unit Test Utility
+ *      Author: Kieran Bingham
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by the
+ * Free Software Foundation; either version 2 of the License, or (at your
+ * option) any later version
+ */
+
+#ifndef _FDP1_RECORD_H_
+#define _FDP1_RECORD_H_
+
+/*
+ * V4L2 session log
+ *
+ * While a context has a log open, every device it opens and closes through
+ * the helpers, and every ioctl issued on it, is appended to the log: when it was made,
+ * how long it took, what it returned, and its argument as the driver left
+ * it. Each device is a session of its own, numbered in the order opened.
+ *
+ * The log is a header followed by entries, each immediately followed by
+ * its payload, in host byte order. The payload of an ioctl is its argument
+ * struct; multi-planar v4l2_buffers are followed by their planes, and
+ * v4l2_ext_controls by their controls. Other memory an argument points to
+ * (the payload of a string or compound control) is not recorded.
+ *
+ * A call whose payload would not fit is recorded as dropped, without it.
+ */
+#define FDP1_RECORD_MAGIC	"FDP1V4L2"
+#define FDP1_RECORD_VERSION	2
+
+/* The largest payload: a v4l2_buffer with all its planes */
+#define FDP1_RECORD_PAYLOAD_MAX	1024
+
+enum fdp1_record_event {
+	FDP1_RECORD_OPEN = 1,	/* Payload: the /dev/videoN number */
+	FDP1_RECORD_CLOSE,
+	FDP1_RECORD_IOCTL,
+	FDP1_RECORD_DROPPED,	/* An ioctl too large to record */
+};
+
+struct fdp1_record_header {
+	char magic[8];
+	uint32_t version;
+	uint32_t entry_size;
+};
+
+struct fdp1_record_entry {
+	uint64_t time_ns;	/* Since the log was opened */
+	uint32_t duration_ns;
+	uint32_t request;	/* FDP1_RECORD_IOCTL, _DROPPED */
+	int32_t ret;		/* The result, or -errno */
+	uint16_t session;
+	uint8_t event;
+	uint8_t reserved;
+	uint32_t size;		/* Of the payload */
+	uint32_t reserved2;
+};
+
+/* Writing: each call is a no-op on a NULL log */
+struct fdp1_record * fdp1_record_start(const char * path);
+void fdp1_record_stop(struct fdp1_record * log);
+
+unsigned int fdp1_record_open(struct fdp1_record * log, uint32_t dev, int ret,
+			      uint64_t start, uint64_t end);
+void fdp1_record_close(struct fdp1_record * log, unsigned int session);
+void fdp1_record_ioctl(struct fdp1_record * log, unsigned int session,
+		       unsigned long request, void * arg, int ret,
+		       uint64_t start, uint64_t end);
+
+/* Reading */
+FILE * fdp1_record_load(const char * path);
+int fdp1_record_next(FILE * log, struct fdp1_record_entry * entry,
+		     void * payload);
+
+#endif /* _FDP1_RECORD_H_ */
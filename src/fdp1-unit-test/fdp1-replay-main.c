@@ -0,0 +1,112 @@
+/*
+ * FDP1 Unit Test Utility
+ *      Author: Kieran Bingham
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by the
+ * Free Software Foundation; either version 2 of the License, or (at your
+ * option) any later version
+ */
+
+#include "fdp1-unit-test.h"
+#include "fdp1-stats.h"
+#include "fdp1-record.h"
+#include "fdp1-replay.h"
+
+/* Options filled with defaults: the devices as recorded */
+static struct fdp1_context fdp1_ctx = {
+	.dev = -1,
+	.verbose = false,
+};
+
+static int timed;
+static const struct fdp1_replay_backend * backend = &fdp1_replay_device;
+
+void help(char ** argv, struct fdp1_context * fdp1)
+{
+	printf("%s: [options] LOG\n", fdp1->appname);
+	printf("Replay a session log recorded with fdp1-unit-test --record\n");
+	printf("--device/-d     :  Use device /dev/videoX, not those recorded\n");
+	printf("--timed/-t      :  Keep the original time between calls\n");
+	printf("--stub/-S       :  Return the recorded results, without a device\n");
+	printf("--verbose/v     :  Verbose output [%d]\n", fdp1->verbose);
+	printf("--help/-?       :  Display this help\n");
+
+	printf("\n");
+}
+
+int process_arguments(int argc, char ** argv, struct fdp1_context * fdp1)
+{
+	int option;
+
+	static struct option long_options[] = {
+		/*  { .name, .has_arg, .flag, .val } */
+		{"device",	required_argument,	0, 'd'},
+		{"timed",	no_argument,		0, 't'},
+		{"stub",	no_argument,		0, 'S'},
+		{"verbose",	no_argument,		0, 'v'},
+		{"help",  	no_argument, 		0, '?'},
+		{0, 0, 0, 0}
+	};
+
+	while ((option = getopt_long(argc, argv, "d:tSv?",
+			long_options, NULL)) != -1) {
+
+		switch (option) {
+		case 'd':
+			fdp1->dev = atoi(optarg);
+			break;
+		case 't':
+			timed = 1;
+			break;
+		case 'S':
+			backend = &fdp1_replay_stub;
+			break;
+		case 'v':
+			fdp1->verbose++;
+			break;
+		default:
+		case '?':
+			help(argv, fdp1);
+			exit(0);
+			break;
+		}
+	}
+
+	if (optind != argc - 1) {
+		help(argv, fdp1);
+		exit(1);
+	}
+
+	return 0;
+}
+
+int main(int argc, char ** argv)
+{
+	struct fdp1_replay_result * result;
+	int ret;
+
+	char * searched = strrchr(argv[0], '/');
+	fdp1_ctx.appname = searched ? searched + 1 : argv[0];
+
+	process_arguments(argc, argv, &fdp1_ctx);
+
+	result = calloc(1, sizeof(*result));
+	if (!result) {
+		perror("calloc");
+		return 1;
+	}
+
+	ret = fdp1_replay(&fdp1_ctx, argv[optind], backend, timed, result);
+
+	/* A replay which stopped part way is still reported */
+	if (!ret || result->calls) {
+		printf("%s: %s replay, %s backend\n", argv[optind],
+		       timed ? "timed" : "fast", backend->name);
+		fdp1_replay_report(result);
+	}
+
+	free(result);
+
+	return ret ? 1 : 0;
+}
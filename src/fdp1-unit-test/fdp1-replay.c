@@ -0,0 +1,490 @@
+/*
+ * FDP1 Unit Test Utility
+ *      Author: Kieran Bingham
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by the
+ * Free Software Foundation; either version 2 of the License, or (at your
+ * option) any later version
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <inttypes.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <time.h>
+#include <sys/ioctl.h>
+
+#include <linux/videodev2.h>
+
+#include "fdp1-unit-test.h"
+#include "fdp1-v4l2-helpers.h"
+#include "fdp1-stats.h"
+#include "fdp1-record.h"
+#include "fdp1-replay.h"
+
+/*
+ * Device backend
+ */
+static int fdp1_replay_device_open(struct fdp1_context * fdp1, uint32_t dev)
+{
+	char devname[] = "/dev/videoNNNNNNN";
+	int fd;
+
+	snprintf(devname, sizeof(devname), "/dev/video%u", dev);
+
+	/* As the helpers open it, so dequeues do not block */
+	fd = open(devname, O_RDWR | O_NONBLOCK, 0);
+	if (fd < 0) {
+		perror(devname);
+		return -errno;
+	}
+
+	return fd;
+}
+
+static void fdp1_replay_device_close(int handle)
+{
+	close(handle);
+}
+
+static int fdp1_replay_device_ioctl(int handle,
+				    const struct fdp1_record_entry * entry,
+				    void * arg)
+{
+	int ret = ioctl(handle, entry->request, arg);
+
+	return ret < 0 ? -errno : ret;
+}
+
+static void fdp1_replay_device_release(int fd)
+{
+	close(fd);
+}
+
+static int fdp1_replay_device_wait(int handle, uint32_t type)
+{
+	struct pollfd pfd = {
+		.fd = handle,
+		.events = V4L2_TYPE_IS_OUTPUT(type) ? POLLOUT : POLLIN,
+	};
+	int ret;
+
+	ret = poll(&pfd, 1, FDP1_REPLAY_TIMEOUT_MS);
+	if (ret < 0)
+		return -errno;
+
+	return ret ? 0 : -ETIMEDOUT;
+}
+
+const struct fdp1_replay_backend fdp1_replay_device = {
+	.name = "device",
+	.open = fdp1_replay_device_open,
+	.close = fdp1_replay_device_close,
+	.release = fdp1_replay_device_release,
+	.ioctl = fdp1_replay_device_ioctl,
+	.wait = fdp1_replay_device_wait,
+};
+
+/*
+ * Stub backend: every call succeeds, or fails, as it was recorded
+ */
+static int fdp1_replay_stub_open(struct fdp1_context * fdp1, uint32_t dev)
+{
+	return dev;
+}
+
+static void fdp1_replay_stub_close(int handle)
+{
+}
+
+static int fdp1_replay_stub_ioctl(int handle,
+				  const struct fdp1_record_entry * entry,
+				  void * arg)
+{
+	return entry->ret;
+}
+
+const struct fdp1_replay_backend fdp1_replay_stub = {
+	.name = "stub",
+	.open = fdp1_replay_stub_open,
+	.close = fdp1_replay_stub_close,
+	.ioctl = fdp1_replay_stub_ioctl,
+};
+
+/* Named as the device phase it belongs to, where it has one */
+static char * fdp1_replay_request_str(uint32_t request, char * buf,
+				      size_t size)
+{
+	int phase = fdp1_v4l2_ioctl_phase(request);
+
+	if (phase >= 0)
+		return fdp1_v4l2_phase_str(phase);
+
+	snprintf(buf, size, "ioctl %u", _IOC_NR(request));
+
+	return buf;
+}
+
+static void fdp1_replay_sleep_until(uint64_t ns)
+{
+	struct timespec ts = {
+		.tv_sec = ns / 1000000000ULL,
+		.tv_nsec = ns % 1000000000ULL,
+	};
+
+	while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) == EINTR)
+		;
+}
+
+/* A dmabuf exported in the recording, and again by the replay */
+struct fdp1_replay_export {
+	int recorded;
+	int fd;
+};
+
+struct fdp1_replay_exports {
+	struct fdp1_replay_export export[FDP1_REPLAY_EXPORTS];
+	unsigned int count;
+};
+
+static struct fdp1_replay_export *
+fdp1_replay_export_find(struct fdp1_replay_exports * exports, int recorded)
+{
+	unsigned int i;
+
+	for (i = 0; i < exports->count; i++)
+		if (exports->export[i].recorded == recorded)
+			return &exports->export[i];
+
+	return NULL;
+}
+
+/*
+ * Map the fd the recording exported to the one the replay did. Its number
+ * may have been closed and reused since, which the log does not show: the
+ * latest export of it replaces the earlier one.
+ */
+static void fdp1_replay_export_add(const struct fdp1_replay_backend * backend,
+				   struct fdp1_replay_exports * exports,
+				   int recorded, int fd)
+{
+	struct fdp1_replay_export * export;
+
+	export = fdp1_replay_export_find(exports, recorded);
+	if (!export) {
+		if (exports->count == FDP1_REPLAY_EXPORTS) {
+			if (backend->release)
+				backend->release(fd);
+			return;
+		}
+
+		export = &exports->export[exports->count++];
+	} else if (backend->release) {
+		backend->release(export->fd);
+	}
+
+	export->recorded = recorded;
+	export->fd = fd;
+}
+
+static int fdp1_replay_export_map(struct fdp1_replay_exports * exports,
+				  int * fd)
+{
+	struct fdp1_replay_export * export;
+
+	export = fdp1_replay_export_find(exports, *fd);
+	if (!export)
+		return -EBADF;
+
+	*fd = export->fd;
+
+	return 0;
+}
+
+/*
+ * Prepare a recorded argument to be issued again, mapping the dmabufs it
+ * queues. Returns 0, or a negative errno if the call cannot be replayed.
+ */
+static int fdp1_replay_prepare(struct fdp1_replay_exports * exports,
+			       const struct fdp1_record_entry * entry,
+			       void * arg)
+{
+	struct v4l2_buffer * buf = arg;
+	struct v4l2_ext_controls * ctrls = arg;
+	unsigned int i;
+
+	switch (entry->request) {
+	case VIDIOC_QBUF:
+	case VIDIOC_PREPARE_BUF:
+		if (buf->flags & V4L2_BUF_FLAG_REQUEST_FD)
+			return -EBADF;
+
+		if (buf->memory != V4L2_MEMORY_DMABUF)
+			return 0;
+
+		if (!V4L2_TYPE_IS_MULTIPLANAR(buf->type))
+			return fdp1_replay_export_map(exports, &buf->m.fd);
+
+		for (i = 0; i < buf->length && i < VIDEO_MAX_PLANES; i++)
+			if (fdp1_replay_export_map(exports,
+						   &buf->m.planes[i].m.fd))
+				return -EBADF;
+
+		return 0;
+
+	case VIDIOC_G_EXT_CTRLS:
+	case VIDIOC_S_EXT_CTRLS:
+	case VIDIOC_TRY_EXT_CTRLS:
+		if (ctrls->which == V4L2_CTRL_WHICH_REQUEST_VAL)
+			return -EBADF;
+
+		/* The payload of a string or compound control is not logged */
+		for (i = 0; i < ctrls->count; i++)
+			if (ctrls->controls[i].size)
+				return -EFAULT;
+
+		return 0;
+
+	default:
+		return 0;
+	}
+}
+
+/*
+ * Issue one recorded ioctl. A buffer the recording dequeued may not be
+ * ready yet, as its poll() was not recorded: wait for it, and time only
+ * the dequeue which succeeds.
+ */
+static int fdp1_replay_ioctl(const struct fdp1_replay_backend * backend,
+			     int handle, const struct fdp1_record_entry * entry,
+			     void * arg, struct fdp1_replay_result * result,
+			     uint64_t * duration)
+{
+	const struct v4l2_buffer * buf = arg;
+	uint64_t start;
+	int ret;
+
+	start = fdp1_time_ns();
+	ret = backend->ioctl(handle, entry, arg);
+
+	if (entry->request == VIDIOC_DQBUF && entry->ret >= 0 &&
+	    ret == -EAGAIN && backend->wait) {
+		uint64_t wait = fdp1_time_ns();
+
+		result->waits++;
+
+		while (ret == -EAGAIN && !backend->wait(handle, buf->type)) {
+			start = fdp1_time_ns();
+			ret = backend->ioctl(handle, entry, arg);
+		}
+
+		result->wait_ns += start - wait;
+	}
+
+	*duration = fdp1_time_ns() - start;
+
+	return ret;
+}
+
+/*
+ * fdp1_replay
+ *
+ * Replay the log at 'path' through 'backend', into 'result'. Timed, each
+ * call is issued no sooner after the first than it was in the recording.
+ */
+int fdp1_replay(struct fdp1_context * fdp1, const char * path,
+		const struct fdp1_replay_backend * backend, bool timed,
+		struct fdp1_replay_result * result)
+{
+	uint64_t payload[FDP1_RECORD_PAYLOAD_MAX / sizeof(uint64_t)];
+	struct v4l2_exportbuffer * expbuf = (struct v4l2_exportbuffer *)payload;
+	int handles[FDP1_REPLAY_SESSIONS];
+	struct fdp1_replay_exports * exports;
+	struct fdp1_record_entry entry;
+	uint64_t start, first = 0;
+	bool started = false;
+	unsigned int i;
+	FILE * log;
+	int ret;
+
+	log = fdp1_record_load(path);
+	if (!log)
+		return -EINVAL;
+
+	exports = calloc(1, sizeof(*exports));
+	if (!exports) {
+		fclose(log);
+		return -ENOMEM;
+	}
+
+	memset(result, 0, sizeof(*result));
+
+	for (i = 0; i < FDP1_REPLAY_SESSIONS; i++)
+		handles[i] = -1;
+
+	start = fdp1_time_ns();
+
+	while ((ret = fdp1_record_next(log, &entry, payload)) > 0) {
+		unsigned int nr = _IOC_NR(entry.request);
+		uint64_t duration;
+		int recorded_fd;
+		int handle;
+
+		if (entry.session >= FDP1_REPLAY_SESSIONS) {
+			ret = -EINVAL;
+			break;
+		}
+
+		if (!started) {
+			first = entry.time_ns;
+			started = true;
+		}
+
+		if (entry.time_ns + entry.duration_ns - first > result->recorded_ns)
+			result->recorded_ns = entry.time_ns + entry.duration_ns - first;
+
+		if (timed)
+			fdp1_replay_sleep_until(start + entry.time_ns - first);
+
+		if (entry.event == FDP1_RECORD_OPEN) {
+			/* A device which failed to open is not replayed */
+			if (entry.ret < 0)
+				continue;
+
+			handle = backend->open(fdp1, fdp1->dev >= 0 ?
+					       (uint32_t)fdp1->dev :
+					       *(uint32_t *)payload);
+			if (handle < 0) {
+				ret = handle;
+				break;
+			}
+
+			handles[entry.session] = handle;
+			result->sessions++;
+			continue;
+		}
+
+		if (entry.event == FDP1_RECORD_CLOSE) {
+			if (handles[entry.session] >= 0)
+				backend->close(handles[entry.session]);
+			handles[entry.session] = -1;
+			continue;
+		}
+
+		if (entry.event == FDP1_RECORD_DROPPED) {
+			result->skipped++;
+			continue;
+		}
+
+		if (entry.event != FDP1_RECORD_IOCTL ||
+		    handles[entry.session] < 0) {
+			ret = -EINVAL;
+			break;
+		}
+
+		ret = fdp1_replay_prepare(exports, &entry, payload);
+		if (ret < 0) {
+			char name[16];
+
+			kprint(fdp1, 1, "Skipped %s: %s\n",
+					fdp1_replay_request_str(entry.request,
+							name, sizeof(name)),
+					strerror(-ret));
+			result->skipped++;
+			ret = 0;
+			continue;
+		}
+
+		recorded_fd = entry.request == VIDIOC_EXPBUF ? expbuf->fd : -1;
+
+		ret = fdp1_replay_ioctl(backend, handles[entry.session], &entry,
+					payload, result, &duration);
+
+		if (entry.request == VIDIOC_EXPBUF && ret >= 0)
+			fdp1_replay_export_add(backend, exports, recorded_fd,
+					       expbuf->fd);
+
+		result->request[nr] = entry.request;
+		fdp1_latency_add(&result->recorded[nr], entry.duration_ns);
+		fdp1_latency_add(&result->replayed[nr], duration);
+		result->calls++;
+
+		if (ret != entry.ret) {
+			char name[16];
+
+			kprint(fdp1, 1, "Call %u (%s): returned %d, recorded %d\n",
+					result->calls,
+					fdp1_replay_request_str(entry.request,
+							name, sizeof(name)),
+					ret, entry.ret);
+			result->mismatches++;
+		}
+
+		ret = 0;
+	}
+
+	result->replayed_ns = fdp1_time_ns() - start;
+
+	for (i = 0; i < exports->count && backend->release; i++)
+		backend->release(exports->export[i].fd);
+
+	for (i = 0; i < FDP1_REPLAY_SESSIONS; i++)
+		if (handles[i] >= 0)
+			backend->close(handles[i]);
+
+	free(exports);
+	fclose(log);
+
+	if (ret < 0)
+		fprintf(stderr, "%s: replay stopped after %u calls: %s\n",
+			path, result->calls, strerror(-ret));
+
+	return ret;
+}
+
+void fdp1_replay_report(const struct fdp1_replay_result * result)
+{
+	unsigned int nr;
+
+	printf("%u sessions, %u calls, %u results differing from the recording\n",
+	       result->sessions, result->calls, result->mismatches);
+	if (result->skipped)
+		printf("%u calls skipped, which could not be replayed\n",
+		       result->skipped);
+	printf("Recorded over %.1f ms, replayed over %.1f ms",
+	       result->recorded_ns / 1000000.0, result->replayed_ns / 1000000.0);
+	if (result->waits)
+		printf(", waiting %.1f ms for %u dequeues",
+		       result->wait_ns / 1000000.0, result->waits);
+	printf("\n\n");
+
+	printf("%-12s %7s | %9s %9s %9s | %9s %9s %9s | %9s\n",
+	       "Request", "calls", "rec p50", "rec p99", "rec max",
+	       "p50", "p99", "max", "p99 delta");
+
+	for (nr = 0; nr < FDP1_REPLAY_REQUESTS; nr++) {
+		const struct fdp1_latency * rec = &result->recorded[nr];
+		const struct fdp1_latency * rep = &result->replayed[nr];
+		char name[16];
+
+		if (!rec->count)
+			continue;
+
+		printf("%-12s %7" PRIu64 " | %9.1f %9.1f %9.1f | %9.1f %9.1f %9.1f | %+9.1f\n",
+		       fdp1_replay_request_str(result->request[nr], name,
+					       sizeof(name)),
+		       rec->count,
+		       fdp1_latency_percentile(rec, 50) / 1000.0,
+		       fdp1_latency_percentile(rec, 99) / 1000.0,
+		       rec->max / 1000.0,
+		       fdp1_latency_percentile(rep, 50) / 1000.0,
+		       fdp1_latency_percentile(rep, 99) / 1000.0,
+		       rep->max / 1000.0,
+		       ((double)fdp1_latency_percentile(rep, 99) -
+			(double)fdp1_latency_percentile(rec, 99)) / 1000.0);
+	}
+
+	printf("(us)\n");
+}
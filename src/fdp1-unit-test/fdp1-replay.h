@@ -0,0 +1,79 @@
+/*
+ * FDP1 Unit Test Utility
+ *      Author: Kieran Bingham
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by the
+ * Free Software Foundation; either version 2 of the License, or (at your
+ * option) any later version
+ */
+
+#ifndef _FDP1_REPLAY_H_
+#define _FDP1_REPLAY_H_
+
+/*
+ * Session replay
+ *
+ * Re-issues the ioctls of a session log (fdp1-record.h), in order, either
+ * as fast as they go or at their original times from the start of the log,
+ * and compares the latency of each request with its recording.
+ *
+ * The device backend opens the devices of the log again. The stub backend
+ * returns what was recorded without a device, so that logs can be read,
+ * and replayed, on any machine.
+ *
+ * The file descriptors a log holds belong to the recording process. Those
+ * VIDIOC_EXPBUF returned are mapped to the ones it returns on replay, and
+ * closed at the end. Calls which need any other (a media request), or
+ * memory which was not recorded, are skipped, as are dropped calls.
+ */
+#define FDP1_REPLAY_SESSIONS	64
+#define FDP1_REPLAY_REQUESTS	256	/* By _IOC_NR() */
+#define FDP1_REPLAY_EXPORTS	(VIDEO_MAX_FRAME * VIDEO_MAX_PLANES)
+
+/* How long to wait for a buffer the recording dequeued */
+#define FDP1_REPLAY_TIMEOUT_MS	1000
+
+struct fdp1_replay_backend {
+	char * name;
+
+	/* Returns a handle for the session, or a negative errno */
+	int (*open)(struct fdp1_context * fdp1, uint32_t dev);
+	void (*close)(int handle);
+
+	/* Release a dmabuf the ioctl returned by VIDIOC_EXPBUF */
+	void (*release)(int fd);
+
+	/* Returns the result, or a negative errno */
+	int (*ioctl)(int handle, const struct fdp1_record_entry * entry,
+		     void * arg);
+
+	/* Wait for a buffer of 'type' to be ready to dequeue, if it can */
+	int (*wait)(int handle, uint32_t type);
+};
+
+extern const struct fdp1_replay_backend fdp1_replay_device;
+extern const struct fdp1_replay_backend fdp1_replay_stub;
+
+struct fdp1_replay_result {
+	uint32_t request[FDP1_REPLAY_REQUESTS];
+	struct fdp1_latency recorded[FDP1_REPLAY_REQUESTS];
+	struct fdp1_latency replayed[FDP1_REPLAY_REQUESTS];
+
+	unsigned int sessions;
+	unsigned int calls;
+	unsigned int mismatches;	/* Results differing from the recording */
+	unsigned int skipped;		/* Calls which could not be replayed */
+	unsigned int waits;		/* Dequeues which had to wait */
+	uint64_t wait_ns;
+
+	uint64_t recorded_ns;		/* From the first entry to the last */
+	uint64_t replayed_ns;
+};
+
+int fdp1_replay(struct fdp1_context * fdp1, const char * path,
+		const struct fdp1_replay_backend * backend, bool timed,
+		struct fdp1_replay_result * result);
+void fdp1_replay_report(const struct fdp1_replay_result * result);
+
+#endif /* _FDP1_REPLAY_H_ */
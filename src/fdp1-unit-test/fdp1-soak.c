@@ -0,0 +1,392 @@
+/*
+ * FDP1 Unit Test Utility
+ *      Author: Kieran Bingham
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by the
+ * Free Software Foundation; either version 2 of the License, or (at your
+ * option) any later version
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+#include <unistd.h>
+#include <dirent.h>
+
+#include "fdp1-unit-test.h"
+#include "fdp1-v4l2-helpers.h"
+#include "fdp1-stats.h"
+#include "fdp1-cadence.h"
+#include "fdp1-soak.h"
+
+/* The streams of one rotation */
+static const struct fdp1_soak_config {
+	uint32_t out_fourcc;
+	enum v4l2_field field;
+	enum fdp1_deint_mode mode;
+	uint32_t cap_fourcc;
+} fdp1_soak_configs[] = {
+	{ V4L2_PIX_FMT_YUYV, V4L2_FIELD_NONE, FDP1_PROGRESSIVE, V4L2_PIX_FMT_YUYV },
+	{ V4L2_PIX_FMT_YUYV, V4L2_FIELD_INTERLACED, FDP1_ADAPT2D3D, V4L2_PIX_FMT_YUYV },
+	{ V4L2_PIX_FMT_UYVY, V4L2_FIELD_SEQ_TB, FDP1_FIXED3D, V4L2_PIX_FMT_YUYV },
+	{ V4L2_PIX_FMT_NV12, V4L2_FIELD_ALTERNATE, FDP1_FIXED2D, V4L2_PIX_FMT_UYVY },
+	{ V4L2_PIX_FMT_NV16, V4L2_FIELD_INTERLACED_BT, FDP1_PREVFIELD, V4L2_PIX_FMT_YUYV },
+	{ V4L2_PIX_FMT_YUYV, V4L2_FIELD_SEQ_BT, FDP1_NEXTFIELD, V4L2_PIX_FMT_UYVY },
+};
+
+/* Parse "N", "Ns", "Nm" or "Nh" as seconds, or return -EINVAL */
+int fdp1_soak_duration(const char * spec)
+{
+	char * end;
+	long n = strtol(spec, &end, 10);
+
+	if (end == spec || n <= 0)
+		return -EINVAL;
+
+	switch (*end) {
+	case 'h':
+		n *= 60;
+		/* fall through */
+	case 'm':
+		n *= 60;
+		/* fall through */
+	case 's':
+		end++;
+		/* fall through */
+	case '\0':
+		break;
+	default:
+		return -EINVAL;
+	}
+
+	if (*end || n > 0x7fffffff / 1000)
+		return -EINVAL;
+
+	return n;
+}
+
+static uint32_t fdp1_soak_rss_kb(void)
+{
+	unsigned long size, resident;
+	FILE * statm = fopen("/proc/self/statm", "r");
+
+	if (!statm)
+		return 0;
+
+	if (fscanf(statm, "%lu %lu", &size, &resident) != 2)
+		resident = 0;
+
+	fclose(statm);
+
+	return resident * (sysconf(_SC_PAGESIZE) / 1024);
+}
+
+static uint32_t fdp1_soak_fds(void)
+{
+	DIR * dir = opendir("/proc/self/fd");
+	struct dirent * entry;
+	uint32_t fds = 0;
+
+	if (!dir)
+		return 0;
+
+	while ((entry = readdir(dir)) != NULL)
+		if (entry->d_name[0] != '.')
+			fds++;
+
+	closedir(dir);
+
+	/* Not counting the one reading the directory */
+	return fds ? fds - 1 : 0;
+}
+
+/* CmaFree in kB, or -ENOENT if the kernel has no CMA */
+static int fdp1_soak_cma_free_kb(uint32_t * kb)
+{
+	FILE * meminfo = fopen("/proc/meminfo", "r");
+	char line[128];
+	int ret = -ENOENT;
+
+	if (!meminfo)
+		return ret;
+
+	while (fgets(line, sizeof(line), meminfo))
+		if (sscanf(line, "CmaFree: %" SCNu32 " kB", kb) == 1) {
+			ret = 0;
+			break;
+		}
+
+	fclose(meminfo);
+
+	return ret;
+}
+
+/* What the drift limits are checked against */
+struct fdp1_soak_average {
+	double rss_kb;
+	double fds;
+	double cma_free_kb;
+	double rate;
+	double p99_us;
+};
+
+static void fdp1_soak_average(const struct fdp1_soak_sample * samples,
+			      unsigned int n,
+			      struct fdp1_soak_average * avg)
+{
+	uint64_t buffers = 0, stream_ms = 0;
+	unsigned int i;
+
+	memzero(*avg);
+
+	for (i = 0; i < n; i++) {
+		avg->rss_kb += samples[i].rss_kb;
+		avg->fds += samples[i].fds;
+		avg->cma_free_kb += samples[i].cma_free_kb;
+		avg->p99_us += samples[i].p99_us;
+		buffers += samples[i].buffers;
+		stream_ms += samples[i].stream_ms;
+	}
+
+	avg->rss_kb /= n;
+	avg->fds /= n;
+	avg->cma_free_kb /= n;
+	avg->p99_us /= n;
+	avg->rate = stream_ms ? buffers * 1000.0 / stream_ms : 0.0;
+}
+
+/*
+ * Compare the first quarter of the samples with the last, so that a single
+ * noisy interval at either end does not decide the result.
+ */
+static int fdp1_soak_drift(struct fdp1_context * fdp1,
+			   const struct fdp1_soak_sample * samples,
+			   unsigned int n, bool cma)
+{
+	unsigned int q = n / 4 ? n / 4 : 1;
+	struct fdp1_soak_average first, last;
+	int fail = 0;
+
+	fdp1_soak_average(samples, q, &first);
+	fdp1_soak_average(samples + n - q, q, &last);
+
+	kprint(fdp1, 1, "Over %u samples: rss %.0f -> %.0f kB, fds %.1f -> %.1f, "
+			"CmaFree %.0f -> %.0f kB, %.1f -> %.1f buf/s, "
+			"p99 %.0f -> %.0f us\n", n,
+			first.rss_kb, last.rss_kb, first.fds, last.fds,
+			first.cma_free_kb, last.cma_free_kb,
+			first.rate, last.rate, first.p99_us, last.p99_us);
+
+	if (last.rss_kb - first.rss_kb > FDP1_SOAK_RSS_KB) {
+		kprint(fdp1, 0, "Resident memory grew by %.0f kB\n",
+				last.rss_kb - first.rss_kb);
+		fail++;
+	}
+
+	if (last.fds - first.fds > FDP1_SOAK_FDS) {
+		kprint(fdp1, 0, "Open file descriptors grew by %.1f\n",
+				last.fds - first.fds);
+		fail++;
+	}
+
+	if (cma && first.cma_free_kb - last.cma_free_kb > FDP1_SOAK_CMA_KB) {
+		kprint(fdp1, 0, "CmaFree fell by %.0f kB\n",
+				first.cma_free_kb - last.cma_free_kb);
+		fail++;
+	}
+
+	if ((first.rate - last.rate) * 100 > first.rate * FDP1_SOAK_RATE_PCT) {
+		kprint(fdp1, 0, "Throughput fell from %.1f to %.1f buf/s\n",
+				first.rate, last.rate);
+		fail++;
+	}
+
+	if ((last.p99_us - first.p99_us) * 100 > first.p99_us * FDP1_SOAK_P99_PCT) {
+		kprint(fdp1, 0, "p99 latency rose from %.0f to %.0f us\n",
+				first.p99_us, last.p99_us);
+		fail++;
+	}
+
+	return fail;
+}
+
+static FILE * fdp1_soak_log_open(struct fdp1_context * fdp1,
+				 uint64_t interval)
+{
+	struct fdp1_soak_header header;
+	FILE * log;
+
+	log = fopen(fdp1->soak_log, "wb");
+	if (!log) {
+		perror(fdp1->soak_log);
+		return NULL;
+	}
+
+	memzero(header);
+	memcpy(header.magic, FDP1_SOAK_MAGIC, sizeof(header.magic));
+	header.version = FDP1_SOAK_VERSION;
+	header.sample_size = sizeof(struct fdp1_soak_sample);
+	header.interval_ms = interval / 1000000;
+	header.width = fdp1->width;
+	header.height = fdp1->height;
+	header.frames = fdp1->num_frames;
+	header.configs = ARRAY_SIZE(fdp1_soak_configs);
+
+	if (fwrite(&header, sizeof(header), 1, log) != 1) {
+		perror(fdp1->soak_log);
+		fclose(log);
+		return NULL;
+	}
+
+	return log;
+}
+
+/*
+ * fdp1_soak
+ *
+ * Stream the rotation of configurations over and over for fdp1->soak
+ * seconds. A sample is taken at the end of the first rotation to complete
+ * after each interval, so every sample covers whole rotations and their
+ * throughput can be compared.
+ */
+int fdp1_soak(struct fdp1_context * fdp1)
+{
+	uint64_t start = fdp1_time_ns();
+	uint64_t end = start + fdp1->soak * 1000000000ULL;
+	uint64_t interval = fdp1->soak * 1000000000ULL / FDP1_SOAK_SAMPLES;
+	uint64_t next, stream_ns = 0;
+	struct fdp1_soak_sample * samples = NULL;
+	struct fdp1_cadence_stats stats;
+	struct fdp1_latency latency;
+	unsigned int n = 0, size = 0;
+	unsigned int streams = 0;
+	unsigned int buffers = 0, failures = 0;
+	unsigned int rotation_failures = 0;
+	uint32_t cma_kb;
+	bool cma;
+	FILE * log = NULL;
+	int fail = 0;
+
+	start_test(fdp1, "Soak Test");
+
+	if (interval < 1000000000ULL)
+		interval = 1000000000ULL;
+	if (interval > 60000000000ULL)
+		interval = 60000000000ULL;
+	next = start + interval;
+
+	cma = !fdp1_soak_cma_free_kb(&cma_kb);
+	if (!cma)
+		kprint(fdp1, 1, "No CMA in /proc/meminfo, not tracking it\n");
+
+	if (fdp1->soak_log) {
+		log = fdp1_soak_log_open(fdp1, interval);
+		if (!log)
+			return TEST_FAIL;
+	}
+
+	printf("%8s %9s %9s %9s %9s %5s %10s %8s\n", "time s", "buf/s",
+	       "p99 us", "max us", "rss kB", "fds", "CmaFree kB", "failures");
+
+	fdp1_latency_reset(&latency);
+
+	for (;;) {
+		const struct fdp1_soak_config * config =
+			&fdp1_soak_configs[streams % ARRAY_SIZE(fdp1_soak_configs)];
+		struct fdp1_soak_sample * sample;
+		uint64_t now = fdp1_time_ns();
+		bool rotated = streams % ARRAY_SIZE(fdp1_soak_configs) == 0;
+
+		/* At least one sample, however short the soak */
+		if (rotated && streams && (now >= next || (now >= end && !n))) {
+			if (n == size) {
+				size = size ? size * 2 : FDP1_SOAK_SAMPLES;
+				sample = realloc(samples, size * sizeof(*samples));
+				if (!sample) {
+					perror("Soak samples");
+					fail++;
+					break;
+				}
+				samples = sample;
+			}
+
+			sample = &samples[n++];
+			memzero(*sample);
+
+			sample->time_ms = (now - start) / 1000000;
+			sample->rss_kb = fdp1_soak_rss_kb();
+			sample->fds = fdp1_soak_fds();
+			if (cma && fdp1_soak_cma_free_kb(&cma_kb) == 0)
+				sample->cma_free_kb = cma_kb;
+			sample->failures = failures < 0xffff ? failures : 0xffff;
+			sample->buffers = buffers;
+			sample->stream_ms = stream_ns / 1000000;
+			sample->p99_us = fdp1_latency_percentile(&latency, 99) / 1000;
+			sample->max_us = latency.max / 1000;
+
+			printf("%8.1f %9.1f %9" PRIu32 " %9" PRIu32 " %9" PRIu32
+			       " %5u %10" PRIu32 " %8u\n",
+			       sample->time_ms / 1000.0,
+			       stream_ns ? buffers * 1000000000.0 / stream_ns : 0.0,
+			       sample->p99_us, sample->max_us, sample->rss_kb,
+			       sample->fds, sample->cma_free_kb, failures);
+
+			if (log && (fwrite(sample, sizeof(*sample), 1, log) != 1 ||
+				    fflush(log))) {
+				perror(fdp1->soak_log);
+				fail++;
+			}
+
+			fdp1_latency_reset(&latency);
+			buffers = 0;
+			failures = 0;
+			stream_ns = 0;
+
+			while (next <= now)
+				next += interval;
+		}
+
+		/* Past the end, only to complete the first sample */
+		if (now >= end && n)
+			break;
+
+		/* Nothing left to soak if no stream works at all */
+		if (rotated && streams) {
+			if (rotation_failures == ARRAY_SIZE(fdp1_soak_configs)) {
+				kprint(fdp1, 0, "Every stream failed, stopping\n");
+				break;
+			}
+			rotation_failures = 0;
+		}
+
+		memzero(stats);
+		if (fdp1_cadence_stream(fdp1, config->out_fourcc, config->field,
+					config->mode, config->cap_fourcc, &stats)) {
+			kprint(fdp1, 0, "Stream %u (%s %s) failed\n", streams,
+					v4l2_field(config->field),
+					fdp1_deint_mode_str(config->mode));
+			failures++;
+			rotation_failures++;
+			fail++;
+		}
+
+		buffers += stats.submitted;
+		stream_ns += stats.elapsed;
+		fdp1_latency_merge(&latency, &stats.latency);
+
+		streams++;
+	}
+
+	if (n)
+		fail += fdp1_soak_drift(fdp1, samples, n, cma);
+
+	kprint(fdp1, 1, "Soaked %u streams over %u samples\n", streams, n);
+
+	if (log)
+		fclose(log);
+	free(samples);
+
+	return fail;
+}
@@ -0,0 +1,64 @@
+/*
+ * FDP1 Unit Test Utility
+ *      Author: Kieran Bingham
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by the
+ * Free Software Foundation; either version 2 of the License, or (at your
+ * option) any later version
+ */
+
+#ifndef _FDP1_SOAK_H_
+#define _FDP1_SOAK_H_
+
+/*
+ * Soak test
+ *
+ * Streams continuously for a given duration, rotating through a set of
+ * formats, field layouts and deinterlace modes, and samples the resources
+ * of the process and system at regular intervals. The run fails if any of
+ * them drifts further than its limit between the start and the end.
+ *
+ * The samples are optionally written as a binary time series: a header,
+ * followed by one fixed size record per interval, in host byte order.
+ */
+#define FDP1_SOAK_MAGIC		"FDP1SOAK"
+#define FDP1_SOAK_VERSION	1
+
+/* Aim for this many samples over the run, between 1s and 60s apart */
+#define FDP1_SOAK_SAMPLES	32
+
+/* Drift limits, from the first quarter of the samples to the last */
+#define FDP1_SOAK_RSS_KB	8192	/* Resident memory growth */
+#define FDP1_SOAK_FDS		0	/* Open file descriptor growth */
+#define FDP1_SOAK_CMA_KB	16384	/* CmaFree loss */
+#define FDP1_SOAK_RATE_PCT	10	/* Throughput loss */
+#define FDP1_SOAK_P99_PCT	50	/* p99 latency growth */
+
+struct fdp1_soak_header {
+	char magic[8];
+	uint16_t version;
+	uint16_t sample_size;
+	uint32_t interval_ms;
+	uint32_t width;
+	uint32_t height;
+	uint32_t frames;	/* Output buffers per stream */
+	uint32_t configs;	/* Streams in each rotation */
+};
+
+struct fdp1_soak_sample {
+	uint32_t time_ms;	/* Since the start of the soak */
+	uint32_t rss_kb;
+	uint32_t cma_free_kb;	/* 0 on systems without CMA */
+	uint16_t fds;
+	uint16_t failures;	/* Streams which failed in the interval */
+	uint32_t buffers;	/* Output buffers processed in the interval */
+	uint32_t stream_ms;	/* Time spent streaming them */
+	uint32_t p99_us;
+	uint32_t max_us;
+};
+
+int fdp1_soak_duration(const char * spec);
+int fdp1_soak(struct fdp1_context * fdp1);
+
+#endif /* _FDP1_SOAK_H_ */
@@ -0,0 +1,118 @@
+/*
+ * FDP1 Unit Test Utility
+ *      Author: Kieran Bingham
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by the
+ * Free Software Foundation; either version 2 of the License, or (at your
+ * option) any later version
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "fdp1-unit-test.h"
+#include "fdp1-stats.h"
+
+#define SUB_BUCKETS (1 << FDP1_LATENCY_SUB_BITS)
+
+static unsigned int fdp1_latency_bucket(uint64_t ns)
+{
+	unsigned int msb;
+
+	if (ns < SUB_BUCKETS)
+		return ns;
+
+	msb = 63 - __builtin_clzll(ns);
+
+	return (msb - FDP1_LATENCY_SUB_BITS + 1) * SUB_BUCKETS
+		+ ((ns >> (msb - FDP1_LATENCY_SUB_BITS)) & (SUB_BUCKETS - 1));
+}
+
+/* The smallest value which falls in a bucket */
+static uint64_t fdp1_latency_bucket_base(unsigned int bucket)
+{
+	unsigned int msb;
+	uint64_t sub;
+
+	if (bucket < SUB_BUCKETS)
+		return bucket;
+
+	msb = bucket / SUB_BUCKETS + FDP1_LATENCY_SUB_BITS - 1;
+	sub = bucket % SUB_BUCKETS;
+
+	return (1ULL << msb) | (sub << (msb - FDP1_LATENCY_SUB_BITS));
+}
+
+void fdp1_latency_reset(struct fdp1_latency * lat)
+{
+	memzero(*lat);
+}
+
+void fdp1_latency_add(struct fdp1_latency * lat, uint64_t ns)
+{
+	if (!lat->count || ns < lat->min)
+		lat->min = ns;
+	if (ns > lat->max)
+		lat->max = ns;
+
+	lat->count++;
+	lat->sum += ns;
+	lat->buckets[fdp1_latency_bucket(ns)]++;
+}
+
+void fdp1_latency_merge(struct fdp1_latency * lat,
+			const struct fdp1_latency * from)
+{
+	unsigned int i;
+
+	if (!from->count)
+		return;
+
+	if (!lat->count || from->min < lat->min)
+		lat->min = from->min;
+	if (from->max > lat->max)
+		lat->max = from->max;
+
+	lat->count += from->count;
+	lat->sum += from->sum;
+
+	for (i = 0; i < FDP1_LATENCY_BUCKETS; i++)
+		lat->buckets[i] += from->buckets[i];
+}
+
+uint64_t fdp1_latency_avg(const struct fdp1_latency * lat)
+{
+	return lat->count ? lat->sum / lat->count : 0;
+}
+
+uint64_t fdp1_latency_percentile(const struct fdp1_latency * lat,
+				 unsigned int percent)
+{
+	uint64_t target;
+	uint64_t upper;
+	uint64_t seen = 0;
+	unsigned int i;
+
+	if (!lat->count)
+		return 0;
+
+	/* The rank of the sample we want, rounded up */
+	target = (lat->count * percent + 99) / 100;
+	if (!target)
+		return lat->min;
+
+	for (i = 0; i < FDP1_LATENCY_BUCKETS; i++) {
+		seen += lat->buckets[i];
+		if (seen >= target)
+			break;
+	}
+
+	/* Report the top of the bucket, so we never understate a percentile */
+	if (i >= fdp1_latency_bucket(UINT64_MAX))
+		return lat->max;
+
+	upper = fdp1_latency_bucket_base(i + 1) - 1;
+
+	return upper > lat->max ? lat->max : upper;
+}
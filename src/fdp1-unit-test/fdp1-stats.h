@@ -0,0 +1,40 @@
+/*
+ * FDP1 Unit Test Utility
+ *      Author: Kieran Bingham
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by the
+ * Free Software Foundation; either version 2 of the License, or (at your
+ * option) any later version
+ */
+
+#ifndef _FDP1_STATS_H_
+#define _FDP1_STATS_H_
+
+/*
+ * Latency histogram
+ *
+ * Samples are kept in logarithmic buckets, each power of two split into
+ * eight linear sub-buckets, so percentiles are accurate to within 12.5%
+ * without having to store every sample.
+ */
+#define FDP1_LATENCY_SUB_BITS	3
+#define FDP1_LATENCY_BUCKETS	512
+
+struct fdp1_latency {
+	uint64_t count;
+	uint64_t sum;
+	uint64_t min;
+	uint64_t max;
+	uint32_t buckets[FDP1_LATENCY_BUCKETS];
+};
+
+void fdp1_latency_reset(struct fdp1_latency * lat);
+void fdp1_latency_add(struct fdp1_latency * lat, uint64_t ns);
+void fdp1_latency_merge(struct fdp1_latency * lat,
+			const struct fdp1_latency * from);
+uint64_t fdp1_latency_avg(const struct fdp1_latency * lat);
+uint64_t fdp1_latency_percentile(const struct fdp1_latency * lat,
+				 unsigned int percent);
+
+#endif /* _FDP1_STATS_H_ */
@@ -0,0 +1,649 @@
+/*
+ * FDP1 Unit Test Utility
+ *      Author: Kieran Bingham
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by the
+ * Free Software Foundation; either version 2 of the License, or (at your
+ * option) any later version
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "fdp1-unit-test.h"
+#include "fdp1-v4l2-helpers.h"
+#include "fdp1-synth.h"
+#include "fdp1-perf.h"
+
+enum fdp1_synth_packing {
+	FDP1_SYNTH_PACKED,	/* Y, U and V interleaved in one plane */
+	FDP1_SYNTH_SEMIPLANAR,	/* Y plane, then interleaved chroma plane */
+	FDP1_SYNTH_PLANAR,	/* Y, U and V planes */
+};
+
+struct fdp1_synth_format {
+	uint32_t fourcc;
+	enum fdp1_synth_packing packing;
+	unsigned int hsub;
+	unsigned int vsub;
+	/* Packed: byte offsets of Y0 U Y1 V in a macropixel */
+	unsigned int offsets[4];
+	/* Chroma stored V before U */
+	bool swap_uv;
+	/* Each component plane in its own memory plane */
+	bool mplane;
+};
+
+static const struct fdp1_synth_format fdp1_synth_formats[] = {
+	{ V4L2_PIX_FMT_YUYV, FDP1_SYNTH_PACKED, 2, 1, { 0, 1, 2, 3 } },
+	{ V4L2_PIX_FMT_UYVY, FDP1_SYNTH_PACKED, 2, 1, { 1, 0, 3, 2 } },
+	{ V4L2_PIX_FMT_YVYU, FDP1_SYNTH_PACKED, 2, 1, { 0, 3, 2, 1 } },
+	{ V4L2_PIX_FMT_VYUY, FDP1_SYNTH_PACKED, 2, 1, { 1, 2, 3, 0 } },
+	{ V4L2_PIX_FMT_NV12, FDP1_SYNTH_SEMIPLANAR, 2, 2 },
+	{ V4L2_PIX_FMT_NV21, FDP1_SYNTH_SEMIPLANAR, 2, 2, { 0 }, true },
+	{ V4L2_PIX_FMT_NV16, FDP1_SYNTH_SEMIPLANAR, 2, 1 },
+	{ V4L2_PIX_FMT_NV61, FDP1_SYNTH_SEMIPLANAR, 2, 1, { 0 }, true },
+	{ V4L2_PIX_FMT_YUV420, FDP1_SYNTH_PLANAR, 2, 2 },
+	{ V4L2_PIX_FMT_YVU420, FDP1_SYNTH_PLANAR, 2, 2, { 0 }, true },
+	{ V4L2_PIX_FMT_NV12M, FDP1_SYNTH_SEMIPLANAR, 2, 2, { 0 }, false, true },
+	{ V4L2_PIX_FMT_NV21M, FDP1_SYNTH_SEMIPLANAR, 2, 2, { 0 }, true, true },
+	{ V4L2_PIX_FMT_NV16M, FDP1_SYNTH_SEMIPLANAR, 2, 1, { 0 }, false, true },
+	{ V4L2_PIX_FMT_NV61M, FDP1_SYNTH_SEMIPLANAR, 2, 1, { 0 }, true, true },
+	{ V4L2_PIX_FMT_YUV420M, FDP1_SYNTH_PLANAR, 2, 2, { 0 }, false, true },
+	{ V4L2_PIX_FMT_YVU420M, FDP1_SYNTH_PLANAR, 2, 2, { 0 }, true, true },
+};
+
+static const struct fdp1_synth_format * fdp1_synth_find_format(uint32_t fourcc)
+{
+	unsigned int i;
+
+	for (i = 0; i < ARRAY_SIZE(fdp1_synth_formats); i++)
+		if (fdp1_synth_formats[i].fourcc == fourcc)
+			return &fdp1_synth_formats[i];
+
+	return NULL;
+}
+
+/*
+ * A component plane of one buffer: where it lives, and its geometry.
+ * 'lines' is the number of lines of the plane held in this buffer, which
+ * is half the frame for V4L2_FIELD_ALTERNATE.
+ */
+struct fdp1_synth_plane {
+	uint8_t * mem;
+	unsigned int stride;
+	unsigned int lines;
+	unsigned int vsub;
+};
+
+static bool fdp1_synth_bottom_first(enum v4l2_field field)
+{
+	return field == V4L2_FIELD_INTERLACED_BT || field == V4L2_FIELD_SEQ_BT;
+}
+
+/*
+ * The scene
+ *
+ * 't' is measured in fields, and everything moves with a period of
+ * FDP1_SYNTH_PERIOD frames, so the sequence can be cached and looped.
+ *
+ *  - The left quarter is a static gradient, which a motion adaptive
+ *    deinterlacer should weave.
+ *  - A band of vertical bars scrolls horizontally.
+ *  - A ball bounces around the whole frame.
+ */
+#define PERIOD_FIELDS (FDP1_SYNTH_PERIOD * 2)
+
+typedef void (*fdp1_synth_paint)(const struct fdp1_synth * synth,
+				 unsigned int t, unsigned int x, unsigned int y,
+				 uint8_t yuv[3]);
+
+static unsigned int fdp1_synth_triangle(unsigned int t, unsigned int range,
+					unsigned int phase)
+{
+	unsigned int half = PERIOD_FIELDS / 2;
+	unsigned int p = (t + phase) % PERIOD_FIELDS;
+
+	if (p > half)
+		p = PERIOD_FIELDS - p;
+
+	return range * p / half;
+}
+
+static void fdp1_synth_scene(const struct fdp1_synth * synth, unsigned int t,
+			     unsigned int x, unsigned int y, uint8_t yuv[3])
+{
+	unsigned int w = synth->width;
+	unsigned int h = synth->height;
+	unsigned int r = (w < h ? w : h) / 8 + 1;
+	unsigned int bars = w / 16 > 4 ? w / 16 : 4;
+	int cx = r + fdp1_synth_triangle(t, w > 2 * r ? w - 2 * r : 0, 0);
+	int cy = r + fdp1_synth_triangle(t, h > 2 * r ? h - 2 * r : 0, PERIOD_FIELDS / 4);
+	int dx = (int)x - cx;
+	int dy = (int)y - cy;
+
+	if (dx * dx + dy * dy < (int)(r * r)) {
+		/* Yellow ball */
+		yuv[0] = 210; yuv[1] = 16; yuv[2] = 146;
+	} else if (x < w / 4) {
+		/* Static gradient */
+		yuv[0] = 16 + (x + y) * 219 / (w / 4 + h);
+		yuv[1] = 128; yuv[2] = 128;
+	} else if (y >= h / 4 && y < h / 2) {
+		/* Bars, scrolling one bar pair per period */
+		unsigned int shift = t * 2 * bars / PERIOD_FIELDS;
+
+		if (((x + shift) / bars) & 1) {
+			yuv[0] = 235; yuv[1] = 128; yuv[2] = 128;
+		} else {
+			yuv[0] = 41; yuv[1] = 240; yuv[2] = 110;
+		}
+	} else {
+		/* Grey background */
+		yuv[0] = 64; yuv[1] = 128; yuv[2] = 128;
+	}
+}
+
+/*
+ * Frame ID watermark
+ *
+ * The first FDP1_WATERMARK_LINES lines of every field carry the time of
+ * the field (in fields) as FDP1_WATERMARK_BITS black or white cells, each
+ * the full height of the band, so any one line of the field is enough to
+ * read it back. The low 16 bits of the time are followed by an 8 bit check.
+ */
+#define FDP1_WATERMARK_BITS	24
+
+static unsigned int fdp1_watermark_cell(unsigned int width)
+{
+	unsigned int cell = (width / FDP1_WATERMARK_BITS) & ~1;
+
+	return cell < 2 ? 2 : cell;
+}
+
+static uint32_t fdp1_watermark_code(unsigned int t)
+{
+	uint32_t id = t & 0xffff;
+	uint32_t check = (id ^ (id >> 8) ^ 0xa5) & 0xff;
+
+	return id | (check << 16);
+}
+
+static void fdp1_synth_watermark(const struct fdp1_synth * synth,
+				 unsigned int t, unsigned int x,
+				 unsigned int y, uint8_t yuv[3])
+{
+	unsigned int bit = x / fdp1_watermark_cell(synth->width);
+
+	yuv[0] = (fdp1_watermark_code(t) >> bit) & 1 ? 235 : 16;
+	yuv[1] = 128;
+	yuv[2] = 128;
+}
+
+/*
+ * The frame line, in luma lines, sampled for line 'row' of a plane.
+ *
+ * Chroma lines of interlaced 4:2:0 content belong to alternate fields just
+ * as luma lines do, so chroma line n of a field sits alongside luma line
+ * (n * vsub) of the same field.
+ */
+static unsigned int fdp1_synth_luma_line(unsigned int row, unsigned int vsub,
+					 bool progressive, unsigned int parity)
+{
+	if (progressive)
+		return row * vsub;
+
+	return (row / 2) * vsub * 2 + parity;
+}
+
+/*
+ * Render one field of a plane (or the whole plane for progressive content)
+ * sampled at time 't'. 'parity' is 0 for the top field and 1 for the bottom.
+ */
+static void fdp1_synth_render_plane(const struct fdp1_synth * synth,
+				    struct fdp1_synth_plane * plane,
+				    unsigned int component,
+				    unsigned int t, unsigned int parity,
+				    fdp1_synth_paint paint,
+				    unsigned int width, unsigned int height)
+{
+	const struct fdp1_synth_format * fmt = synth->format;
+	bool progressive = synth->field == V4L2_FIELD_NONE;
+	unsigned int frame_lines = synth->height / plane->vsub;
+	unsigned int row, line, x;
+	uint8_t yuv[3];
+
+	for (row = 0; row < frame_lines; row++) {
+		uint8_t * p;
+		unsigned int y = fdp1_synth_luma_line(row, plane->vsub,
+						      progressive, parity);
+
+		if (!progressive && (row & 1) != parity)
+			continue;
+
+		if (y >= height)
+			continue;
+
+		/* Where this frame line of the plane is stored in the buffer */
+		switch (synth->field) {
+		case V4L2_FIELD_SEQ_TB:
+		case V4L2_FIELD_SEQ_BT:
+			line = row / 2;
+			if (parity != fdp1_synth_bottom_first(synth->field))
+				line += frame_lines / 2;
+			break;
+		case V4L2_FIELD_ALTERNATE:
+			line = row / 2;
+			break;
+		default:
+			line = row;
+			break;
+		}
+
+		if (line >= plane->lines)
+			continue;
+
+		p = plane->mem + line * plane->stride;
+
+		for (x = 0; x < width; x += fmt->hsub) {
+			switch (fmt->packing) {
+			case FDP1_SYNTH_PACKED:
+				paint(synth, t, x, y, yuv);
+				p[fmt->offsets[0]] = yuv[0];
+				p[fmt->offsets[1]] = yuv[1];
+				p[fmt->offsets[3]] = yuv[2];
+				paint(synth, t, x + 1, y, yuv);
+				p[fmt->offsets[2]] = yuv[0];
+				p += 4;
+				break;
+			case FDP1_SYNTH_SEMIPLANAR:
+			case FDP1_SYNTH_PLANAR:
+				paint(synth, t, x, y, yuv);
+				if (component == 0) {
+					*p++ = yuv[0];
+					paint(synth, t, x + 1, y, yuv);
+					*p++ = yuv[0];
+				} else if (fmt->packing == FDP1_SYNTH_SEMIPLANAR) {
+					*p++ = yuv[fmt->swap_uv ? 2 : 1];
+					*p++ = yuv[fmt->swap_uv ? 1 : 2];
+				} else {
+					*p++ = yuv[component];
+				}
+				break;
+			}
+		}
+	}
+}
+
+/*
+ * Describe the component planes of a buffer laid out in 'mem'.
+ * Returns the number of component planes.
+ */
+static unsigned int fdp1_synth_planes(const struct fdp1_synth * synth,
+				      uint8_t * mem[3],
+				      struct fdp1_synth_plane planes[3])
+{
+	const struct fdp1_synth_format * fmt = synth->format;
+	unsigned int lines = synth->height;
+	unsigned int w = synth->width;
+	unsigned int n, i;
+	uint8_t * p = mem[0];
+
+	if (synth->field == V4L2_FIELD_ALTERNATE)
+		lines /= 2;
+
+	switch (fmt->packing) {
+	case FDP1_SYNTH_PACKED:
+		planes[0] = (struct fdp1_synth_plane) { NULL, w * 2, lines, 1 };
+		n = 1;
+		break;
+	case FDP1_SYNTH_SEMIPLANAR:
+		planes[0] = (struct fdp1_synth_plane) { NULL, w, lines, 1 };
+		planes[1] = (struct fdp1_synth_plane) { NULL, w, lines / fmt->vsub, fmt->vsub };
+		n = 2;
+		break;
+	case FDP1_SYNTH_PLANAR:
+	default:
+		planes[0] = (struct fdp1_synth_plane) { NULL, w, lines, 1 };
+		planes[1] = (struct fdp1_synth_plane) { NULL, w / fmt->hsub, lines / fmt->vsub, fmt->vsub };
+		planes[2] = planes[1];
+		n = 3;
+		break;
+	}
+
+	for (i = 0; i < n; i++) {
+		if (fmt->mplane) {
+			planes[i].mem = mem[i];
+		} else {
+			planes[i].mem = p;
+			p += planes[i].stride * planes[i].lines;
+		}
+	}
+
+	/* Planar chroma stored V first */
+	if (fmt->packing == FDP1_SYNTH_PLANAR && fmt->swap_uv) {
+		uint8_t * u = planes[1].mem;
+
+		planes[1].mem = planes[2].mem;
+		planes[2].mem = u;
+	}
+
+	return n;
+}
+
+/*
+ * Paint the area (width x height) at the top left of every field of buffer
+ * 'sequence' of the stream, held in the memory planes 'mem'.
+ */
+static void fdp1_synth_paint_buffer(const struct fdp1_synth * synth,
+				    uint8_t * mem[3], unsigned int sequence,
+				    fdp1_synth_paint paint,
+				    unsigned int width, unsigned int height)
+{
+	struct fdp1_synth_plane planes[3];
+	unsigned int n = fdp1_synth_planes(synth, mem, planes);
+	bool bt = fdp1_synth_bottom_first(synth->field);
+	unsigned int i;
+
+	for (i = 0; i < n; i++) {
+		switch (synth->field) {
+		case V4L2_FIELD_NONE:
+			fdp1_synth_render_plane(synth, &planes[i], i, sequence * 2, 0,
+						paint, width, height);
+			break;
+		case V4L2_FIELD_ALTERNATE:
+			/* One field per buffer, top first */
+			fdp1_synth_render_plane(synth, &planes[i], i, sequence,
+						sequence & 1, paint, width, height);
+			break;
+		default:
+			fdp1_synth_render_plane(synth, &planes[i], i,
+						sequence * 2 + bt, 0,
+						paint, width, height);
+			fdp1_synth_render_plane(synth, &planes[i], i,
+						sequence * 2 + !bt, 1,
+						paint, width, height);
+			break;
+		}
+	}
+}
+
+/* Render buffer 'sequence' of the stream into the memory planes 'mem' */
+static void fdp1_synth_render(const struct fdp1_synth * synth,
+			      uint8_t * mem[3], unsigned int sequence)
+{
+	fdp1_synth_paint_buffer(synth, mem, sequence, fdp1_synth_scene,
+				synth->width, synth->height);
+}
+
+/* Stamp the time of each field of buffer 'sequence' into its watermark */
+static void fdp1_synth_stamp(const struct fdp1_synth * synth,
+			     uint8_t * mem[3], unsigned int sequence)
+{
+	unsigned int width = FDP1_WATERMARK_BITS * fdp1_watermark_cell(synth->width);
+	unsigned int height = FDP1_WATERMARK_LINES;
+
+	if (width > synth->width)
+		width = synth->width & ~1;
+	if (height > synth->height)
+		height = synth->height;
+
+	fdp1_synth_paint_buffer(synth, mem, sequence, fdp1_synth_watermark,
+				width, height);
+}
+
+static struct fdp1_synth * fdp1_synth_create(struct fdp1_context * fdp1,
+					     const struct fdp1_synth_format * fmt,
+					     enum v4l2_field field)
+{
+	struct fdp1_synth * synth = calloc(1, sizeof(*synth));
+	struct fdp1_synth_plane planes[3];
+	uint8_t * mem[3] = { NULL, NULL, NULL };
+	unsigned int n, i;
+
+	if (!synth) {
+		perror("Synth Allocation");
+		return NULL;
+	}
+
+	synth->format = fmt;
+	synth->field = field;
+	synth->width = fdp1->width;
+	synth->height = fdp1->height;
+
+	/* Measure the buffer by laying it out at address zero */
+	n = fdp1_synth_planes(synth, mem, planes);
+	for (i = 0; i < n; i++)
+		synth->sizes[fmt->mplane ? i : 0] += planes[i].stride * planes[i].lines;
+
+	synth->n_planes = fmt->mplane ? n : 1;
+	for (i = 0; i < synth->n_planes; i++)
+		synth->buffer_size += synth->sizes[i];
+
+	synth->n_buffers = FDP1_SYNTH_PERIOD;
+	if (field == V4L2_FIELD_ALTERNATE)
+		synth->n_buffers *= 2;
+
+	/* Larger sequences are rendered as they are needed instead */
+	if ((uint64_t)synth->buffer_size * synth->n_buffers > FDP1_SYNTH_MAX_CACHE) {
+		kprint(fdp1, 1, "Synth sequence too large to cache\n");
+		synth->uncached = true;
+	}
+
+	return synth;
+}
+
+/* Render the whole period into the cache, the first time it is needed */
+static void fdp1_synth_prerender(struct fdp1_synth * synth)
+{
+	uint8_t * mem[3] = { NULL, NULL, NULL };
+	unsigned int i, k;
+
+	synth->cache = malloc(synth->buffer_size * synth->n_buffers);
+	if (!synth->cache) {
+		synth->uncached = true;
+		return;
+	}
+
+	for (k = 0; k < synth->n_buffers; k++) {
+		uint8_t * p = synth->cache + k * synth->buffer_size;
+
+		for (i = 0; i < synth->n_planes; i++) {
+			mem[i] = p;
+			p += synth->sizes[i];
+		}
+
+		fdp1_synth_render(synth, mem, k);
+	}
+}
+
+/*
+ * fdp1_synth_get
+ *
+ * Returns the synthesiser for a format and layout at the current test size,
+ * creating it on first use. Its sequence is rendered by the first fill.
+ */
+struct fdp1_synth * fdp1_synth_get(struct fdp1_context * fdp1,
+				   uint32_t fourcc,
+				   enum v4l2_field field)
+{
+	const struct fdp1_synth_format * fmt = fdp1_synth_find_format(fourcc);
+	struct fdp1_synth * synth;
+
+	if (!fmt) {
+		kprint(fdp1, 1, "No synthesiser for format 0x%x\n", fourcc);
+		return NULL;
+	}
+
+	for (synth = fdp1->synth_cache; synth; synth = synth->next)
+		if (synth->format == fmt && synth->field == field &&
+		    synth->width == fdp1->width && synth->height == fdp1->height)
+			return synth;
+
+	synth = fdp1_synth_create(fdp1, fmt, field);
+	if (!synth)
+		return NULL;
+
+	synth->next = fdp1->synth_cache;
+	fdp1->synth_cache = synth;
+
+	return synth;
+}
+
+void fdp1_synth_free_all(struct fdp1_context * fdp1)
+{
+	struct fdp1_synth * synth = fdp1->synth_cache;
+
+	while (synth) {
+		struct fdp1_synth * next = synth->next;
+
+		free(synth->cache);
+		free(synth);
+		synth = next;
+	}
+
+	fdp1->synth_cache = NULL;
+}
+
+/*
+ * fdp1_synth_fill
+ *
+ * Fill an output buffer with buffer 'sequence' of the stream.
+ */
+int fdp1_synth_fill(struct fdp1_synth * synth,
+		    struct fdp1_v4l2_buffer * buffer,
+		    unsigned int sequence)
+{
+	uint8_t * mem[3] = { NULL, NULL, NULL };
+	struct fdp1_perf_sample perf;
+	unsigned int i;
+
+	if (buffer->n_planes < synth->n_planes)
+		return -EINVAL;
+
+	for (i = 0; i < synth->n_planes; i++) {
+		if (buffer->sizes[i] < synth->sizes[i])
+			return -EINVAL;
+		mem[i] = (uint8_t *)buffer->mem[i];
+	}
+
+	if (fdp1_v4l2_buffer_set_state(buffer, FDP1_BUF_FILLED))
+		return -EBUSY;
+
+	if (!synth->cache && !synth->uncached)
+		fdp1_synth_prerender(synth);
+
+	/* Not counting the one-off rendering */
+	fdp1_perf_begin(buffer->pool->perf, &perf);
+
+	if (synth->cache) {
+		uint8_t * p = synth->cache +
+			(sequence % synth->n_buffers) * synth->buffer_size;
+
+		for (i = 0; i < synth->n_planes; i++) {
+			memcpy(mem[i], p, synth->sizes[i]);
+			p += synth->sizes[i];
+		}
+	} else {
+		fdp1_synth_render(synth, mem, sequence);
+	}
+
+	/* The cached sequence loops, but the time in the watermark does not */
+	fdp1_synth_stamp(synth, mem, sequence);
+
+	fdp1_perf_end(buffer->pool->perf, FDP1_PERF_FILL, &perf);
+
+	return 0;
+}
+
+/* Read the watermark from one line of a progressive buffer */
+static int fdp1_synth_read_line(const struct fdp1_synth * synth,
+				struct fdp1_synth_plane * luma,
+				unsigned int line, uint32_t * id)
+{
+	const struct fdp1_synth_format * fmt = synth->format;
+	unsigned int cell = fdp1_watermark_cell(synth->width);
+	uint8_t * row = luma->mem + line * luma->stride;
+	uint32_t code = 0;
+	unsigned int bit;
+
+	for (bit = 0; bit < FDP1_WATERMARK_BITS; bit++) {
+		unsigned int x = bit * cell + cell / 2;
+		uint8_t y;
+
+		if (x >= synth->width)
+			return -EINVAL;
+
+		if (fmt->packing == FDP1_SYNTH_PACKED)
+			y = row[(x / 2) * 4 + fmt->offsets[x & 1 ? 2 : 0]];
+		else
+			y = row[x];
+
+		if (y > 128)
+			code |= 1 << bit;
+	}
+
+	*id = code & 0xffff;
+
+	return code == fdp1_watermark_code(*id) ? 0 : -EINVAL;
+}
+
+/*
+ * fdp1_synth_decode
+ *
+ * Read the field time from the watermark of a captured (progressive) frame,
+ * described by 'synth'. Only one line of each parity is sampled.
+ *
+ * A deinterlaced frame keeps the lines of its own field, but the other
+ * lines may be woven from a neighbouring field and so carry a neighbouring
+ * time. Where both parities decode, the time closest to 'expected' wins.
+ */
+int fdp1_synth_decode(struct fdp1_synth * synth,
+		      struct fdp1_v4l2_buffer * buffer,
+		      unsigned int expected,
+		      unsigned int * t)
+{
+	uint8_t * mem[3] = { NULL, NULL, NULL };
+	struct fdp1_synth_plane planes[3];
+	unsigned int parity, i;
+	unsigned int best = 0;
+	int found = 0;
+
+	if (synth->height < FDP1_WATERMARK_LINES ||
+	    buffer->n_planes < synth->n_planes)
+		return -EINVAL;
+
+	for (i = 0; i < synth->n_planes; i++) {
+		if (buffer->sizes[i] < synth->sizes[i])
+			return -EINVAL;
+		mem[i] = (uint8_t *)buffer->mem[i];
+	}
+
+	fdp1_synth_planes(synth, mem, planes);
+
+	for (parity = 0; parity < 2; parity++) {
+		unsigned int candidate;
+		uint32_t id;
+
+		/* Sample away from the edges of the band */
+		if (fdp1_synth_read_line(synth, &planes[0],
+					 FDP1_WATERMARK_LINES / 2 + parity, &id))
+			continue;
+
+		/* Extend the 16 bit id to the time nearest to that expected */
+		candidate = expected + (int16_t)(id - (expected & 0xffff));
+
+		if (!found || abs((int)(candidate - expected)) <
+			      abs((int)(best - expected)))
+			best = candidate;
+		found++;
+	}
+
+	if (!found)
+		return -EINVAL;
+
+	*t = best;
+
+	return 0;
+}
@@ -0,0 +1,71 @@
+/*
+ * FDP1 Unit Test Utility
+ *      Author: Kieran Bingham
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by the
+ * Free Software Foundation; either version 2 of the License, or (at your
+ * option) any later version
+ */
+
+#ifndef _FDP1_SYNTH_H_
+#define _FDP1_SYNTH_H_
+
+/*
+ * Interlaced content synthesiser
+ *
+ * Renders a scene with a known motion model: a static region, scrolling
+ * bars and a bouncing ball. Each field is sampled at its own point in time,
+ * so the two fields of a frame differ wherever there is motion, exactly as
+ * from an interlaced camera.
+ *
+ * The motion repeats every FDP1_SYNTH_PERIOD frames, so a whole sequence
+ * is rendered once per format, layout and size, and then copied into the
+ * output buffers.
+ */
+#define FDP1_SYNTH_PERIOD	8
+#define FDP1_SYNTH_MAX_CACHE	(64 * 1024 * 1024)
+
+/*
+ * Every field also carries its time, in fields, in a watermark across the
+ * top FDP1_WATERMARK_LINES lines of the frame, which fdp1_synth_decode()
+ * reads back from a capture by sampling a handful of pixels.
+ */
+#define FDP1_WATERMARK_LINES	8
+
+struct fdp1_synth_format;
+
+struct fdp1_synth {
+	struct fdp1_synth * next;
+
+	const struct fdp1_synth_format * format;
+	enum v4l2_field field;
+	unsigned int width;
+	unsigned int height;
+
+	/* Bytes of each memory plane of one buffer */
+	unsigned int n_planes;
+	unsigned int sizes[3];
+	unsigned int buffer_size;
+
+	/* Pre-rendered buffers for one period, unless too large to keep */
+	unsigned int n_buffers;
+	uint8_t * cache;
+	bool uncached;
+};
+
+struct fdp1_synth * fdp1_synth_get(struct fdp1_context * fdp1,
+				   uint32_t fourcc,
+				   enum v4l2_field field);
+void fdp1_synth_free_all(struct fdp1_context * fdp1);
+
+int fdp1_synth_fill(struct fdp1_synth * synth,
+		    struct fdp1_v4l2_buffer * buffer,
+		    unsigned int sequence);
+
+int fdp1_synth_decode(struct fdp1_synth * synth,
+		      struct fdp1_v4l2_buffer * buffer,
+		      unsigned int expected,
+		      unsigned int * t);
+
+#endif /* _FDP1_SYNTH_H_ */
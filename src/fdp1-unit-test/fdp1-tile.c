@@ -0,0 +1,352 @@
+/*
+ * FDP1 Unit Test Utility
+ *      Author: Kieran Bingham
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by the
+ * Free Software Foundation; either version 2 of the License, or (at your
+ * option) any later version
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <poll.h>
+
+#include <linux/videodev2.h>
+
+#include "fdp1-unit-test.h"
+#include "fdp1-v4l2-helpers.h"
+#include "fdp1-tile.h"
+#include "fdp1.h"
+
+/* Stripes are YUYV, in and out */
+#define FDP1_TILE_BPP		2
+
+/* How long to wait for any stripe before giving up on a frame */
+#define FDP1_TILE_TIMEOUT_MS	1000
+
+/*
+ * The columns of context a stripe needs either side in 'mode'. Progressive
+ * frames only have their chroma resampled, 4:2:2 to 4:4:4 and back, which
+ * reaches a pixel pair either side. The only deinterlacing a stripe can do
+ * (FIXED2D, see fdp1_tile_open()) builds each missing line from the lines
+ * of its own field above and below, along the edge direction it finds
+ * between them. rcar_fdp1 programs that search with fixed values it does
+ * not document, so its reach is taken as 16 columns, 8 pixel pairs either
+ * side, and the Stripe Seam Test holds it to that: a frame tiled with this
+ * overlap must come out as it does processed whole.
+ */
+unsigned int fdp1_tile_overlap(enum fdp1_deint_mode mode)
+{
+	return mode == FDP1_PROGRESSIVE ? 2 : 16;
+}
+
+/*
+ * fdp1_tile_plan
+ *
+ * Split a frame into stripes which each keep 'stripe_width' columns, the
+ * last whatever is left, read with 'overlap' columns either side. Returns
+ * -EINVAL for an empty frame or stripe, or -E2BIG for too many stripes.
+ */
+int fdp1_tile_plan(struct fdp1_tiler * tiler, unsigned int width,
+		   unsigned int height, unsigned int stripe_width,
+		   unsigned int overlap)
+{
+	unsigned int start, end;
+	unsigned int i;
+
+	memzero(*tiler);
+
+	stripe_width &= ~(FDP1_TILE_ALIGN - 1);
+	overlap = (overlap + FDP1_TILE_ALIGN - 1) & ~(FDP1_TILE_ALIGN - 1);
+
+	if (!width || !height || !stripe_width)
+		return -EINVAL;
+
+	tiler->width = width;
+	tiler->height = height;
+	tiler->overlap = overlap;
+	tiler->n_stripes = (width + stripe_width - 1) / stripe_width;
+
+	if (tiler->n_stripes > FDP1_TILE_MAX_STRIPES)
+		return -E2BIG;
+
+	for (i = 0; i < tiler->n_stripes; i++) {
+		struct fdp1_stripe * s = &tiler->stripe[i];
+		unsigned int right;
+
+		start = i * stripe_width;
+		end = start + stripe_width < width ? start + stripe_width : width;
+
+		s->left = start > overlap ? start - overlap : 0;
+		right = end + overlap < width ? end + overlap : width;
+
+		s->width = right - s->left;
+		s->owned = start - s->left;
+		s->kept = end - start;
+	}
+
+	return 0;
+}
+
+/* The columns processed for each frame, overlaps and all */
+unsigned int fdp1_tile_columns(const struct fdp1_tiler * tiler)
+{
+	unsigned int columns = 0;
+	unsigned int i;
+
+	for (i = 0; i < tiler->n_stripes; i++)
+		columns += tiler->stripe[i].width;
+
+	return columns;
+}
+
+/* Narrow a context of the widest stripe's format to a stripe of its own */
+static int fdp1_tile_select(struct fdp1_tiler * tiler, struct fdp1_m2m * m2m,
+			    const struct fdp1_stripe * s)
+{
+	struct fdp1_context * fdp1 = &tiler->fdp1;
+	struct v4l2_rect crop = { 0, 0, s->width, tiler->height };
+	struct v4l2_rect compose = crop;
+
+	if (fdp1_m2m_set_selection(m2m, V4L2_BUF_TYPE_VIDEO_OUTPUT_MPLANE,
+				   V4L2_SEL_TGT_CROP, &crop) ||
+	    fdp1_m2m_set_selection(m2m, V4L2_BUF_TYPE_VIDEO_CAPTURE_MPLANE,
+				   V4L2_SEL_TGT_COMPOSE, &compose))
+		return TEST_FAIL;
+
+	/* The window must be as asked, or the stripes will not line up */
+	if (crop.width != s->width || compose.width != s->width) {
+		kprint(fdp1, 0, "Stripe of %u columns selected as %u, %u\n",
+				s->width, crop.width, compose.width);
+		return TEST_FAIL;
+	}
+
+	return TEST_PASS;
+}
+
+/*
+ * fdp1_tile_open
+ *
+ * Create and start a context for each stripe of a planned tiler, to
+ * process frames of 'field' layout in 'mode'.
+ */
+int fdp1_tile_open(struct fdp1_context * fdp1, struct fdp1_tiler * tiler,
+		   enum v4l2_field field, enum fdp1_deint_mode mode)
+{
+	int captures = fdp1_job_captures(field, mode);
+	unsigned int widest = 0;
+	unsigned int i;
+	int fail = 0;
+
+	if (captures < 0) {
+		kprint(fdp1, 0, "%s in %s needs fields of other frames\n",
+				v4l2_field(field), fdp1_deint_mode_str(mode));
+		return TEST_FAIL;
+	}
+
+	tiler->field = field;
+	tiler->captures = captures;
+
+	for (i = 0; i < tiler->n_stripes; i++)
+		if (tiler->stripe[i].width > widest)
+			widest = tiler->stripe[i].width;
+
+	tiler->fdp1 = *fdp1;
+	tiler->fdp1.width = widest;
+	tiler->fdp1.height = tiler->height;
+	tiler->selection = tiler->n_stripes > 1 &&
+			   fdp1_selection_supported(&tiler->fdp1) > 0;
+
+	kprint(fdp1, 1, "%u stripes of up to %u columns, %u overlapping, %s\n",
+			tiler->n_stripes, widest, tiler->overlap,
+			tiler->selection ? "selected" : "sized to fit");
+
+	for (i = 0; i < tiler->n_stripes && !fail; i++) {
+		const struct fdp1_stripe * s = &tiler->stripe[i];
+		struct fdp1_m2m * m2m;
+
+		if (!tiler->selection)
+			tiler->fdp1.width = s->width;
+
+		m2m = fdp1_create_m2m(&tiler->fdp1, V4L2_PIX_FMT_YUYV, field,
+				      V4L2_PIX_FMT_YUYV);
+		if (!m2m) {
+			kprint(fdp1, 0, "Failed to create a context for stripe %u\n", i);
+			fail++;
+			break;
+		}
+
+		tiler->m2m[i] = m2m;
+
+		/* The stripe is copied in whole, and out again line for line */
+		if (m2m->width < tiler->fdp1.width ||
+		    m2m->height != tiler->height) {
+			kprint(fdp1, 0, "Stripe %u negotiated as %ux%u, not %ux%u\n",
+					i, m2m->width, m2m->height,
+					tiler->fdp1.width, tiler->height);
+			fail++;
+			break;
+		}
+
+		if (tiler->selection && s->width != widest)
+			fail += fdp1_tile_select(tiler, m2m, s);
+
+		if (m2m->dst_queue.pool->qty < tiler->captures)
+			fail++;
+
+		if (field != V4L2_FIELD_NONE &&
+		    fdp1_m2m_set_ctrl(m2m, V4L2_CID_DEINTERLACING_MODE, mode))
+			fail++;
+
+		fail += !!fdp1_m2m_stream_on(m2m, V4L2_BUF_TYPE_VIDEO_OUTPUT_MPLANE);
+		fail += !!fdp1_m2m_stream_on(m2m, V4L2_BUF_TYPE_VIDEO_CAPTURE_MPLANE);
+	}
+
+	if (fail)
+		fdp1_tile_close(tiler);
+
+	return fail;
+}
+
+void fdp1_tile_close(struct fdp1_tiler * tiler)
+{
+	unsigned int i;
+
+	for (i = 0; i < tiler->n_stripes; i++) {
+		fdp1_free_m2m(tiler->m2m[i]);
+		tiler->m2m[i] = NULL;
+	}
+}
+
+/*
+ * Copy the columns of a stripe, overlap and all, into its output buffer,
+ * which fdp1_tile_open() made sure has room for them, and the frame's lines.
+ */
+static void fdp1_tile_copy_in(const struct fdp1_stripe * s,
+			      struct fdp1_v4l2_buffer * buffer,
+			      const uint8_t * src, unsigned int src_stride)
+{
+	struct fdp1_v4l2_plane_layout layout[3];
+	char * line;
+	unsigned int y;
+
+	fdp1_v4l2_buffer_layout(buffer, layout);
+	line = buffer->mem[layout[0].mem] + layout[0].offset;
+
+	src += s->left * FDP1_TILE_BPP;
+
+	for (y = 0; y < layout[0].lines; y++, line += layout[0].stride)
+		memcpy(line, src + (size_t)y * src_stride, s->width * FDP1_TILE_BPP);
+}
+
+/* Copy the columns a stripe owns from its capture into the whole frame */
+static void fdp1_tile_copy_out(const struct fdp1_stripe * s,
+			       struct fdp1_v4l2_buffer * buffer,
+			       uint8_t * dst, unsigned int dst_stride)
+{
+	struct fdp1_v4l2_plane_layout layout[3];
+	const char * line;
+	unsigned int y;
+
+	fdp1_v4l2_buffer_layout(buffer, layout);
+	line = buffer->mem[layout[0].mem] + layout[0].offset +
+	       s->owned * FDP1_TILE_BPP;
+
+	dst += (s->left + s->owned) * FDP1_TILE_BPP;
+
+	for (y = 0; y < layout[0].lines; y++, line += layout[0].stride)
+		memcpy(dst + (size_t)y * dst_stride, line, s->kept * FDP1_TILE_BPP);
+}
+
+/*
+ * fdp1_tile_process
+ *
+ * Process one frame of 'src' through every stripe at once, stitching each
+ * capture into 'dst', which takes the captures of the frame one after the
+ * other, each 'height' lines of 'dst_stride' bytes. Returns the number of
+ * captures, or -errno.
+ */
+int fdp1_tile_process(struct fdp1_tiler * tiler,
+		      const uint8_t * src, unsigned int src_stride,
+		      uint8_t * dst, unsigned int dst_stride)
+{
+	struct pollfd pfd[FDP1_TILE_MAX_STRIPES];
+	unsigned int captured[FDP1_TILE_MAX_STRIPES];
+	bool returned[FDP1_TILE_MAX_STRIPES];
+	size_t frame_size = (size_t)tiler->height * dst_stride;
+	unsigned int pending = 0;
+	unsigned int i, c;
+
+	for (i = 0; i < tiler->n_stripes; i++) {
+		struct fdp1_m2m * m2m = tiler->m2m[i];
+		struct fdp1_v4l2_buffer * out = &m2m->src_queue.pool->buffer[0];
+
+		if (fdp1_v4l2_buffer_set_state(out, FDP1_BUF_FILLED))
+			return -EBUSY;
+
+		fdp1_tile_copy_in(&tiler->stripe[i], out, src, src_stride);
+
+		for (c = 0; c < tiler->captures; c++)
+			if (fdp1_v4l2_queue_buffer(m2m->dev,
+						   &m2m->dst_queue.pool->buffer[c]))
+				return -errno;
+
+		if (fdp1_v4l2_queue_buffer(m2m->dev, out))
+			return -errno;
+
+		pfd[i].fd = m2m->dev->fd;
+		pfd[i].events = POLLIN | POLLOUT;
+		captured[i] = 0;
+		returned[i] = false;
+		pending += tiler->captures + 1;
+	}
+
+	while (pending) {
+		int ret = poll(pfd, tiler->n_stripes, FDP1_TILE_TIMEOUT_MS);
+
+		if (ret < 0 && errno == EINTR)
+			continue;
+		if (ret <= 0)
+			return ret ? -errno : -ETIMEDOUT;
+
+		for (i = 0; i < tiler->n_stripes; i++) {
+			struct fdp1_m2m * m2m = tiler->m2m[i];
+			struct fdp1_v4l2_buffer * buffer;
+
+			if (pfd[i].revents & POLLERR)
+				return -EIO;
+
+			if (pfd[i].revents & POLLOUT && !returned[i]) {
+				buffer = fdp1_v4l2_dequeue_buffer(m2m->dev,
+								  &m2m->src_queue);
+				if (!buffer)
+					return -errno;
+
+				fdp1_v4l2_buffer_release(buffer);
+				returned[i] = true;
+				pending--;
+			}
+
+			if (pfd[i].revents & POLLIN && captured[i] < tiler->captures) {
+				buffer = fdp1_v4l2_dequeue_buffer(m2m->dev,
+								  &m2m->dst_queue);
+				if (!buffer)
+					return -errno;
+
+				fdp1_tile_copy_out(&tiler->stripe[i], buffer,
+						   dst + captured[i] * frame_size,
+						   dst_stride);
+				fdp1_v4l2_buffer_release(buffer);
+				captured[i]++;
+				pending--;
+			}
+
+			/* Done with this stripe: poll() skips negative fds */
+			if (returned[i] && captured[i] == tiler->captures)
+				pfd[i].fd = -1;
+		}
+	}
+
+	return tiler->captures;
+}
@@ -0,0 +1,76 @@
+/*
+ * FDP1 Unit Test Utility
+ *      Author: Kieran Bingham
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by the
+ * Free Software Foundation; either version 2 of the License, or (at your
+ * option) any later version
+ */
+
+#ifndef _FDP1_TILE_H_
+#define _FDP1_TILE_H_
+
+/*
+ * Stripe tiling
+ *
+ * A frame wider than one context can take is split into vertical stripes,
+ * each processed as a frame of its own by a context of its own, all queued
+ * at once, and written back into the whole frame. Each stripe is read with
+ * 'overlap' extra columns either side (where the frame has them), so that
+ * the filters of the deinterlacer see the same pixels at the edge of a
+ * stripe as they would in the whole frame. Only the columns a stripe owns
+ * are kept, so the stripes meet without seams.
+ *
+ * A context per stripe keeps the field history of its own columns, but
+ * only layouts and modes which produce each capture from the frame it
+ * came with (as fdp1_job_captures() has it) can be tiled.
+ */
+#define FDP1_TILE_MAX_STRIPES	16
+
+/* Stripes start on a pixel pair, as YUYV does */
+#define FDP1_TILE_ALIGN		2
+
+struct fdp1_stripe {
+	unsigned int left;	/* The first column read from the source */
+	unsigned int width;	/* Columns read, owned and overlap */
+	unsigned int owned;	/* The first column kept, from 'left' */
+	unsigned int kept;	/* Columns kept */
+};
+
+struct fdp1_tiler {
+	unsigned int width;
+	unsigned int height;
+	unsigned int overlap;
+	enum v4l2_field field;
+	unsigned int captures;	/* Per frame processed */
+
+	unsigned int n_stripes;
+	struct fdp1_stripe stripe[FDP1_TILE_MAX_STRIPES];
+
+	/*
+	 * With selection support every context has the format of the widest
+	 * stripe, cropped and composed to its own. Otherwise each is set to
+	 * the size of its stripe.
+	 */
+	bool selection;
+	struct fdp1_context fdp1;
+	struct fdp1_m2m * m2m[FDP1_TILE_MAX_STRIPES];
+};
+
+unsigned int fdp1_tile_overlap(enum fdp1_deint_mode mode);
+
+int fdp1_tile_plan(struct fdp1_tiler * tiler, unsigned int width,
+		   unsigned int height, unsigned int stripe_width,
+		   unsigned int overlap);
+unsigned int fdp1_tile_columns(const struct fdp1_tiler * tiler);
+
+int fdp1_tile_open(struct fdp1_context * fdp1, struct fdp1_tiler * tiler,
+		   enum v4l2_field field, enum fdp1_deint_mode mode);
+void fdp1_tile_close(struct fdp1_tiler * tiler);
+
+int fdp1_tile_process(struct fdp1_tiler * tiler,
+		      const uint8_t * src, unsigned int src_stride,
+		      uint8_t * dst, unsigned int dst_stride);
+
+#endif /* _FDP1_TILE_H_ */
@@ -0,0 +1,341 @@
+/*
+ * FDP1 Unit Test Utility
+ *      Author: Kieran Bingham
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by the
+ * Free Software Foundation; either version 2 of the License, or (at your
+ * option) any later version
+ */
+
+#include <inttypes.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include <linux/videodev2.h>
+
+#include "fdp1-unit-test.h"
+#include "fdp1-v4l2-helpers.h"
+#include "fdp1-stats.h"
+#include "fdp1-trace.h"
+
+/* Every ioctl, by phase where it has one, and by number where not */
+#define FDP1_TRACE_IOCTLS	256
+
+struct fdp1_trace_report {
+	struct fdp1_latency phase[FDP1_PHASE_MAX];
+	unsigned int phase_errors[FDP1_PHASE_MAX];
+
+	struct fdp1_latency ioctl[FDP1_TRACE_IOCTLS];
+	unsigned int ioctl_errors[FDP1_TRACE_IOCTLS];
+
+	struct fdp1_latency poll;
+	struct fdp1_latency select;
+
+	/* Capture, output */
+	struct fdp1_latency lifetime[2];
+	uint64_t depth_sum[2];
+	unsigned int depth_count[2];
+	unsigned int depth_max[2];
+
+	uint64_t records;
+	uint64_t lost;
+};
+
+/* Options filled with defaults */
+static struct fdp1_context fdp1_ctx = {
+	.verbose = false,
+};
+
+static int unlink_ring;
+
+void help(char ** argv, struct fdp1_context * fdp1)
+{
+	printf("%s: [options] PID|NAME\n", fdp1->appname);
+	printf("Report the V4L2 calls recorded by libfdp1-trace.so\n");
+	printf("--unlink/-u     :  Remove the recording once reported\n");
+	printf("--verbose/v     :  List each call [%d]\n", fdp1->verbose);
+	printf("--help/-?       :  Display this help\n");
+
+	printf("\n");
+}
+
+int process_arguments(int argc, char ** argv, struct fdp1_context * fdp1)
+{
+	int option;
+
+	static struct option long_options[] = {
+		/*  { .name, .has_arg, .flag, .val } */
+		{"unlink",	no_argument,		0, 'u'},
+		{"verbose",	no_argument,		0, 'v'},
+		{"help",  	no_argument, 		0, '?'},
+		{0, 0, 0, 0}
+	};
+
+	while ((option = getopt_long(argc, argv, "uv?",
+			long_options, NULL)) != -1) {
+
+		switch (option) {
+		case 'u':
+			unlink_ring = 1;
+			break;
+		case 'v':
+			fdp1->verbose++;
+			break;
+		default:
+		case '?':
+			help(argv, fdp1);
+			exit(0);
+			break;
+		}
+	}
+
+	if (optind != argc - 1) {
+		help(argv, fdp1);
+		exit(1);
+	}
+
+	return 0;
+}
+
+static char * fdp1_trace_event_str(const struct fdp1_trace_record * record,
+				   char * buf, size_t size)
+{
+	int phase;
+
+	switch (record->event) {
+	case FDP1_TRACE_IOCTL:
+		phase = fdp1_v4l2_ioctl_phase(record->arg);
+		if (phase >= 0)
+			return fdp1_v4l2_phase_str(phase);
+
+		snprintf(buf, size, "ioctl %" PRIu64, (uint64_t)_IOC_NR(record->arg));
+		return buf;
+	case FDP1_TRACE_MMAP:
+		return fdp1_v4l2_phase_str(FDP1_PHASE_MMAP);
+	case FDP1_TRACE_POLL:
+		return "poll";
+	case FDP1_TRACE_SELECT:
+		return "select";
+	default:
+		return "unknown";
+	}
+}
+
+static void fdp1_trace_account(struct fdp1_trace_report * report,
+			       const struct fdp1_trace_record * record)
+{
+	struct fdp1_latency * lat;
+	unsigned int * errors = NULL;
+	int phase;
+
+	switch (record->event) {
+	case FDP1_TRACE_IOCTL:
+		phase = fdp1_v4l2_ioctl_phase(record->arg);
+		if (phase >= 0) {
+			lat = &report->phase[phase];
+			errors = &report->phase_errors[phase];
+		} else {
+			lat = &report->ioctl[_IOC_NR(record->arg)];
+			errors = &report->ioctl_errors[_IOC_NR(record->arg)];
+		}
+		break;
+	case FDP1_TRACE_MMAP:
+		lat = &report->phase[FDP1_PHASE_MMAP];
+		errors = &report->phase_errors[FDP1_PHASE_MMAP];
+		break;
+	case FDP1_TRACE_POLL:
+		lat = &report->poll;
+		break;
+	case FDP1_TRACE_SELECT:
+		lat = &report->select;
+		break;
+	default:
+		return;
+	}
+
+	fdp1_latency_add(lat, record->duration_ns);
+	if (errors && record->ret < 0)
+		(*errors)++;
+
+	/* Only the buffer ioctls which succeeded carry a queue */
+	if (record->event == FDP1_TRACE_IOCTL && record->type && !record->ret) {
+		unsigned int q = !!V4L2_TYPE_IS_OUTPUT(record->type);
+
+		if (record->arg == VIDIOC_DQBUF && record->lifetime_ns)
+			fdp1_latency_add(&report->lifetime[q], record->lifetime_ns);
+
+		report->depth_sum[q] += record->depth;
+		report->depth_count[q]++;
+		if (record->depth > report->depth_max[q])
+			report->depth_max[q] = record->depth;
+	}
+}
+
+static void fdp1_trace_print(char * name, const struct fdp1_latency * lat,
+			     unsigned int errors)
+{
+	if (!lat->count)
+		return;
+
+	printf("%-14s %8" PRIu64 " %8u %10.1f %10.1f %10.1f\n", name,
+	       lat->count, errors,
+	       fdp1_latency_avg(lat) / 1000.0,
+	       fdp1_latency_percentile(lat, 99) / 1000.0,
+	       lat->max / 1000.0);
+}
+
+static void fdp1_trace_report(struct fdp1_trace_report * report)
+{
+	unsigned int i;
+	char name[32];
+
+	printf("%" PRIu64 " calls recorded", report->records);
+	if (report->lost)
+		printf(", %" PRIu64 " lost to the ring wrapping", report->lost);
+	printf("\n\n");
+
+	printf("%-14s %8s %8s %10s %10s %10s\n", "Call", "count", "errors",
+	       "avg us", "p99 us", "max us");
+
+	for (i = 0; i < FDP1_PHASE_MAX; i++)
+		fdp1_trace_print(fdp1_v4l2_phase_str(i), &report->phase[i],
+				 report->phase_errors[i]);
+
+	for (i = 0; i < FDP1_TRACE_IOCTLS; i++) {
+		snprintf(name, sizeof(name), "ioctl %u", i);
+		fdp1_trace_print(name, &report->ioctl[i],
+				 report->ioctl_errors[i]);
+	}
+
+	fdp1_trace_print("poll", &report->poll, 0);
+	fdp1_trace_print("select", &report->select, 0);
+
+	if (!report->depth_count[0] && !report->depth_count[1])
+		return;
+
+	printf("\n%-14s %8s %10s %10s %10s %9s %9s\n", "Queue", "buffers",
+	       "avg us", "p99 us", "max us", "avg depth", "max depth");
+
+	for (i = 0; i < 2; i++) {
+		struct fdp1_latency * lat = &report->lifetime[i];
+		uint32_t type = i ? V4L2_BUF_TYPE_VIDEO_OUTPUT_MPLANE :
+				    V4L2_BUF_TYPE_VIDEO_CAPTURE_MPLANE;
+
+		if (!report->depth_count[i])
+			continue;
+
+		printf("%-14s %8" PRIu64 " %10.1f %10.1f %10.1f %9.1f %9u\n",
+		       q_type(type), lat->count,
+		       fdp1_latency_avg(lat) / 1000.0,
+		       fdp1_latency_percentile(lat, 99) / 1000.0,
+		       lat->max / 1000.0,
+		       (double)report->depth_sum[i] / report->depth_count[i],
+		       report->depth_max[i]);
+	}
+}
+
+int main(int argc, char ** argv)
+{
+	struct fdp1_trace_report * report;
+	struct fdp1_trace_ring * ring;
+	const char * prefix = getenv("FDP1_TRACE");
+	char * arg, * end;
+	char name[256];
+	struct stat st;
+	uint64_t head, n;
+	uint64_t start = 0;
+	int fd;
+
+	char * searched = strrchr(argv[0], '/');
+	fdp1_ctx.appname = searched ? searched + 1 : argv[0];
+
+	process_arguments(argc, argv, &fdp1_ctx);
+
+	/* A pid names the recording of that process */
+	arg = argv[optind];
+	strtoul(arg, &end, 10);
+	if (*arg && !*end)
+		snprintf(name, sizeof(name), "%s.%s",
+			 prefix ? prefix : FDP1_TRACE_NAME, arg);
+	else
+		snprintf(name, sizeof(name), "%s", arg);
+
+	fd = shm_open(name, O_RDONLY, 0);
+	if (fd < 0 || fstat(fd, &st)) {
+		perror(name);
+		return 1;
+	}
+
+	ring = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+	close(fd);
+
+	if (ring == MAP_FAILED) {
+		perror("mmap");
+		return 1;
+	}
+
+	if ((size_t)st.st_size < sizeof(*ring) ||
+	    memcmp(ring->magic, FDP1_TRACE_MAGIC, sizeof(ring->magic)) ||
+	    ring->version != FDP1_TRACE_VERSION ||
+	    ring->record_size != sizeof(ring->records[0]) ||
+	    sizeof(*ring) + (size_t)ring->capacity * ring->record_size >
+	    (size_t)st.st_size) {
+		fprintf(stderr, "%s: not a recording this tool can read\n", name);
+		return 1;
+	}
+
+	report = calloc(1, sizeof(*report));
+	if (!report) {
+		perror("calloc");
+		return 1;
+	}
+
+	head = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+	if (head > ring->capacity)
+		start = head - ring->capacity;
+
+	printf("%s: pid %u\n", name, ring->pid);
+
+	for (n = start; n < head; n++) {
+		const struct fdp1_trace_record * slot =
+			&ring->records[n & (ring->capacity - 1)];
+		struct fdp1_trace_record record;
+		char buf[32];
+
+		/* Skip any record still being written, or already overwritten */
+		if (__atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE) != n + 1)
+			continue;
+
+		record = *slot;
+		if (__atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE) != n + 1)
+			continue;
+
+		report->records++;
+		fdp1_trace_account(report, &record);
+
+		if (fdp1_ctx.verbose)
+			printf("%" PRIu64 ".%06" PRIu64 " %5u fd %-3d %-12s %4d "
+			       "%8.1f us %s %u depth %u\n",
+			       record.start_ns / 1000000000,
+			       record.start_ns / 1000 % 1000000,
+			       record.tid, record.fd,
+			       fdp1_trace_event_str(&record, buf, sizeof(buf)),
+			       record.ret, record.duration_ns / 1000.0,
+			       record.type ? q_type(record.type) : "-",
+			       record.index, record.depth);
+	}
+
+	report->lost = start;
+
+	fdp1_trace_report(report);
+
+	free(report);
+	munmap(ring, st.st_size);
+
+	if (unlink_ring && shm_unlink(name))
+		perror(name);
+
+	return 0;
+}
@@ -0,0 +1,533 @@
+/*
+ * FDP1 Unit Test Utility
+ *      Author: Kieran Bingham
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by the
+ * Free Software Foundation; either version 2 of the License, or (at your
+ * option) any later version
+ */
+
+/*
+ * libfdp1-trace.so: LD_PRELOAD=libfdp1-trace.so <client>
+ *
+ * This is loaded into processes which know nothing of us, so it stands
+ * alone: nothing from the rest of the utility is linked in, no symbol but
+ * the interposed calls is exported, and errno is preserved across them.
+ */
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdarg.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <dlfcn.h>
+#include <poll.h>
+#include <signal.h>
+#include <time.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/select.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <sys/sysmacros.h>
+
+#include <linux/videodev2.h>
+
+#include "fdp1-trace.h"
+
+#define FDP1_TRACE_EXPORT	__attribute__((visibility("default")))
+
+/* The character device major of every V4L2 device node */
+#define FDP1_TRACE_V4L2_MAJOR	81
+
+/* File descriptors tracked; calls on any beyond are not recorded */
+#define FDP1_TRACE_FDS		1024
+
+enum fdp1_trace_fd_kind {
+	FDP1_TRACE_FD_UNKNOWN = 0,
+	FDP1_TRACE_FD_V4L2,
+	FDP1_TRACE_FD_OTHER,
+};
+
+struct fdp1_trace_queue {
+	uint32_t queued;	/* A bit for each index with the driver */
+	uint64_t since[FDP1_TRACE_BUFFERS];
+};
+
+struct fdp1_trace_fd {
+	int kind;
+
+	/* The file the kind was worked out for */
+	dev_t dev;
+	ino_t ino;
+	dev_t rdev;
+
+	struct fdp1_trace_queue queue[2];	/* Capture, output */
+};
+
+enum fdp1_trace_state {
+	FDP1_TRACE_IDLE = 0,
+	FDP1_TRACE_CREATING,
+	FDP1_TRACE_READY,
+	FDP1_TRACE_FAILED,
+};
+
+static struct {
+	int (*ioctl)(int, unsigned long, ...);
+	void * (*mmap)(void *, size_t, int, int, int, off_t);
+	void * (*mmap64)(void *, size_t, int, int, int, off64_t);
+	int (*poll)(struct pollfd *, nfds_t, int);
+	int (*ppoll)(struct pollfd *, nfds_t, const struct timespec *,
+		     const sigset_t *);
+	int (*select)(int, fd_set *, fd_set *, fd_set *, struct timeval *);
+	int (*close)(int);
+} real;
+
+static int fdp1_trace_state;
+static struct fdp1_trace_ring * fdp1_trace_ring;
+static struct fdp1_trace_fd fdp1_trace_fds[FDP1_TRACE_FDS];
+
+static void fdp1_trace_resolve(void)
+{
+	real.ioctl = dlsym(RTLD_NEXT, "ioctl");
+	real.mmap = dlsym(RTLD_NEXT, "mmap");
+	real.mmap64 = dlsym(RTLD_NEXT, "mmap64");
+	real.poll = dlsym(RTLD_NEXT, "poll");
+	real.ppoll = dlsym(RTLD_NEXT, "ppoll");
+	real.select = dlsym(RTLD_NEXT, "select");
+	real.close = dlsym(RTLD_NEXT, "close");
+}
+
+static uint64_t fdp1_trace_now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/*
+ * Create this process's ring. Only one thread creates it; any other
+ * tracing meanwhile goes unrecorded rather than waiting.
+ */
+static void fdp1_trace_create(void)
+{
+	struct fdp1_trace_ring * ring;
+	const char * prefix = getenv("FDP1_TRACE");
+	const char * records = getenv("FDP1_TRACE_RECORDS");
+	unsigned int capacity = FDP1_TRACE_RECORDS;
+	int expected = FDP1_TRACE_IDLE;
+	char name[256];
+	size_t size;
+	int fd;
+
+	if (!__atomic_compare_exchange_n(&fdp1_trace_state, &expected,
+					 FDP1_TRACE_CREATING, false,
+					 __ATOMIC_ACQUIRE, __ATOMIC_RELAXED))
+		return;
+
+	if (records && atoi(records) > 0)
+		capacity = atoi(records);
+
+	/* Round up to a power of two, so a position is a mask away */
+	while (capacity & (capacity - 1))
+		capacity += capacity & -capacity;
+
+	snprintf(name, sizeof(name), "%s.%d", prefix ? prefix : FDP1_TRACE_NAME,
+		 getpid());
+	size = sizeof(*ring) + capacity * sizeof(ring->records[0]);
+
+	fd = shm_open(name, O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0600);
+	if (fd < 0 || ftruncate(fd, size)) {
+		fprintf(stderr, "fdp1-trace: %s: %s\n", name, strerror(errno));
+		if (fd >= 0)
+			real.close(fd);
+		__atomic_store_n(&fdp1_trace_state, FDP1_TRACE_FAILED,
+				 __ATOMIC_RELEASE);
+		return;
+	}
+
+	ring = real.mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	real.close(fd);
+
+	if (ring == MAP_FAILED) {
+		fprintf(stderr, "fdp1-trace: %s: %s\n", name, strerror(errno));
+		__atomic_store_n(&fdp1_trace_state, FDP1_TRACE_FAILED,
+				 __ATOMIC_RELEASE);
+		return;
+	}
+
+	memcpy(ring->magic, FDP1_TRACE_MAGIC, sizeof(ring->magic));
+	ring->version = FDP1_TRACE_VERSION;
+	ring->record_size = sizeof(ring->records[0]);
+	ring->capacity = capacity;
+	ring->pid = getpid();
+
+	fprintf(stderr, "fdp1-trace: recording to %s, %u records\n",
+		name, capacity);
+
+	fdp1_trace_ring = ring;
+	__atomic_store_n(&fdp1_trace_state, FDP1_TRACE_READY, __ATOMIC_RELEASE);
+}
+
+/*
+ * Whether 'fd' is a V4L2 device. A number can be closed and reused without
+ * our close() seeing it (close_range, fclose, dup2 and dup3), so the file
+ * it was worked out for is checked again with fstat() on every call.
+ */
+static struct fdp1_trace_fd * fdp1_trace_fd(int fd)
+{
+	struct fdp1_trace_fd * tfd;
+	struct stat st;
+	int kind;
+
+	if (fd < 0 || fd >= FDP1_TRACE_FDS || fstat(fd, &st))
+		return NULL;
+
+	tfd = &fdp1_trace_fds[fd];
+	kind = __atomic_load_n(&tfd->kind, __ATOMIC_RELAXED);
+
+	if (kind == FDP1_TRACE_FD_UNKNOWN || tfd->dev != st.st_dev ||
+	    tfd->ino != st.st_ino || tfd->rdev != st.st_rdev) {
+		/* Another file: nothing of it is queued yet */
+		memset(tfd, 0, sizeof(*tfd));
+		tfd->dev = st.st_dev;
+		tfd->ino = st.st_ino;
+		tfd->rdev = st.st_rdev;
+
+		kind = FDP1_TRACE_FD_OTHER;
+		if (S_ISCHR(st.st_mode) &&
+		    major(st.st_rdev) == FDP1_TRACE_V4L2_MAJOR)
+			kind = FDP1_TRACE_FD_V4L2;
+
+		__atomic_store_n(&tfd->kind, kind, __ATOMIC_RELAXED);
+	}
+
+	if (kind != FDP1_TRACE_FD_V4L2)
+		return NULL;
+
+	if (__atomic_load_n(&fdp1_trace_state, __ATOMIC_ACQUIRE) == FDP1_TRACE_IDLE)
+		fdp1_trace_create();
+
+	return tfd;
+}
+
+static void fdp1_trace_record(struct fdp1_trace_record * record)
+{
+	struct fdp1_trace_ring * ring;
+	struct fdp1_trace_record * slot;
+	uint64_t n;
+
+	if (__atomic_load_n(&fdp1_trace_state, __ATOMIC_ACQUIRE) != FDP1_TRACE_READY)
+		return;
+
+	ring = fdp1_trace_ring;
+	n = __atomic_fetch_add(&ring->head, 1, __ATOMIC_RELAXED);
+	slot = &ring->records[n & (ring->capacity - 1)];
+
+	/* Invalidate the slot while it is rewritten */
+	__atomic_store_n(&slot->seq, 0, __ATOMIC_RELAXED);
+	__atomic_thread_fence(__ATOMIC_RELEASE);
+
+	record->tid = syscall(SYS_gettid);
+	memcpy((char *)slot + sizeof(slot->seq),
+	       (char *)record + sizeof(record->seq),
+	       sizeof(*record) - sizeof(record->seq));
+
+	__atomic_store_n(&slot->seq, n + 1, __ATOMIC_RELEASE);
+}
+
+/* Follow the buffers through QBUF, DQBUF, and the resets of a queue */
+static void fdp1_trace_buffers(struct fdp1_trace_fd * tfd,
+			       unsigned long request, void * arg,
+			       struct fdp1_trace_record * record)
+{
+	struct v4l2_buffer * buf = arg;
+	struct fdp1_trace_queue * queue;
+	uint32_t bit;
+
+	switch (request) {
+	case VIDIOC_QBUF:
+	case VIDIOC_DQBUF:
+		break;
+	case VIDIOC_STREAMOFF:
+		queue = &tfd->queue[!!V4L2_TYPE_IS_OUTPUT(*(int *)arg)];
+		__atomic_store_n(&queue->queued, 0, __ATOMIC_RELAXED);
+		return;
+	case VIDIOC_REQBUFS:
+		queue = &tfd->queue[!!V4L2_TYPE_IS_OUTPUT(
+				((struct v4l2_requestbuffers *)arg)->type)];
+		__atomic_store_n(&queue->queued, 0, __ATOMIC_RELAXED);
+		return;
+	default:
+		return;
+	}
+
+	record->type = buf->type;
+	record->index = buf->index;
+
+	if (buf->index >= FDP1_TRACE_BUFFERS)
+		return;
+
+	queue = &tfd->queue[!!V4L2_TYPE_IS_OUTPUT(buf->type)];
+	bit = 1U << buf->index;
+
+	if (request == VIDIOC_QBUF) {
+		queue->since[buf->index] = record->start_ns;
+		record->depth = __builtin_popcount(
+			__atomic_or_fetch(&queue->queued, bit, __ATOMIC_RELAXED));
+	} else {
+		if (queue->queued & bit)
+			record->lifetime_ns = record->start_ns +
+					      record->duration_ns -
+					      queue->since[buf->index];
+		record->depth = __builtin_popcount(
+			__atomic_and_fetch(&queue->queued, ~bit, __ATOMIC_RELAXED));
+	}
+}
+
+FDP1_TRACE_EXPORT
+int ioctl(int fd, unsigned long request, ...)
+{
+	struct fdp1_trace_record record;
+	struct fdp1_trace_fd * tfd;
+	va_list ap;
+	void * arg;
+	int ret;
+	int err;
+
+	va_start(ap, request);
+	arg = va_arg(ap, void *);
+	va_end(ap);
+
+	if (!real.ioctl)
+		fdp1_trace_resolve();
+
+	tfd = fdp1_trace_fd(fd);
+	if (!tfd)
+		return real.ioctl(fd, request, arg);
+
+	memset(&record, 0, sizeof(record));
+	record.event = FDP1_TRACE_IOCTL;
+	record.fd = fd;
+	record.arg = request;
+
+	record.start_ns = fdp1_trace_now();
+	ret = real.ioctl(fd, request, arg);
+	err = errno;
+	record.duration_ns = fdp1_trace_now() - record.start_ns;
+	record.ret = ret < 0 ? -err : ret;
+
+	if (!ret)
+		fdp1_trace_buffers(tfd, request, arg, &record);
+
+	fdp1_trace_record(&record);
+
+	errno = err;
+	return ret;
+}
+
+static void fdp1_trace_mmap(int fd, size_t length, uint64_t start,
+			    void * mem, int err)
+{
+	struct fdp1_trace_record record;
+
+	memset(&record, 0, sizeof(record));
+	record.event = FDP1_TRACE_MMAP;
+	record.fd = fd;
+	record.arg = length;
+	record.start_ns = start;
+	record.duration_ns = fdp1_trace_now() - start;
+	record.ret = mem == MAP_FAILED ? -err : 0;
+
+	fdp1_trace_record(&record);
+}
+
+FDP1_TRACE_EXPORT
+void * mmap(void * addr, size_t length, int prot, int flags, int fd,
+	    off_t offset)
+{
+	uint64_t start;
+	void * mem;
+	int err;
+
+	if (!real.mmap)
+		fdp1_trace_resolve();
+
+	if (!fdp1_trace_fd(fd))
+		return real.mmap(addr, length, prot, flags, fd, offset);
+
+	start = fdp1_trace_now();
+	mem = real.mmap(addr, length, prot, flags, fd, offset);
+	err = errno;
+
+	fdp1_trace_mmap(fd, length, start, mem, err);
+
+	errno = err;
+	return mem;
+}
+
+/* Where off_t is 32 bits, large file clients call this instead */
+FDP1_TRACE_EXPORT
+void * mmap64(void * addr, size_t length, int prot, int flags, int fd,
+	      off64_t offset)
+{
+	uint64_t start;
+	void * mem;
+	int err;
+
+	if (!real.mmap64)
+		fdp1_trace_resolve();
+
+	if (!fdp1_trace_fd(fd))
+		return real.mmap64(addr, length, prot, flags, fd, offset);
+
+	start = fdp1_trace_now();
+	mem = real.mmap64(addr, length, prot, flags, fd, offset);
+	err = errno;
+
+	fdp1_trace_mmap(fd, length, start, mem, err);
+
+	errno = err;
+	return mem;
+}
+
+/* The first V4L2 device among those polled, or -1 */
+static int fdp1_trace_pollfds(struct pollfd * fds, nfds_t nfds)
+{
+	nfds_t i;
+
+	for (i = 0; i < nfds; i++)
+		if (fdp1_trace_fd(fds[i].fd))
+			return fds[i].fd;
+
+	return -1;
+}
+
+static void fdp1_trace_wait(enum fdp1_trace_event event, int fd,
+			    uint64_t start, int64_t timeout_ms, int ret,
+			    int err)
+{
+	struct fdp1_trace_record record;
+
+	memset(&record, 0, sizeof(record));
+	record.event = event;
+	record.fd = fd;
+	record.arg = timeout_ms;
+	record.start_ns = start;
+	record.duration_ns = fdp1_trace_now() - start;
+	record.ret = ret < 0 ? -err : ret;
+
+	fdp1_trace_record(&record);
+}
+
+FDP1_TRACE_EXPORT
+int poll(struct pollfd * fds, nfds_t nfds, int timeout)
+{
+	uint64_t start;
+	int ret, err;
+	int fd;
+
+	if (!real.poll)
+		fdp1_trace_resolve();
+
+	fd = fdp1_trace_pollfds(fds, nfds);
+	if (fd < 0)
+		return real.poll(fds, nfds, timeout);
+
+	start = fdp1_trace_now();
+	ret = real.poll(fds, nfds, timeout);
+	err = errno;
+
+	fdp1_trace_wait(FDP1_TRACE_POLL, fd, start, timeout, ret, err);
+
+	errno = err;
+	return ret;
+}
+
+FDP1_TRACE_EXPORT
+int ppoll(struct pollfd * fds, nfds_t nfds, const struct timespec * tmo,
+	  const sigset_t * sigmask)
+{
+	uint64_t start;
+	int ret, err;
+	int fd;
+
+	if (!real.ppoll)
+		fdp1_trace_resolve();
+
+	fd = fdp1_trace_pollfds(fds, nfds);
+	if (fd < 0)
+		return real.ppoll(fds, nfds, tmo, sigmask);
+
+	start = fdp1_trace_now();
+	ret = real.ppoll(fds, nfds, tmo, sigmask);
+	err = errno;
+
+	fdp1_trace_wait(FDP1_TRACE_POLL, fd, start,
+			tmo ? tmo->tv_sec * 1000 + tmo->tv_nsec / 1000000 : -1,
+			ret, err);
+
+	errno = err;
+	return ret;
+}
+
+FDP1_TRACE_EXPORT
+int select(int nfds, fd_set * readfds, fd_set * writefds, fd_set * exceptfds,
+	   struct timeval * timeout)
+{
+	int64_t timeout_ms = -1;
+	uint64_t start;
+	int ret, err;
+	int fd;
+
+	if (!real.select)
+		fdp1_trace_resolve();
+
+	for (fd = 0; fd < nfds; fd++) {
+		if (!((readfds && FD_ISSET(fd, readfds)) ||
+		      (writefds && FD_ISSET(fd, writefds)) ||
+		      (exceptfds && FD_ISSET(fd, exceptfds))))
+			continue;
+
+		if (fdp1_trace_fd(fd))
+			break;
+	}
+
+	if (fd == nfds)
+		return real.select(nfds, readfds, writefds, exceptfds, timeout);
+
+	/* Taken now, as Linux updates it with the time left */
+	if (timeout)
+		timeout_ms = timeout->tv_sec * 1000 + timeout->tv_usec / 1000;
+
+	start = fdp1_trace_now();
+	ret = real.select(nfds, readfds, writefds, exceptfds, timeout);
+	err = errno;
+
+	fdp1_trace_wait(FDP1_TRACE_SELECT, fd, start, timeout_ms, ret, err);
+
+	errno = err;
+	return ret;
+}
+
+/* A closed descriptor number is reused for whatever is opened next */
+FDP1_TRACE_EXPORT
+int close(int fd)
+{
+	if (!real.close)
+		fdp1_trace_resolve();
+
+	if (fd >= 0 && fd < FDP1_TRACE_FDS)
+		memset(&fdp1_trace_fds[fd], 0, sizeof(fdp1_trace_fds[fd]));
+
+	return real.close(fd);
+}
@@ -0,0 +1,72 @@
+/*
+ * FDP1 Unit Test Utility
+ *      Author: Kieran Bingham
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by the
+ * Free Software Foundation; either version 2 of the License, or (at your
+ * option) any later version
+ */
+
+#ifndef _FDP1_TRACE_H_
+#define _FDP1_TRACE_H_
+
+/*
+ * V4L2 call trace
+ *
+ * libfdp1-trace.so is preloaded into a client we cannot rebuild, and
+ * records the calls it makes on V4L2 devices (ioctl, mmap, poll, ppoll and
+ * select) into a ring in shared memory. The ring of each process is
+ * created as it first touches a V4L2 device, named by the FDP1_TRACE
+ * environment variable (FDP1_TRACE_NAME by default) and its pid, and is
+ * left behind for fdp1-trace to decode once the client is done.
+ *
+ * The ring holds the most recent 'capacity' records; 'head' counts every
+ * record ever claimed. A record is only complete once its 'seq' is its
+ * position in the ring's history plus one.
+ */
+#define FDP1_TRACE_MAGIC	"FDP1TRCE"
+#define FDP1_TRACE_VERSION	1
+#define FDP1_TRACE_NAME		"/fdp1-trace"
+#define FDP1_TRACE_RECORDS	65536	/* Default, FDP1_TRACE_RECORDS overrides */
+
+/* V4L2 buffer indices tracked per queue */
+#define FDP1_TRACE_BUFFERS	32
+
+enum fdp1_trace_event {
+	FDP1_TRACE_IOCTL = 0,
+	FDP1_TRACE_MMAP,
+	FDP1_TRACE_POLL,	/* poll() and ppoll() */
+	FDP1_TRACE_SELECT,
+};
+
+struct fdp1_trace_record {
+	uint64_t seq;
+	uint64_t start_ns;	/* CLOCK_MONOTONIC */
+	uint64_t duration_ns;
+	uint64_t lifetime_ns;	/* DQBUF: since the buffer was queued */
+	uint64_t arg;		/* ioctl: the request; mmap: the length;
+				   poll, select: the timeout in ms, or -1 */
+	uint32_t event;
+	int32_t fd;		/* The first V4L2 fd polled, for poll and select */
+	int32_t ret;		/* The result, or -errno */
+	uint32_t tid;
+
+	/* QBUF and DQBUF, once they succeed */
+	uint32_t type;
+	uint32_t index;
+	uint32_t depth;		/* Buffers with the driver afterwards */
+	uint32_t reserved;
+};
+
+struct fdp1_trace_ring {
+	char magic[8];
+	uint32_t version;
+	uint32_t record_size;
+	uint32_t capacity;	/* A power of two */
+	uint32_t pid;
+	uint64_t head;
+	struct fdp1_trace_record records[];
+};
+
+#endif /* _FDP1_TRACE_H_ */
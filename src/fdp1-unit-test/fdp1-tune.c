@@ -0,0 +1,477 @@
+/*
+ * FDP1 Unit Test Utility
+ *      Author: Kieran Bingham
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by the
+ * Free Software Foundation; either version 2 of the License, or (at your
+ * option) any later version
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <inttypes.h>
+
+#include <linux/videodev2.h>
+
+#include "fdp1-unit-test.h"
+#include "fdp1-v4l2-helpers.h"
+#include "fdp1-stats.h"
+#include "fdp1-mux.h"
+#include "fdp1.h"
+
+/*
+ * Auto-tuning
+ *
+ * Search the buffers on each queue, the contexts streamed at once and the
+ * frames kept queued to each, on the device itself, through the deadline
+ * multiplexer. The goal is either the most frames a second whose p99 from
+ * queueing to capture stays within a bound ('latency:US'), or the least
+ * memory in buffers which keeps up with a paced rate without dropping or
+ * missing a frame ('rate:FPS').
+ *
+ * Every point is first streamed for a quarter of the time, and only run
+ * in full if that trial did not already fail the goal. For throughput, a
+ * setting stops growing once it gains less than FDP1_TUNE_GAIN; for
+ * memory, points are tried from the smallest, and the first to keep up is
+ * the answer.
+ */
+#define FDP1_TUNE_MAX_CONTEXTS	4
+#define FDP1_TUNE_GAIN		1.02
+
+#define FDP1_TUNE_OUT		"fdp1-tuning.conf"
+
+static const unsigned int fdp1_tune_buffers[] = { 2, 3, 4, 6, 8, 12, 16 };
+static const unsigned int fdp1_tune_depths[] = { 1, 2, 4, 8 };
+
+enum fdp1_tune_goal {
+	FDP1_TUNE_LATENCY = 0,
+	FDP1_TUNE_RATE,
+};
+
+struct fdp1_tune {
+	enum fdp1_tune_goal goal;
+	unsigned int bound;	/* Microseconds, or frames a second */
+
+	/* The workload: what the multiplexer can stream */
+	enum v4l2_field field;
+	enum fdp1_deint_mode mode;
+	unsigned int captures;
+
+	uint64_t frame;		/* Bytes of an output and a capture buffer */
+	uint64_t duration;	/* Of a full run, in ns */
+	unsigned int tried;
+};
+
+struct fdp1_tune_point {
+	unsigned int buffers;
+	unsigned int contexts;
+	unsigned int depth;
+	uint64_t estimate;	/* Bytes, to order the search for memory */
+
+	/* As measured */
+	double fps;
+	uint64_t p99;
+	unsigned int dropped;
+	unsigned int missed;
+	uint64_t memory;
+};
+
+static const struct {
+	const char * key;
+	enum fdp1_tune_goal goal;
+} fdp1_tune_goals[] = {
+	{ "latency",	FDP1_TUNE_LATENCY },
+	{ "rate",	FDP1_TUNE_RATE },
+};
+
+static int fdp1_tune_parse(struct fdp1_tune * tune, const char * spec)
+{
+	const char * param = strchr(spec, ':');
+	unsigned int i;
+	size_t len;
+	int value;
+
+	if (!param || sscanf(param + 1, "%d", &value) != 1 || value <= 0)
+		return -EINVAL;
+
+	len = param - spec;
+
+	for (i = 0; i < ARRAY_SIZE(fdp1_tune_goals); i++) {
+		if (len == strlen(fdp1_tune_goals[i].key) &&
+		    !strncmp(spec, fdp1_tune_goals[i].key, len)) {
+			tune->goal = fdp1_tune_goals[i].goal;
+			tune->bound = value;
+			return 0;
+		}
+	}
+
+	return -EINVAL;
+}
+
+static uint64_t fdp1_tune_pool_bytes(const struct fdp1_v4l2_buffer_pool * pool)
+{
+	uint64_t bytes = 0;
+	unsigned int i, p;
+
+	for (i = 0; i < pool->qty; i++)
+		for (p = 0; p < pool->buffer[i].n_planes; p++)
+			bytes += pool->buffer[i].sizes[p];
+
+	return bytes;
+}
+
+/* The bytes of one output and one capture buffer of the workload */
+static uint64_t fdp1_tune_frame_bytes(struct fdp1_context * fdp1,
+				      const struct fdp1_tune * tune)
+{
+	struct fdp1_context ctx = *fdp1;
+	struct fdp1_m2m * m2m;
+	uint64_t bytes;
+
+	ctx.buffers = 1;
+
+	m2m = fdp1_create_m2m(&ctx, V4L2_PIX_FMT_YUYV, tune->field,
+			      V4L2_PIX_FMT_YUYV);
+	if (!m2m)
+		return 0;
+
+	bytes = fdp1_tune_pool_bytes(m2m->src_queue.pool) /
+		m2m->src_queue.pool->qty +
+		fdp1_tune_pool_bytes(m2m->dst_queue.pool) /
+		m2m->dst_queue.pool->qty;
+
+	fdp1_free_m2m(m2m);
+
+	return bytes;
+}
+
+/*
+ * Stream a point for 'duration' ns: frames flood every context for
+ * throughput, or arrive at an equal share of the rate for memory, each
+ * due before the next of its stream.
+ */
+static int fdp1_tune_measure(struct fdp1_context * fdp1,
+			     const struct fdp1_tune * tune,
+			     struct fdp1_tune_point * pt, uint64_t duration)
+{
+	struct fdp1_context ctx = *fdp1;
+	struct fdp1_latency service;
+	uint64_t period = 0, latency = 1000000000ULL;
+	unsigned int completed = 0;
+	struct fdp1_mux mux;
+	unsigned int i;
+	int ret;
+
+	if (tune->goal == FDP1_TUNE_RATE) {
+		period = 1000000000ULL * pt->contexts / tune->bound;
+		latency = period;
+	}
+
+	ctx.buffers = pt->buffers;
+
+	memzero(mux);
+	mux.policy = FDP1_MUX_EDF;
+	mux.inflight = pt->contexts * pt->depth;
+
+	for (i = 0; i < pt->contexts; i++) {
+		struct fdp1_mux_stream * s;
+
+		s = fdp1_mux_add(&mux, "tune", fdp1->width, fdp1->height,
+				 tune->field, tune->mode, period, latency);
+		if (!s)
+			return TEST_FAIL;
+
+		s->depth = pt->depth;
+	}
+
+	if (fdp1_mux_open(&ctx, &mux))
+		return TEST_FAIL;
+
+	pt->memory = 0;
+	for (i = 0; i < mux.n_streams; i++)
+		pt->memory += fdp1_tune_pool_bytes(mux.stream[i].m2m->src_queue.pool) +
+			      fdp1_tune_pool_bytes(mux.stream[i].m2m->dst_queue.pool);
+
+	ret = fdp1_mux_run(&mux, duration);
+
+	fdp1_mux_close(&mux);
+
+	if (ret) {
+		kprint(fdp1, 0, "%u buffers, %u contexts, %u deep: %s\n",
+				pt->buffers, pt->contexts, pt->depth,
+				strerror(-ret));
+		return TEST_FAIL;
+	}
+
+	fdp1_latency_reset(&service);
+	pt->dropped = 0;
+	pt->missed = 0;
+
+	for (i = 0; i < mux.n_streams; i++) {
+		struct fdp1_mux_stream_stats * stats = &mux.stream[i].stats;
+
+		completed += stats->completed;
+		pt->dropped += stats->dropped;
+		pt->missed += stats->missed;
+		fdp1_latency_merge(&service, &stats->service);
+	}
+
+	pt->fps = completed * 1000000000.0 / duration;
+	pt->p99 = fdp1_latency_percentile(&service, 99);
+
+	return TEST_PASS;
+}
+
+static bool fdp1_tune_meets(const struct fdp1_tune * tune,
+			    const struct fdp1_tune_point * pt)
+{
+	if (tune->goal == FDP1_TUNE_LATENCY)
+		return pt->p99 <= tune->bound * 1000ULL;
+
+	return !pt->dropped && !pt->missed;
+}
+
+/*
+ * Measure a point, in a trial first and then in full. Returns whether it
+ * meets the goal, or -1 if it could not be streamed at all.
+ */
+static int fdp1_tune_try(struct fdp1_context * fdp1, struct fdp1_tune * tune,
+			 struct fdp1_tune_point * pt)
+{
+	const char * result;
+	bool early = false;
+	bool meets;
+
+	tune->tried++;
+
+	if (fdp1_tune_measure(fdp1, tune, pt, tune->duration / 4)) {
+		printf("%7u %8u %5u %9s\n", pt->buffers, pt->contexts,
+		       pt->depth, "failed");
+		return -1;
+	}
+
+	meets = fdp1_tune_meets(tune, pt);
+	if (!meets)
+		early = true;
+	else if (fdp1_tune_measure(fdp1, tune, pt, tune->duration))
+		return -1;
+	else
+		meets = fdp1_tune_meets(tune, pt);
+
+	result = early ? "early" : meets ? "ok" : "over";
+
+	printf("%7u %8u %5u %9.1f %9" PRIu64 " %9" PRIu64 " %9u %9u  %s\n",
+	       pt->buffers, pt->contexts, pt->depth, pt->fps, pt->p99 / 1000,
+	       pt->memory / 1024, pt->dropped, pt->missed, result);
+
+	return meets;
+}
+
+/* A depth needs a frame's buffers for each frame queued */
+static bool fdp1_tune_fits(const struct fdp1_tune * tune,
+			   unsigned int buffers, unsigned int depth)
+{
+	return depth <= buffers && depth * tune->captures <= buffers;
+}
+
+/*
+ * The most frames a second within the latency bound. Deeper queues only
+ * add latency once the bound is broken, and more of any setting stops
+ * being tried once it stops paying for itself.
+ */
+static int fdp1_tune_throughput(struct fdp1_context * fdp1,
+				struct fdp1_tune * tune,
+				struct fdp1_tune_point * best)
+{
+	double contexts_best = 0;
+	unsigned int c, b, d;
+	bool found = false;
+
+	for (c = 1; c <= FDP1_TUNE_MAX_CONTEXTS; c++) {
+		double buffers_best = 0;
+		double this_contexts = 0;
+
+		for (b = 0; b < ARRAY_SIZE(fdp1_tune_buffers); b++) {
+			double this_buffers = 0;
+
+			for (d = 0; d < ARRAY_SIZE(fdp1_tune_depths); d++) {
+				struct fdp1_tune_point pt = {
+					.buffers = fdp1_tune_buffers[b],
+					.contexts = c,
+					.depth = fdp1_tune_depths[d],
+				};
+				double last = this_buffers;
+				int ret;
+
+				if (!fdp1_tune_fits(tune, pt.buffers, pt.depth))
+					break;
+
+				ret = fdp1_tune_try(fdp1, tune, &pt);
+				if (ret <= 0)
+					break;
+
+				if (!found || pt.fps > best->fps) {
+					*best = pt;
+					found = true;
+				}
+
+				if (pt.fps > this_buffers)
+					this_buffers = pt.fps;
+
+				if (pt.fps < last * FDP1_TUNE_GAIN)
+					break;
+			}
+
+			if (this_buffers > this_contexts)
+				this_contexts = this_buffers;
+
+			if (this_buffers < buffers_best * FDP1_TUNE_GAIN)
+				break;
+
+			buffers_best = this_buffers;
+		}
+
+		if (this_contexts < contexts_best * FDP1_TUNE_GAIN)
+			break;
+
+		contexts_best = this_contexts;
+	}
+
+	return found ? TEST_PASS : TEST_FAIL;
+}
+
+static int fdp1_tune_by_memory(const void * a, const void * b)
+{
+	const struct fdp1_tune_point * pa = a;
+	const struct fdp1_tune_point * pb = b;
+
+	if (pa->estimate != pb->estimate)
+		return pa->estimate < pb->estimate ? -1 : 1;
+	if (pa->contexts != pb->contexts)
+		return (int)pa->contexts - (int)pb->contexts;
+
+	return (int)pa->depth - (int)pb->depth;
+}
+
+/* The least memory which keeps up with the rate, smallest first */
+static int fdp1_tune_memory(struct fdp1_context * fdp1,
+			    struct fdp1_tune * tune,
+			    struct fdp1_tune_point * best)
+{
+	struct fdp1_tune_point points[FDP1_TUNE_MAX_CONTEXTS *
+				      ARRAY_SIZE(fdp1_tune_buffers) *
+				      ARRAY_SIZE(fdp1_tune_depths)];
+	unsigned int n = 0;
+	unsigned int c, b, d, i;
+
+	for (c = 1; c <= FDP1_TUNE_MAX_CONTEXTS; c++)
+		for (b = 0; b < ARRAY_SIZE(fdp1_tune_buffers); b++)
+			for (d = 0; d < ARRAY_SIZE(fdp1_tune_depths); d++) {
+				if (!fdp1_tune_fits(tune, fdp1_tune_buffers[b],
+						    fdp1_tune_depths[d]))
+					continue;
+
+				points[n].buffers = fdp1_tune_buffers[b];
+				points[n].contexts = c;
+				points[n].depth = fdp1_tune_depths[d];
+				points[n].estimate = tune->frame * c *
+						     fdp1_tune_buffers[b];
+				n++;
+			}
+
+	qsort(points, n, sizeof(points[0]), fdp1_tune_by_memory);
+
+	for (i = 0; i < n; i++) {
+		if (fdp1_tune_try(fdp1, tune, &points[i]) > 0) {
+			*best = points[i];
+			return TEST_PASS;
+		}
+	}
+
+	return TEST_FAIL;
+}
+
+/*
+ * fdp1_tune
+ *
+ * Search for the best settings for fdp1->tune, and write them to
+ * fdp1->tune_out for a service to load with fdp1_tuning_load().
+ */
+int fdp1_tune(struct fdp1_context * fdp1)
+{
+	const char * out = fdp1->tune_out ? fdp1->tune_out : FDP1_TUNE_OUT;
+	struct fdp1_tune_point best;
+	struct fdp1_tuning tuning;
+	struct fdp1_tune tune;
+	int fail;
+	int ret;
+
+	memzero(tune);
+
+	if (fdp1_tune_parse(&tune, fdp1->tune)) {
+		kprint(fdp1, 0, "Invalid tuning goal '%s'\n", fdp1->tune);
+		return TEST_FAIL;
+	}
+
+	/* The interlaced workload is 60i, or whatever the multiplexer takes */
+	tune.field = fdp1->interlaced_tests ? V4L2_FIELD_INTERLACED
+					    : V4L2_FIELD_NONE;
+	tune.mode = fdp1->interlaced_tests ? FDP1_FIXED2D : FDP1_PROGRESSIVE;
+	tune.captures = fdp1_job_captures(tune.field, tune.mode);
+
+	/* Which also finds out whether there is a device to tune at all */
+	tune.frame = fdp1_tune_frame_bytes(fdp1, &tune);
+	if (!tune.frame) {
+		kprint(fdp1, 0, "Failed to size the buffers of the workload\n");
+		return TEST_FAIL;
+	}
+
+	/* As long as the benchmarks stream num_frames at 30 a second */
+	tune.duration = fdp1->num_frames * 1000000000ULL / 30;
+
+	printf("%s: tuning %s %s, %dx%d, for %s\n", fdp1->appname,
+	       v4l2_field(tune.field), fdp1_deint_mode_str(tune.mode),
+	       fdp1->width, fdp1->height, fdp1->tune);
+
+	printf("%7s %8s %5s %9s %9s %9s %9s %9s  %s\n", "Buffers", "Contexts",
+	       "Depth", "frames/s", "p99 us", "KiB", "Dropped", "Missed",
+	       "Result");
+
+	if (tune.goal == FDP1_TUNE_LATENCY)
+		fail = fdp1_tune_throughput(fdp1, &tune, &best);
+	else
+		fail = fdp1_tune_memory(fdp1, &tune, &best);
+
+	if (fail) {
+		printf("No setting of %u tried meets %s\n", tune.tried, fdp1->tune);
+		return fail;
+	}
+
+	printf("Best of %u: %u buffers, %u contexts, %u deep: %.1f frames/s, "
+	       "p99 %" PRIu64 " us, %" PRIu64 " KiB\n", tune.tried,
+	       best.buffers, best.contexts, best.depth, best.fps,
+	       best.p99 / 1000, best.memory / 1024);
+
+	memzero(tuning);
+	tuning.width = fdp1->width;
+	tuning.height = fdp1->height;
+	tuning.out_field = tune.field;
+	tuning.mode = tune.mode;
+	tuning.buffers = best.buffers;
+	tuning.contexts = best.contexts;
+	tuning.depth = best.depth;
+	tuning.fps = best.fps;
+	tuning.p99_us = best.p99 / 1000;
+	tuning.memory = best.memory;
+
+	ret = fdp1_tuning_save(out, &tuning);
+	if (ret) {
+		kprint(fdp1, 0, "Failed to write %s: %s\n", out, strerror(-ret));
+		return TEST_FAIL;
+	}
+
+	printf("Written to %s\n", out);
+
+	return TEST_PASS;
+}
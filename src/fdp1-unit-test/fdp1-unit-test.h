@@ -27,6 +27,10 @@ enum test_result {
 	TEST_FAIL,
 };
 
+struct fdp1_synth;
+struct fdp1_perf;
+struct fdp1_record;
+
 struct fdp1_context {
 	char * appname;
 	int dev;
@@ -36,6 +40,29 @@ struct fdp1_context {
 	int hex_not_draw;
 	int verbose;
 	int interlaced_tests;
+	char * bench;
+	char * verify;
+	int lock_buffers;
+	int cache_hints;
+	int touch;
+	int prepare_buffers;
+	int soak;		/* Seconds */
+	char * soak_log;
+	int perf;
+	char * record;		/* Session log */
+	int rate;		/* Paced buffers a second, 0 for unpaced */
+	int jitter;		/* Microseconds */
+	int drop_oldest;
+	int buffers;		/* On each queue of a context, 0 for 4 */
+	char * tune;		/* Goal of the auto-tuner */
+	char * tune_out;	/* Configuration it writes */
+
+	/* Pre-rendered content, shared between tests */
+	struct fdp1_synth * synth_cache;
+
+	/* Stage counters and session log, handed on to each device opened */
+	struct fdp1_perf * counters;
+	struct fdp1_record * log;
 };
 
 int fdp1_open_tests(struct fdp1_context * fdp1);
@@ -43,10 +70,25 @@ int fdp1_allocation_tests(struct fdp1_context * fdp1);
 int fdp1_stream_on_tests(struct fdp1_context * fdp1);
 int fdp1_progressive(struct fdp1_context * fdp1);
 int fdp1_deinterlace(struct fdp1_context * fdp1);
+int fdp1_field_layouts(struct fdp1_context * fdp1);
+int fdp1_reconfigure(struct fdp1_context * fdp1);
+int fdp1_broker_tests(struct fdp1_context * fdp1);
+int fdp1_replay_tests(struct fdp1_context * fdp1);
+int fdp1_library_tests(struct fdp1_context * fdp1);
+int fdp1_pixel_format_tests(struct fdp1_context * fdp1);
+int fdp1_selection_tests(struct fdp1_context * fdp1);
+int fdp1_tiling_tests(struct fdp1_context * fdp1);
+int fdp1_mux_tests(struct fdp1_context * fdp1);
+
+int fdp1_bench(struct fdp1_context * fdp1);
+int fdp1_soak(struct fdp1_context * fdp1);
+int fdp1_tune(struct fdp1_context * fdp1);
 
 #define memzero(x)\
 	memset(&(x), 0, sizeof (x));
 
+#define ARRAY_SIZE(a) (sizeof(a) / sizeof((a)[0]))
+
 /* It's like printk ... but better */
 #define kprint(fdp1, level, fmt, args...) \
 	if (fdp1->verbose >= level) \
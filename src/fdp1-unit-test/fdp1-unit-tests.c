@@ -22,6 +22,11 @@
 #include <sys/mman.h>
 
 #include "fdp1-unit-test.h"
+#include "fdp1-v4l2-helpers.h"
+#include "fdp1-synth.h"
+#include "fdp1-soak.h"
+#include "fdp1-perf.h"
+#include "fdp1-record.h"
 
 #define memzero(x)\
 	memset(&(x), 0, sizeof (x));
@@ -34,6 +39,7 @@ static struct fdp1_context fdp1_ctx = {
 	.num_frames = 30,
 	.verbose = false,
 	.interlaced_tests = 0,
+	.touch = 1,
 };
 
 void help(char ** argv, struct fdp1_context * fdp1)
@@ -43,8 +49,26 @@ void help(char ** argv, struct fdp1_context * fdp1)
 	printf("--width/-w      :  Set width [%d]\n", fdp1->width);
 	printf("--height/-h     :  Set height [%d]\n", fdp1->height);
 	printf("--num_frames/-n :  Number of frames to process [%d]\n", fdp1->num_frames);
-	printf("--hexdump/x     :  Hexdump instead of draw\n");
+	printf("--hexdump/x     :  Dump frames (-vvvv) in hex rather than as text\n");
 	printf("--verbose/v     :  Verbose test output [%d]\n", fdp1->verbose);
+	printf("--interlaced/-i :  Run interlaced tests\n");
+	printf("--bench/-b NAME :  Run benchmark NAME (layouts, startup, faults, cache, qbuf,\n"
+	       "                   modeswitch, roi, tiles, mux, live, all)\n");
+	printf("--verify/-V SPEC:  Verify captures (none, full, lines:N, tiles:N, bytes:N)\n");
+	printf("--lock/-l       :  Pre-fault and lock buffer mappings\n");
+	printf("--cache-hints/-c:  Skip cache maintenance the CPU does not need\n");
+	printf("--touch/-t N    :  Touch every Nth buffer with the CPU, 0 for none [%d]\n", fdp1->touch);
+	printf("--prepare/-P    :  Prepare buffers ahead of queueing them\n");
+	printf("--soak/-s TIME  :  Stream for TIME (N[smh]), failing on resource drift\n");
+	printf("--soak-log/-S F :  Write the soak samples to file F\n");
+	printf("--perf/-p       :  Report CPU counters for each pipeline stage\n");
+	printf("--record/-r FILE:  Record every V4L2 call to FILE, for fdp1-replay\n");
+	printf("--rate/-R FPS   :  Pace sources as a live feed of FPS buffers a second\n");
+	printf("--jitter/-j US  :  Delay each paced buffer by up to US microseconds\n");
+	printf("--drop/-D WHICH :  Drop the oldest or newest paced buffer when behind [newest]\n");
+	printf("--buffers/-B N  :  Buffers on each queue of a stream [4]\n");
+	printf("--tune/-T GOAL  :  Search for the best settings (latency:US, rate:FPS)\n");
+	printf("--tune-out/-O F :  Write the settings found to file F [fdp1-tuning.conf]\n");
 	printf("--help/-?       :  Display this help\n");
 
 	printf("\n");
@@ -64,11 +88,27 @@ int process_arguments(int argc, char ** argv, struct fdp1_context * fdp1)
 		{"hexdump",	no_argument,		0, 'x'},
 		{"verbose",	no_argument,		0, 'v'},
 		{"interlaced",	no_argument,		0, 'i'},
+		{"bench",	required_argument,	0, 'b'},
+		{"verify",	required_argument,	0, 'V'},
+		{"lock",	no_argument,		0, 'l'},
+		{"cache-hints",	no_argument,		0, 'c'},
+		{"touch",	required_argument,	0, 't'},
+		{"prepare",	no_argument,		0, 'P'},
+		{"soak",	required_argument,	0, 's'},
+		{"soak-log",	required_argument,	0, 'S'},
+		{"perf",	no_argument,		0, 'p'},
+		{"record",	required_argument,	0, 'r'},
+		{"rate",	required_argument,	0, 'R'},
+		{"jitter",	required_argument,	0, 'j'},
+		{"drop",	required_argument,	0, 'D'},
+		{"buffers",	required_argument,	0, 'B'},
+		{"tune",	required_argument,	0, 'T'},
+		{"tune-out",	required_argument,	0, 'O'},
 		{0, 0, 0, 0}
 	};
 
 	while ((option = getopt_long(argc, argv,
-			"d:w:h:n:xvi?",
+			"d:w:h:n:xvib:V:lct:Ps:S:pr:R:j:D:B:T:O:?",
 			long_options, NULL)) != -1) {
 
 		switch (option) {
@@ -93,6 +133,68 @@ int process_arguments(int argc, char ** argv, struct fdp1_context * fdp1)
 		case 'i':
 			fdp1->interlaced_tests = 1;
 			break;
+		case 'b':
+			fdp1->bench = optarg;
+			break;
+		case 'V':
+			fdp1->verify = optarg;
+			break;
+		case 'l':
+			fdp1->lock_buffers = 1;
+			break;
+		case 'c':
+			fdp1->cache_hints = 1;
+			break;
+		case 't':
+			fdp1->touch = atoi(optarg);
+			break;
+		case 'P':
+			fdp1->prepare_buffers = 1;
+			break;
+		case 's':
+			fdp1->soak = fdp1_soak_duration(optarg);
+			if (fdp1->soak < 0) {
+				fprintf(stderr, "Invalid soak duration '%s'\n", optarg);
+				exit(1);
+			}
+			break;
+		case 'S':
+			fdp1->soak_log = optarg;
+			break;
+		case 'p':
+			fdp1->perf = 1;
+			break;
+		case 'r':
+			fdp1->record = optarg;
+			break;
+		case 'R':
+			fdp1->rate = atoi(optarg);
+			break;
+		case 'j':
+			fdp1->jitter = atoi(optarg);
+			break;
+		case 'D':
+			if (strcmp(optarg, "oldest") && strcmp(optarg, "newest")) {
+				fprintf(stderr, "Invalid drop policy '%s'\n", optarg);
+				exit(1);
+			}
+			fdp1->drop_oldest = !strcmp(optarg, "oldest");
+			break;
+		case 'B':
+			fdp1->buffers = atoi(optarg);
+			if (fdp1->buffers < 1 ||
+			    fdp1->buffers > MAX_BUFFER_POOL_SIZE) {
+				fprintf(stderr, "Buffers must be 1 to %d\n",
+					MAX_BUFFER_POOL_SIZE);
+				exit(1);
+			}
+			break;
+		case 'T':
+			fdp1->tune = optarg;
+			break;
+		case 'O':
+			fdp1->tune_out = optarg;
+			break;
 		default:
 		case '?':
 			help(argv, fdp1);
@@ -113,15 +215,43 @@ int main(int argc, char ** argv)
 
 	process_arguments(argc, argv, &fdp1_ctx);
 
+	if (fdp1_ctx.perf && fdp1_perf_open(&fdp1_ctx))
+		fprintf(stderr, "Stage counters are unavailable\n");
+
+	if (fdp1_ctx.record) {
+		fdp1_ctx.log = fdp1_record_start(fdp1_ctx.record);
+		if (!fdp1_ctx.log)
+			exit(1);
+	}
+
 	/* Ideally these would be automatically iterated */
-	if (fdp1_ctx.interlaced_tests) {
+	if (fdp1_ctx.bench) {
+		fail += fdp1_bench(&fdp1_ctx);
+	} else if (fdp1_ctx.soak) {
+		fail += fdp1_soak(&fdp1_ctx);
+	} else if (fdp1_ctx.tune) {
+		fail += fdp1_tune(&fdp1_ctx);
+	} else if (fdp1_ctx.interlaced_tests) {
 		fail += fdp1_deinterlace(&fdp1_ctx);
+		fail += fdp1_field_layouts(&fdp1_ctx);
 	} else {
 		fail += fdp1_open_tests(&fdp1_ctx);
 		fail += fdp1_allocation_tests(&fdp1_ctx);
 		fail += fdp1_stream_on_tests(&fdp1_ctx);
 		fail += fdp1_progressive(&fdp1_ctx);
+		fail += fdp1_reconfigure(&fdp1_ctx);
+		fail += fdp1_broker_tests(&fdp1_ctx);
+		fail += fdp1_replay_tests(&fdp1_ctx);
+		fail += fdp1_library_tests(&fdp1_ctx);
+		fail += fdp1_pixel_format_tests(&fdp1_ctx);
+		fail += fdp1_selection_tests(&fdp1_ctx);
+		fail += fdp1_tiling_tests(&fdp1_ctx);
+		fail += fdp1_mux_tests(&fdp1_ctx);
 	}
 
+	fdp1_synth_free_all(&fdp1_ctx);
+	fdp1_perf_close(&fdp1_ctx);
+	fdp1_record_stop(fdp1_ctx.log);
+
 	printf("%s: Test results: %d tests failed\n", fdp1_ctx.appname, fail);
 }
@@ -19,16 +19,25 @@
 #include <stdbool.h>
 #include <unistd.h>
 #include <errno.h>
+#include <time.h>
 
 #include <sys/ioctl.h>
 #include <sys/prctl.h>
+#include <sys/resource.h>
 #include <fcntl.h>
+#include <poll.h>
+#include <dirent.h>
+#include <sys/stat.h>
+#include <sys/sysmacros.h>
 
 #include <linux/videodev2.h>
+#include <linux/media.h>
 #include <sys/mman.h>
 
 #include "fdp1-unit-test.h"
 #include "fdp1-v4l2-helpers.h"
+#include "fdp1-perf.h"
+#include "fdp1-record.h"
 
 void start_test(struct fdp1_context * fdp1, char * test)
 {
@@ -73,11 +82,422 @@ char * q_type(uint32_t type)
 	return V4L2_TYPE_IS_OUTPUT(type) ? "Output" : "Capture";
 }
 
+static char * fdp1_buffer_state_strs[] = {
+	"Free",
+	"Filled",
+	"Queued",
+	"Dequeued",
+	"Verify",
+};
+
+char *fdp1_buffer_state_str(enum fdp1_buffer_state s)
+{
+	return fdp1_buffer_state_strs[s];
+}
+
+uint64_t fdp1_time_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/* Page faults taken by the process so far */
+void fdp1_faults(struct fdp1_faults * faults)
+{
+	struct rusage usage;
+
+	getrusage(RUSAGE_SELF, &usage);
+
+	faults->minor = usage.ru_minflt;
+	faults->major = usage.ru_majflt;
+}
+
+/* Page faults taken since 'since' */
+void fdp1_faults_since(struct fdp1_faults * faults,
+		       const struct fdp1_faults * since)
+{
+	fdp1_faults(faults);
+
+	faults->minor -= since->minor;
+	faults->major -= since->major;
+}
+
+static char * fdp1_v4l2_phase_strs[] = {
+	"open",
+	"QUERYCAP",
+	"TRY_FMT",
+	"S_FMT",
+	"REQBUFS",
+	"CREATE_BUFS",
+	"QUERYBUF",
+	"mmap",
+	"QBUF",
+	"STREAMON",
+	"DQBUF",
+	"STREAMOFF",
+	"PREPARE_BUF",
+	"EXPBUF",
+	"REQUEST",
+};
+
+char * fdp1_v4l2_memory_str(uint32_t memory)
+{
+	switch (memory) {
+	case V4L2_MEMORY_MMAP:
+		return "MMAP";
+	case V4L2_MEMORY_USERPTR:
+		return "USERPTR";
+	case V4L2_MEMORY_DMABUF:
+		return "DMABUF";
+	default:
+		return "unknown";
+	}
+}
+
+char * fdp1_v4l2_phase_str(enum fdp1_v4l2_phase phase)
+{
+	return fdp1_v4l2_phase_strs[phase];
+}
+
+/* The phase an ioctl request is accounted to, or -1 if none */
+int fdp1_v4l2_ioctl_phase(unsigned long request)
+{
+	switch (request) {
+	case VIDIOC_QUERYCAP:
+		return FDP1_PHASE_QUERYCAP;
+	case VIDIOC_TRY_FMT:
+		return FDP1_PHASE_TRY_FMT;
+	case VIDIOC_S_FMT:
+		return FDP1_PHASE_S_FMT;
+	case VIDIOC_REQBUFS:
+		return FDP1_PHASE_REQBUFS;
+	case VIDIOC_CREATE_BUFS:
+		return FDP1_PHASE_CREATE_BUFS;
+	case VIDIOC_QUERYBUF:
+		return FDP1_PHASE_QUERYBUF;
+	case VIDIOC_QBUF:
+		return FDP1_PHASE_QBUF;
+	case VIDIOC_STREAMON:
+		return FDP1_PHASE_STREAMON;
+	case VIDIOC_DQBUF:
+		return FDP1_PHASE_DQBUF;
+	case VIDIOC_STREAMOFF:
+		return FDP1_PHASE_STREAMOFF;
+	case VIDIOC_PREPARE_BUF:
+		return FDP1_PHASE_PREPARE_BUF;
+	case VIDIOC_EXPBUF:
+		return FDP1_PHASE_EXPBUF;
+	default:
+		return -1;
+	}
+}
+
+void fdp1_v4l2_phase_reset(struct fdp1_v4l2_dev * dev)
+{
+	memzero(dev->phase_ns);
+	memzero(dev->phase_calls);
+}
+
+/* Account the time since 'start' to a phase of the device */
+static void fdp1_v4l2_phase(struct fdp1_v4l2_dev * dev,
+			    enum fdp1_v4l2_phase phase, uint64_t start)
+{
+	dev->phase_ns[phase] += fdp1_time_ns() - start;
+	dev->phase_calls[phase]++;
+}
+
+/* The timestamp the driver returned with the buffer, in nanoseconds */
+uint64_t fdp1_v4l2_buffer_timestamp(struct fdp1_v4l2_buffer * buffer)
+{
+	struct timeval * tv = &buffer->v4l2_buf.timestamp;
+
+	return (uint64_t)tv->tv_sec * 1000000000ULL + tv->tv_usec * 1000ULL;
+}
+
+/*
+ * Legal ownership transitions, indexed by the current state.
+ *
+ * Anything else is a misuse of the buffer, either by the test, or by the
+ * driver returning a buffer it was never given.
+ */
+#define BIT(s) (1 << (s))
+static const unsigned int fdp1_buffer_transitions[FDP1_BUF_STATE_MAX] = {
+	[FDP1_BUF_FREE]     = BIT(FDP1_BUF_FILLED) | BIT(FDP1_BUF_QUEUED),
+	[FDP1_BUF_FILLED]   = BIT(FDP1_BUF_FILLED) | BIT(FDP1_BUF_QUEUED)
+			    | BIT(FDP1_BUF_FREE),
+	[FDP1_BUF_QUEUED]   = BIT(FDP1_BUF_DEQUEUED) | BIT(FDP1_BUF_FREE),
+	[FDP1_BUF_DEQUEUED] = BIT(FDP1_BUF_FILLED) | BIT(FDP1_BUF_QUEUED)
+			    | BIT(FDP1_BUF_VERIFY) | BIT(FDP1_BUF_FREE),
+	[FDP1_BUF_VERIFY]   = BIT(FDP1_BUF_DEQUEUED) | BIT(FDP1_BUF_FILLED)
+			    | BIT(FDP1_BUF_QUEUED) | BIT(FDP1_BUF_FREE),
+};
+
+/*
+ * fdp1_v4l2_buffer_set_state
+ *
+ * Moves a buffer to a new ownership state, accounting the time spent in the
+ * previous one. Returns 0 on a legal transition, or -EBUSY if the transition
+ * is not permitted, in which case the state is left unchanged.
+ */
+int fdp1_v4l2_buffer_set_state(struct fdp1_v4l2_buffer * buffer,
+			       enum fdp1_buffer_state state)
+{
+	unsigned int old = __atomic_load_n(&buffer->state, __ATOMIC_ACQUIRE);
+	uint64_t now;
+
+	do {
+		if (!(fdp1_buffer_transitions[old] & BIT(state))) {
+			kprint(buffer->pool, 0, "%s buffer %d: illegal transition %s -> %s\n",
+					q_type(buffer->type), buffer->index,
+					fdp1_buffer_state_str(old),
+					fdp1_buffer_state_str(state));
+			__atomic_add_fetch(&buffer->misuse, 1, __ATOMIC_RELAXED);
+			return -EBUSY;
+		}
+	} while (!__atomic_compare_exchange_n(&buffer->state, &old, state, false,
+					      __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE));
+
+	now = fdp1_time_ns();
+	buffer->state_ns[old] += now - buffer->state_since;
+	buffer->state_since = now;
+
+	if (state == FDP1_BUF_FILLED) {
+		/* The caches were cleaned when it was prepared, not now */
+		if (buffer->prepared && buffer->pool->cache_hints) {
+			kprint(buffer->pool, 0, "%s buffer %d: written after preparation\n",
+					q_type(buffer->type), buffer->index);
+			__atomic_add_fetch(&buffer->misuse, 1, __ATOMIC_RELAXED);
+		}
+
+		buffer->cpu_dirty = true;
+	}
+
+	return 0;
+}
+
+/*
+ * Pixel formats
+ *
+ * How the FDP1's formats arrange their components: the planes, as laid out
+ * in memory, with the bytes per pixel of each, and the subsampling of all
+ * but the first.
+ */
+static const struct fdp1_v4l2_format_info {
+	uint32_t fourcc;
+	uint8_t planes;
+	uint8_t mem_planes;
+	uint8_t hsub;
+	uint8_t vsub;
+	uint8_t bpp[3];
+} fdp1_v4l2_formats[] = {
+	{ V4L2_PIX_FMT_RGB332,   1, 1, 1, 1, { 1 } },
+	{ V4L2_PIX_FMT_ARGB444,  1, 1, 1, 1, { 2 } },
+	{ V4L2_PIX_FMT_XRGB444,  1, 1, 1, 1, { 2 } },
+	{ V4L2_PIX_FMT_ARGB555,  1, 1, 1, 1, { 2 } },
+	{ V4L2_PIX_FMT_XRGB555,  1, 1, 1, 1, { 2 } },
+	{ V4L2_PIX_FMT_RGB565,   1, 1, 1, 1, { 2 } },
+	{ V4L2_PIX_FMT_ABGR32,   1, 1, 1, 1, { 4 } },
+	{ V4L2_PIX_FMT_XBGR32,   1, 1, 1, 1, { 4 } },
+	{ V4L2_PIX_FMT_ARGB32,   1, 1, 1, 1, { 4 } },
+	{ V4L2_PIX_FMT_XRGB32,   1, 1, 1, 1, { 4 } },
+	{ V4L2_PIX_FMT_RGB24,    1, 1, 1, 1, { 3 } },
+	{ V4L2_PIX_FMT_BGR24,    1, 1, 1, 1, { 3 } },
+	{ V4L2_PIX_FMT_HSV24,    1, 1, 1, 1, { 3 } },
+	{ V4L2_PIX_FMT_HSV32,    1, 1, 1, 1, { 4 } },
+	{ V4L2_PIX_FMT_YUYV,     1, 1, 1, 1, { 2 } },
+	{ V4L2_PIX_FMT_YVYU,     1, 1, 1, 1, { 2 } },
+	{ V4L2_PIX_FMT_UYVY,     1, 1, 1, 1, { 2 } },
+	{ V4L2_PIX_FMT_VYUY,     1, 1, 1, 1, { 2 } },
+	{ V4L2_PIX_FMT_NV12,     2, 1, 2, 2, { 1, 2 } },
+	{ V4L2_PIX_FMT_NV21,     2, 1, 2, 2, { 1, 2 } },
+	{ V4L2_PIX_FMT_NV16,     2, 1, 2, 1, { 1, 2 } },
+	{ V4L2_PIX_FMT_NV61,     2, 1, 2, 1, { 1, 2 } },
+	{ V4L2_PIX_FMT_NV24,     2, 1, 1, 1, { 1, 2 } },
+	{ V4L2_PIX_FMT_NV42,     2, 1, 1, 1, { 1, 2 } },
+	{ V4L2_PIX_FMT_NV12M,    2, 2, 2, 2, { 1, 2 } },
+	{ V4L2_PIX_FMT_NV21M,    2, 2, 2, 2, { 1, 2 } },
+	{ V4L2_PIX_FMT_NV16M,    2, 2, 2, 1, { 1, 2 } },
+	{ V4L2_PIX_FMT_NV61M,    2, 2, 2, 1, { 1, 2 } },
+	{ V4L2_PIX_FMT_YUV420,   3, 1, 2, 2, { 1, 1, 1 } },
+	{ V4L2_PIX_FMT_YVU420,   3, 1, 2, 2, { 1, 1, 1 } },
+	{ V4L2_PIX_FMT_YUV422P,  3, 1, 2, 1, { 1, 1, 1 } },
+	{ V4L2_PIX_FMT_YUV420M,  3, 3, 2, 2, { 1, 1, 1 } },
+	{ V4L2_PIX_FMT_YVU420M,  3, 3, 2, 2, { 1, 1, 1 } },
+	{ V4L2_PIX_FMT_YUV422M,  3, 3, 2, 1, { 1, 1, 1 } },
+	{ V4L2_PIX_FMT_YVU422M,  3, 3, 2, 1, { 1, 1, 1 } },
+	{ V4L2_PIX_FMT_YUV444M,  3, 3, 1, 1, { 1, 1, 1 } },
+	{ V4L2_PIX_FMT_YVU444M,  3, 3, 1, 1, { 1, 1, 1 } },
+};
+
+static const struct fdp1_v4l2_format_info *
+fdp1_v4l2_format_info(uint32_t fourcc)
+{
+	unsigned int i;
+
+	for (i = 0; i < ARRAY_SIZE(fdp1_v4l2_formats); i++)
+		if (fdp1_v4l2_formats[i].fourcc == fourcc)
+			return &fdp1_v4l2_formats[i];
+
+	return NULL;
+}
+
+/*
+ * fdp1_v4l2_buffer_layout
+ *
+ * Where the pixels of a buffer are, from the format of its queue, filling
+ * in up to three 'layout' planes. A format which is not known, or does not
+ * fit the buffer, is taken as one line per memory plane: all of it active.
+ * Returns the number of planes.
+ */
+unsigned int fdp1_v4l2_buffer_layout(struct fdp1_v4l2_buffer * buffer,
+				     struct fdp1_v4l2_plane_layout * layout)
+{
+	const struct v4l2_pix_format_mplane * fmt = &buffer->pool->fmt;
+	const struct fdp1_v4l2_format_info * info;
+	unsigned int offset = 0;
+	unsigned int p;
+
+	info = fdp1_v4l2_format_info(fmt->pixelformat);
+	if (!info || info->mem_planes > buffer->n_planes ||
+	    !fmt->plane_fmt[0].bytesperline)
+		goto flat;
+
+	for (p = 0; p < info->planes; p++) {
+		struct fdp1_v4l2_plane_layout * l = &layout[p];
+		unsigned int hsub = p ? info->hsub : 1;
+		unsigned int vsub = p ? info->vsub : 1;
+
+		if (info->mem_planes > 1) {
+			l->mem = p;
+			l->offset = 0;
+			l->stride = fmt->plane_fmt[p].bytesperline;
+		} else {
+			/* Chroma lines follow the luma stride, as V4L2 has it */
+			l->mem = 0;
+			l->offset = offset;
+			l->stride = fmt->plane_fmt[0].bytesperline * info->bpp[p] /
+				    (info->bpp[0] * hsub);
+		}
+
+		l->bytes = fmt->width / hsub * info->bpp[p];
+		l->lines = fmt->height / vsub;
+		offset += l->stride * l->lines;
+
+		if (l->bytes > l->stride || (uint64_t)l->offset +
+		    (uint64_t)l->stride * l->lines > buffer->sizes[l->mem])
+			goto flat;
+	}
+
+	return info->planes;
+
+flat:
+	for (p = 0; p < buffer->n_planes; p++) {
+		layout[p].mem = p;
+		layout[p].offset = 0;
+		layout[p].stride = buffer->sizes[p];
+		layout[p].bytes = buffer->sizes[p];
+		layout[p].lines = 1;
+	}
+
+	return buffer->n_planes;
+}
+
+/* Hand a buffer we own back to the pool without queueing it */
+void fdp1_v4l2_buffer_release(struct fdp1_v4l2_buffer * buffer)
+{
+	fdp1_v4l2_buffer_set_state(buffer, FDP1_BUF_FREE);
+}
+
+unsigned int fdp1_v4l2_pool_count(struct fdp1_v4l2_buffer_pool * pool,
+				  enum fdp1_buffer_state state)
+{
+	unsigned int i;
+	unsigned int count = 0;
+
+	for (i = 0; i < pool->qty; i++)
+		if (__atomic_load_n(&pool->buffer[i].state, __ATOMIC_ACQUIRE) == state)
+			count++;
+
+	return count;
+}
+
+unsigned int fdp1_v4l2_pool_misuse(struct fdp1_v4l2_buffer_pool * pool)
+{
+	unsigned int i;
+	unsigned int misuse = 0;
+
+	for (i = 0; i < pool->qty; i++)
+		misuse += pool->buffer[i].misuse;
+
+	return misuse;
+}
+
+/*
+ * Once a queue is stopped, the driver no longer owns any of its buffers,
+ * and has forgotten any it had prepared. Return any still marked as queued
+ * to the pool.
+ */
+void fdp1_v4l2_pool_reclaim(struct fdp1_v4l2_buffer_pool * pool)
+{
+	unsigned int i;
+
+	if (!pool)
+		return;
+
+	for (i = 0; i < pool->qty; i++) {
+		if (pool->buffer[i].state == FDP1_BUF_QUEUED)
+			fdp1_v4l2_buffer_set_state(&pool->buffer[i], FDP1_BUF_FREE);
+
+		pool->buffer[i].prepared = false;
+	}
+}
+
+/*
+ * Report the time each buffer of the pool has spent in each state.
+ *
+ * The 'held' figure is the average number of buffers in that state over the
+ * life of the pool, so 'Queued' is the depth the driver really needs.
+ */
+void fdp1_v4l2_pool_report(struct fdp1_context * fdp1,
+			   struct fdp1_v4l2_buffer_pool * pool)
+{
+	uint64_t now = fdp1_time_ns();
+	uint64_t lifetime = now - pool->created;
+	uint64_t total[FDP1_BUF_STATE_MAX] = { 0 };
+	unsigned int i, s;
+
+	if (!pool->qty || !lifetime)
+		return;
+
+	for (i = 0; i < pool->qty; i++) {
+		struct fdp1_v4l2_buffer * buf = &pool->buffer[i];
+
+		for (s = 0; s < FDP1_BUF_STATE_MAX; s++)
+			total[s] += buf->state_ns[s];
+
+		total[buf->state] += now - buf->state_since;
+	}
+
+	kprint(fdp1, 1, "%s pool: %d buffers, %d misuses, %" PRIu64 " us lifetime\n",
+			q_type(pool->buffer[0].type), pool->qty,
+			fdp1_v4l2_pool_misuse(pool),
+			lifetime / 1000);
+
+	for (s = 0; s < FDP1_BUF_STATE_MAX; s++)
+		kprint(fdp1, 1, "  %-8s %10" PRIu64 " us  held %.2f\n",
+				fdp1_buffer_state_str(s), total[s] / 1000,
+				(double)total[s] / lifetime);
+}
+
 struct fdp1_v4l2_dev * fdp1_v4l2_open(struct fdp1_context * fdp1)
 {
 	int ret;
 	char devname[] = "/dev/videoNNNNNNN";
-	struct fdp1_v4l2_dev * v4l2_dev = malloc(sizeof(struct fdp1_v4l2_dev));
+	struct fdp1_v4l2_dev * v4l2_dev = calloc(1, sizeof(struct fdp1_v4l2_dev));
+	uint64_t start;
 
 	if (!v4l2_dev)
 		return NULL;
@@ -86,25 +506,35 @@ struct fdp1_v4l2_dev * fdp1_v4l2_open(struct fdp1_context * fdp1)
 
 	kprint(fdp1, 2, "Opening %s\n", devname);
 
+	start = fdp1_time_ns();
+	v4l2_dev->media_fd = -1;
+	v4l2_dev->verbose = fdp1->verbose;
+	v4l2_dev->perf = fdp1->counters;
+	v4l2_dev->log = fdp1->log;
 	v4l2_dev->fd = open(devname, O_RDWR | O_NONBLOCK, 0);
+	fdp1_v4l2_phase(v4l2_dev, FDP1_PHASE_OPEN, start);
+	v4l2_dev->session = fdp1_record_open(fdp1->log, fdp1->dev,
+			v4l2_dev->fd < 0 ? -errno : 0, start, fdp1_time_ns());
 	if (v4l2_dev->fd < 0) {
-		fprintf(stderr, "%s:%d: failed to open %s", __func__, __LINE__, devname);\
-		perror("open");
+		kprint(fdp1, 0, "failed to open %s: %s\n", devname, strerror(errno));
 		free(v4l2_dev);
 		return 0;
 	}
 
-	ret = ioctl(v4l2_dev->fd, VIDIOC_QUERYCAP, &v4l2_dev->cap);
+	start = fdp1_time_ns();
+	ret = fdp1_v4l2_ioctl(v4l2_dev, VIDIOC_QUERYCAP, &v4l2_dev->cap);
+	fdp1_v4l2_phase(v4l2_dev, FDP1_PHASE_QUERYCAP, start);
 	if (ret < 0) {
-		fprintf(stderr, "%s:%d: failed to query cap %s", __func__, __LINE__, devname);\
-		perror("VIDIOC_QUERYCAP");
+		kprint(fdp1, 0, "failed to query cap %s: %s\n", devname,
+				strerror(errno));
 		fdp1_v4l2_close(v4l2_dev);
 		return 0;
 	}
 
 	if (!(v4l2_dev->cap.capabilities & V4L2_CAP_VIDEO_M2M_MPLANE)) {
-		fprintf(stderr, "Device does not support V4L2_CAP_VIDEO_M2M_MPLANE\n");
+		kprint(fdp1, 0, "Device does not support V4L2_CAP_VIDEO_M2M_MPLANE\n");
 		fdp1_v4l2_close(v4l2_dev);
+		errno = ENODEV;
 		return 0;
 	}
 
@@ -116,12 +546,50 @@ int fdp1_v4l2_close(struct fdp1_v4l2_dev * v4l2_dev)
 	if (!v4l2_dev)
 		return 0;
 
+	if (v4l2_dev->media_fd >= 0)
+		close(v4l2_dev->media_fd);
+
 	close(v4l2_dev->fd);
+	fdp1_record_close(v4l2_dev->log, v4l2_dev->session);
 	free(v4l2_dev);
 
 	return 0;
 }
 
+/* Every ioctl on the device, so that each is in the session log */
+int fdp1_v4l2_ioctl(struct fdp1_v4l2_dev * dev, unsigned long request,
+		    void * arg)
+{
+	uint64_t start;
+	int ret, err;
+
+	if (!dev->log)
+		return ioctl(dev->fd, request, arg);
+
+	start = fdp1_time_ns();
+	ret = ioctl(dev->fd, request, arg);
+	err = errno;
+
+	fdp1_record_ioctl(dev->log, dev->session, request, arg,
+			  ret < 0 ? -err : ret, start, fdp1_time_ns());
+
+	errno = err;
+	return ret;
+}
+
+/* The format last negotiated on the queue of 'type' */
+struct v4l2_format * fdp1_v4l2_queue_fmt(struct fdp1_v4l2_dev * v4l2_dev,
+					 uint32_t type)
+{
+	return V4L2_TYPE_IS_OUTPUT(type) ? &v4l2_dev->out_fmt : &v4l2_dev->cap_fmt;
+}
+
+static void fdp1_v4l2_keep_fmt(struct fdp1_v4l2_dev * v4l2_dev,
+			       const struct v4l2_format * fmt)
+{
+	*fdp1_v4l2_queue_fmt(v4l2_dev, fmt->type) = *fmt;
+}
+
 int fdp1_v4l2_set_fmt(struct fdp1_context * fdp1,
 			struct fdp1_v4l2_dev * v4l2_dev,
 			uint32_t type,
@@ -131,6 +599,7 @@ int fdp1_v4l2_set_fmt(struct fdp1_context * fdp1,
 			uint32_t field)
 {
 	struct v4l2_format fmt;
+	uint64_t start;
 	int ret;
 
 	/* The data we send to the device/driver */
@@ -140,50 +609,131 @@ int fdp1_v4l2_set_fmt(struct fdp1_context * fdp1,
 	fmt.fmt.pix_mp.pixelformat	= fourcc;
 	fmt.fmt.pix_mp.field		= field;
 
-	ret = ioctl(v4l2_dev->fd, VIDIOC_S_FMT, &fmt);
+	start = fdp1_time_ns();
+	ret = fdp1_v4l2_ioctl(v4l2_dev, VIDIOC_S_FMT, &fmt);
+	fdp1_v4l2_phase(v4l2_dev, FDP1_PHASE_S_FMT, start);
 	if (ret < 0) {
-		fprintf(stderr, "Format not set\n");
-		perror("VIDIOC_S_FMT");
+		kprint(fdp1, 0, "Format not set: %s\n", strerror(errno));
 		return TEST_FAIL;
 	}
 
+	fdp1_v4l2_keep_fmt(v4l2_dev, &fmt);
+
 	if (fmt.fmt.pix_mp.pixelformat != fourcc) {
-		fprintf(stderr, "Format changed\n");
+		kprint(fdp1, 0, "Format changed\n");
+		errno = EINVAL;
+		return TEST_FAIL;
+	}
+
+	return TEST_PASS;
+}
+
+/* Read back the format of a queue, as fdp1_v4l2_queue_fmt() returns it */
+int fdp1_v4l2_get_fmt(struct fdp1_context * fdp1,
+		      struct fdp1_v4l2_dev * v4l2_dev,
+		      uint32_t type)
+{
+	struct v4l2_format fmt;
+
+	memzero(fmt);
+	fmt.type = type;
+
+	if (fdp1_v4l2_ioctl(v4l2_dev, VIDIOC_G_FMT, &fmt) < 0) {
+		kprint(fdp1, 0, "VIDIOC_G_FMT: %s\n", strerror(errno));
 		return TEST_FAIL;
 	}
 
+	fdp1_v4l2_keep_fmt(v4l2_dev, &fmt);
+
 	return TEST_PASS;
 }
 
 /*
- * Request some buffers,
- *
- * Returns the number granted
+ * Ask the driver what it would make of a format, without changing anything.
+ * The adjusted format, with the size of each plane, is returned in 'fmt'.
  */
-int fdp1_v4l2_request_buffers(struct fdp1_context * fdp1,
-			struct fdp1_v4l2_dev * v4l2_dev,
-			uint32_t type,
-			uint32_t buffers_requested)
+int fdp1_v4l2_try_fmt(struct fdp1_context * fdp1,
+		      struct fdp1_v4l2_dev * v4l2_dev,
+		      struct v4l2_format * fmt,
+		      uint32_t type,
+		      uint32_t width,
+		      uint32_t height,
+		      uint32_t fourcc,
+		      uint32_t field)
+{
+	uint64_t start;
+	int ret;
+
+	memzero(*fmt);
+
+	fmt->type			= type;
+	fmt->fmt.pix_mp.width		= width;
+	fmt->fmt.pix_mp.height		= height;
+	fmt->fmt.pix_mp.pixelformat	= fourcc;
+	fmt->fmt.pix_mp.field		= field;
+
+	start = fdp1_time_ns();
+	ret = fdp1_v4l2_ioctl(v4l2_dev, VIDIOC_TRY_FMT, fmt);
+	fdp1_v4l2_phase(v4l2_dev, FDP1_PHASE_TRY_FMT, start);
+	if (ret < 0) {
+		kprint(fdp1, 0, "VIDIOC_TRY_FMT: %s\n", strerror(errno));
+		return TEST_FAIL;
+	}
+
+	kprint(fdp1, 2, "%s %dx%d needs %d plane(s), %d bytes\n", q_type(type),
+			fmt->fmt.pix_mp.width, fmt->fmt.pix_mp.height,
+			fmt->fmt.pix_mp.num_planes,
+			fmt->fmt.pix_mp.plane_fmt[0].sizeimage);
+
+	return TEST_PASS;
+}
+
+static int fdp1_v4l2_reqbufs(struct fdp1_context * fdp1,
+			     struct fdp1_v4l2_dev * v4l2_dev,
+			     uint32_t type,
+			     uint32_t memory,
+			     uint32_t buffers_requested)
 {
 	struct v4l2_requestbuffers reqbuf;
+	uint64_t start;
 	int ret;
 
 	memzero(reqbuf);
 
 	reqbuf.count	= buffers_requested;
 	reqbuf.type	= type;
-	reqbuf.memory	= V4L2_MEMORY_MMAP;
-	ret = ioctl(v4l2_dev->fd, VIDIOC_REQBUFS, &reqbuf);
+	reqbuf.memory	= memory;
+	if (fdp1->cache_hints && memory == V4L2_MEMORY_MMAP)
+		reqbuf.flags = V4L2_MEMORY_FLAG_NON_COHERENT;
+
+	start = fdp1_time_ns();
+	ret = fdp1_v4l2_ioctl(v4l2_dev, VIDIOC_REQBUFS, &reqbuf);
+	fdp1_v4l2_phase(v4l2_dev, FDP1_PHASE_REQBUFS, start);
 	if (ret < 0) {
-		fprintf(stderr, "Request Buffers failed\n");
-		perror("VIDIOC_REQBUFS");
+		kprint(fdp1, 0, "VIDIOC_REQBUFS: %s\n", strerror(errno));
 		return 0;
 	}
 
+	v4l2_dev->buf_caps = reqbuf.capabilities;
+
 	kprint(fdp1, 2, "Got %d buffers\n", reqbuf.count);
 	return reqbuf.count;
 }
 
+/*
+ * Request some buffers,
+ *
+ * Returns the number granted
+ */
+int fdp1_v4l2_request_buffers(struct fdp1_context * fdp1,
+			struct fdp1_v4l2_dev * v4l2_dev,
+			uint32_t type,
+			uint32_t buffers_requested)
+{
+	return fdp1_v4l2_reqbufs(fdp1, v4l2_dev, type, V4L2_MEMORY_MMAP,
+				 buffers_requested);
+}
+
 int fdp1_v4l2_query_buffer(struct fdp1_context * fdp1,
 		struct fdp1_v4l2_dev * v4l2_dev,
 		struct fdp1_v4l2_buffer * fdp1_buf,
@@ -192,6 +742,8 @@ int fdp1_v4l2_query_buffer(struct fdp1_context * fdp1,
 {
 	int i;
 	int fail = 0;
+	int flags = MAP_SHARED;
+	uint64_t start;
 	int ret;
 
 	memzero(*fdp1_buf);
@@ -202,9 +754,11 @@ int fdp1_v4l2_query_buffer(struct fdp1_context * fdp1,
 	fdp1_buf->v4l2_buf.m.planes	= fdp1_buf->planes;
 	fdp1_buf->v4l2_buf.length	= 1; /* Only one plane ATM */
 
-	ret = ioctl(v4l2_dev->fd, VIDIOC_QUERYBUF, &fdp1_buf->v4l2_buf);
+	start = fdp1_time_ns();
+	ret = fdp1_v4l2_ioctl(v4l2_dev, VIDIOC_QUERYBUF, &fdp1_buf->v4l2_buf);
+	fdp1_v4l2_phase(v4l2_dev, FDP1_PHASE_QUERYBUF, start);
 	if (ret != 0) {
-		perror("ioctl VIDIOC_QUERYBUF");
+		kprint(fdp1, 0, "VIDIOC_QUERYBUF: %s\n", strerror(errno));
 		return ret;
 	}
 
@@ -215,15 +769,31 @@ int fdp1_v4l2_query_buffer(struct fdp1_context * fdp1,
 
 	fdp1_buf->n_planes = fdp1_buf->v4l2_buf.length;
 
+	/*
+	 * Locked buffers are faulted in as they are mapped, and kept resident,
+	 * so that neither the first frame nor a later one pays for page faults.
+	 */
+	if (fdp1->lock_buffers)
+		flags |= MAP_POPULATE;
+
 	for (i = 0; i < fdp1_buf->n_planes; i++) {
 		fdp1_buf->sizes[i] = fdp1_buf->v4l2_buf.m.planes[i].length;
+
+		start = fdp1_time_ns();
 		fdp1_buf->mem[i] = mmap(NULL, fdp1_buf->v4l2_buf.m.planes[i].length,
-			  PROT_READ | PROT_WRITE, MAP_SHARED, v4l2_dev->fd,
+			  PROT_READ | PROT_WRITE, flags, v4l2_dev->fd,
 			  fdp1_buf->v4l2_buf.m.planes[i].m.mem_offset);
 
+		if (fdp1_buf->mem[i] != MAP_FAILED && fdp1->lock_buffers &&
+		    mlock(fdp1_buf->mem[i], fdp1_buf->sizes[i]))
+			kprint(fdp1, 1, "Failed to lock plane %d: %s\n", i,
+					strerror(errno));
+
+		fdp1_v4l2_phase(v4l2_dev, FDP1_PHASE_MMAP, start);
+
 		if (fdp1_buf->mem[i] == MAP_FAILED) {
-			kprint(fdp1, 1, "Failed to mmap plane %d\n", i);
-			perror("mmap");
+			kprint(fdp1, 0, "Failed to mmap plane %d: %s\n", i,
+					strerror(errno));
 			fail++;
 		}
 	}
@@ -231,6 +801,80 @@ int fdp1_v4l2_query_buffer(struct fdp1_context * fdp1,
 	return fail;
 }
 
+/* Set up the bookkeeping of a new pool, and of its buffers */
+static void fdp1_v4l2_pool_setup(struct fdp1_context * fdp1,
+				 struct fdp1_v4l2_dev * v4l2_dev,
+				 struct fdp1_v4l2_buffer_pool * pool,
+				 uint32_t type,
+				 uint32_t memory,
+				 enum v4l2_field field)
+{
+	pool->created = fdp1_time_ns();
+	pool->caps = v4l2_dev->buf_caps;
+	pool->memory = memory;
+	pool->field = field;
+	pool->sequence_in = 0;
+	pool->verbose = fdp1->verbose;
+	pool->perf = fdp1->counters;
+
+	/* The format the buffers are laid out by, read back if never set */
+	if (fdp1_v4l2_queue_fmt(v4l2_dev, type)->type != type)
+		fdp1_v4l2_get_fmt(fdp1, v4l2_dev, type);
+	pool->fmt = fdp1_v4l2_queue_fmt(v4l2_dev, type)->fmt.pix_mp;
+
+	pool->cache_hints = fdp1->cache_hints && memory == V4L2_MEMORY_MMAP &&
+		(v4l2_dev->buf_caps & V4L2_BUF_CAP_SUPPORTS_MMAP_CACHE_HINTS);
+	if (fdp1->cache_hints && !pool->cache_hints)
+		kprint(fdp1, 1, "%s queue does not support cache hints\n",
+				q_type(type));
+}
+
+static void fdp1_v4l2_buffer_setup(struct fdp1_v4l2_buffer_pool * pool,
+				   unsigned int i,
+				   uint32_t type)
+{
+	struct fdp1_v4l2_buffer * buffer = &pool->buffer[i];
+
+	buffer->pool = pool;
+	buffer->type = type;
+	buffer->index = i;
+	buffer->v4l2_buf.field = pool->field;
+	buffer->state = FDP1_BUF_FREE;
+	buffer->state_since = pool->created;
+	buffer->request_fd = -1;
+
+	/* Unless told otherwise, captures are expected to be read */
+	buffer->cpu_reads = !V4L2_TYPE_IS_OUTPUT(type);
+}
+
+/* Query and map the buffers the driver has allocated for a new pool */
+static struct fdp1_v4l2_buffer_pool *
+fdp1_v4l2_pool_init(struct fdp1_context * fdp1,
+		    struct fdp1_v4l2_dev * v4l2_dev,
+		    struct fdp1_v4l2_buffer_pool * pool,
+		    uint32_t type,
+		    enum v4l2_field field)
+{
+	uint32_t i;
+	uint32_t fail = 0;
+
+	fdp1_v4l2_pool_setup(fdp1, v4l2_dev, pool, type, V4L2_MEMORY_MMAP, field);
+
+	for (i = 0; i < pool->qty; ++i) {
+		fail += fdp1_v4l2_query_buffer(fdp1, v4l2_dev,
+				&pool->buffer[i], type, i);
+		fdp1_v4l2_buffer_setup(pool, i, type);
+	}
+
+	if (fail) {
+		kprint(fdp1, 2, "Failed to query buffers\n");
+		free(pool);
+		return NULL;
+	}
+
+	return pool;
+}
+
 /*
  * fdp1_v4l2_allocate_buffers
  *
@@ -244,13 +888,9 @@ fdp1_v4l2_allocate_buffers(struct fdp1_context * fdp1,
 			enum v4l2_field field,
 			uint32_t buffers_requested)
 {
-	uint32_t qty;
-	uint32_t i;
-	uint32_t fail = 0;
-
 	struct fdp1_v4l2_buffer_pool * pool = malloc(sizeof(struct fdp1_v4l2_buffer_pool));
 	if (!pool) {
-		perror("BufferPool Allocation");
+		kprint(fdp1, 0, "BufferPool Allocation: %s\n", strerror(errno));
 		return NULL;
 	}
 
@@ -266,99 +906,431 @@ fdp1_v4l2_allocate_buffers(struct fdp1_context * fdp1,
 		return NULL;
 	}
 
-	for (i = 0; i < pool->qty; ++i) {
-		fail += fdp1_v4l2_query_buffer(fdp1, v4l2_dev,
-				&pool->buffer[i], type, i);
-		pool->buffer[i].type = type;
-		pool->buffer[i].index = i;
-		pool->buffer[i].v4l2_buf.field = field;
+	return fdp1_v4l2_pool_init(fdp1, v4l2_dev, pool, type, field);
+}
+
+/*
+ * fdp1_v4l2_create_buffers
+ *
+ * As fdp1_v4l2_allocate_buffers(), but with VIDIOC_CREATE_BUFS, so that the
+ * buffers are sized from 'fmt' rather than the current format. The queue
+ * must have no buffers allocated.
+ */
+struct fdp1_v4l2_buffer_pool *
+fdp1_v4l2_create_buffers(struct fdp1_context * fdp1,
+			 struct fdp1_v4l2_dev * v4l2_dev,
+			 struct v4l2_format * fmt,
+			 enum v4l2_field field,
+			 uint32_t buffers_requested)
+{
+	struct v4l2_create_buffers create;
+	uint64_t start;
+	int ret;
+
+	struct fdp1_v4l2_buffer_pool * pool = malloc(sizeof(struct fdp1_v4l2_buffer_pool));
+	if (!pool) {
+		kprint(fdp1, 0, "BufferPool Allocation: %s\n", strerror(errno));
+		return NULL;
 	}
 
-	if (fail) {
-		kprint(fdp1, 2, "Failed to query buffers\n");
+	if (buffers_requested > MAX_BUFFER_POOL_SIZE)
+		buffers_requested = MAX_BUFFER_POOL_SIZE;
+
+	memzero(create);
+	create.count	= buffers_requested;
+	create.memory	= V4L2_MEMORY_MMAP;
+	create.format	= *fmt;
+	if (fdp1->cache_hints)
+		create.flags = V4L2_MEMORY_FLAG_NON_COHERENT;
+
+	start = fdp1_time_ns();
+	ret = fdp1_v4l2_ioctl(v4l2_dev, VIDIOC_CREATE_BUFS, &create);
+	fdp1_v4l2_phase(v4l2_dev, FDP1_PHASE_CREATE_BUFS, start);
+	if (ret < 0 || create.count == 0 || create.index != 0) {
+		kprint(fdp1, 1, "Failed to create buffers (%d at %d): %s\n",
+				create.count, create.index, strerror(errno));
 		free(pool);
 		return NULL;
 	}
 
+	v4l2_dev->buf_caps = create.capabilities;
+
+	if (create.count > MAX_BUFFER_POOL_SIZE)
+		create.count = MAX_BUFFER_POOL_SIZE;
+
+	kprint(fdp1, 2, "Created %d buffers of %d bytes\n", create.count,
+			fmt->fmt.pix_mp.plane_fmt[0].sizeimage);
+
+	pool->qty = create.count;
+
+	return fdp1_v4l2_pool_init(fdp1, v4l2_dev, pool, fmt->type, field);
+}
+
+/*
+ * fdp1_v4l2_import_buffers
+ *
+ * Create a pool of V4L2_MEMORY_DMABUF or V4L2_MEMORY_USERPTR buffers,
+ * matching the buffers of 'donor'. DMABUF buffers are exported from the
+ * donor's own buffers, on 'donor_dev', and USERPTR buffers are allocated
+ * here. Either way, each plane is also mapped for the CPU.
+ */
+struct fdp1_v4l2_buffer_pool *
+fdp1_v4l2_import_buffers(struct fdp1_context * fdp1,
+			 struct fdp1_v4l2_dev * v4l2_dev,
+			 uint32_t type,
+			 uint32_t memory,
+			 enum v4l2_field field,
+			 struct fdp1_v4l2_dev * donor_dev,
+			 struct fdp1_v4l2_buffer_pool * donor)
+{
+	long page = sysconf(_SC_PAGESIZE);
+	unsigned int i, k;
+	uint64_t start;
+	int fail = 0;
+
+	struct fdp1_v4l2_buffer_pool * pool = calloc(1, sizeof(struct fdp1_v4l2_buffer_pool));
+	if (!pool) {
+		kprint(fdp1, 0, "BufferPool Allocation: %s\n", strerror(errno));
+		return NULL;
+	}
+
+	pool->qty = fdp1_v4l2_reqbufs(fdp1, v4l2_dev, type, memory, donor->qty);
+	if (pool->qty == 0) {
+		kprint(fdp1, 1, "Failed to get any %s buffers\n",
+				fdp1_v4l2_memory_str(memory));
+		free(pool);
+		return NULL;
+	}
+
+	if (pool->qty > donor->qty)
+		pool->qty = donor->qty;
+
+	fdp1_v4l2_pool_setup(fdp1, v4l2_dev, pool, type, memory, field);
+
+	for (i = 0; i < pool->qty; i++) {
+		struct fdp1_v4l2_buffer * buffer = &pool->buffer[i];
+
+		buffer->n_planes = donor->buffer[i].n_planes;
+		fdp1_v4l2_buffer_setup(pool, i, type);
+
+		for (k = 0; k < buffer->n_planes; k++) {
+			buffer->sizes[k] = donor->buffer[i].sizes[k];
+			buffer->dmabuf[k] = -1;
+			buffer->mem[k] = MAP_FAILED;
+
+			if (memory == V4L2_MEMORY_USERPTR) {
+				void * mem;
+
+				if (posix_memalign(&mem, page, buffer->sizes[k])) {
+					fail++;
+					continue;
+				}
+
+				buffer->mem[k] = mem;
+				continue;
+			}
+
+			struct v4l2_exportbuffer expbuf = {
+				.type = donor->buffer[i].type,
+				.index = i,
+				.plane = k,
+				.flags = O_RDWR | O_CLOEXEC,
+			};
+
+			start = fdp1_time_ns();
+			if (fdp1_v4l2_ioctl(donor_dev, VIDIOC_EXPBUF, &expbuf)) {
+				fdp1_v4l2_phase(v4l2_dev, FDP1_PHASE_EXPBUF, start);
+				kprint(fdp1, 0, "VIDIOC_EXPBUF: %s\n", strerror(errno));
+				fail++;
+				continue;
+			}
+			fdp1_v4l2_phase(v4l2_dev, FDP1_PHASE_EXPBUF, start);
+
+			buffer->dmabuf[k] = expbuf.fd;
+
+			start = fdp1_time_ns();
+			buffer->mem[k] = mmap(NULL, buffer->sizes[k],
+					      PROT_READ | PROT_WRITE, MAP_SHARED,
+					      expbuf.fd, 0);
+			fdp1_v4l2_phase(v4l2_dev, FDP1_PHASE_MMAP, start);
+
+			if (buffer->mem[k] == MAP_FAILED) {
+				kprint(fdp1, 0, "mmap dmabuf: %s\n", strerror(errno));
+				fail++;
+			}
+		}
+	}
+
+	if (fail) {
+		kprint(fdp1, 1, "Failed to import %s buffers\n",
+				fdp1_v4l2_memory_str(memory));
+		fdp1_v4l2_free_buffers(pool);
+		return NULL;
+	}
+
 	return pool;
 }
 
-/* Releases all mmapped memory and free's the pool */
-void fdp1_v4l2_free_buffers(struct fdp1_v4l2_buffer_pool * pool)
+/*
+ * Releases all mmapped memory and free's the pool
+ *
+ * Returns the number of buffers which were leaked: still owned by us, but
+ * never queued or released. Buffers still queued to the driver are also
+ * leaks, as the queue should have been stopped first. Any ownership misuse
+ * seen during the life of the pool is counted as well.
+ */
+int fdp1_v4l2_free_buffers(struct fdp1_v4l2_buffer_pool * pool)
 {
 	unsigned int i, k;
+	int leaked = 0;
 
 	if (!pool)
-		return;
+		return 0;
+
+	leaked += fdp1_v4l2_pool_misuse(pool);
 
 	for (i = 0; i < pool->qty; ++i) {
 		struct fdp1_v4l2_buffer * buf = &pool->buffer[i];
-		for (k = 0; k < buf->n_planes; ++k)
-			munmap(buf->mem[k], buf->sizes[k]);;
+
+		if (buf->state != FDP1_BUF_FREE) {
+			kprint(pool, 0, "%s buffer %d leaked in state %s\n",
+					q_type(buf->type), buf->index,
+					fdp1_buffer_state_str(buf->state));
+			leaked++;
+		}
+
+		for (k = 0; k < buf->n_planes; ++k) {
+			if (pool->memory == V4L2_MEMORY_USERPTR) {
+				if (buf->mem[k] != MAP_FAILED)
+					free(buf->mem[k]);
+				continue;
+			}
+
+			if (buf->mem[k] != MAP_FAILED)
+				munmap(buf->mem[k], buf->sizes[k]);
+
+			if (pool->memory == V4L2_MEMORY_DMABUF &&
+			    buf->dmabuf[k] >= 0)
+				close(buf->dmabuf[k]);
+		}
+
+		if (buf->request_fd >= 0)
+			close(buf->request_fd);
 	}
 
 	free(pool);
+
+	return leaked;
 }
 
-int fdp1_v4l2_queue_buffer(struct fdp1_v4l2_dev * dev,
-		struct fdp1_v4l2_buffer * buffer)
+/*
+ * The field carried by the next buffer queued to a pool.
+ *
+ * With V4L2_FIELD_ALTERNATE each buffer holds a single field, and must be
+ * tagged with the one it holds. We always start with the top field.
+ */
+static enum v4l2_field fdp1_v4l2_next_field(struct fdp1_v4l2_buffer_pool * pool)
+{
+	if (pool->field != V4L2_FIELD_ALTERNATE)
+		return pool->field;
+
+	return (pool->sequence_in & 1) ? V4L2_FIELD_BOTTOM : V4L2_FIELD_TOP;
+}
+
+/* Describe a buffer to the driver, for QBUF or PREPARE_BUF */
+static void fdp1_v4l2_buffer_describe(struct fdp1_v4l2_buffer * buffer,
+				      struct v4l2_buffer * buf,
+				      struct v4l2_plane * planes)
 {
 	/* Using the mplane API for single planes so far */
+	buf->type	= buffer->type;
+	buf->memory	= buffer->pool->memory;
+	buf->index	= buffer->index;
+	buf->field	= buffer->v4l2_buf.field;
+	buf->m.planes 	= planes;
+	buf->length	= 1;
+
+	planes[0].length = buffer->sizes[0];
+	planes[0].bytesused = buffer->sizes[0];
+
+	if (buf->memory == V4L2_MEMORY_DMABUF)
+		planes[0].m.fd = buffer->dmabuf[0];
+	else if (buf->memory == V4L2_MEMORY_USERPTR)
+		planes[0].m.userptr = (unsigned long)buffer->mem[0];
+
+	/*
+	 * Skip the cache maintenance the CPU does not need: cleaning if it
+	 * has not written the buffer, invalidating if it will not read it.
+	 */
+	if (buffer->pool->cache_hints) {
+		if (!buffer->cpu_dirty)
+			buf->flags |= V4L2_BUF_FLAG_NO_CACHE_CLEAN;
+		if (!buffer->cpu_reads)
+			buf->flags |= V4L2_BUF_FLAG_NO_CACHE_INVALIDATE;
+	}
+}
+
+/*
+ * fdp1_v4l2_prepare_buffer
+ *
+ * Have the driver validate (and for DMABUF or USERPTR, map or pin) a buffer
+ * we own ahead of queueing it, so that QBUF itself has less to do. The
+ * buffer must have its content: on a non-coherent pool the caches are
+ * cleaned here, not when it is queued.
+ */
+int fdp1_v4l2_prepare_buffer(struct fdp1_v4l2_dev * dev,
+			     struct fdp1_v4l2_buffer * buffer)
+{
+	struct v4l2_buffer buf = { 0 };
+	struct v4l2_plane planes[1] = { 0 };
+	uint64_t start;
+	int ret;
+
+	if (buffer->state == FDP1_BUF_QUEUED || buffer->prepared)
+		return -EBUSY;
+
+	fdp1_v4l2_buffer_describe(buffer, &buf, planes);
+
+	start = fdp1_time_ns();
+	ret = fdp1_v4l2_ioctl(dev, VIDIOC_PREPARE_BUF, &buf);
+	fdp1_v4l2_phase(dev, FDP1_PHASE_PREPARE_BUF, start);
+	if (ret) {
+		kprint(dev, 0, "VIDIOC_PREPARE_BUF: %s\n", strerror(errno));
+		return ret;
+	}
+
+	buffer->prepared = true;
+	buffer->cpu_dirty = false;
+
+	return 0;
+}
+
+/* Prepare every buffer of a pool which we own, returning the failures */
+int fdp1_v4l2_pool_prepare(struct fdp1_v4l2_dev * dev,
+			   struct fdp1_v4l2_buffer_pool * pool)
+{
+	unsigned int i;
+	int fail = 0;
+
+	for (i = 0; i < pool->qty; i++)
+		if (pool->buffer[i].state != FDP1_BUF_QUEUED &&
+		    !pool->buffer[i].prepared)
+			fail += !!fdp1_v4l2_prepare_buffer(dev, &pool->buffer[i]);
+
+	return fail;
+}
+
+/* Queue a buffer, to the driver, or to a request when request_fd >= 0 */
+static int fdp1_v4l2_qbuf(struct fdp1_v4l2_dev * dev,
+			  struct fdp1_v4l2_buffer * buffer,
+			  int request_fd)
+{
 	struct v4l2_buffer buf = { 0 };
 	struct v4l2_plane planes[1] = { 0 };
+	struct fdp1_perf_sample perf;
+	uint64_t now;
 	int ret;
 
-	fprintf(stderr, "QBUF type=%d idx=%d: size (%d) %s %m\n",
+	if (fdp1_v4l2_buffer_set_state(buffer, FDP1_BUF_QUEUED))
+		return -EBUSY;
+
+	buffer->v4l2_buf.field = fdp1_v4l2_next_field(buffer->pool);
+
+	kprint(dev, 2, "QBUF type=%d idx=%d: size (%d) %s\n",
 			buffer->type, buffer->index, buffer->sizes[0],
 			v4l2_field(buffer->v4l2_buf.field));
 
-	buf.type	= buffer->type;
-	buf.memory	= V4L2_MEMORY_MMAP;
-	buf.index	= buffer->index;
-	buf.field	= buffer->v4l2_buf.field;
-	buf.m.planes 	= planes;
-	buf.length	= 1;
+	fdp1_v4l2_buffer_describe(buffer, &buf, planes);
+
+	/* The driver copies this to the capture buffer(s) produced from it */
+	now = fdp1_time_ns();
+	buf.timestamp.tv_sec = now / 1000000000ULL;
+	buf.timestamp.tv_usec = (now % 1000000000ULL) / 1000;
 
-	buf.m.planes[0].length = buffer->sizes[0];
-	buf.m.planes[0].bytesused = buffer->sizes[0];
+	if (request_fd >= 0) {
+		buf.flags |= V4L2_BUF_FLAG_REQUEST_FD;
+		buf.request_fd = request_fd;
+	}
 
-	ret = ioctl(dev->fd, VIDIOC_QBUF, &buf);
+	fdp1_perf_begin(dev->perf, &perf);
+	ret = fdp1_v4l2_ioctl(dev, VIDIOC_QBUF, &buf);
+	fdp1_perf_end(dev->perf, FDP1_PERF_QBUF, &perf);
+	fdp1_v4l2_phase(dev, FDP1_PHASE_QBUF, now);
 	if (ret) {
-		fprintf(stderr, "Failed to QBUF type=%d idx=%d: size (%d) %m\n",
-				buffer->type, buffer->index, buffer->sizes[0]);
+		kprint(dev, 0, "Failed to QBUF type=%d idx=%d: size (%d) %s\n",
+				buffer->type, buffer->index, buffer->sizes[0],
+				strerror(errno));
 
-		perror("VIDIOC_QBUF");
+		/* The driver refused it, so we still own it */
+		fdp1_v4l2_buffer_set_state(buffer, FDP1_BUF_DEQUEUED);
+		return ret;
 	}
 
+	buffer->queued_at = now;
+	buffer->cpu_dirty = false;
+	buffer->prepared = false;
+	buffer->pool->sequence_in++;
+
 	return ret;
 }
 
+int fdp1_v4l2_queue_buffer(struct fdp1_v4l2_dev * dev,
+		struct fdp1_v4l2_buffer * buffer)
+{
+	return fdp1_v4l2_qbuf(dev, buffer, -1);
+}
+
 struct fdp1_v4l2_buffer *
 fdp1_v4l2_dequeue_buffer(struct fdp1_v4l2_dev * dev, struct fdp1_v4l2_queue * queue)
 {
 	struct v4l2_buffer qbuf = { 0, };
 	struct v4l2_plane planes[2] = { 0, };
 	struct fdp1_v4l2_buffer * buffer;
+	struct fdp1_perf_sample perf;
+	uint64_t start;
+	int ret;
 
 	qbuf.type = queue->type;
-	qbuf.memory = V4L2_MEMORY_MMAP;
+	qbuf.memory = queue->pool->memory;
 	qbuf.m.planes = planes;
 	/* Only single planes supported so far */
 	qbuf.length = 1;
 
-	if (ioctl(dev->fd, VIDIOC_DQBUF, &qbuf)) {
-		fprintf(stderr, "Output dequeue error: %m\n");
-		perror("VIDIOC_DQBUF");
+	fdp1_perf_begin(dev->perf, &perf);
+	start = fdp1_time_ns();
+	ret = fdp1_v4l2_ioctl(dev, VIDIOC_DQBUF, &qbuf);
+	fdp1_v4l2_phase(dev, FDP1_PHASE_DQBUF, start);
+	fdp1_perf_end(dev->perf, FDP1_PERF_DQBUF, &perf);
+
+	if (ret) {
+		kprint(dev, 0, "VIDIOC_DQBUF: %s\n", strerror(errno));
 		return NULL;
 	}
 
 	if (qbuf.index >= queue->pool->qty) {
-		fprintf(stderr, "Buffer index not in pool %d %d\n",qbuf.index, queue->type);
+		kprint(dev, 0, "Buffer index not in pool %d %d\n", qbuf.index,
+				queue->type);
+		errno = EINVAL;
 		return NULL;
 	}
 
 	buffer = &queue->pool->buffer[qbuf.index];
 	buffer->bytesused = qbuf.m.planes[0].bytesused;
+	buffer->dequeued_at = fdp1_time_ns();
+
+	buffer->v4l2_buf.field = qbuf.field;
+	buffer->v4l2_buf.flags = qbuf.flags;
+	buffer->v4l2_buf.sequence = qbuf.sequence;
+	buffer->v4l2_buf.timestamp = qbuf.timestamp;
+
+	/*
+	 * The driver has handed back a buffer it did not own. Take ownership
+	 * regardless, the misuse is recorded against the buffer.
+	 */
+	if (fdp1_v4l2_buffer_set_state(buffer, FDP1_BUF_DEQUEUED)) {
+		buffer->state = FDP1_BUF_DEQUEUED;
+		buffer->state_since = fdp1_time_ns();
+	}
 
 	queue->sequence_out++;
 
@@ -373,6 +1345,8 @@ int fdp1_v4l2_buffer_pool_queue(struct fdp1_v4l2_dev * dev,
 
 static int fdp1_set_input_output_formats(struct fdp1_context * fdp1,
 		struct fdp1_v4l2_dev * dev,
+		unsigned int width,
+		unsigned int height,
 		uint32_t out_fourcc,
 		uint32_t out_field,
 		uint32_t cap_fourcc)
@@ -380,11 +1354,11 @@ static int fdp1_set_input_output_formats(struct fdp1_context * fdp1,
 	uint32_t fail = 0;
 
 	fail += fdp1_v4l2_set_fmt(fdp1, dev, V4L2_BUF_TYPE_VIDEO_OUTPUT_MPLANE,
-			fdp1->width, fdp1->height,
+			width, height,
 			out_fourcc, out_field);
 
 	fail += fdp1_v4l2_set_fmt(fdp1, dev, V4L2_BUF_TYPE_VIDEO_CAPTURE_MPLANE,
-			fdp1->width, fdp1->height,
+			width, height,
 			cap_fourcc, V4L2_FIELD_NONE);
 
 	kprint(fdp1, 2, "Format set to 0x%x:0x%x for test (fail=%d)\n",
@@ -393,6 +1367,20 @@ static int fdp1_set_input_output_formats(struct fdp1_context * fdp1,
 	return fail;
 }
 
+static void fdp1_m2m_full_frame(struct fdp1_m2m * m2m)
+{
+	struct v4l2_rect frame = { 0, 0, m2m->width, m2m->height };
+
+	m2m->crop = frame;
+	m2m->compose = frame;
+}
+
+/* The buffers to allocate on each queue of a context */
+static unsigned int fdp1_m2m_buffers(struct fdp1_context * fdp1)
+{
+	return fdp1->buffers > 0 ? fdp1->buffers : FDP1_M2M_BUFFERS;
+}
+
 struct fdp1_m2m *
 fdp1_create_m2m(struct fdp1_context * fdp1,
 		uint32_t out_fourcc,
@@ -409,7 +1397,7 @@ fdp1_create_m2m(struct fdp1_context * fdp1,
 
 	struct fdp1_m2m * m2m = calloc(1, sizeof(struct fdp1_m2m));
 	if (!m2m) {
-		perror("M2M Ctx Allocation");
+		kprint(fdp1, 0, "M2M Ctx Allocation: %s\n", strerror(errno));
 		return NULL;
 	}
 
@@ -420,7 +1408,15 @@ fdp1_create_m2m(struct fdp1_context * fdp1,
 		return NULL;
 	}
 
+	m2m->out_fourcc = out_fourcc;
+	m2m->out_field = out_field;
+	m2m->cap_fourcc = cap_fourcc;
+	m2m->width = fdp1->width;
+	m2m->height = fdp1->height;
+	fdp1_m2m_full_frame(m2m);
+
 	fail = fdp1_set_input_output_formats(fdp1, m2m->dev,
+			m2m->width, m2m->height,
 			out_fourcc, out_field, cap_fourcc);
 
 	if (fail) {
@@ -433,7 +1429,8 @@ fdp1_create_m2m(struct fdp1_context * fdp1,
 	/* This should be wrapped in a 'create-queue' later */
 	m2m->src_queue.type = V4L2_BUF_TYPE_VIDEO_OUTPUT_MPLANE;
 	m2m->src_queue.pool = fdp1_v4l2_allocate_buffers(fdp1, m2m->dev,
-			V4L2_BUF_TYPE_VIDEO_OUTPUT_MPLANE, out_field, 4);
+			V4L2_BUF_TYPE_VIDEO_OUTPUT_MPLANE, out_field,
+			fdp1_m2m_buffers(fdp1));
 	if (!m2m->src_queue.pool) {
 		kprint(fdp1, 0, "Failed to create a src_buf pool\n");
 		fail++;
@@ -441,7 +1438,8 @@ fdp1_create_m2m(struct fdp1_context * fdp1,
 
 	m2m->dst_queue.type = V4L2_BUF_TYPE_VIDEO_CAPTURE_MPLANE;
 	m2m->dst_queue.pool = fdp1_v4l2_allocate_buffers(fdp1, m2m->dev,
-			V4L2_BUF_TYPE_VIDEO_CAPTURE_MPLANE, V4L2_FIELD_NONE, 4);
+			V4L2_BUF_TYPE_VIDEO_CAPTURE_MPLANE, V4L2_FIELD_NONE,
+			fdp1_m2m_buffers(fdp1));
 	if (!m2m->dst_queue.pool) {
 		kprint(fdp1, 0, "Failed to create a dst_buf pool\n");
 		fail++;
@@ -452,32 +1450,181 @@ fdp1_create_m2m(struct fdp1_context * fdp1,
 		return NULL;
 	}
 
+	/*
+	 * Buffers of a non-coherent pool have their caches cleaned as they
+	 * are prepared, so those can only be prepared once they are filled.
+	 */
+	if (fdp1->prepare_buffers) {
+		if (!m2m->src_queue.pool->cache_hints)
+			fail += fdp1_v4l2_pool_prepare(m2m->dev, m2m->src_queue.pool);
+		if (!m2m->dst_queue.pool->cache_hints)
+			fail += fdp1_v4l2_pool_prepare(m2m->dev, m2m->dst_queue.pool);
+
+		if (fail)
+			kprint(fdp1, 1, "Failed to prepare %d buffers\n", fail);
+	}
+
 	return m2m;
 }
 
-void fdp1_free_m2m(struct fdp1_m2m * m2m)
+/*
+ * Stops both queues, returning all buffers to their pools, and releases the
+ * context. Returns the number of leaked buffers.
+ */
+int fdp1_free_m2m(struct fdp1_m2m * m2m)
 {
+	int leaked = 0;
+
 	if (!m2m)
-		return;
+		return 0;
+
+	if (m2m->src_queue.pool)
+		fdp1_m2m_stream_off(m2m, V4L2_BUF_TYPE_VIDEO_OUTPUT_MPLANE);
+	if (m2m->dst_queue.pool)
+		fdp1_m2m_stream_off(m2m, V4L2_BUF_TYPE_VIDEO_CAPTURE_MPLANE);
 
 	/* Clean Up */
-	fdp1_v4l2_free_buffers(m2m->src_queue.pool);
-	fdp1_v4l2_free_buffers(m2m->dst_queue.pool);
+	leaked += fdp1_v4l2_free_buffers(m2m->src_queue.pool);
+	leaked += fdp1_v4l2_free_buffers(m2m->dst_queue.pool);
 	fdp1_v4l2_close(m2m->dev);
 	free(m2m);
+
+	return leaked;
+}
+
+/*
+ * Replace the buffers of a stopped queue with buffers for 'fmt'. vb2 will
+ * not change the format of a queue with buffers allocated, whether or not
+ * they would fit it, so they are all released first.
+ */
+static int fdp1_m2m_realloc_queue(struct fdp1_context * fdp1,
+				  struct fdp1_m2m * m2m,
+				  struct fdp1_v4l2_queue * queue,
+				  struct v4l2_format * fmt,
+				  enum v4l2_field field)
+{
+	uint64_t start;
+	int fail = 0;
+
+	fail += fdp1_v4l2_free_buffers(queue->pool);
+	queue->pool = NULL;
+
+	fdp1_v4l2_request_buffers(fdp1, m2m->dev, queue->type, 0);
+
+	start = fdp1_time_ns();
+	if (fdp1_v4l2_ioctl(m2m->dev, VIDIOC_S_FMT, fmt) < 0) {
+		kprint(fdp1, 0, "VIDIOC_S_FMT: %s\n", strerror(errno));
+		fail++;
+	} else {
+		fdp1_v4l2_keep_fmt(m2m->dev, fmt);
+	}
+	fdp1_v4l2_phase(m2m->dev, FDP1_PHASE_S_FMT, start);
+
+	queue->pool = fdp1_v4l2_create_buffers(fdp1, m2m->dev, fmt,
+					       field, fdp1_m2m_buffers(fdp1));
+
+	/* Not every driver supports VIDIOC_CREATE_BUFS */
+	if (!queue->pool)
+		queue->pool = fdp1_v4l2_allocate_buffers(fdp1, m2m->dev,
+				queue->type, field, fdp1_m2m_buffers(fdp1));
+
+	if (!queue->pool) {
+		kprint(fdp1, 0, "Failed to reallocate %s buffers\n",
+				q_type(queue->type));
+		fail++;
+	}
+
+	return fail;
+}
+
+/*
+ * fdp1_m2m_reconfigure
+ *
+ * Change the resolution of a context. Both queues are stopped, and each is
+ * given new buffers for the new format, allocated with VIDIOC_CREATE_BUFS
+ * where the driver has it.
+ *
+ * Both queues are left stopped, with every buffer free. If either queue
+ * does not support the new size, neither is changed: the context keeps
+ * its format and buffers, but is still left stopped. Returns the number
+ * of failures, including any buffers leaked from replaced pools.
+ */
+int fdp1_m2m_reconfigure(struct fdp1_context * fdp1,
+			 struct fdp1_m2m * m2m,
+			 unsigned int width,
+			 unsigned int height)
+{
+	struct fdp1_v4l2_queue * queues[] = { &m2m->src_queue, &m2m->dst_queue };
+	enum v4l2_field fields[] = { m2m->out_field, V4L2_FIELD_NONE };
+	uint32_t fourccs[] = { m2m->out_fourcc, m2m->cap_fourcc };
+	struct v4l2_format fmts[ARRAY_SIZE(queues)];
+	unsigned int i;
+	int fail = 0;
+
+	fail += fdp1_m2m_stream_off(m2m, V4L2_BUF_TYPE_VIDEO_OUTPUT_MPLANE);
+	fail += fdp1_m2m_stream_off(m2m, V4L2_BUF_TYPE_VIDEO_CAPTURE_MPLANE);
+
+	for (i = 0; i < ARRAY_SIZE(queues); i++) {
+		if (fdp1_v4l2_try_fmt(fdp1, m2m->dev, &fmts[i], queues[i]->type,
+				      width, height, fourccs[i], fields[i])) {
+			kprint(fdp1, 0, "%s format %dx%d not supported\n",
+					q_type(queues[i]->type), width, height);
+			return ++fail;
+		}
+	}
+
+	for (i = 0; i < ARRAY_SIZE(queues); i++) {
+		queues[i]->sequence_out = 0;
+		fail += fdp1_m2m_realloc_queue(fdp1, m2m, queues[i], &fmts[i],
+					       fields[i]);
+	}
+
+	m2m->width = width;
+	m2m->height = height;
+
+	/* A new format resets the selections to the whole frame */
+	fdp1_m2m_full_frame(m2m);
+
+	return fail;
 }
 
 int fdp1_m2m_stream_on(struct fdp1_m2m * m2m, int type)
 {
 	int fail = 0;
+	uint64_t start;
+	int ret;
+
+	start = fdp1_time_ns();
+	ret = fdp1_v4l2_ioctl(m2m->dev, VIDIOC_STREAMON, &type);
+	fdp1_v4l2_phase(m2m->dev, FDP1_PHASE_STREAMON, start);
+	if (ret != 0) {
+		kprint(m2m->dev, 0, "VIDIOC_STREAMON: %s\n", strerror(errno));
+		fail++;
+	}
+
+	return fail;
+}
+
+/* Stopping a queue implicitly returns all of its buffers to us */
+int fdp1_m2m_stream_off(struct fdp1_m2m * m2m, int type)
+{
+	int fail = 0;
+	uint64_t start;
 	int ret;
 
-	ret = ioctl(m2m->dev->fd, VIDIOC_STREAMON, &type);
+	start = fdp1_time_ns();
+	ret = fdp1_v4l2_ioctl(m2m->dev, VIDIOC_STREAMOFF, &type);
+	fdp1_v4l2_phase(m2m->dev, FDP1_PHASE_STREAMOFF, start);
 	if (ret != 0) {
-		perror("VIDIOC_STREAMON");
+		kprint(m2m->dev, 0, "VIDIOC_STREAMOFF: %s\n", strerror(errno));
 		fail++;
 	}
 
+	if (V4L2_TYPE_IS_OUTPUT(type))
+		fdp1_v4l2_pool_reclaim(m2m->src_queue.pool);
+	else
+		fdp1_v4l2_pool_reclaim(m2m->dst_queue.pool);
+
 	return fail;
 }
 
@@ -485,12 +1632,15 @@ int fdp1_m2m_wait(struct fdp1_m2m * m2m, int type)
 {
 	fd_set read_fds;
 	fd_set write_fds;
+	struct fdp1_perf_sample perf;
 
 	int r;
 	FD_ZERO(&write_fds);
 	FD_ZERO(&read_fds);
 
-	printf("Before select\n");
+	kprint(m2m->dev, 2, "Before select\n");
+
+	fdp1_perf_begin(m2m->dev->perf, &perf);
 
 	if (V4L2_TYPE_IS_OUTPUT(type)) {
 		FD_SET(m2m->dev->fd, &write_fds);
@@ -500,15 +1650,16 @@ int fdp1_m2m_wait(struct fdp1_m2m * m2m, int type)
 		r = select(m2m->dev->fd + 1, &read_fds, NULL, NULL, 0);
 	}
 
+	fdp1_perf_end(m2m->dev->perf, FDP1_PERF_WAIT, &perf);
+
 	if (FD_ISSET(m2m->dev->fd, &read_fds))
-		printf("FD %d Is ready to read!\n", m2m->dev->fd);
+		kprint(m2m->dev, 2, "FD %d Is ready to read!\n", m2m->dev->fd);
 
 	if (FD_ISSET(m2m->dev->fd, &write_fds))
-		printf("FD %d Is ready to write!\n", m2m->dev->fd);
+		kprint(m2m->dev, 2, "FD %d Is ready to write!\n", m2m->dev->fd);
 
 	if (r < 0) {
-		fprintf(stderr, "Select Failed\n");
-		perror("select");
+		kprint(m2m->dev, 0, "select: %s\n", strerror(errno));
 	}
 
 	return r;
@@ -537,9 +1688,9 @@ int fdp1_m2m_set_ctrl(struct fdp1_m2m * m2m, uint32_t ctrl_id, int32_t val)
 	ctrl.id = ctrl_id;
 	ctrl.value = val;
 
-	ret = ioctl(m2m->dev->fd, VIDIOC_S_CTRL, &ctrl);
+	ret = fdp1_v4l2_ioctl(m2m->dev, VIDIOC_S_CTRL, &ctrl);
 	if (ret != 0) {
-		perror("VIDIOC_S_CTRL");
+		kprint(m2m->dev, 0, "VIDIOC_S_CTRL: %s\n", strerror(errno));
 		return ret;
 	}
 
@@ -554,9 +1705,9 @@ int fdp1_m2m_get_ctrl(struct fdp1_m2m * m2m, uint32_t ctrl_id, int32_t *val)
 
 	ctrl.id = ctrl_id;
 
-	ret = ioctl(m2m->dev->fd, VIDIOC_G_CTRL, &ctrl);
+	ret = fdp1_v4l2_ioctl(m2m->dev, VIDIOC_G_CTRL, &ctrl);
 	if (ret != 0) {
-		perror("VIDIOC_G_CTRL");
+		kprint(m2m->dev, 0, "VIDIOC_G_CTRL: %s\n", strerror(errno));
 		return ret;
 	}
 
@@ -565,3 +1716,268 @@ int fdp1_m2m_get_ctrl(struct fdp1_m2m * m2m, uint32_t ctrl_id, int32_t *val)
 	return 0;
 }
 
+/*
+ * fdp1_m2m_set_selection
+ *
+ * Process only part of each source, with V4L2_SEL_TGT_CROP of the output
+ * queue, or write only part of each capture, with V4L2_SEL_TGT_COMPOSE of
+ * the capture queue. 'rect' is updated to what the driver made of it.
+ */
+int fdp1_m2m_set_selection(struct fdp1_m2m * m2m, uint32_t type,
+			   uint32_t target, struct v4l2_rect * rect)
+{
+	struct v4l2_selection sel;
+	int ret;
+
+	memzero(sel);
+	sel.type = type;
+	sel.target = target;
+	sel.r = *rect;
+
+	ret = fdp1_v4l2_ioctl(m2m->dev, VIDIOC_S_SELECTION, &sel);
+	if (ret != 0) {
+		kprint(m2m->dev, 1, "VIDIOC_S_SELECTION: %s\n", strerror(errno));
+		return ret;
+	}
+
+	*rect = sel.r;
+
+	if (target == V4L2_SEL_TGT_CROP)
+		m2m->crop = sel.r;
+	else if (target == V4L2_SEL_TGT_COMPOSE)
+		m2m->compose = sel.r;
+
+	return 0;
+}
+
+int fdp1_m2m_get_selection(struct fdp1_m2m * m2m, uint32_t type,
+			   uint32_t target, struct v4l2_rect * rect)
+{
+	struct v4l2_selection sel;
+	int ret;
+
+	memzero(sel);
+	sel.type = type;
+	sel.target = target;
+
+	ret = fdp1_v4l2_ioctl(m2m->dev, VIDIOC_G_SELECTION, &sel);
+	if (ret != 0) {
+		kprint(m2m->dev, 1, "VIDIOC_G_SELECTION: %s\n", strerror(errno));
+		return ret;
+	}
+
+	*rect = sel.r;
+
+	return 0;
+}
+
+/*
+ * Media requests
+ *
+ * A request carries a buffer together with the control values which apply
+ * to it, so a control can change from one frame to the next while the
+ * queues keep streaming. Requests are allocated from the media device of
+ * the video node, found through sysfs.
+ */
+static int fdp1_media_open(struct fdp1_v4l2_dev * dev)
+{
+	char path[64];
+	struct stat st;
+	struct dirent * entry;
+	DIR * dir;
+	int index = -1;
+
+	if (dev->media_fd >= 0)
+		return dev->media_fd;
+
+	if (fstat(dev->fd, &st))
+		return -errno;
+
+	snprintf(path, sizeof(path), "/sys/dev/char/%u:%u/device",
+		 major(st.st_rdev), minor(st.st_rdev));
+
+	dir = opendir(path);
+	if (!dir)
+		return -errno;
+
+	while ((entry = readdir(dir)) != NULL)
+		if (sscanf(entry->d_name, "media%d", &index) == 1)
+			break;
+
+	closedir(dir);
+
+	if (index < 0)
+		return -ENODEV;
+
+	snprintf(path, sizeof(path), "/dev/media%d", index);
+
+	dev->media_fd = open(path, O_RDWR | O_CLOEXEC);
+	if (dev->media_fd < 0)
+		return -errno;
+
+	return dev->media_fd;
+}
+
+/* Can buffers of this pool be queued through requests */
+bool fdp1_v4l2_pool_requests(struct fdp1_v4l2_dev * dev,
+			     struct fdp1_v4l2_buffer_pool * pool)
+{
+	if (!(pool->caps & V4L2_BUF_CAP_SUPPORTS_REQUESTS))
+		return false;
+
+	return fdp1_media_open(dev) >= 0;
+}
+
+/*
+ * Does the device take output buffers through requests at all: 1 if it
+ * does, 0 if not, or a negative errno if there is no device to ask.
+ */
+int fdp1_requests_supported(struct fdp1_context * fdp1)
+{
+	struct fdp1_m2m * m2m;
+	int supported;
+
+	errno = 0;
+	m2m = fdp1_create_m2m(fdp1, V4L2_PIX_FMT_YUYV, V4L2_FIELD_NONE,
+			      V4L2_PIX_FMT_YUYV);
+	if (!m2m)
+		return errno ? -errno : -ENODEV;
+
+	supported = fdp1_v4l2_pool_requests(m2m->dev, m2m->src_queue.pool);
+
+	fdp1_free_m2m(m2m);
+
+	return supported;
+}
+
+/*
+ * Can the source be cropped, and the capture composed, at all: 1 if so,
+ * 0 if not, or a negative errno if there is no device to ask.
+ */
+int fdp1_selection_supported(struct fdp1_context * fdp1)
+{
+	struct fdp1_m2m * m2m;
+	struct v4l2_rect bounds;
+	int supported;
+
+	errno = 0;
+	m2m = fdp1_create_m2m(fdp1, V4L2_PIX_FMT_YUYV, V4L2_FIELD_NONE,
+			      V4L2_PIX_FMT_YUYV);
+	if (!m2m)
+		return errno ? -errno : -ENODEV;
+
+	supported = !fdp1_m2m_get_selection(m2m, V4L2_BUF_TYPE_VIDEO_OUTPUT_MPLANE,
+					    V4L2_SEL_TGT_CROP_BOUNDS, &bounds) &&
+		    !fdp1_m2m_get_selection(m2m, V4L2_BUF_TYPE_VIDEO_CAPTURE_MPLANE,
+					    V4L2_SEL_TGT_COMPOSE_BOUNDS, &bounds);
+
+	fdp1_free_m2m(m2m);
+
+	return supported;
+}
+
+/*
+ * Get the buffer's request ready to be filled: allocated the first time,
+ * and recycled once the driver has completed it after that.
+ */
+static int fdp1_v4l2_request_get(struct fdp1_v4l2_dev * dev,
+				 struct fdp1_v4l2_buffer * buffer)
+{
+	struct pollfd pfd = {
+		.fd = buffer->request_fd,
+		.events = POLLPRI,
+	};
+	uint64_t start;
+	int media_fd;
+	int ret;
+
+	if (buffer->request_fd >= 0) {
+		/* The buffer returns just before its request completes */
+		if (poll(&pfd, 1, 1000) <= 0) {
+			kprint(dev, 0, "Request of buffer %d did not complete\n",
+					buffer->index);
+			return -ETIMEDOUT;
+		}
+
+		start = fdp1_time_ns();
+		ret = ioctl(buffer->request_fd, MEDIA_REQUEST_IOC_REINIT);
+		fdp1_v4l2_phase(dev, FDP1_PHASE_REQUEST, start);
+		if (ret)
+			kprint(dev, 0, "MEDIA_REQUEST_IOC_REINIT: %s\n",
+					strerror(errno));
+
+		return ret;
+	}
+
+	media_fd = fdp1_media_open(dev);
+	if (media_fd < 0)
+		return media_fd;
+
+	start = fdp1_time_ns();
+	ret = ioctl(media_fd, MEDIA_IOC_REQUEST_ALLOC, &buffer->request_fd);
+	fdp1_v4l2_phase(dev, FDP1_PHASE_REQUEST, start);
+	if (ret) {
+		kprint(dev, 0, "MEDIA_IOC_REQUEST_ALLOC: %s\n", strerror(errno));
+		buffer->request_fd = -1;
+	}
+
+	return ret;
+}
+
+/*
+ * fdp1_v4l2_queue_request
+ *
+ * Queue a buffer in a request, with control 'ctrl_id' set to 'val' for
+ * that buffer alone (no control when ctrl_id is 0). Once a queue has taken
+ * a buffer through a request, it must take all of them that way until it
+ * is stopped.
+ */
+int fdp1_v4l2_queue_request(struct fdp1_v4l2_dev * dev,
+			    struct fdp1_v4l2_buffer * buffer,
+			    uint32_t ctrl_id, int32_t val)
+{
+	struct v4l2_ext_control ctrl = {
+		.id = ctrl_id,
+		.value = val,
+	};
+	struct v4l2_ext_controls ctrls = {
+		.which = V4L2_CTRL_WHICH_REQUEST_VAL,
+		.count = 1,
+		.controls = &ctrl,
+	};
+	uint64_t start;
+	int ret;
+
+	ret = fdp1_v4l2_request_get(dev, buffer);
+	if (ret)
+		return ret;
+
+	if (ctrl_id) {
+		ctrls.request_fd = buffer->request_fd;
+
+		start = fdp1_time_ns();
+		ret = fdp1_v4l2_ioctl(dev, VIDIOC_S_EXT_CTRLS, &ctrls);
+		fdp1_v4l2_phase(dev, FDP1_PHASE_REQUEST, start);
+		if (ret) {
+			kprint(dev, 0, "VIDIOC_S_EXT_CTRLS: %s\n", strerror(errno));
+			return ret;
+		}
+	}
+
+	ret = fdp1_v4l2_qbuf(dev, buffer, buffer->request_fd);
+	if (ret)
+		return ret;
+
+	start = fdp1_time_ns();
+	ret = ioctl(buffer->request_fd, MEDIA_REQUEST_IOC_QUEUE);
+	fdp1_v4l2_phase(dev, FDP1_PHASE_REQUEST, start);
+	if (ret) {
+		kprint(dev, 0, "MEDIA_REQUEST_IOC_QUEUE: %s\n", strerror(errno));
+
+		/* The buffer never reached the driver */
+		fdp1_v4l2_buffer_set_state(buffer, FDP1_BUF_DEQUEUED);
+	}
+
+	return ret;
+}
+
@@ -24,29 +24,147 @@ enum fdp1_deint_mode {
 	FDP1_NEXTFIELD,
 };
 
+/*
+ * Buffer ownership
+ *
+ * Every buffer in a pool is either owned by us, or by the driver. The pool
+ * tracks which, so that tests can verify the cadence they assume, and so
+ * that buffers which are never handed back can be detected at teardown.
+ */
+enum fdp1_buffer_state {
+	FDP1_BUF_FREE = 0,	/* Owned by us, no valid content */
+	FDP1_BUF_FILLED,	/* Owned by us, prepared for the driver */
+	FDP1_BUF_QUEUED,	/* Owned by the driver */
+	FDP1_BUF_DEQUEUED,	/* Returned by the driver, owned by us */
+	FDP1_BUF_VERIFY,	/* Contents being inspected */
+	FDP1_BUF_STATE_MAX,
+};
+
+/*
+ * Device phases
+ *
+ * The time spent in each step of bringing up (or tearing down) a context
+ * is accumulated against the device, so startup costs can be broken down.
+ */
+enum fdp1_v4l2_phase {
+	FDP1_PHASE_OPEN = 0,
+	FDP1_PHASE_QUERYCAP,
+	FDP1_PHASE_TRY_FMT,
+	FDP1_PHASE_S_FMT,
+	FDP1_PHASE_REQBUFS,
+	FDP1_PHASE_CREATE_BUFS,
+	FDP1_PHASE_QUERYBUF,
+	FDP1_PHASE_MMAP,
+	FDP1_PHASE_QBUF,
+	FDP1_PHASE_STREAMON,
+	FDP1_PHASE_DQBUF,
+	FDP1_PHASE_STREAMOFF,
+	FDP1_PHASE_PREPARE_BUF,
+	FDP1_PHASE_EXPBUF,
+	FDP1_PHASE_REQUEST,
+	FDP1_PHASE_MAX,
+};
+
 struct fdp1_v4l2_dev {
 	int fd;
+	int media_fd;	/* Opened for the first media request */
+	unsigned int session;	/* In the session log, if one is recording */
+	int verbose;		/* Errors are reported with kprint() */
+
+	/* Those of the context which opened it, if any */
+	struct fdp1_perf * perf;
+	struct fdp1_record * log;
+
+	uint64_t phase_ns[FDP1_PHASE_MAX];
+	unsigned int phase_calls[FDP1_PHASE_MAX];
+
+	/* Capabilities reported by the last buffer allocation */
+	uint32_t buf_caps;
 
 	struct v4l2_capability cap;
-	struct v4l2_format fmt;
 	struct v4l2_control ctrl;
+
+	/* As negotiated on each queue, by the last S_FMT or G_FMT */
+	struct v4l2_format out_fmt;
+	struct v4l2_format cap_fmt;
 };
 
+struct fdp1_v4l2_buffer_pool;
+
 struct fdp1_v4l2_buffer {
+	struct fdp1_v4l2_buffer_pool * pool;
 	uint32_t n_planes;
 	struct v4l2_plane planes[3];
 	uint32_t sizes[3]; // plane sizes
 	char * mem[3];
+	int dmabuf[3];	/* V4L2_MEMORY_DMABUF only */
 	unsigned int type;
 	unsigned int index;
 	unsigned int bytesused;
 	struct v4l2_buffer v4l2_buf;
+
+	/* Ownership tracking: only modify through fdp1_v4l2_buffer_set_state() */
+	unsigned int state;
+	uint64_t state_since;
+	uint64_t state_ns[FDP1_BUF_STATE_MAX];
+	unsigned int misuse;
+
+	uint64_t queued_at;
+	uint64_t dequeued_at;
+
+	/*
+	 * CPU access, which decides the cache maintenance a queue needs: the
+	 * buffer has been written since it was last queued, and what the
+	 * driver writes to it will be read.
+	 */
+	bool cpu_dirty;
+	bool cpu_reads;
+
+	/* Validated by VIDIOC_PREPARE_BUF, since it was last queued */
+	bool prepared;
+
+	/* The media request it was last queued in, reused each time */
+	int request_fd;
 };
 
-#define MAX_BUFFER_POOL_SIZE 4
+#define MAX_BUFFER_POOL_SIZE 16
+
+/* Buffers on each queue of a context, unless fdp1->buffers says otherwise */
+#define FDP1_M2M_BUFFERS 4
+
 struct fdp1_v4l2_buffer_pool {
 	unsigned int qty;
 	struct fdp1_v4l2_buffer buffer[MAX_BUFFER_POOL_SIZE];
+
+	uint64_t created;
+	uint32_t memory;
+	uint32_t caps;	/* V4L2_BUF_CAP_* of the queue */
+
+	/* The layout of the queue, and the number of buffers queued to it */
+	enum v4l2_field field;
+	unsigned int sequence_in;
+
+	/* Allocated non-coherent, so the cache maintenance can be skipped */
+	bool cache_hints;
+
+	int verbose;	/* As the device the pool belongs to */
+	struct fdp1_perf * perf;
+
+	/* The format of the queue, which lays out the content of each buffer */
+	struct v4l2_pix_format_mplane fmt;
+};
+
+/*
+ * The active area of one component plane of a buffer: 'lines' lines of
+ * 'bytes' bytes, each 'stride' bytes after the last, from 'offset' in
+ * memory plane 'mem'. Anything else in the buffer is padding.
+ */
+struct fdp1_v4l2_plane_layout {
+	unsigned int mem;
+	unsigned int offset;
+	unsigned int stride;
+	unsigned int bytes;
+	unsigned int lines;
 };
 
 struct fdp1_v4l2_queue {
@@ -58,6 +176,20 @@ struct fdp1_v4l2_queue {
 struct fdp1_m2m {
 	struct fdp1_v4l2_dev * dev;
 
+	/* As negotiated by fdp1_create_m2m() or fdp1_m2m_reconfigure() */
+	uint32_t out_fourcc;
+	uint32_t out_field;
+	uint32_t cap_fourcc;
+	unsigned int width;
+	unsigned int height;
+
+	/*
+	 * The part of each source processed, and where it lands in each
+	 * capture: the whole frame, unless fdp1_m2m_set_selection() says not.
+	 */
+	struct v4l2_rect crop;
+	struct v4l2_rect compose;
+
 	struct fdp1_v4l2_queue src_queue;
 	struct fdp1_v4l2_queue dst_queue;
 };
@@ -68,9 +200,29 @@ void start_test(struct fdp1_context * fdp1, char * test);
 char *v4l2_field(enum v4l2_field f);
 char *fdp1_deint_mode_str(enum fdp1_deint_mode m);
 char * q_type(uint32_t type);
+char *fdp1_buffer_state_str(enum fdp1_buffer_state s);
+
+uint64_t fdp1_time_ns(void);
+
+struct fdp1_faults {
+	uint64_t minor;
+	uint64_t major;
+};
+
+void fdp1_faults(struct fdp1_faults * faults);
+void fdp1_faults_since(struct fdp1_faults * faults,
+		       const struct fdp1_faults * since);
+
+char * fdp1_v4l2_memory_str(uint32_t memory);
+char * fdp1_v4l2_phase_str(enum fdp1_v4l2_phase phase);
+int fdp1_v4l2_ioctl_phase(unsigned long request);
+void fdp1_v4l2_phase_reset(struct fdp1_v4l2_dev * dev);
+uint64_t fdp1_v4l2_buffer_timestamp(struct fdp1_v4l2_buffer * buffer);
 
 struct fdp1_v4l2_dev * fdp1_v4l2_open(struct fdp1_context * fdp1);
 int fdp1_v4l2_close(struct fdp1_v4l2_dev * dev);
+int fdp1_v4l2_ioctl(struct fdp1_v4l2_dev * dev, unsigned long request,
+		    void * arg);
 
 int fdp1_v4l2_set_fmt(struct fdp1_context * fdp1,
 		      struct fdp1_v4l2_dev * v4l2_dev,
@@ -80,6 +232,21 @@ int fdp1_v4l2_set_fmt(struct fdp1_context * fdp1,
 		      uint32_t fourcc,
 		      uint32_t field);
 
+int fdp1_v4l2_get_fmt(struct fdp1_context * fdp1,
+		      struct fdp1_v4l2_dev * v4l2_dev,
+		      uint32_t type);
+struct v4l2_format * fdp1_v4l2_queue_fmt(struct fdp1_v4l2_dev * v4l2_dev,
+					 uint32_t type);
+
+int fdp1_v4l2_try_fmt(struct fdp1_context * fdp1,
+		      struct fdp1_v4l2_dev * v4l2_dev,
+		      struct v4l2_format * fmt,
+		      uint32_t type,
+		      uint32_t width,
+		      uint32_t height,
+		      uint32_t fourcc,
+		      uint32_t field);
+
 struct fdp1_v4l2_buffer_pool *
 fdp1_v4l2_allocate_buffers(struct fdp1_context * fdp1,
 			   struct fdp1_v4l2_dev * v4l2_dev,
@@ -87,7 +254,42 @@ fdp1_v4l2_allocate_buffers(struct fdp1_context * fdp1,
 			   enum v4l2_field field,
 			   uint32_t buffers_requested);
 
-void fdp1_v4l2_free_buffers(struct fdp1_v4l2_buffer_pool * pool);
+struct fdp1_v4l2_buffer_pool *
+fdp1_v4l2_create_buffers(struct fdp1_context * fdp1,
+			 struct fdp1_v4l2_dev * v4l2_dev,
+			 struct v4l2_format * fmt,
+			 enum v4l2_field field,
+			 uint32_t buffers_requested);
+
+struct fdp1_v4l2_buffer_pool *
+fdp1_v4l2_import_buffers(struct fdp1_context * fdp1,
+			 struct fdp1_v4l2_dev * v4l2_dev,
+			 uint32_t type,
+			 uint32_t memory,
+			 enum v4l2_field field,
+			 struct fdp1_v4l2_dev * donor_dev,
+			 struct fdp1_v4l2_buffer_pool * donor);
+
+int fdp1_v4l2_free_buffers(struct fdp1_v4l2_buffer_pool * pool);
+
+int fdp1_v4l2_buffer_set_state(struct fdp1_v4l2_buffer * buffer,
+			       enum fdp1_buffer_state state);
+void fdp1_v4l2_buffer_release(struct fdp1_v4l2_buffer * buffer);
+
+unsigned int fdp1_v4l2_buffer_layout(struct fdp1_v4l2_buffer * buffer,
+				     struct fdp1_v4l2_plane_layout * layout);
+
+unsigned int fdp1_v4l2_pool_count(struct fdp1_v4l2_buffer_pool * pool,
+				  enum fdp1_buffer_state state);
+unsigned int fdp1_v4l2_pool_misuse(struct fdp1_v4l2_buffer_pool * pool);
+void fdp1_v4l2_pool_reclaim(struct fdp1_v4l2_buffer_pool * pool);
+void fdp1_v4l2_pool_report(struct fdp1_context * fdp1,
+			   struct fdp1_v4l2_buffer_pool * pool);
+
+int fdp1_v4l2_prepare_buffer(struct fdp1_v4l2_dev * dev,
+			     struct fdp1_v4l2_buffer * buffer);
+int fdp1_v4l2_pool_prepare(struct fdp1_v4l2_dev * dev,
+			   struct fdp1_v4l2_buffer_pool * pool);
 
 int fdp1_v4l2_queue_buffer(struct fdp1_v4l2_dev * dev,
 		struct fdp1_v4l2_buffer * buffer);
@@ -105,9 +307,15 @@ fdp1_create_m2m(struct fdp1_context * fdp1,
 		uint32_t out_field,
 		uint32_t cap_fourcc);
 
-void fdp1_free_m2m(struct fdp1_m2m * m2m);
+int fdp1_free_m2m(struct fdp1_m2m * m2m);
+
+int fdp1_m2m_reconfigure(struct fdp1_context * fdp1,
+			 struct fdp1_m2m * m2m,
+			 unsigned int width,
+			 unsigned int height);
 
 int fdp1_m2m_stream_on(struct fdp1_m2m * m2m, int type);
+int fdp1_m2m_stream_off(struct fdp1_m2m * m2m, int type);
 
 struct fdp1_v4l2_buffer *
 fdp1_m2m_dequeue_output(struct fdp1_m2m * m2m);
@@ -118,4 +326,17 @@ fdp1_m2m_dequeue_capture(struct fdp1_m2m * m2m);
 int fdp1_m2m_set_ctrl(struct fdp1_m2m * m2m, uint32_t ctrl_id, int32_t val);
 int fdp1_m2m_get_ctrl(struct fdp1_m2m * m2m, uint32_t ctrl_id, int32_t *val);
 
+int fdp1_m2m_set_selection(struct fdp1_m2m * m2m, uint32_t type,
+			   uint32_t target, struct v4l2_rect * rect);
+int fdp1_m2m_get_selection(struct fdp1_m2m * m2m, uint32_t type,
+			   uint32_t target, struct v4l2_rect * rect);
+int fdp1_selection_supported(struct fdp1_context * fdp1);
+
+bool fdp1_v4l2_pool_requests(struct fdp1_v4l2_dev * dev,
+			     struct fdp1_v4l2_buffer_pool * pool);
+int fdp1_requests_supported(struct fdp1_context * fdp1);
+int fdp1_v4l2_queue_request(struct fdp1_v4l2_dev * dev,
+			    struct fdp1_v4l2_buffer * buffer,
+			    uint32_t ctrl_id, int32_t val);
+
 #endif /* _FDP1_V4L2_HELPERS_H_ */
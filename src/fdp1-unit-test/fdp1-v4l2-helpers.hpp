@@ -0,0 +1,430 @@
+/*
+ * FDP1 Unit Test Utility
+ *      Author: Kieran Bingham
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by the
+ * Free Software Foundation; either version 2 of the License, or (at your
+ * option) any later version
+ */
+
+#ifndef _FDP1_V4L2_HELPERS_HPP_
+#define _FDP1_V4L2_HELPERS_HPP_
+
+#include <cstddef>
+#include <cstdint>
+
+/*
+ * C++ layer over the helpers
+ *
+ * Owners for the devices, m2m contexts, pools and buffers of the helpers,
+ * which give them back as they go out of scope, and pixel formats described
+ * at compile time. The fill, convert and verify kernels are templates over
+ * the format, so each is built with its layout known to the compiler, and
+ * nothing is decided per pixel at run time.
+ *
+ * Include it after fdp1-unit-test.h and fdp1-v4l2-helpers.h, which are C:
+ * wrap those in extern "C". Nothing throws. An owner which failed to
+ * acquire its object is empty, as valid() tells.
+ */
+namespace fdp1 {
+
+/*
+ * Ownership
+ */
+template <typename T, int (*Release)(T *)>
+class Owner {
+public:
+	Owner() : object(nullptr) {}
+	explicit Owner(T * object) : object(object) {}
+	Owner(Owner && other) : object(other.object) { other.object = nullptr; }
+	Owner(const Owner &) = delete;
+	Owner & operator=(const Owner &) = delete;
+	~Owner() { reset(); }
+
+	Owner & operator=(Owner && other)
+	{
+		if (this != &other) {
+			reset();
+			object = other.object;
+			other.object = nullptr;
+		}
+		return *this;
+	}
+
+	T * get() const { return object; }
+	T * operator->() const { return object; }
+	bool valid() const { return object; }
+
+	/* Give the object back now, returning what its helper does */
+	int reset()
+	{
+		int ret = object ? Release(object) : 0;
+
+		object = nullptr;
+		return ret;
+	}
+
+private:
+	T * object;
+};
+
+class Device : public Owner<fdp1_v4l2_dev, fdp1_v4l2_close> {
+public:
+	explicit Device(fdp1_context * fdp1) : Owner(fdp1_v4l2_open(fdp1)) {}
+};
+
+/* reset() returns the buffers leaked */
+class Pool : public Owner<fdp1_v4l2_buffer_pool, fdp1_v4l2_free_buffers> {
+public:
+	Pool(fdp1_context * fdp1, const Device & dev, uint32_t type,
+	     enum v4l2_field field, uint32_t count)
+		: Owner(fdp1_v4l2_allocate_buffers(fdp1, dev.get(), type,
+						   field, count)) {}
+};
+
+/* reset() returns the buffers leaked */
+class M2M : public Owner<fdp1_m2m, fdp1_free_m2m> {
+public:
+	M2M(fdp1_context * fdp1, uint32_t out_fourcc, uint32_t out_field,
+	    uint32_t cap_fourcc)
+		: Owner(fdp1_create_m2m(fdp1, out_fourcc, out_field,
+					cap_fourcc)) {}
+
+	template <class Out, class Cap>
+	static M2M create(fdp1_context * fdp1, uint32_t out_field)
+	{
+		return M2M(fdp1, Out::fourcc, out_field, Cap::fourcc);
+	}
+
+	/* Returns the failure of the first queue which would not start */
+	int stream_on()
+	{
+		int ret = fdp1_m2m_stream_on(get(), V4L2_BUF_TYPE_VIDEO_OUTPUT_MPLANE);
+
+		return ret ? ret :
+		       fdp1_m2m_stream_on(get(), V4L2_BUF_TYPE_VIDEO_CAPTURE_MPLANE);
+	}
+};
+
+/*
+ * A buffer we own, mapped for the CPU. Unless it has been queued to the
+ * driver since, it goes back to its pool as it goes out of scope.
+ */
+class MappedBuffer {
+public:
+	explicit MappedBuffer(fdp1_v4l2_buffer * buffer) : buffer(buffer) {}
+	MappedBuffer(MappedBuffer && other) : buffer(other.buffer) { other.buffer = nullptr; }
+	MappedBuffer(const MappedBuffer &) = delete;
+	MappedBuffer & operator=(const MappedBuffer &) = delete;
+
+	~MappedBuffer()
+	{
+		if (buffer && buffer->state != FDP1_BUF_FREE &&
+		    buffer->state != FDP1_BUF_QUEUED)
+			fdp1_v4l2_buffer_release(buffer);
+	}
+
+	fdp1_v4l2_buffer * get() const { return buffer; }
+	bool valid() const { return buffer; }
+
+	/* To be written by the CPU, which the helpers need to know */
+	int write() { return fdp1_v4l2_buffer_set_state(buffer, FDP1_BUF_FILLED); }
+
+	int queue(fdp1_v4l2_dev * dev) { return fdp1_v4l2_queue_buffer(dev, buffer); }
+
+private:
+	fdp1_v4l2_buffer * buffer;
+};
+
+/*
+ * Pixel formats
+ *
+ * Each component plane holds blocks of 'hsub' pixels, of bytes[plane]
+ * bytes each, and one line for every 'vsub' lines of the frame (luma is
+ * never subsampled). Frame sizes must be multiples of the subsampling.
+ * Multi-planar ('mplane') formats keep each component plane in a memory
+ * plane of its own; the others lay them out one after the other.
+ */
+enum class Packing {
+	packed,		/* Y, U and V interleaved in one plane */
+	semiplanar,	/* Y plane, then interleaved chroma plane */
+	planar,		/* Y, U and V planes */
+};
+
+template <uint32_t FourCC, Packing P, unsigned int VSub, bool SwapUV,
+	  bool MPlane, unsigned int... Bytes>
+struct Format {
+	static constexpr uint32_t fourcc = FourCC;
+	static constexpr Packing packing = P;
+	static constexpr unsigned int hsub = 2;
+	static constexpr unsigned int vsub = VSub;
+	static constexpr bool swap_uv = SwapUV;	/* V stored before U */
+	static constexpr bool mplane = MPlane;
+
+	static constexpr unsigned int planes = sizeof...(Bytes);
+	static constexpr unsigned int bytes[planes] = { Bytes... };
+	static constexpr unsigned int mem_planes = MPlane ? planes : 1;
+
+	static constexpr unsigned int width_align = hsub;
+	static constexpr unsigned int height_align = vsub;
+
+	static constexpr unsigned int stride(unsigned int plane, unsigned int width)
+	{
+		return width / hsub * bytes[plane];
+	}
+
+	static constexpr unsigned int lines(unsigned int plane, unsigned int height)
+	{
+		return plane ? height / vsub : height;
+	}
+
+	static constexpr size_t plane_size(unsigned int plane, unsigned int width,
+					   unsigned int height)
+	{
+		return (size_t)stride(plane, width) * lines(plane, height);
+	}
+
+	/* All planes, as laid out in a single memory plane */
+	static constexpr size_t size(unsigned int width, unsigned int height)
+	{
+		size_t total = 0;
+
+		for (unsigned int p = 0; p < planes; p++)
+			total += plane_size(p, width, height);
+
+		return total;
+	}
+};
+
+/* 4:2:2 packed, with the byte offsets of Y0 U Y1 V in each block */
+template <uint32_t FourCC, unsigned int Y0, unsigned int U, unsigned int Y1,
+	  unsigned int V>
+struct Packed : Format<FourCC, Packing::packed, 1, false, false, 4> {
+	static constexpr unsigned int y0 = Y0;
+	static constexpr unsigned int u = U;
+	static constexpr unsigned int y1 = Y1;
+	static constexpr unsigned int v = V;
+};
+
+template <uint32_t FourCC, unsigned int VSub, bool SwapUV, bool MPlane>
+using SemiPlanar = Format<FourCC, Packing::semiplanar, VSub, SwapUV, MPlane, 2, 2>;
+
+template <uint32_t FourCC, unsigned int VSub, bool SwapUV, bool MPlane>
+using Planar = Format<FourCC, Packing::planar, VSub, SwapUV, MPlane, 2, 1, 1>;
+
+using Yuyv = Packed<V4L2_PIX_FMT_YUYV, 0, 1, 2, 3>;
+using Uyvy = Packed<V4L2_PIX_FMT_UYVY, 1, 0, 3, 2>;
+using Yvyu = Packed<V4L2_PIX_FMT_YVYU, 0, 3, 2, 1>;
+using Vyuy = Packed<V4L2_PIX_FMT_VYUY, 1, 2, 3, 0>;
+using Nv12 = SemiPlanar<V4L2_PIX_FMT_NV12, 2, false, false>;
+using Nv21 = SemiPlanar<V4L2_PIX_FMT_NV21, 2, true, false>;
+using Nv16 = SemiPlanar<V4L2_PIX_FMT_NV16, 1, false, false>;
+using Nv61 = SemiPlanar<V4L2_PIX_FMT_NV61, 1, true, false>;
+using Yuv420 = Planar<V4L2_PIX_FMT_YUV420, 2, false, false>;
+using Yvu420 = Planar<V4L2_PIX_FMT_YVU420, 2, true, false>;
+using Nv12m = SemiPlanar<V4L2_PIX_FMT_NV12M, 2, false, true>;
+using Nv21m = SemiPlanar<V4L2_PIX_FMT_NV21M, 2, true, true>;
+using Nv16m = SemiPlanar<V4L2_PIX_FMT_NV16M, 1, false, true>;
+using Nv61m = SemiPlanar<V4L2_PIX_FMT_NV61M, 1, true, true>;
+using Yuv420m = Planar<V4L2_PIX_FMT_YUV420M, 2, false, true>;
+using Yvu420m = Planar<V4L2_PIX_FMT_YVU420M, 2, true, true>;
+
+/* Call fn(F()) for each format of the list */
+template <class... Fs>
+struct Formats {
+	template <class Fn>
+	static void for_each(Fn && fn) { (fn(Fs()), ...); }
+
+	/* Call fn(F()) for the format of 'fourcc', if it is in the list */
+	template <class Fn>
+	static bool find(uint32_t fourcc, Fn && fn)
+	{
+		return ((Fs::fourcc == fourcc ? (fn(Fs()), true) : false) || ...);
+	}
+};
+
+using AllFormats = Formats<Yuyv, Uyvy, Yvyu, Vyuy, Nv12, Nv21, Nv16, Nv61,
+			   Yuv420, Yvu420, Nv12m, Nv21m, Nv16m, Nv61m,
+			   Yuv420m, Yvu420m>;
+
+/*
+ * A frame of format F in memory: where each component plane starts, and
+ * the bytes from one of its lines to the next.
+ */
+template <class F>
+struct Frame {
+	uint8_t * plane[3] = {};
+	unsigned int stride[3] = {};
+	unsigned int width = 0;
+	unsigned int height = 0;
+
+	Frame() = default;
+
+	/* The planes one after the other from 'mem' */
+	Frame(uint8_t * mem, unsigned int width, unsigned int height)
+		: width(width), height(height)
+	{
+		for (unsigned int p = 0; p < F::planes; p++) {
+			plane[p] = mem;
+			stride[p] = F::stride(p, width);
+			mem += F::plane_size(p, width, height);
+		}
+	}
+
+	/*
+	 * The planes of a mapped buffer, if it is large enough: where they are
+	 * in the format of its queue, or one after the other without padding.
+	 */
+	Frame(const MappedBuffer & buffer, unsigned int width, unsigned int height)
+		: Frame((uint8_t *)buffer.get()->mem[0], width, height)
+	{
+		fdp1_v4l2_buffer * buf = buffer.get();
+		const v4l2_pix_format_mplane & fmt = buf->pool->fmt;
+		fdp1_v4l2_plane_layout layout[3];
+
+		if (fmt.pixelformat == F::fourcc && fmt.width == width &&
+		    fmt.height == height &&
+		    fdp1_v4l2_buffer_layout(buf, layout) == F::planes &&
+		    layout[0].lines == height) {
+			for (unsigned int p = 0; p < F::planes; p++) {
+				plane[p] = (uint8_t *)buf->mem[layout[p].mem] +
+					   layout[p].offset;
+				stride[p] = layout[p].stride;
+			}
+		} else if (F::mplane) {
+			for (unsigned int p = 0; p < F::planes; p++) {
+				plane[p] = (uint8_t *)buf->mem[p];
+				if (p >= buf->n_planes ||
+				    buf->sizes[p] < F::plane_size(p, width, height))
+					plane[0] = nullptr;
+			}
+		} else if (buf->sizes[0] < F::size(width, height)) {
+			plane[0] = nullptr;
+		}
+	}
+
+	bool valid() const { return plane[0]; }
+
+	uint8_t * line(unsigned int p, unsigned int y) const
+	{
+		return plane[p] + (size_t)y * stride[p];
+	}
+};
+
+struct Yuv {
+	uint8_t y;
+	uint8_t u;
+	uint8_t v;
+};
+
+/*
+ * Kernels
+ *
+ * walk() visits every byte of a frame with the sample paint(x, y) gives
+ * for it: op(byte, sample). Chroma is taken from the top left pixel of the
+ * block it covers.
+ */
+template <class F, class Paint, class Op>
+inline void walk(const Frame<F> & frame, Paint && paint, Op && op)
+{
+	for (unsigned int y = 0; y < frame.height; y++) {
+		if constexpr (F::packing == Packing::packed) {
+			uint8_t * p = frame.line(0, y);
+
+			for (unsigned int x = 0; x < frame.width; x += 2, p += 4) {
+				const Yuv a = paint(x, y);
+				const Yuv b = paint(x + 1, y);
+
+				op(p[F::y0], a.y);
+				op(p[F::u], a.u);
+				op(p[F::y1], b.y);
+				op(p[F::v], a.v);
+			}
+		} else {
+			uint8_t * l = frame.line(0, y);
+
+			for (unsigned int x = 0; x < frame.width; x++)
+				op(l[x], paint(x, y).y);
+
+			if (y % F::vsub)
+				continue;
+
+			if constexpr (F::packing == Packing::semiplanar) {
+				uint8_t * c = frame.line(1, y / F::vsub);
+
+				for (unsigned int x = 0; x < frame.width; x += 2, c += 2) {
+					const Yuv s = paint(x, y);
+
+					op(c[F::swap_uv], s.u);
+					op(c[!F::swap_uv], s.v);
+				}
+			} else {
+				uint8_t * u = frame.line(F::swap_uv ? 2 : 1, y / F::vsub);
+				uint8_t * v = frame.line(F::swap_uv ? 1 : 2, y / F::vsub);
+
+				for (unsigned int x = 0; x < frame.width; x += 2) {
+					const Yuv s = paint(x, y);
+
+					op(*u++, s.u);
+					op(*v++, s.v);
+				}
+			}
+		}
+	}
+}
+
+template <class F, class Paint>
+inline void fill(const Frame<F> & frame, Paint && paint)
+{
+	walk(frame, paint, [](uint8_t & byte, uint8_t sample) { byte = sample; });
+}
+
+/* The bytes further than 'tolerance' from what paint(x, y) gives */
+template <class F, class Paint>
+inline uint64_t verify(const Frame<F> & frame, Paint && paint,
+		       unsigned int tolerance = 0)
+{
+	uint64_t mismatched = 0;
+
+	walk(frame, paint, [&](uint8_t & byte, uint8_t sample) {
+		mismatched += (unsigned int)(byte > sample ? byte - sample :
+					     sample - byte) > tolerance;
+	});
+
+	return mismatched;
+}
+
+/* The pixel at (x, y), with the chroma of its block */
+template <class F>
+inline Yuv read(const Frame<F> & frame, unsigned int x, unsigned int y)
+{
+	const unsigned int cx = x & ~1U;
+
+	if constexpr (F::packing == Packing::packed) {
+		const uint8_t * p = frame.line(0, y) + cx * 2;
+
+		return { p[x & 1 ? F::y1 : F::y0], p[F::u], p[F::v] };
+	} else if constexpr (F::packing == Packing::semiplanar) {
+		const uint8_t * c = frame.line(1, y / F::vsub) + cx;
+
+		return { frame.line(0, y)[x], c[F::swap_uv], c[!F::swap_uv] };
+	} else {
+		const unsigned int cy = y / F::vsub;
+
+		return { frame.line(0, y)[x],
+			 frame.line(F::swap_uv ? 2 : 1, cy)[cx / 2],
+			 frame.line(F::swap_uv ? 1 : 2, cy)[cx / 2] };
+	}
+}
+
+/* Resample 'src' into the format of 'dst', which has the same size */
+template <class From, class To>
+inline void convert(const Frame<From> & src, const Frame<To> & dst)
+{
+	fill(dst, [&](unsigned int x, unsigned int y) { return read(src, x, y); });
+}
+
+} /* namespace fdp1 */
+
+#endif /* _FDP1_V4L2_HELPERS_HPP_ */
@@ -0,0 +1,261 @@
+/*
+ * FDP1 Unit Test Utility
+ *      Author: Kieran Bingham
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by the
+ * Free Software Foundation; either version 2 of the License, or (at your
+ * option) any later version
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <inttypes.h>
+#include <time.h>
+
+#include "fdp1-unit-test.h"
+#include "fdp1-v4l2-helpers.h"
+#include "fdp1-buffer.h"
+#include "fdp1-verify.h"
+#include "fdp1-perf.h"
+
+static const char * fdp1_verify_modes[] = {
+	[FDP1_VERIFY_NONE]  = "none",
+	[FDP1_VERIFY_FULL]  = "full",
+	[FDP1_VERIFY_LINES] = "lines",
+	[FDP1_VERIFY_TILES] = "tiles",
+	[FDP1_VERIFY_BYTES] = "bytes",
+};
+
+const char * fdp1_verify_mode_str(enum fdp1_verify_mode mode)
+{
+	if (mode >= ARRAY_SIZE(fdp1_verify_modes))
+		return "unknown";
+
+	return fdp1_verify_modes[mode];
+}
+
+/*
+ * fdp1_verify_init
+ *
+ * Parse a verification spec, "mode" or "mode:N". Returns -EINVAL if the
+ * spec is not understood.
+ */
+int fdp1_verify_init(struct fdp1_verify * verify, const char * spec)
+{
+	const char * param;
+	size_t len;
+	unsigned int i;
+
+	memzero(*verify);
+
+	verify->seed = 0x2545f491;
+
+	if (!spec)
+		return 0;
+
+	param = strchr(spec, ':');
+	len = param ? (size_t)(param - spec) : strlen(spec);
+
+	for (i = 0; i < ARRAY_SIZE(fdp1_verify_modes); i++) {
+		if (strlen(fdp1_verify_modes[i]) == len &&
+		    !strncmp(spec, fdp1_verify_modes[i], len))
+			break;
+	}
+
+	if (i == ARRAY_SIZE(fdp1_verify_modes))
+		return -EINVAL;
+
+	verify->mode = i;
+
+	switch (verify->mode) {
+	case FDP1_VERIFY_LINES:
+	case FDP1_VERIFY_TILES:
+	case FDP1_VERIFY_BYTES:
+		if (!param || atoi(param + 1) <= 0)
+			return -EINVAL;
+		verify->param = atoi(param + 1);
+		break;
+	default:
+		if (param)
+			return -EINVAL;
+		break;
+	}
+
+	return 0;
+}
+
+/* xorshift32: cheap, and repeatable from run to run */
+static uint32_t fdp1_verify_random(struct fdp1_verify * verify)
+{
+	uint32_t x = verify->seed;
+
+	x ^= x << 13;
+	x ^= x >> 17;
+	x ^= x << 5;
+
+	return verify->seed = x;
+}
+
+/*
+ * Check 'len' bytes from 'offset' into the active area of a plane, as if its
+ * lines had no padding. A range is cut short at the end of its line.
+ */
+static unsigned int fdp1_verify_range(struct fdp1_verify * verify,
+				      const char * mem,
+				      const struct fdp1_v4l2_plane_layout * layout,
+				      unsigned int offset, unsigned int len)
+{
+	unsigned int y = offset / layout->bytes;
+	unsigned int x = offset % layout->bytes;
+
+	if (y >= layout->lines)
+		return 0;
+	if (len > layout->bytes - x)
+		len = layout->bytes - x;
+
+	verify->checked += len;
+
+	return fdp1_fill_compare(mem + (size_t)y * layout->stride + x, offset, len);
+}
+
+/* Verify the active area of one plane, returning the bytes which differ */
+static unsigned int fdp1_verify_plane(struct fdp1_verify * verify,
+				      const char * mem,
+				      const struct fdp1_v4l2_plane_layout * layout,
+				      unsigned int budget)
+{
+	unsigned int line = layout->bytes;
+	unsigned int lines = layout->lines;
+	unsigned int size = line * lines;
+	unsigned int mismatched = 0;
+	unsigned int i, n, step, offset;
+
+	if (!size)
+		return 0;
+
+	switch (verify->mode) {
+	case FDP1_VERIFY_FULL:
+		for (i = 0; i < lines; i++)
+			mismatched += fdp1_verify_range(verify, mem, layout,
+							i * line, line);
+		break;
+
+	case FDP1_VERIFY_LINES:
+		/* Start one line later on each frame */
+		for (i = verify->frames % verify->param; i < lines;
+		     i += verify->param)
+			mismatched += fdp1_verify_range(verify, mem, layout,
+							i * line, line);
+		break;
+
+	case FDP1_VERIFY_TILES:
+		for (n = 0; n < verify->param; n++) {
+			unsigned int x = fdp1_verify_random(verify) % line;
+			unsigned int y = fdp1_verify_random(verify) % lines;
+
+			for (i = y; i < y + FDP1_VERIFY_TILE_LINES && i < lines; i++)
+				mismatched += fdp1_verify_range(verify, mem, layout,
+								i * line + x,
+								FDP1_VERIFY_TILE_BYTES);
+		}
+		break;
+
+	case FDP1_VERIFY_BYTES:
+		n = (budget + FDP1_VERIFY_RUN - 1) / FDP1_VERIFY_RUN;
+		if (!n)
+			break;
+
+		step = size / n;
+		if (step < FDP1_VERIFY_RUN)
+			step = FDP1_VERIFY_RUN;
+
+		/* Slide the runs along by one run each frame */
+		offset = (verify->frames * FDP1_VERIFY_RUN) % step;
+
+		for (i = 0; i < n; i++)
+			mismatched += fdp1_verify_range(verify, mem, layout,
+							offset + i * step,
+							FDP1_VERIFY_RUN);
+		break;
+
+	default:
+		break;
+	}
+
+	return mismatched;
+}
+
+/*
+ * fdp1_verify_buffer
+ *
+ * Check the sampled part of a capture of fdp1_fill_buffer() content, and
+ * account the CPU time it took. Only the active pixels of each line are
+ * checked. Returns the number of bytes which differ.
+ */
+unsigned int fdp1_verify_buffer(struct fdp1_verify * verify,
+				struct fdp1_v4l2_buffer * buffer)
+{
+	struct fdp1_v4l2_plane_layout layout[3];
+	struct fdp1_perf_sample perf;
+	struct timespec start, end;
+	unsigned int mismatched = 0;
+	uint64_t size = 0;
+	unsigned int n, i;
+
+	if (verify->mode == FDP1_VERIFY_NONE)
+		return 0;
+
+	if (fdp1_v4l2_buffer_set_state(buffer, FDP1_BUF_VERIFY))
+		return 0;
+
+	fdp1_perf_begin(buffer->pool->perf, &perf);
+	clock_gettime(CLOCK_THREAD_CPUTIME_ID, &start);
+
+	n = fdp1_v4l2_buffer_layout(buffer, layout);
+	for (i = 0; i < n; i++)
+		size += (uint64_t)layout[i].bytes * layout[i].lines;
+
+	for (i = 0; i < n; i++) {
+		uint64_t plane = (uint64_t)layout[i].bytes * layout[i].lines;
+		/* Share the byte budget between the planes by their size */
+		unsigned int budget = size ?
+			(uint64_t)verify->param * plane / size : 0;
+
+		mismatched += fdp1_verify_plane(verify,
+				buffer->mem[layout[i].mem] + layout[i].offset,
+				&layout[i], budget);
+	}
+
+	clock_gettime(CLOCK_THREAD_CPUTIME_ID, &end);
+	fdp1_perf_end(buffer->pool->perf, FDP1_PERF_VERIFY, &perf);
+
+	verify->cpu_ns += (end.tv_sec - start.tv_sec) * 1000000000LL +
+			  (end.tv_nsec - start.tv_nsec);
+	verify->size += size;
+	verify->mismatched += mismatched;
+	verify->bad_frames += !!mismatched;
+	verify->frames++;
+
+	return mismatched;
+}
+
+/* Report coverage, and the CPU used against 'elapsed' ns of streaming */
+void fdp1_verify_report(struct fdp1_context * fdp1,
+			const struct fdp1_verify * verify,
+			uint64_t elapsed)
+{
+	if (verify->mode == FDP1_VERIFY_NONE)
+		return;
+
+	kprint(fdp1, 1, "Verified %u frames (%s:%u): %" PRIu64 " of %" PRIu64
+			" bytes checked (%.1f%%), %" PRIu64 " mismatched in %u frames\n",
+			verify->frames, fdp1_verify_mode_str(verify->mode),
+			verify->param, verify->checked, verify->size,
+			verify->size ? 100.0 * verify->checked / verify->size : 0.0,
+			verify->mismatched, verify->bad_frames);
+
+	kprint(fdp1, 1, "Verifier CPU %" PRIu64 " us of %" PRIu64 " us (%.2f%%)\n",
+			verify->cpu_ns / 1000, elapsed / 1000,
+			elapsed ? 100.0 * verify->cpu_ns / elapsed : 0.0);
+}
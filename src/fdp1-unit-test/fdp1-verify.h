@@ -0,0 +1,66 @@
+/*
+ * FDP1 Unit Test Utility
+ *      Author: Kieran Bingham
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by the
+ * Free Software Foundation; either version 2 of the License, or (at your
+ * option) any later version
+ */
+
+#ifndef _FDP1_VERIFY_H_
+#define _FDP1_VERIFY_H_
+
+/*
+ * Sampled content verification
+ *
+ * Captures of fdp1_fill_buffer() content are checked against the expected
+ * bytes, computed from their position, over a configurable part of the
+ * active pixels of each frame. The sampled part moves from frame to frame,
+ * so a long stream still covers the whole buffer.
+ *
+ *   none     :  No verification
+ *   full     :  Every byte of every frame
+ *   lines:N  :  Every Nth line
+ *   tiles:N  :  N tiles at random positions
+ *   bytes:N  :  N bytes, spread evenly over the frame
+ */
+enum fdp1_verify_mode {
+	FDP1_VERIFY_NONE,
+	FDP1_VERIFY_FULL,
+	FDP1_VERIFY_LINES,
+	FDP1_VERIFY_TILES,
+	FDP1_VERIFY_BYTES,
+};
+
+/* A tile is this many bytes of this many lines */
+#define FDP1_VERIFY_TILE_BYTES	64
+#define FDP1_VERIFY_TILE_LINES	16
+
+/* Sampled bytes are checked in runs of a cache line */
+#define FDP1_VERIFY_RUN		64
+
+struct fdp1_verify {
+	enum fdp1_verify_mode mode;
+	unsigned int param;
+	uint32_t seed;
+
+	unsigned int frames;
+	unsigned int bad_frames;
+	uint64_t size;		/* Active bytes in all frames verified */
+	uint64_t checked;
+	uint64_t mismatched;
+	uint64_t cpu_ns;
+};
+
+int fdp1_verify_init(struct fdp1_verify * verify, const char * spec);
+const char * fdp1_verify_mode_str(enum fdp1_verify_mode mode);
+
+unsigned int fdp1_verify_buffer(struct fdp1_verify * verify,
+				struct fdp1_v4l2_buffer * buffer);
+
+void fdp1_verify_report(struct fdp1_context * fdp1,
+			const struct fdp1_verify * verify,
+			uint64_t elapsed);
+
+#endif /* _FDP1_VERIFY_H_ */
@@ -0,0 +1,370 @@
+/*
+ * FDP1 Unit Test Utility
+ *      Author: Kieran Bingham
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by the
+ * Free Software Foundation; either version 2 of the License, or (at your
+ * option) any later version
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <poll.h>
+
+#include <linux/videodev2.h>
+
+#include "fdp1-unit-test.h"
+#include "fdp1-v4l2-helpers.h"
+#include "fdp1.h"
+
+/* How long to wait for the device before giving up on a frame */
+#define FDP1_TIMEOUT_MS	1000
+
+struct fdp1_device {
+	/* The options of the helpers, which stay silent */
+	struct fdp1_context fdp1;
+	struct fdp1_m2m * m2m;
+
+	unsigned int captures;	/* Per frame processed */
+};
+
+/* The helpers leave errno as the call which failed did */
+static int fdp1_errno(void)
+{
+	return errno ? -errno : -EIO;
+}
+
+unsigned int fdp1_api_version(void)
+{
+	return FDP1_API_VERSION;
+}
+
+int fdp1_job_captures(uint32_t field, uint32_t mode)
+{
+	switch (field) {
+	case V4L2_FIELD_NONE:
+		return 1;
+	case V4L2_FIELD_TOP:
+	case V4L2_FIELD_BOTTOM:
+	case V4L2_FIELD_ALTERNATE:
+		return mode == FDP1_MODE_FIXED2D ? 1 : -EINVAL;
+	case V4L2_FIELD_INTERLACED:
+	case V4L2_FIELD_INTERLACED_TB:
+	case V4L2_FIELD_INTERLACED_BT:
+	case V4L2_FIELD_SEQ_TB:
+	case V4L2_FIELD_SEQ_BT:
+		return mode == FDP1_MODE_FIXED2D ? 2 : -EINVAL;
+	default:
+		return -EINVAL;
+	}
+}
+
+/* The keys of a tuning file, in the order they are written */
+#define FDP1_TUNING_KEY(k)						\
+	{ #k, offsetof(struct fdp1_tuning, k),				\
+	  sizeof(((struct fdp1_tuning *)0)->k) }
+
+static const struct {
+	const char * key;
+	size_t offset;
+	size_t size;
+} fdp1_tuning_keys[] = {
+	FDP1_TUNING_KEY(width),
+	FDP1_TUNING_KEY(height),
+	FDP1_TUNING_KEY(out_field),
+	FDP1_TUNING_KEY(mode),
+	FDP1_TUNING_KEY(buffers),
+	FDP1_TUNING_KEY(contexts),
+	FDP1_TUNING_KEY(depth),
+	FDP1_TUNING_KEY(fps),
+	FDP1_TUNING_KEY(p99_us),
+	FDP1_TUNING_KEY(memory),
+};
+
+/* Set a known key, ignore an unknown one, and refuse what does not fit */
+static int fdp1_tuning_set(struct fdp1_tuning * tuning, const char * key,
+			   unsigned long long value)
+{
+	uint8_t * field;
+	unsigned int i;
+
+	for (i = 0; i < ARRAY_SIZE(fdp1_tuning_keys); i++) {
+		if (strcmp(key, fdp1_tuning_keys[i].key))
+			continue;
+
+		field = (uint8_t *)tuning + fdp1_tuning_keys[i].offset;
+
+		if (fdp1_tuning_keys[i].size == sizeof(uint64_t)) {
+			*(uint64_t *)field = value;
+		} else {
+			if (value > UINT32_MAX)
+				return -EINVAL;
+			*(uint32_t *)field = value;
+		}
+	}
+
+	return 0;
+}
+
+int fdp1_tuning_load(const char * path, struct fdp1_tuning * tuning)
+{
+	FILE * file = fopen(path, "r");
+	char line[256];
+	int ret = 0;
+
+	if (!file)
+		return -errno;
+
+	memset(tuning, 0, sizeof(*tuning));
+
+	while (!ret && fgets(line, sizeof(line), file)) {
+		char * p = line + strspn(line, " \t");
+		unsigned long long value;
+		char key[32];
+		int end = 0;
+
+		if (*p == '#' || *p == '\n' || !*p)
+			continue;
+
+		if (sscanf(p, "%31s %llu %n", key, &value, &end) < 2 || p[end])
+			ret = -EINVAL;
+		else
+			ret = fdp1_tuning_set(tuning, key, value);
+	}
+
+	if (!ret && ferror(file))
+		ret = -EIO;
+
+	fclose(file);
+
+	return ret;
+}
+
+int fdp1_tuning_save(const char * path, const struct fdp1_tuning * tuning)
+{
+	FILE * file = fopen(path, "w");
+	unsigned long long value;
+	const uint8_t * field;
+	unsigned int i;
+	int ret = 0;
+
+	if (!file)
+		return -errno;
+
+	fprintf(file, "# FDP1 tuning, API version %u\n", FDP1_API_VERSION);
+
+	for (i = 0; i < ARRAY_SIZE(fdp1_tuning_keys); i++) {
+		field = (const uint8_t *)tuning + fdp1_tuning_keys[i].offset;
+
+		if (fdp1_tuning_keys[i].size == sizeof(uint64_t))
+			value = *(const uint64_t *)field;
+		else
+			value = *(const uint32_t *)field;
+
+		fprintf(file, "%s %llu\n", fdp1_tuning_keys[i].key, value);
+	}
+
+	if (ferror(file))
+		ret = -EIO;
+
+	if (fclose(file) && !ret)
+		ret = -errno;
+
+	return ret;
+}
+
+/*
+ * fdp1_device_open
+ *
+ * Open /dev/video'index', set up its formats and buffers from 'config',
+ * and start streaming, so that frames can be processed straight away.
+ */
+int fdp1_device_open(unsigned int index, const struct fdp1_config * config,
+		     struct fdp1_device ** device)
+{
+	struct fdp1_device * d;
+	int captures;
+	int ret = 0;
+
+	*device = NULL;
+
+	captures = fdp1_job_captures(config->out_field, config->mode);
+	if (captures < 0 || !config->width || !config->height)
+		return -EINVAL;
+
+	d = calloc(1, sizeof(*d));
+	if (!d)
+		return -ENOMEM;
+
+	d->fdp1.appname = "libfdp1";
+	d->fdp1.dev = index;
+	d->fdp1.width = config->width;
+	d->fdp1.height = config->height;
+	d->fdp1.verbose = -1;
+	d->fdp1.cache_hints = !!(config->flags & FDP1_CONFIG_CACHE_HINTS);
+	d->fdp1.prepare_buffers = !!(config->flags & FDP1_CONFIG_PREPARE);
+	d->fdp1.lock_buffers = !!(config->flags & FDP1_CONFIG_LOCK);
+	d->captures = captures;
+
+	errno = 0;
+	d->m2m = fdp1_create_m2m(&d->fdp1, config->out_fourcc,
+				 config->out_field, config->cap_fourcc);
+	if (!d->m2m) {
+		ret = fdp1_errno();
+		free(d);
+		return ret;
+	}
+
+	/* Only plane 0 is copied in and out, so it must be the whole frame */
+	if (d->m2m->src_queue.pool->buffer[0].n_planes > 1 ||
+	    d->m2m->dst_queue.pool->buffer[0].n_planes > 1)
+		ret = -EINVAL;
+
+	/* Only one frame is ever in the device, so every capture is ours */
+	if (!ret && d->m2m->dst_queue.pool->qty < d->captures)
+		ret = -ENOMEM;
+
+	if (!ret && config->out_field != V4L2_FIELD_NONE &&
+	    fdp1_m2m_set_ctrl(d->m2m, V4L2_CID_DEINTERLACING_MODE, config->mode))
+		ret = fdp1_errno();
+
+	if (!ret && fdp1_m2m_stream_on(d->m2m, V4L2_BUF_TYPE_VIDEO_OUTPUT_MPLANE))
+		ret = fdp1_errno();
+
+	if (!ret && fdp1_m2m_stream_on(d->m2m, V4L2_BUF_TYPE_VIDEO_CAPTURE_MPLANE))
+		ret = fdp1_errno();
+
+	if (ret) {
+		fdp1_device_close(d);
+		return ret;
+	}
+
+	*device = d;
+
+	return 0;
+}
+
+void fdp1_device_close(struct fdp1_device * device)
+{
+	if (!device)
+		return;
+
+	fdp1_free_m2m(device->m2m);
+	free(device);
+}
+
+int fdp1_device_sizes(struct fdp1_device * device, size_t * src_size,
+		      size_t * dst_size)
+{
+	*src_size = device->m2m->src_queue.pool->buffer[0].sizes[0];
+	*dst_size = device->m2m->dst_queue.pool->buffer[0].sizes[0];
+
+	return 0;
+}
+
+/*
+ * Take back every buffer a failed job left with the driver, by stopping
+ * both queues, and start them again for the next job. Returns 'ret'.
+ */
+static int fdp1_device_reset(struct fdp1_device * device, int ret)
+{
+	struct fdp1_m2m * m2m = device->m2m;
+	struct fdp1_v4l2_buffer_pool * pools[] = {
+		m2m->src_queue.pool, m2m->dst_queue.pool,
+	};
+	unsigned int i, p;
+
+	fdp1_m2m_stream_off(m2m, V4L2_BUF_TYPE_VIDEO_OUTPUT_MPLANE);
+	fdp1_m2m_stream_off(m2m, V4L2_BUF_TYPE_VIDEO_CAPTURE_MPLANE);
+
+	/* Those the driver did return, or never took, are ours already */
+	for (p = 0; p < ARRAY_SIZE(pools); p++)
+		for (i = 0; i < pools[p]->qty; i++)
+			if (pools[p]->buffer[i].state != FDP1_BUF_FREE)
+				fdp1_v4l2_buffer_release(&pools[p]->buffer[i]);
+
+	fdp1_m2m_stream_on(m2m, V4L2_BUF_TYPE_VIDEO_OUTPUT_MPLANE);
+	fdp1_m2m_stream_on(m2m, V4L2_BUF_TYPE_VIDEO_CAPTURE_MPLANE);
+
+	return ret;
+}
+
+/*
+ * fdp1_device_process
+ *
+ * Queue the captures, then the frame, and collect them all back: the
+ * frame is copied in, and the captures out, of the buffers of the device.
+ * Anything past the size of a source buffer is not processed. Once a
+ * buffer is queued, a failure restarts both queues to take it back.
+ */
+int fdp1_device_process(struct fdp1_device * device,
+			const void * src, size_t src_size,
+			void * dst, size_t dst_size,
+			uint32_t * bytesused)
+{
+	struct fdp1_m2m * m2m = device->m2m;
+	struct fdp1_v4l2_buffer_pool * src_pool = m2m->src_queue.pool;
+	struct fdp1_v4l2_buffer_pool * dst_pool = m2m->dst_queue.pool;
+	struct fdp1_v4l2_buffer * out = &src_pool->buffer[0];
+	struct pollfd pfd = { .fd = m2m->dev->fd, .events = POLLIN | POLLOUT };
+	unsigned int captures = 0;
+	bool returned = false;
+	unsigned int i;
+
+	/* Every capture fits whatever the driver says it used */
+	if (dst_size < device->captures * (size_t)dst_pool->buffer[0].sizes[0])
+		return -ENOSPC;
+
+	memcpy(out->mem[0], src, src_size < out->sizes[0] ? src_size : out->sizes[0]);
+	fdp1_v4l2_buffer_set_state(out, FDP1_BUF_FILLED);
+
+	for (i = 0; i < device->captures; i++) {
+		dst_pool->buffer[i].cpu_reads = true;
+		if (fdp1_v4l2_queue_buffer(m2m->dev, &dst_pool->buffer[i]))
+			return fdp1_device_reset(device, fdp1_errno());
+	}
+
+	if (fdp1_v4l2_queue_buffer(m2m->dev, out))
+		return fdp1_device_reset(device, fdp1_errno());
+
+	while (captures < device->captures || !returned) {
+		struct fdp1_v4l2_buffer * buffer;
+		int ret;
+
+		ret = poll(&pfd, 1, FDP1_TIMEOUT_MS);
+		if (ret < 0 && errno == EINTR)
+			continue;
+		if (ret <= 0)
+			return fdp1_device_reset(device,
+						 ret ? -errno : -ETIMEDOUT);
+
+		if (pfd.revents & POLLERR)
+			return fdp1_device_reset(device, -EIO);
+
+		if (pfd.revents & POLLOUT && !returned) {
+			buffer = fdp1_v4l2_dequeue_buffer(m2m->dev, &m2m->src_queue);
+			if (!buffer)
+				return fdp1_device_reset(device, fdp1_errno());
+
+			fdp1_v4l2_buffer_release(buffer);
+			returned = true;
+		}
+
+		if (pfd.revents & POLLIN && captures < device->captures) {
+			buffer = fdp1_v4l2_dequeue_buffer(m2m->dev, &m2m->dst_queue);
+			if (!buffer)
+				return fdp1_device_reset(device, fdp1_errno());
+
+			*bytesused = buffer->bytesused;
+			memcpy((uint8_t *)dst + captures * buffer->bytesused,
+			       buffer->mem[0], buffer->bytesused);
+			fdp1_v4l2_buffer_release(buffer);
+			captures++;
+		}
+	}
+
+	return captures;
+}
@@ -0,0 +1,128 @@
+/*
+ * FDP1 Unit Test Utility
+ *      Author: Kieran Bingham
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by the
+ * Free Software Foundation; either version 2 of the License, or (at your
+ * option) any later version
+ */
+
+#ifndef _FDP1_H_
+#define _FDP1_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * libfdp1
+ *
+ * The m2m path the unit tests exercise, for services which drive the FDP1
+ * themselves. A device is an opaque handle holding all of its own state,
+ * so each may be used from a thread of its own. Nothing is printed: every
+ * call returns 0 (or a count) on success, or a negative errno.
+ *
+ * Formats and fields are V4L2's, from <linux/videodev2.h>.
+ */
+#define FDP1_API_VERSION	2
+
+#define FDP1_EXPORT	__attribute__((visibility("default")))
+
+/* The values of the driver's V4L2_CID_DEINTERLACING_MODE menu */
+enum fdp1_mode {
+	FDP1_MODE_PROGRESSIVE = 0,
+	FDP1_MODE_ADAPT2D3D,
+	FDP1_MODE_FIXED2D,
+	FDP1_MODE_FIXED3D,
+	FDP1_MODE_PREVFIELD,
+	FDP1_MODE_NEXTFIELD,
+};
+
+/* Flags of struct fdp1_config */
+#define FDP1_CONFIG_CACHE_HINTS	(1 << 0)	/* Skip unneeded cache maintenance */
+#define FDP1_CONFIG_PREPARE	(1 << 1)	/* Prepare buffers ahead of use */
+#define FDP1_CONFIG_LOCK	(1 << 2)	/* Keep buffers resident */
+
+struct fdp1_config {
+	uint32_t width;
+	uint32_t height;
+	uint32_t out_fourcc;	/* Frames processed */
+	uint32_t out_field;
+	uint32_t cap_fourcc;	/* Frames produced */
+	uint32_t mode;		/* enum fdp1_mode, unless out_field is NONE */
+	uint32_t flags;
+};
+
+/*
+ * The settings fdp1-unit-test --tune found for a workload on the device:
+ * the buffers to allocate on each queue, the contexts to stream through
+ * at once, and the frames to keep queued to each, with what they were
+ * measured to do. A service applies what applies to it; a device opened
+ * here only ever has one frame in flight.
+ */
+struct fdp1_tuning {
+	/* The workload */
+	uint32_t width;
+	uint32_t height;
+	uint32_t out_field;
+	uint32_t mode;
+
+	/* The settings */
+	uint32_t buffers;
+	uint32_t contexts;
+	uint32_t depth;
+
+	/* As measured, across every context */
+	uint32_t fps;
+	uint32_t p99_us;	/* From queueing a frame to its last capture */
+	uint64_t memory;	/* Bytes of buffers */
+};
+
+struct fdp1_device;
+
+/* The FDP1_API_VERSION the library was built with */
+FDP1_EXPORT unsigned int fdp1_api_version(void);
+
+/*
+ * The frames each processed frame produces in 'mode' from a 'field'
+ * layout, or -EINVAL where it would need the fields of the frames either
+ * side of it.
+ */
+FDP1_EXPORT int fdp1_job_captures(uint32_t field, uint32_t mode);
+
+/*
+ * Read and write a tuning as a text file of "key value" lines. Lines
+ * starting with '#', and keys this version does not know, are skipped;
+ * anything else which does not parse is -EINVAL. Added in API version 2.
+ */
+FDP1_EXPORT int fdp1_tuning_load(const char * path, struct fdp1_tuning * tuning);
+FDP1_EXPORT int fdp1_tuning_save(const char * path,
+				 const struct fdp1_tuning * tuning);
+
+/*
+ * Open /dev/video'index' streaming in 'config'. Frames are passed as one
+ * contiguous buffer, so formats of more than one memory plane (NV12M,
+ * YUV420M and the like) are -EINVAL.
+ */
+FDP1_EXPORT int fdp1_device_open(unsigned int index,
+				 const struct fdp1_config * config,
+				 struct fdp1_device ** device);
+FDP1_EXPORT void fdp1_device_close(struct fdp1_device * device);
+
+/* The largest frame processed, and the size of each frame produced */
+FDP1_EXPORT int fdp1_device_sizes(struct fdp1_device * device,
+				  size_t * src_size, size_t * dst_size);
+
+/*
+ * Process one frame of 'src' into 'dst', which takes each frame produced
+ * in turn. Returns the number produced, each of 'bytesused' bytes, or
+ * -ENOSPC, before anything is queued, if 'dst' cannot take every frame at
+ * the size fdp1_device_sizes() gives. Whatever it returns, the device is
+ * left ready for the next frame.
+ */
+FDP1_EXPORT int fdp1_device_process(struct fdp1_device * device,
+				    const void * src, size_t src_size,
+				    void * dst, size_t dst_size,
+				    uint32_t * bytesused);
+
+#endif /* _FDP1_H_ */